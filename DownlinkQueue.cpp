@@ -0,0 +1,188 @@
+// DownlinkQueue.cpp
+//
+// Messages waiting to be sent to the nodes, ordered by priority and deadline.
+
+#include <string.h>
+#include <time.h>
+
+#include "DownlinkQueue.h"
+
+DownlinkQueue::DownlinkQueue(uint16_t capacity)
+	:
+	_capacity(capacity ? capacity : 1),
+	_seq(0),
+	_taken(0),
+	_expired(0),
+	_dropped(0),
+	_latencySum(0),
+	_maxLatency(0)
+{
+	_messages.reserve(_capacity);
+}
+
+bool DownlinkQueue::push(uint8_t node, uint8_t priority, unsigned long ttl, const uint8_t* data, size_t len)
+{
+	if (len > RH_RF95_MAX_MESSAGE_LEN)
+		return false;
+
+	Downlink downlink;
+	downlink.queued = now();
+	downlink.deadline = downlink.queued + (uint64_t) ttl * 1000;
+	downlink.node = node;
+	downlink.priority = priority;
+	downlink.len = len;
+	memcpy(downlink.payload, data, len);
+
+	std::lock_guard<std::mutex> guard(_lock);
+	downlink.seq = _seq++;
+	expire(downlink.queued);
+	return insert(downlink);
+}
+
+bool DownlinkQueue::restore(const Downlink& downlink)
+{
+	std::lock_guard<std::mutex> guard(_lock);
+	uint64_t t = now();
+	expire(t);
+	if (downlink.deadline < t)
+	{
+		_expired++;
+		return false;
+	}
+	return insert(downlink);
+}
+
+bool DownlinkQueue::insert(const Downlink& downlink)
+{
+	if (_messages.size() >= _capacity)
+	{
+		// Full: make room by dropping the least urgent message, unless that is the new one
+		size_t last = 0;
+		for (size_t i = 1; i < _messages.size(); i++)
+			if (before(_messages[last], _messages[i]))
+				last = i;
+		_dropped++;
+		if (!before(downlink, _messages[last]))
+			return false;
+		_messages[last] = downlink;
+		return true;
+	}
+	_messages.push_back(downlink);
+	return true;
+}
+
+bool DownlinkQueue::peek(Downlink& downlink)
+{
+	return next(downlink, -1);
+}
+
+bool DownlinkQueue::peek(Downlink& downlink, uint8_t node)
+{
+	return next(downlink, node);
+}
+
+bool DownlinkQueue::remove(uint32_t seq)
+{
+	std::lock_guard<std::mutex> guard(_lock);
+	for (size_t i = 0; i < _messages.size(); i++)
+	{
+		if (_messages[i].seq != seq)
+			continue;
+		unsigned long latency = (now() - _messages[i].queued) / 1000;
+		_latencySum += latency;
+		if (latency > _maxLatency)
+			_maxLatency = latency;
+		_taken++;
+		_messages[i] = _messages.back();
+		_messages.pop_back();
+		return true;
+	}
+	return false;
+}
+
+uint16_t DownlinkQueue::size()
+{
+	std::lock_guard<std::mutex> guard(_lock);
+	return _messages.size();
+}
+
+uint32_t DownlinkQueue::taken()
+{
+	std::lock_guard<std::mutex> guard(_lock);
+	return _taken;
+}
+
+uint32_t DownlinkQueue::expired()
+{
+	std::lock_guard<std::mutex> guard(_lock);
+	return _expired;
+}
+
+uint32_t DownlinkQueue::dropped()
+{
+	std::lock_guard<std::mutex> guard(_lock);
+	return _dropped;
+}
+
+unsigned long DownlinkQueue::avgLatency()
+{
+	std::lock_guard<std::mutex> guard(_lock);
+	return _taken ? _latencySum / _taken : 0;
+}
+
+unsigned long DownlinkQueue::maxLatency()
+{
+	std::lock_guard<std::mutex> guard(_lock);
+	return _maxLatency;
+}
+
+uint64_t DownlinkQueue::now()
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t) ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+bool DownlinkQueue::before(const Downlink& a, const Downlink& b)
+{
+	if (a.priority != b.priority)
+		return a.priority > b.priority;
+	if (a.deadline != b.deadline)
+		return a.deadline < b.deadline;
+	return (int32_t) (a.seq - b.seq) < 0;
+}
+
+bool DownlinkQueue::next(Downlink& downlink, int node)
+{
+	std::lock_guard<std::mutex> guard(_lock);
+	expire(now());
+	int next = -1;
+	for (size_t i = 0; i < _messages.size(); i++)
+	{
+		if (node >= 0 && _messages[i].node != node)
+			continue;
+		if (next < 0 || before(_messages[i], _messages[next]))
+			next = i;
+	}
+	if (next < 0)
+		return false;
+	downlink = _messages[next];
+	return true;
+}
+
+void DownlinkQueue::expire(uint64_t now)
+{
+	for (size_t i = 0; i < _messages.size(); )
+	{
+		if (_messages[i].deadline < now)
+		{
+			_expired++;
+			_messages[i] = _messages.back();
+			_messages.pop_back();
+		}
+		else
+		{
+			i++;
+		}
+	}
+}
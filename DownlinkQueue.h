@@ -0,0 +1,140 @@
+// DownlinkQueue.h
+//
+// Messages waiting to be sent to the nodes, ordered by priority and deadline.
+// Filled from the MQTT subscription, emptied by the radio thread between receptions.
+
+#ifndef DownlinkQueue_h
+#define DownlinkQueue_h
+
+#include <stdint.h>
+#include <stddef.h>
+#include <vector>
+#include <mutex>
+
+#include <RH_RF95.h>
+
+// Defaults used when the ini file does not override them
+#define DOWNLINK_QUEUE_DEFAULT_SIZE        16
+#define DOWNLINK_QUEUE_DEFAULT_TTL         30000
+
+/// One message for a node
+typedef struct
+{
+	uint64_t        queued;                     ///< Monotonic time it was pushed, in microseconds
+	uint64_t        deadline;                   ///< Monotonic time after which it is dropped, in microseconds
+	uint32_t        seq;                        ///< Push order, breaks ties and identifies it for remove()
+	uint8_t         node;                       ///< Destination address
+	uint8_t         priority;                   ///< Higher goes first
+	uint8_t         len;                        ///< Number of octets in payload
+	uint8_t         payload[RH_RF95_MAX_MESSAGE_LEN]; ///< Message data, without the RadioHead headers
+} Downlink;
+
+/////////////////////////////////////////////////////////////////////
+/// \class DownlinkQueue DownlinkQueue.h <DownlinkQueue.h>
+/// \brief Bounded priority queue of downlink messages
+///
+/// The next message is the one with the highest priority, among those the one with
+/// the earliest deadline, then the oldest. Messages whose deadline has passed are
+/// dropped instead of sent, so a command never reaches a node later than its
+/// time to live. When the queue is full a new message replaces the least urgent
+/// one if it is more urgent than that, otherwise it is rejected.
+///
+/// The queue holds a few dozen messages at most and is searched linearly, which is
+/// cheaper than keeping a heap ordered against deadlines that expire on their own.
+///
+/// A queue can also hold the messages of nodes that only listen right after they
+/// sent something: peek() with a node address returns the next one for that node.
+///
+/// push() may be called from any thread. The consumer side (peek(), remove()) is
+/// meant for the one radio thread owning the queue: it peeks at the next message,
+/// decides whether the radio can send it now and only then removes it, so a
+/// message that has to wait stays in the queue where a more urgent one can still
+/// overtake it.
+class DownlinkQueue
+{
+public:
+	/// Constructor
+	/// \param[in] capacity Maximum number of messages waiting
+	DownlinkQueue(uint16_t capacity = DOWNLINK_QUEUE_DEFAULT_SIZE);
+
+	/// Queues a message.
+	/// \param[in] node Destination address
+	/// \param[in] priority Higher priorities are sent first
+	/// \param[in] ttl Milliseconds after which the message is dropped if it was not sent
+	/// \param[in] data Message data
+	/// \param[in] len Number of octets in data, at most RH_RF95_MAX_MESSAGE_LEN
+	/// \return true if the message was queued
+	bool push(uint8_t node, uint8_t priority, unsigned long ttl, const uint8_t* data, size_t len);
+
+	/// Drops expired messages and copies the next one.
+	/// \param[out] downlink Receives the next message
+	/// \return true if there is one
+	bool peek(Downlink& downlink);
+
+	/// Drops expired messages and copies the next one for a node.
+	/// \param[out] downlink Receives the next message for the node
+	/// \param[in] node Destination address
+	/// \return true if there is one
+	bool peek(Downlink& downlink, uint8_t node);
+
+	/// Removes a message returned by peek().
+	/// \param[in] seq The seq of the message
+	/// \return true if it was still queued, false if it expired or was replaced in the meantime
+	bool remove(uint32_t seq);
+
+	/// Puts back a message taken with remove() that could not be sent. It keeps its
+	/// seq and deadline, so it goes out in the order it would have had.
+	/// \param[in] downlink The message
+	/// \return true if it was queued again, false if its deadline passed or the queue
+	/// is full of more urgent messages
+	bool restore(const Downlink& downlink);
+
+	/// \return Number of messages waiting
+	uint16_t size();
+
+	/// \return Number of messages removed with remove()
+	uint32_t taken();
+
+	/// \return Number of messages dropped because their deadline passed
+	uint32_t expired();
+
+	/// \return Number of messages rejected or replaced because the queue was full
+	uint32_t dropped();
+
+	/// \return Average time a message removed with remove() waited, in milliseconds
+	unsigned long avgLatency();
+
+	/// \return Longest time a message removed with remove() waited, in milliseconds
+	unsigned long maxLatency();
+
+	/// \return Monotonic time in microseconds, the time base of the deadlines
+	static uint64_t now();
+
+private:
+	/// \return true if a goes before b
+	static bool before(const Downlink& a, const Downlink& b);
+
+	/// Drops messages whose deadline is before now. Must be called with _lock held.
+	void expire(uint64_t now);
+
+	/// Adds a message, replacing the least urgent one if the queue is full.
+	/// Must be called with _lock held.
+	bool insert(const Downlink& downlink);
+
+	/// Copies the next message for node, or for any node if node is negative
+	bool next(Downlink& downlink, int node);
+
+	std::mutex              _lock;
+	uint16_t                _capacity;
+	/// The waiting messages, unordered
+	std::vector<Downlink>   _messages;
+	uint32_t                _seq;
+
+	uint32_t                _taken;
+	uint32_t                _expired;
+	uint32_t                _dropped;
+	unsigned long long      _latencySum;
+	unsigned long           _maxLatency;
+};
+
+#endif
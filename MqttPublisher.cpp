@@ -0,0 +1,471 @@
+// MqttPublisher.cpp
+//
+// Long-lived MQTT publisher session for the radiohead gateway.
+
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/eventfd.h>
+
+#include "MqttPublisher.h"
+
+// All messages are published with QoS1
+#define MQTT_PUBLISHER_QOS 1
+
+MqttPublisher::MqttPublisher(const char* address, const char* clientId, uint16_t queueSize, uint16_t maxInflight)
+	:
+	_address(address ? address : ""),
+	_clientId(clientId ? clientId : ""),
+	_client(NULL),
+	_created(false),
+	_keepAlive(MQTT_PUBLISHER_DEFAULT_KEEPALIVE),
+	_backoffMin(MQTT_PUBLISHER_DEFAULT_BACKOFF_MIN),
+	_backoffMax(MQTT_PUBLISHER_DEFAULT_BACKOFF_MAX),
+	_queueSize(queueSize ? queueSize : 1),
+	_maxInflight(maxInflight ? maxInflight : 1),
+	_pendingHead(0),
+	_pendingCount(0),
+	_running(false),
+	_stopping(false),
+	_connected(false),
+	_everConnected(false),
+	_full(false),
+	_eventFd(-1),
+	_published(0),
+	_delivered(0),
+	_dropped(0),
+	_received(0),
+	_reconnects(0)
+{
+	// In flight messages are requeued on connection loss, so the ring must
+	// be able to hold both at the same time
+	uint16_t slots = _queueSize + _maxInflight;
+	_slots.resize(slots);
+	_free.reserve(slots);
+	for (uint16_t i = slots; i > 0; i--)
+		_free.push_back(i - 1);
+	_pending.resize(slots);
+	_inflight.reserve(_maxInflight);
+	_earlyAcks.reserve(_maxInflight);
+}
+
+MqttPublisher::~MqttPublisher()
+{
+	end(0);
+	if (_eventFd >= 0)
+		close(_eventFd);
+}
+
+void MqttPublisher::setKeepAlive(int seconds)
+{
+	_keepAlive = seconds;
+}
+
+void MqttPublisher::setBackoff(unsigned long minMs, unsigned long maxMs)
+{
+	_backoffMin = minMs ? minMs : 1;
+	_backoffMax = maxMs < _backoffMin ? _backoffMin : maxMs;
+}
+
+bool MqttPublisher::begin()
+{
+	if (_running)
+		return true;
+
+	if (!_created)
+	{
+		if (MQTTClient_create(&_client, _address.c_str(), _clientId.c_str(), MQTTCLIENT_PERSISTENCE_NONE, NULL) != MQTTCLIENT_SUCCESS)
+			return false;
+		// Setting the callbacks puts the client in asynchronous mode:
+		// publishMessage() returns as soon as the message is written and
+		// the PUBACK is reported through deliveryComplete()
+		if (MQTTClient_setCallbacks(_client, this, connectionLost, messageArrived, deliveryComplete) != MQTTCLIENT_SUCCESS)
+		{
+			MQTTClient_destroy(&_client);
+			return false;
+		}
+		_created = true;
+	}
+
+	if (_eventFd < 0)
+	{
+		_eventFd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+		if (_eventFd < 0)
+			return false;
+	}
+
+	_stopping = false;
+	_running = true;
+	_worker = std::thread(&MqttPublisher::run, this);
+	return true;
+}
+
+void MqttPublisher::end(unsigned long drainTimeout)
+{
+	if (_running)
+	{
+		std::unique_lock<std::mutex> guard(_lock);
+		if (drainTimeout)
+			_wakeup.wait_for(guard, std::chrono::milliseconds(drainTimeout),
+					[this] { return !_connected || (_pendingCount == 0 && _inflight.empty()); });
+		_stopping = true;
+		guard.unlock();
+		_wakeup.notify_all();
+		_worker.join();
+		_running = false;
+	}
+
+	if (_created)
+	{
+		if (MQTTClient_isConnected(_client))
+			MQTTClient_disconnect(_client, 1000);
+		MQTTClient_destroy(&_client);
+		_created = false;
+	}
+	_connected = false;
+}
+
+bool MqttPublisher::publish(const char* topic, const uint8_t* payload, size_t len)
+{
+	std::unique_lock<std::mutex> guard(_lock);
+	if (_pendingCount >= _queueSize || _free.empty())
+	{
+		_dropped++;
+		_full = true;
+		return false;
+	}
+
+	uint16_t slot = _free.back();
+	_free.pop_back();
+	Message& m = _slots[slot];
+	m.topic.assign(topic);
+	m.payload.assign(payload, payload + len);
+	m.token = 0;
+
+	_pending[(_pendingHead + _pendingCount) % _pending.size()] = slot;
+	_pendingCount++;
+	guard.unlock();
+	_wakeup.notify_one();
+	return true;
+}
+
+void MqttPublisher::subscribe(const char* topicFilter, MqttMessageHandler handler, void* arg)
+{
+	Subscription subscription;
+	subscription.filter.assign(topicFilter);
+	subscription.handler = handler;
+	subscription.arg = arg;
+	_subscriptions.push_back(subscription);
+}
+
+bool MqttPublisher::isConnected()
+{
+	std::lock_guard<std::mutex> guard(_lock);
+	return _connected;
+}
+
+uint32_t MqttPublisher::published()
+{
+	std::lock_guard<std::mutex> guard(_lock);
+	return _published;
+}
+
+uint32_t MqttPublisher::delivered()
+{
+	std::lock_guard<std::mutex> guard(_lock);
+	return _delivered;
+}
+
+uint32_t MqttPublisher::dropped()
+{
+	std::lock_guard<std::mutex> guard(_lock);
+	return _dropped;
+}
+
+uint32_t MqttPublisher::received()
+{
+	std::lock_guard<std::mutex> guard(_lock);
+	return _received;
+}
+
+uint32_t MqttPublisher::reconnects()
+{
+	std::lock_guard<std::mutex> guard(_lock);
+	return _reconnects;
+}
+
+uint16_t MqttPublisher::queued()
+{
+	std::lock_guard<std::mutex> guard(_lock);
+	return _pendingCount;
+}
+
+uint16_t MqttPublisher::inflight()
+{
+	std::lock_guard<std::mutex> guard(_lock);
+	return _inflight.size();
+}
+
+int MqttPublisher::eventFd()
+{
+	return _eventFd;
+}
+
+bool MqttPublisher::takeUndelivered(std::string& topic, std::vector<uint8_t>& payload)
+{
+	std::lock_guard<std::mutex> guard(_lock);
+	if (_running)
+		return false;
+	// Unacknowledged messages are older than the queued ones
+	requeueInflight();
+	if (_pendingCount == 0)
+		return false;
+
+	uint16_t slot = _pending[_pendingHead];
+	_pendingHead = (_pendingHead + 1) % _pending.size();
+	_pendingCount--;
+	Message& m = _slots[slot];
+	topic.swap(m.topic);
+	payload.swap(m.payload);
+	_free.push_back(slot);
+	return true;
+}
+
+void MqttPublisher::notify()
+{
+	uint64_t one = 1;
+	if (write(_eventFd, &one, sizeof(one)) < 0)
+		perror("MqttPublisher eventfd");
+}
+
+void MqttPublisher::connectionLost(void* context, char* cause)
+{
+	MqttPublisher* self = (MqttPublisher*)context;
+	printf("MQTT connection lost%s%s\n", cause ? ": " : "", cause ? cause : "");
+	{
+		std::lock_guard<std::mutex> guard(self->_lock);
+		self->_connected = false;
+	}
+	self->_wakeup.notify_all();
+}
+
+int MqttPublisher::messageArrived(void* context, char* topicName, int topicLen, MQTTClient_message* message)
+{
+	MqttPublisher* self = (MqttPublisher*)context;
+	// topicLen is only set when the topic contains a NUL
+	std::string topic = topicLen ? std::string(topicName, topicLen) : std::string(topicName);
+	{
+		std::lock_guard<std::mutex> guard(self->_lock);
+		self->_received++;
+	}
+	for (size_t i = 0; i < self->_subscriptions.size(); i++)
+	{
+		Subscription& subscription = self->_subscriptions[i];
+		if (matches(subscription.filter, topic.c_str()))
+			subscription.handler(topic.c_str(), (const uint8_t*)message->payload, message->payloadlen, subscription.arg);
+	}
+	MQTTClient_freeMessage(&message);
+	MQTTClient_free(topicName);
+	return 1;
+}
+
+void MqttPublisher::deliveryComplete(void* context, MQTTClient_deliveryToken token)
+{
+	MqttPublisher* self = (MqttPublisher*)context;
+	{
+		std::lock_guard<std::mutex> guard(self->_lock);
+		if (!self->complete(token) && self->_earlyAcks.size() < self->_maxInflight)
+			self->_earlyAcks.push_back(token); // The worker has not recorded the token yet
+	}
+	self->_wakeup.notify_all();
+}
+
+bool MqttPublisher::complete(MQTTClient_deliveryToken token)
+{
+	for (size_t i = 0; i < _inflight.size(); i++)
+	{
+		uint16_t slot = _inflight[i];
+		if (_slots[slot].token == token)
+		{
+			_inflight.erase(_inflight.begin() + i);
+			_free.push_back(slot);
+			_delivered++;
+			return true;
+		}
+	}
+	return false;
+}
+
+void MqttPublisher::requeueInflight()
+{
+	// Push back to the front in reverse so the original order is kept
+	while (!_inflight.empty())
+	{
+		_pendingHead = (_pendingHead + _pending.size() - 1) % _pending.size();
+		_pending[_pendingHead] = _inflight.back();
+		_pendingCount++;
+		_inflight.pop_back();
+	}
+	_earlyAcks.clear();
+}
+
+bool MqttPublisher::connect()
+{
+	MQTTClient_connectOptions connOpts = MQTTClient_connectOptions_initializer;
+	connOpts.keepAliveInterval = _keepAlive;
+	connOpts.cleansession = 1;
+
+	printf("Connect to mqtt server %s ", _address.c_str());
+	int rc = MQTTClient_connect(_client, &connOpts);
+	if (rc == MQTTCLIENT_SUCCESS)
+		printf("OK\n");
+	else
+		printf("failed (%d)\n", rc);
+	if (rc != MQTTCLIENT_SUCCESS)
+		return false;
+
+	for (size_t i = 0; i < _subscriptions.size(); i++)
+	{
+		rc = MQTTClient_subscribe(_client, _subscriptions[i].filter.c_str(), MQTT_PUBLISHER_QOS);
+		if (rc != MQTTCLIENT_SUCCESS)
+		{
+			// Without the subscription the session is of no use, start over
+			printf("Subscribe to %s failed (%d)\n", _subscriptions[i].filter.c_str(), rc);
+			MQTTClient_disconnect(_client, 1000);
+			return false;
+		}
+		printf("Subscribed to %s\n", _subscriptions[i].filter.c_str());
+	}
+	return true;
+}
+
+bool MqttPublisher::matches(const std::string& filter, const char* topic)
+{
+	size_t f = 0;
+	while (f < filter.size())
+	{
+		if (filter[f] == '#')
+			return true; // Matches the parent level and everything below
+		if (filter[f] == '+')
+		{
+			while (*topic && *topic != '/')
+				topic++;
+			f++;
+		}
+		else
+		{
+			if (filter[f] == '/' && *topic == '\0' && filter.compare(f, std::string::npos, "/#") == 0)
+				return true; // a/# matches a
+			if (filter[f] != *topic)
+				return false;
+			f++;
+			topic++;
+			continue;
+		}
+		if (f < filter.size() && *topic != '/')
+			return false;
+	}
+	return *topic == '\0';
+}
+
+void MqttPublisher::run()
+{
+	unsigned long backoff = _backoffMin;
+	std::unique_lock<std::mutex> guard(_lock);
+
+	while (!_stopping)
+	{
+		if (!_connected)
+		{
+			// Anything in flight on the lost connection has to be sent again
+			requeueInflight();
+			guard.unlock();
+			bool ok = connect();
+			guard.lock();
+			if (ok)
+			{
+				if (_everConnected)
+					_reconnects++;
+				_everConnected = true;
+				_connected = true;
+				backoff = _backoffMin;
+				notify();
+			}
+			else
+			{
+				_wakeup.wait_for(guard, std::chrono::milliseconds(backoff), [this] { return _stopping; });
+				backoff = backoff * 2 > _backoffMax ? _backoffMax : backoff * 2;
+			}
+			continue;
+		}
+
+		if (_pendingCount == 0 || _inflight.size() >= _maxInflight)
+		{
+			_wakeup.wait(guard);
+			continue;
+		}
+
+		// Publish the message at the head of the queue. It is moved to the
+		// in flight list before the lock is released, so a concurrent
+		// connectionLost() still finds it there and requeues it
+		uint16_t slot = _pending[_pendingHead];
+		_pendingHead = (_pendingHead + 1) % _pending.size();
+		_pendingCount--;
+		if (_full)
+		{
+			// Whoever was turned away can publish again
+			_full = false;
+			notify();
+		}
+		Message& m = _slots[slot];
+		m.token = -1;
+		_inflight.push_back(slot);
+		guard.unlock();
+
+		MQTTClient_message pubmsg = MQTTClient_message_initializer;
+		pubmsg.payload = m.payload.data();
+		pubmsg.payloadlen = m.payload.size();
+		pubmsg.qos = MQTT_PUBLISHER_QOS;
+		pubmsg.retained = 0;
+		MQTTClient_deliveryToken token = -1;
+		int rc = MQTTClient_publishMessage(_client, m.topic.c_str(), &pubmsg, &token);
+
+		guard.lock();
+		if (rc != MQTTCLIENT_SUCCESS)
+		{
+			printf("Publish mqtt message failed (%d)\n", rc);
+			// Treat as a broken connection, the message is requeued on reconnect
+			_connected = MQTTClient_isConnected(_client);
+			if (_connected)
+			{
+				// Still connected, so retry this message at the head of the queue
+				for (size_t i = 0; i < _inflight.size(); i++)
+				{
+					if (_inflight[i] == slot)
+					{
+						_inflight.erase(_inflight.begin() + i);
+						break;
+					}
+				}
+				_pendingHead = (_pendingHead + _pending.size() - 1) % _pending.size();
+				_pending[_pendingHead] = slot;
+				_pendingCount++;
+				_wakeup.wait_for(guard, std::chrono::milliseconds(_backoffMin), [this] { return _stopping; });
+			}
+			continue;
+		}
+
+		_published++;
+		m.token = token;
+		for (size_t i = 0; i < _earlyAcks.size(); i++)
+		{
+			if (_earlyAcks[i] == token)
+			{
+				_earlyAcks.erase(_earlyAcks.begin() + i);
+				complete(token);
+				break;
+			}
+		}
+		_wakeup.notify_all(); // end() may be waiting for the queue to drain
+	}
+}
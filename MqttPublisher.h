@@ -0,0 +1,218 @@
+// MqttPublisher.h
+//
+// Long-lived MQTT publisher session for the radiohead gateway.
+// Owns one MQTTClient connection, reconnects with exponential backoff and
+// publishes QoS1 messages from a bounded queue on its own thread, so the
+// caller (the radio loop) never blocks on the broker. Messages on subscribed
+// topics are handed to a callback.
+
+#ifndef MqttPublisher_h
+#define MqttPublisher_h
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+
+#include <MQTTClient.h>
+
+// Defaults used when the ini file does not override them
+#define MQTT_PUBLISHER_DEFAULT_QUEUE_SIZE     64
+#define MQTT_PUBLISHER_DEFAULT_MAX_INFLIGHT   8
+#define MQTT_PUBLISHER_DEFAULT_KEEPALIVE      60
+#define MQTT_PUBLISHER_DEFAULT_BACKOFF_MIN    500
+#define MQTT_PUBLISHER_DEFAULT_BACKOFF_MAX    30000
+
+/// Function called for every message received on a subscription, on the paho client
+/// thread. It must not block, the payload is only valid during the call.
+typedef void (*MqttMessageHandler)(const char* topic, const uint8_t* payload, size_t len, void* arg);
+
+/////////////////////////////////////////////////////////////////////
+/// \class MqttPublisher MqttPublisher.h <MqttPublisher.h>
+/// \brief Persistent, asynchronous MQTT publisher session
+///
+/// publish() copies the message into a bounded queue and returns immediately.
+/// A worker thread keeps the broker connection alive, reconnecting with an
+/// exponential backoff between the configured minimum and maximum delay, and
+/// publishes queued messages with at most maxInflight unacknowledged QoS1
+/// messages outstanding. Messages that were in flight when the connection was
+/// lost are put back at the front of the queue and published again after the
+/// reconnect, so nothing accepted by publish() is silently lost while the
+/// process is running.
+///
+/// Subscriptions are made with QoS1 after every connect, since the session
+/// is clean and the broker forgets them when the connection is lost.
+class MqttPublisher
+{
+public:
+	/// Constructor
+	/// \param[in] address Broker URI, eg tcp://10.0.0.52:1883
+	/// \param[in] clientId MQTT client identifier
+	/// \param[in] queueSize Maximum number of messages waiting to be published
+	/// \param[in] maxInflight Maximum number of published but not yet acknowledged messages
+	MqttPublisher(const char* address, const char* clientId,
+			uint16_t queueSize = MQTT_PUBLISHER_DEFAULT_QUEUE_SIZE,
+			uint16_t maxInflight = MQTT_PUBLISHER_DEFAULT_MAX_INFLIGHT);
+
+	/// Destructor, stops the worker thread if still running
+	~MqttPublisher();
+
+	/// Sets the MQTT keep alive interval. Call before begin().
+	/// \param[in] seconds Keep alive interval in seconds
+	void setKeepAlive(int seconds);
+
+	/// Sets the reconnect backoff. The first retry waits minMs, each further
+	/// failed attempt doubles the delay up to maxMs. Call before begin().
+	/// \param[in] minMs Initial reconnect delay in milliseconds
+	/// \param[in] maxMs Maximum reconnect delay in milliseconds
+	void setBackoff(unsigned long minMs, unsigned long maxMs);
+
+	/// Creates the MQTT client and starts the worker thread, which connects
+	/// to the broker in the background.
+	/// \return true if the client could be created
+	bool begin();
+
+	/// Stops the worker thread, giving queued and in flight messages up to
+	/// drainTimeout milliseconds to be delivered, then disconnects.
+	/// \param[in] drainTimeout Maximum time to wait for the queue to drain, in milliseconds
+	void end(unsigned long drainTimeout = 1000);
+
+	/// Queues a message for publishing. Never blocks on the broker.
+	/// \param[in] topic Topic to publish to
+	/// \param[in] payload Message payload
+	/// \param[in] len Number of octets in payload
+	/// \return true if the message was queued, false if the queue is full
+	bool publish(const char* topic, const uint8_t* payload, size_t len);
+
+	/// Subscribes to a topic filter. Call before begin().
+	/// \param[in] topicFilter Topic filter, may contain the + and # wildcards
+	/// \param[in] handler Called for every message matching the filter
+	/// \param[in] arg Passed to handler
+	void subscribe(const char* topicFilter, MqttMessageHandler handler, void* arg);
+
+	/// \return true if the session is currently connected to the broker
+	bool isConnected();
+
+	/// \return Number of messages handed to the broker
+	uint32_t published();
+
+	/// \return Number of messages acknowledged by the broker
+	uint32_t delivered();
+
+	/// \return Number of messages rejected by publish() because the queue was full
+	uint32_t dropped();
+
+	/// \return Number of messages received on subscriptions
+	uint32_t received();
+
+	/// \return Number of successful connects after the first one
+	uint32_t reconnects();
+
+	/// \return Number of messages currently waiting in the queue
+	uint16_t queued();
+
+	/// \return Number of messages currently published but not yet acknowledged
+	uint16_t inflight();
+
+	/// \return An eventfd that becomes readable when the session connects and when the queue
+	/// has room again after publish() returned false, -1 before begin(). Lets an event loop
+	/// move its own backlog to the publisher without polling. Read 8 bytes to clear it.
+	int eventFd();
+
+	/// Takes back a message that was not delivered, oldest first. Call after end(): the
+	/// messages still queued and those in flight, which the broker may or may not have
+	/// received, are returned so they can be kept for the next start.
+	/// \param[out] topic Topic of the message
+	/// \param[out] payload Message payload
+	/// \return true if a message was taken, false if none is left or the worker still runs
+	bool takeUndelivered(std::string& topic, std::vector<uint8_t>& payload);
+
+private:
+	/// One queued or in flight message
+	typedef struct
+	{
+		std::string                 topic;
+		std::vector<uint8_t>        payload;
+		MQTTClient_deliveryToken    token;
+	} Message;
+
+	/// One subscription, made again on every connect
+	typedef struct
+	{
+		std::string                 filter;
+		MqttMessageHandler          handler;
+		void*                       arg;
+	} Subscription;
+
+	/// paho callbacks, context is the MqttPublisher instance
+	static void connectionLost(void* context, char* cause);
+	static int  messageArrived(void* context, char* topicName, int topicLen, MQTTClient_message* message);
+	static void deliveryComplete(void* context, MQTTClient_deliveryToken token);
+
+	/// Worker thread main loop
+	void run();
+
+	/// Tries to connect once and makes the subscriptions. Called by the worker thread without _lock held.
+	bool connect();
+
+	/// \return true if topic matches the topic filter, with + matching one level and # all remaining levels
+	static bool matches(const std::string& filter, const char* topic);
+
+	/// Moves all in flight messages back to the front of the queue, in their original order.
+	/// Must be called with _lock held.
+	void requeueInflight();
+
+	/// Removes the in flight message with the given token, if any.
+	/// Must be called with _lock held.
+	/// \return true if a message was removed
+	bool complete(MQTTClient_deliveryToken token);
+
+	/// Makes eventFd() readable
+	void notify();
+
+	std::string                 _address;
+	std::string                 _clientId;
+	MQTTClient                  _client;
+	bool                        _created;
+	int                         _keepAlive;
+	unsigned long               _backoffMin;
+	unsigned long               _backoffMax;
+	uint16_t                    _queueSize;
+	uint16_t                    _maxInflight;
+
+	/// Message storage, _queueSize + _maxInflight slots, allocated once
+	std::vector<Message>        _slots;
+	/// Indexes of unused slots
+	std::vector<uint16_t>       _free;
+	/// Ring of slot indexes waiting to be published
+	std::vector<uint16_t>       _pending;
+	uint16_t                    _pendingHead;
+	uint16_t                    _pendingCount;
+	/// Slot indexes published but not yet acknowledged, in publish order
+	std::vector<uint16_t>       _inflight;
+	/// Tokens acknowledged before publishMessage() returned to the worker
+	std::vector<MQTTClient_deliveryToken> _earlyAcks;
+	/// Set up before begin(), read only afterwards
+	std::vector<Subscription>   _subscriptions;
+
+	std::mutex                  _lock;
+	std::condition_variable     _wakeup;
+	std::thread                 _worker;
+	bool                        _running;
+	bool                        _stopping;
+	bool                        _connected;
+	bool                        _everConnected;
+	/// publish() returned false since the worker last took a message from the queue
+	bool                        _full;
+	int                         _eventFd;
+
+	uint32_t                    _published;
+	uint32_t                    _delivered;
+	uint32_t                    _dropped;
+	uint32_t                    _received;
+	uint32_t                    _reconnects;
+};
+
+#endif
@@ -0,0 +1,182 @@
+// PacketBatch.cpp
+//
+// Collects received packets into one MQTT message per time window.
+
+#include <stdio.h>
+
+#include "PacketBatch.h"
+
+// Space for the JSON object of one full size packet
+#define PACKET_BATCH_JSON_RECORD_LEN (128 + 2 * RH_RF95_MAX_MESSAGE_LEN)
+
+PacketBatch::PacketBatch(Format format, uint16_t maxPackets, unsigned long maxDelay)
+	:
+	_format(format),
+	_maxPackets(maxPackets < 1 ? 1 : maxPackets > 255 ? 255 : maxPackets),
+	_maxDelay(maxDelay),
+	_count(0),
+	_batches(0),
+	_packets(0),
+	_maxBatchPackets(0),
+	_maxBatchSize(0),
+	_latencySum(0),
+	_maxLatency(0)
+{
+	_opened.tv_sec = 0;
+	_opened.tv_nsec = 0;
+	_message.reserve(_format == FormatJson
+			? 2 + _maxPackets * PACKET_BATCH_JSON_RECORD_LEN
+			: 2 + _maxPackets * (13 + RH_RF95_MAX_MESSAGE_LEN));
+}
+
+bool PacketBatch::add(const RadioPacket& packet)
+{
+	if (_count == 0)
+	{
+		clock_gettime(CLOCK_MONOTONIC, &_opened);
+		if (_format == FormatJson)
+		{
+			_message.push_back('[');
+		}
+		else
+		{
+			_message.push_back(PACKET_BATCH_BINARY_VERSION);
+			_message.push_back(0); // Count, set by take()
+		}
+	}
+
+	uint32_t seconds = packet.timestamp.tv_sec;
+	uint16_t millis = packet.timestamp.tv_nsec / 1000000;
+	if (_format == FormatJson)
+	{
+		char record[PACKET_BATCH_JSON_RECORD_LEN];
+		int len = snprintf(record, sizeof(record),
+				"%s{\"time\":%u.%03u,\"from\":%u,\"to\":%u,\"id\":%u,\"flags\":%u,\"rssi\":%d,\"snr\":%d,\"data\":\"",
+				_count ? "," : "", seconds, millis, packet.from, packet.to, packet.id, packet.flags,
+				packet.rssi, packet.snr);
+		static const char hex[] = "0123456789abcdef";
+		for (uint8_t i = 0; i < packet.len; i++)
+		{
+			record[len++] = hex[packet.payload[i] >> 4];
+			record[len++] = hex[packet.payload[i] & 0x0f];
+		}
+		record[len++] = '"';
+		record[len++] = '}';
+		_message.insert(_message.end(), record, record + len);
+	}
+	else
+	{
+		uint8_t record[13];
+		record[0] = seconds;
+		record[1] = seconds >> 8;
+		record[2] = seconds >> 16;
+		record[3] = seconds >> 24;
+		record[4] = millis;
+		record[5] = millis >> 8;
+		record[6] = packet.from;
+		record[7] = packet.to;
+		record[8] = packet.id;
+		record[9] = packet.flags;
+		record[10] = packet.rssi;
+		record[11] = packet.snr;
+		record[12] = packet.len;
+		_message.insert(_message.end(), record, record + sizeof(record));
+		_message.insert(_message.end(), packet.payload, packet.payload + packet.len);
+	}
+	_count++;
+	return _count >= _maxPackets;
+}
+
+bool PacketBatch::due()
+{
+	return _count && (_count >= _maxPackets || age() >= _maxDelay);
+}
+
+int PacketBatch::timeout()
+{
+	if (_count == 0)
+		return -1;
+	unsigned long elapsed = age();
+	return due() ? 0 : (int) (_maxDelay - elapsed);
+}
+
+uint16_t PacketBatch::count() const
+{
+	return _count;
+}
+
+uint16_t PacketBatch::take(std::vector<uint8_t>& message)
+{
+	uint16_t count = _count;
+	if (count == 0)
+	{
+		message.clear();
+		return 0;
+	}
+
+	if (_format == FormatJson)
+		_message.push_back(']');
+	else
+		_message[1] = count;
+
+	unsigned long latency = age();
+	_batches++;
+	_packets += count;
+	if (count > _maxBatchPackets)
+		_maxBatchPackets = count;
+	if (_message.size() > _maxBatchSize)
+		_maxBatchSize = _message.size();
+	_latencySum += latency;
+	if (latency > _maxLatency)
+		_maxLatency = latency;
+
+	// Hand over the buffer and keep the capacity of the caller's one
+	message.clear();
+	message.swap(_message);
+	if (_message.capacity() < message.capacity())
+		_message.reserve(message.capacity());
+	_count = 0;
+	return count;
+}
+
+uint32_t PacketBatch::batches() const
+{
+	return _batches;
+}
+
+uint32_t PacketBatch::packets() const
+{
+	return _packets;
+}
+
+uint16_t PacketBatch::maxBatchPackets() const
+{
+	return _maxBatchPackets;
+}
+
+size_t PacketBatch::maxBatchSize() const
+{
+	return _maxBatchSize;
+}
+
+unsigned long PacketBatch::avgLatency() const
+{
+	return _batches ? _latencySum / _batches : 0;
+}
+
+unsigned long PacketBatch::maxLatency() const
+{
+	return _maxLatency;
+}
+
+const char* PacketBatch::formatName(Format format)
+{
+	return format == FormatJson ? "json" : "binary";
+}
+
+unsigned long PacketBatch::age()
+{
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (now.tv_sec - _opened.tv_sec) * 1000 + (now.tv_nsec - _opened.tv_nsec) / 1000000;
+}
@@ -0,0 +1,130 @@
+// PacketBatch.h
+//
+// Collects received packets into one MQTT message per time window, so the
+// gateway publishes once per batch instead of once per packet.
+
+#ifndef PacketBatch_h
+#define PacketBatch_h
+
+#include <stdint.h>
+#include <stddef.h>
+#include <time.h>
+#include <vector>
+
+#include "PacketRing.h"
+
+// Defaults used when the ini file does not override them
+#define PACKET_BATCH_DEFAULT_MAX_PACKETS   32
+#define PACKET_BATCH_DEFAULT_MAX_DELAY     1000
+
+// Version octet at the start of a binary batch
+#define PACKET_BATCH_BINARY_VERSION        1
+
+/////////////////////////////////////////////////////////////////////
+/// \class PacketBatch PacketBatch.h <PacketBatch.h>
+/// \brief Encodes a window of received packets into one message
+///
+/// Packets are encoded as they are added, so closing a batch costs nothing.
+/// A batch is due for publishing when it holds maxPackets packets or its oldest
+/// packet was added maxDelay milliseconds ago, whichever comes first.
+///
+/// Binary format, all integers little endian:
+/// \code
+/// uint8  version (PACKET_BATCH_BINARY_VERSION)
+/// uint8  number of packets
+/// per packet:
+///   uint32 receive time, seconds since the epoch
+///   uint16 receive time, milliseconds
+///   uint8  from, to, id, flags
+///   int8   rssi (dBm), snr (dB)
+///   uint8  payload length
+///   payload
+/// \endcode
+///
+/// JSON format, one array per batch, payload in hex:
+/// \code
+/// [{"time":1639130000.123,"from":7,"to":1,"id":12,"flags":0,"rssi":-87,"snr":9,"data":"0a1b"}, ...]
+/// \endcode
+///
+/// Statistics cover all batches taken with take(): number of batches and packets,
+/// largest batch, and the time the oldest packet of a batch waited in it.
+class PacketBatch
+{
+public:
+	typedef enum
+	{
+		FormatBinary = 0,  ///< Compact binary records
+		FormatJson         ///< JSON array of objects
+	} Format;
+
+	/// Constructor
+	/// \param[in] format Encoding of the batch
+	/// \param[in] maxPackets Maximum number of packets in one batch, 1 to 255
+	/// \param[in] maxDelay Maximum time a packet waits in the batch, in milliseconds
+	PacketBatch(Format format = FormatBinary,
+			uint16_t maxPackets = PACKET_BATCH_DEFAULT_MAX_PACKETS,
+			unsigned long maxDelay = PACKET_BATCH_DEFAULT_MAX_DELAY);
+
+	/// Appends a packet to the batch.
+	/// \param[in] packet The packet
+	/// \return true if the batch is now full and should be taken
+	bool add(const RadioPacket& packet);
+
+	/// \return true if the batch is full or its window has expired
+	bool due();
+
+	/// \return Milliseconds until the window of the current batch expires, 0 if it
+	/// is due, -1 if the batch is empty (for poll())
+	int timeout();
+
+	/// \return Number of packets in the current batch
+	uint16_t count() const;
+
+	/// Finishes the current batch and starts a new one.
+	/// \param[out] message Receives the encoded batch
+	/// \return Number of packets in the batch, 0 if it was empty
+	uint16_t take(std::vector<uint8_t>& message);
+
+	/// \return Number of batches taken
+	uint32_t batches() const;
+
+	/// \return Number of packets in all batches taken
+	uint32_t packets() const;
+
+	/// \return Largest number of packets in one batch
+	uint16_t maxBatchPackets() const;
+
+	/// \return Largest encoded batch in octets
+	size_t maxBatchSize() const;
+
+	/// \return Average time the oldest packet of a batch waited, in milliseconds
+	unsigned long avgLatency() const;
+
+	/// \return Longest time the oldest packet of a batch waited, in milliseconds
+	unsigned long maxLatency() const;
+
+	/// \return The format as named in the ini file
+	static const char* formatName(Format format);
+
+private:
+	/// \return Milliseconds since the first packet of the current batch was added
+	unsigned long age();
+
+	Format                  _format;
+	uint16_t                _maxPackets;
+	unsigned long           _maxDelay;
+
+	/// The batch being built
+	std::vector<uint8_t>    _message;
+	uint16_t                _count;
+	struct timespec         _opened;
+
+	uint32_t                _batches;
+	uint32_t                _packets;
+	uint16_t                _maxBatchPackets;
+	size_t                  _maxBatchSize;
+	unsigned long long      _latencySum;
+	unsigned long           _maxLatency;
+};
+
+#endif
@@ -0,0 +1,365 @@
+// PacketJournal.cpp
+//
+// Store-and-forward journal of the radiohead gateway.
+
+#include <stdio.h>
+#include <stddef.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <atomic>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include <RHCRC.h>
+
+#include "PacketJournal.h"
+
+#define PACKET_JOURNAL_MAGIC     "RHJRNL1"
+#define PACKET_JOURNAL_VERSION   1
+
+// The ring starts one page into the file, after the FileHeader
+#define PACKET_JOURNAL_DATA_OFFSET 4096
+
+// Records start on 4 octet boundaries
+#define PACKET_JOURNAL_ALIGN(n)  (((n) + 3) & ~3U)
+
+// RecordHeader flag: no record here, the next one is at the start of the ring
+#define PACKET_JOURNAL_FLAG_WRAP 0x0001
+
+PacketJournal::PacketJournal()
+	:
+	_fd(-1),
+	_map(NULL),
+	_mapSize(0),
+	_header(NULL),
+	_ring(NULL),
+	_appended(0),
+	_replayed(0),
+	_overwritten(0),
+	_recovered(0)
+{
+}
+
+PacketJournal::~PacketJournal()
+{
+	close();
+}
+
+bool PacketJournal::open(const char* path, size_t size)
+{
+	close();
+	if (size < PACKET_JOURNAL_MIN_SIZE)
+		size = PACKET_JOURNAL_MIN_SIZE;
+	size = PACKET_JOURNAL_ALIGN(size);
+	_path = path;
+
+	_fd = ::open(path, O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+	if (_fd < 0)
+	{
+		_error = _path + ": " + strerror(errno);
+		return false;
+	}
+	struct stat st;
+	if (fstat(_fd, &st) < 0 || (st.st_size != (off_t) (PACKET_JOURNAL_DATA_OFFSET + size)
+			&& ftruncate(_fd, PACKET_JOURNAL_DATA_OFFSET + size) < 0))
+	{
+		_error = _path + ": " + strerror(errno);
+		close();
+		return false;
+	}
+	bool existing = st.st_size == (off_t) (PACKET_JOURNAL_DATA_OFFSET + size);
+
+	_mapSize = PACKET_JOURNAL_DATA_OFFSET + size;
+	void* map = mmap(NULL, _mapSize, PROT_READ | PROT_WRITE, MAP_SHARED, _fd, 0);
+	if (map == MAP_FAILED)
+	{
+		_error = _path + ": " + strerror(errno);
+		_map = NULL;
+		close();
+		return false;
+	}
+	_map = (uint8_t*) map;
+	_header = (FileHeader*) _map;
+	_ring = _map + PACKET_JOURNAL_DATA_OFFSET;
+
+	if (!existing
+		|| memcmp(_header->magic, PACKET_JOURNAL_MAGIC, sizeof(_header->magic)) != 0
+		|| _header->version != PACKET_JOURNAL_VERSION
+		|| _header->capacity != size
+		|| _header->tail >= size)
+	{
+		// New file, or one we cannot trust: start empty
+		memset(_header, 0, sizeof(*_header));
+		memcpy(_header->magic, PACKET_JOURNAL_MAGIC, sizeof(_header->magic));
+		_header->version = PACKET_JOURNAL_VERSION;
+		_header->capacity = size;
+	}
+	recover();
+	_recovered = _header->records;
+	_appended = 0;
+	_replayed = 0;
+	_overwritten = 0;
+	return true;
+}
+
+void PacketJournal::close()
+{
+	if (_map)
+	{
+		sync();
+		munmap(_map, _mapSize);
+	}
+	_map = NULL;
+	_header = NULL;
+	_ring = NULL;
+	if (_fd >= 0)
+		::close(_fd);
+	_fd = -1;
+}
+
+bool PacketJournal::isOpen() const
+{
+	return _map != NULL;
+}
+
+bool PacketJournal::append(const char* topic, const uint8_t* data, size_t len)
+{
+	if (!_map)
+		return false;
+	size_t topicLen = strlen(topic);
+	if (topicLen > 255)
+		topicLen = 255;
+	uint32_t bodyLen = 1 + topicLen + len;
+	uint32_t need = recordSize(bodyLen);
+	if (need > _header->capacity / 2)
+		return false;
+
+	if (_header->records == 0)
+		_header->head = _header->tail = 0; // Keep the ring contiguous when we can
+
+	// Space needed from head: the record, plus the end of the ring if it does not fit there.
+	// head must never catch up with tail, equal means empty
+	uint32_t pos = _header->head;
+	bool wrap = pos + need > _header->capacity;
+	uint32_t consume = (wrap ? _header->capacity - pos : 0) + need;
+	while (_header->records && consume >= freeSpace())
+	{
+		dropOldest();
+		_overwritten++;
+	}
+
+	if (wrap)
+	{
+		if (_header->capacity - pos >= sizeof(RecordHeader))
+		{
+			RecordHeader* marker = (RecordHeader*) (_ring + pos);
+			marker->seq = _header->nextSeq;
+			marker->len = 0;
+			marker->flags = PACKET_JOURNAL_FLAG_WRAP;
+			marker->crc = crc(marker, NULL);
+		}
+		pos = 0;
+	}
+
+	// Body first, the header with the CRC last
+	RecordHeader* header = (RecordHeader*) (_ring + pos);
+	uint8_t* body = (uint8_t*) (header + 1);
+	body[0] = topicLen;
+	memcpy(body + 1, topic, topicLen);
+	memcpy(body + 1 + topicLen, data, len);
+	header->seq = _header->nextSeq;
+	header->len = bodyLen;
+	header->flags = 0;
+	header->crc = crc(header, body);
+
+	_header->head = (pos + need) % _header->capacity;
+	_header->nextSeq++;
+	_header->records++;
+	_appended++;
+	return true;
+}
+
+bool PacketJournal::front(Record& record)
+{
+	if (!_map || _header->records == 0)
+		return false;
+	const RecordHeader* header;
+	locate(_header->tail, _header->tailSeq, header);
+	if (!header)
+		return false; // recover() made sure this does not happen
+	const uint8_t* body = (const uint8_t*) (header + 1);
+	record.seq = header->seq;
+	record.topicLen = body[0];
+	record.topic = (const char*) body + 1;
+	record.data = body + 1 + body[0];
+	record.len = header->len - 1 - body[0];
+	return true;
+}
+
+void PacketJournal::pop()
+{
+	if (!_map || _header->records == 0)
+		return;
+	dropOldest();
+	_replayed++;
+}
+
+bool PacketJournal::empty() const
+{
+	return !_map || _header->records == 0;
+}
+
+uint32_t PacketJournal::records() const
+{
+	return _map ? _header->records : 0;
+}
+
+size_t PacketJournal::used() const
+{
+	return _map ? _header->capacity - freeSpace() : 0;
+}
+
+void PacketJournal::sync()
+{
+	if (_map)
+		msync(_map, _mapSize, MS_SYNC);
+}
+
+uint32_t PacketJournal::appended() const
+{
+	return _appended;
+}
+
+uint32_t PacketJournal::replayed() const
+{
+	return _replayed;
+}
+
+uint32_t PacketJournal::overwritten() const
+{
+	return _overwritten;
+}
+
+uint32_t PacketJournal::recovered() const
+{
+	return _recovered;
+}
+
+const char* PacketJournal::error() const
+{
+	return _error.c_str();
+}
+
+uint32_t PacketJournal::recordSize(uint32_t len) const
+{
+	return PACKET_JOURNAL_ALIGN(sizeof(RecordHeader) + len);
+}
+
+uint16_t PacketJournal::crc(const RecordHeader* header, const uint8_t* body) const
+{
+	uint16_t crc = 0xffff;
+	const uint8_t* p = (const uint8_t*) header;
+	for (size_t i = 0; i < offsetof(RecordHeader, crc); i++)
+		crc = RHcrc_ccitt_update(crc, p[i]);
+	crc = RHcrc_ccitt_update(crc, header->flags & 0xff);
+	crc = RHcrc_ccitt_update(crc, header->flags >> 8);
+	if (body)
+		for (uint32_t i = 0; i < header->len; i++)
+			crc = RHcrc_ccitt_update(crc, body[i]);
+	return crc;
+}
+
+uint32_t PacketJournal::locate(uint32_t pos, uint32_t seq, const RecordHeader*& header) const
+{
+	uint32_t capacity = _header->capacity;
+	header = NULL;
+	if (capacity - pos < sizeof(RecordHeader))
+	{
+		pos = 0; // No room for a marker at the end of the ring
+	}
+	else
+	{
+		const RecordHeader* marker = (const RecordHeader*) (_ring + pos);
+		if (marker->flags == PACKET_JOURNAL_FLAG_WRAP && marker->seq == seq
+			&& marker->len == 0 && marker->crc == crc(marker, NULL))
+			pos = 0;
+	}
+
+	const RecordHeader* h = (const RecordHeader*) (_ring + pos);
+	if (h->seq != seq || h->flags != 0 || h->len < 1
+		|| pos + recordSize(h->len) > capacity
+		|| ((const uint8_t*) (h + 1))[0] >= h->len
+		|| h->crc != crc(h, (const uint8_t*) (h + 1)))
+		return pos;
+	header = h;
+	return pos;
+}
+
+uint32_t PacketJournal::freeSpace() const
+{
+	if (_header->records == 0)
+		return _header->capacity;
+	return (_header->tail - _header->head + _header->capacity) % _header->capacity;
+}
+
+void PacketJournal::dropOldest()
+{
+	const RecordHeader* header;
+	uint32_t pos = locate(_header->tail, _header->tailSeq, header);
+	if (!header)
+	{
+		// Should not happen, give up on the rest
+		_header->records = 0;
+		_header->tail = _header->head;
+		_header->tailSeq = _header->nextSeq;
+		return;
+	}
+	// tail before tailSeq, in this order even if we are killed in between: recover() then
+	// finds the next record at tail with a tailSeq one behind
+	_header->tail = (pos + recordSize(header->len)) % _header->capacity;
+	std::atomic_signal_fence(std::memory_order_release);
+	_header->tailSeq++;
+	_header->records--;
+	if (_header->records == 0)
+		_header->tail = _header->head;
+}
+
+void PacketJournal::recover()
+{
+	// Killed in dropOldest() after it moved tail, but before it counted tailSeq
+	const RecordHeader* first;
+	locate(_header->tail, _header->tailSeq, first);
+	if (!first)
+	{
+		locate(_header->tail, _header->tailSeq + 1, first);
+		if (first)
+			_header->tailSeq++;
+	}
+
+	// Walk from the oldest record while records are intact and in sequence
+	uint32_t pos = _header->tail;
+	uint32_t seq = _header->tailSeq;
+	uint32_t records = 0;
+	uint32_t walked = 0;
+	for (;;)
+	{
+		const RecordHeader* header;
+		uint32_t at = locate(pos, seq, header);
+		if (!header)
+			break;
+		uint32_t size = recordSize(header->len);
+		walked += (at < pos ? _header->capacity - pos : 0) + size;
+		if (walked >= _header->capacity)
+			break; // Would overlap the oldest record
+		pos = (at + size) % _header->capacity;
+		seq++;
+		records++;
+	}
+	_header->head = pos;
+	_header->nextSeq = seq;
+	_header->records = records;
+	if (records == 0)
+		_header->head = _header->tail;
+}
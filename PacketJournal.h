@@ -0,0 +1,166 @@
+// PacketJournal.h
+//
+// Store-and-forward journal of the radiohead gateway: messages that cannot be
+// handed to the broker are appended to a memory mapped ring file and replayed
+// in order once the broker is back.
+
+#ifndef PacketJournal_h
+#define PacketJournal_h
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string>
+
+// Defaults used when the ini file does not override them
+#define PACKET_JOURNAL_DEFAULT_SIZE   (4 * 1024 * 1024)
+#define PACKET_JOURNAL_MIN_SIZE       (64 * 1024)
+
+/////////////////////////////////////////////////////////////////////
+/// \class PacketJournal PacketJournal.h <PacketJournal.h>
+/// \brief Bounded, crash safe FIFO of MQTT messages in a memory mapped file
+///
+/// The file holds a small header followed by a ring of records. Each record
+/// carries a sequence number, the topic and the message, and a CCITT CRC
+/// (RHcrc_ccitt_update()) over all of it. Appending is a memcpy and a CRC into
+/// the mapping, no system call, so it costs a few microseconds per packet.
+///
+/// The data reaches the disk through the page cache, so it survives a crash or
+/// kill of the gateway. sync() writes it out, to also survive a power loss.
+///
+/// On open() the records from the saved oldest position are checked one by one:
+/// the first record with a wrong CRC or sequence number (a torn write) ends the
+/// journal, so a partly written record is never replayed.
+///
+/// When the ring is full the oldest records are dropped to make room, counted by
+/// overwritten().
+class PacketJournal
+{
+public:
+	/// One record, pointing into the mapping. Valid until the next append() or pop().
+	typedef struct
+	{
+		uint32_t        seq;        ///< Sequence number
+		const char*     topic;      ///< Topic, not 0 terminated
+		uint8_t         topicLen;   ///< Octets in topic
+		const uint8_t*  data;       ///< Message
+		size_t          len;        ///< Octets in data
+	} Record;
+
+	PacketJournal();
+
+	/// Closes the journal
+	~PacketJournal();
+
+	/// Opens the journal file, creating it if needed, and recovers its records.
+	/// An existing file of a different size or format is started afresh.
+	/// \param[in] path Journal file
+	/// \param[in] size Size of the ring in octets, at least PACKET_JOURNAL_MIN_SIZE
+	/// \return false if the file could not be created or mapped, see error()
+	bool open(const char* path, size_t size = PACKET_JOURNAL_DEFAULT_SIZE);
+
+	/// Syncs and unmaps the file
+	void close();
+
+	/// \return true if the journal is open
+	bool isOpen() const;
+
+	/// Appends a message, dropping the oldest records if there is not enough room.
+	/// \param[in] topic Topic, at most 255 octets
+	/// \param[in] data Message
+	/// \param[in] len Octets in data
+	/// \return false if the journal is not open or the message is larger than half the ring
+	bool append(const char* topic, const uint8_t* data, size_t len);
+
+	/// Returns the oldest record without removing it
+	/// \param[out] record The record
+	/// \return false if the journal is empty
+	bool front(Record& record);
+
+	/// Removes the oldest record
+	void pop();
+
+	/// \return true if there are no records
+	bool empty() const;
+
+	/// \return Number of records in the journal
+	uint32_t records() const;
+
+	/// \return Octets used by records
+	size_t used() const;
+
+	/// Writes the mapping to disk (msync)
+	void sync();
+
+	/// \return Number of records appended since open()
+	uint32_t appended() const;
+
+	/// \return Number of records removed with pop() since open()
+	uint32_t replayed() const;
+
+	/// \return Number of records dropped because the ring was full since open()
+	uint32_t overwritten() const;
+
+	/// \return Number of records found and kept by open()
+	uint32_t recovered() const;
+
+	/// \return Description of the last open() failure
+	const char* error() const;
+
+private:
+	/// Start of the file
+	typedef struct
+	{
+		char            magic[8];
+		uint32_t        version;
+		uint32_t        capacity;   ///< Octets in the ring
+		uint32_t        head;       ///< Where the next record goes
+		uint32_t        tail;       ///< Oldest record
+		uint32_t        tailSeq;    ///< Sequence number of the oldest record
+		uint32_t        nextSeq;    ///< Sequence number of the next record
+		uint32_t        records;    ///< Number of records
+	} FileHeader;
+
+	/// Start of each record, followed by the topic length octet, the topic and the message
+	typedef struct
+	{
+		uint32_t        seq;
+		uint32_t        len;        ///< Octets after this header
+		uint16_t        crc;        ///< Over seq, len, flags and the octets after the header
+		uint16_t        flags;
+	} RecordHeader;
+
+	/// \return Octets in the ring used by a record with len octets after its header
+	uint32_t recordSize(uint32_t len) const;
+
+	/// \return The CRC of a record
+	uint16_t crc(const RecordHeader* header, const uint8_t* body) const;
+
+	/// \return The position of the record at pos, after following a wrap marker or
+	/// skipping a too short end of the ring. Sets header to NULL if pos holds no valid record.
+	uint32_t locate(uint32_t pos, uint32_t seq, const RecordHeader*& header) const;
+
+	/// \return Octets free in the ring
+	uint32_t freeSpace() const;
+
+	/// Removes the oldest record
+	void dropOldest();
+
+	/// Walks the records from the tail and sets head, nextSeq and records. Accepts a tailSeq
+	/// one behind tail, left by a dropOldest() that was interrupted
+	void recover();
+
+	std::string         _path;
+	int                 _fd;
+	uint8_t*            _map;
+	size_t              _mapSize;
+	FileHeader*         _header;
+	uint8_t*            _ring;
+
+	uint32_t            _appended;
+	uint32_t            _replayed;
+	uint32_t            _overwritten;
+	uint32_t            _recovered;
+	std::string         _error;
+};
+
+#endif
@@ -0,0 +1,165 @@
+// PacketRing.h
+//
+// Fixed capacity, lock-free single-producer/single-consumer ring used to hand
+// received radio packets from the radio thread to the publishing thread.
+
+#ifndef PacketRing_h
+#define PacketRing_h
+
+#include <stdint.h>
+#include <stddef.h>
+#include <time.h>
+#include <atomic>
+
+#include <RH_RF95.h>
+
+// Size of a cache line on the Raspberry Pi (and most other ARM and x86 cores).
+// The producer and consumer indexes live on separate lines so the two
+// threads do not keep invalidating each other's cache
+#define PACKET_RING_CACHE_LINE 64
+
+/// One received packet, as handed from the radio thread to the publisher
+typedef struct
+{
+	struct timespec timestamp;                  ///< Wall clock time the packet was read from the radio
+	uint8_t         from;                       ///< FROM header
+	uint8_t         to;                         ///< TO header
+	uint8_t         id;                         ///< ID header
+	uint8_t         flags;                      ///< FLAGS header
+	int8_t          rssi;                       ///< RSSI of the packet in dBm
+	int8_t          snr;                        ///< SNR of the packet in dB
+	uint8_t         radio;                      ///< Number of the radio that received the packet
+	uint8_t         len;                        ///< Number of octets in payload
+	uint8_t         payload[RH_RF95_MAX_MESSAGE_LEN]; ///< Message data, without the RadioHead headers
+} RadioPacket;
+
+/////////////////////////////////////////////////////////////////////
+/// \class PacketRing PacketRing.h <PacketRing.h>
+/// \brief Lock-free single-producer/single-consumer ring of fixed size records
+///
+/// Exactly one thread may call the producer functions (claim(), commit(), push())
+/// and exactly one other thread the consumer functions (front(), pop()).
+/// Records are written and read in place, so a packet is copied only once, from the
+/// radio into its slot.
+/// The producer counts records it had to drop because the ring was full (overflows())
+/// and the highest fill level seen so far (highWatermark()). Both can be read from any thread.
+/// \tparam T Record type
+/// \tparam Capacity Number of slots, must be a power of two
+template <typename T, size_t Capacity>
+class PacketRing
+{
+	static_assert(Capacity >= 2 && (Capacity & (Capacity - 1)) == 0, "PacketRing capacity must be a power of two");
+
+public:
+	PacketRing()
+		:
+		_head(0),
+		_tailCache(0),
+		_tail(0),
+		_headCache(0),
+		_overflows(0),
+		_highWatermark(0)
+	{
+	}
+
+	/// Producer: returns the next free slot to be filled in place, or NULL if the
+	/// ring is full (the overflow counter is incremented). The slot becomes visible to
+	/// the consumer only after commit().
+	T* claim()
+	{
+		size_t head = _head.load(std::memory_order_relaxed);
+		if (head - _tailCache >= Capacity)
+		{
+			_tailCache = _tail.load(std::memory_order_acquire);
+			if (head - _tailCache >= Capacity)
+			{
+				_overflows.fetch_add(1, std::memory_order_relaxed);
+				return NULL;
+			}
+		}
+		return &_slots[head & (Capacity - 1)];
+	}
+
+	/// Producer: publishes the slot returned by the last successful claim()
+	void commit()
+	{
+		size_t head = _head.load(std::memory_order_relaxed) + 1;
+		_head.store(head, std::memory_order_release);
+		size_t used = head - _tailCache;
+		if (used > _highWatermark.load(std::memory_order_relaxed))
+			_highWatermark.store(used, std::memory_order_relaxed);
+	}
+
+	/// Producer: copies a record into the ring
+	/// \return false if the ring was full and the record dropped
+	bool push(const T& record)
+	{
+		T* slot = claim();
+		if (!slot)
+			return false;
+		*slot = record;
+		commit();
+		return true;
+	}
+
+	/// Consumer: returns the oldest record, or NULL if the ring is empty.
+	/// The record stays valid until pop().
+	T* front()
+	{
+		size_t tail = _tail.load(std::memory_order_relaxed);
+		if (tail == _headCache)
+		{
+			_headCache = _head.load(std::memory_order_acquire);
+			if (tail == _headCache)
+				return NULL;
+		}
+		return &_slots[tail & (Capacity - 1)];
+	}
+
+	/// Consumer: releases the record returned by front()
+	void pop()
+	{
+		_tail.store(_tail.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+	}
+
+	/// \return Number of records currently in the ring. Approximate while both sides are running.
+	size_t size() const
+	{
+		return _head.load(std::memory_order_acquire) - _tail.load(std::memory_order_acquire);
+	}
+
+	/// \return Number of slots
+	size_t capacity() const
+	{
+		return Capacity;
+	}
+
+	/// \return Number of records dropped because the ring was full
+	uint32_t overflows() const
+	{
+		return _overflows.load(std::memory_order_relaxed);
+	}
+
+	/// \return Highest number of records that were in the ring at the same time
+	uint32_t highWatermark() const
+	{
+		return _highWatermark.load(std::memory_order_relaxed);
+	}
+
+private:
+	/// Producer side: next slot to write, and the producer's last view of _tail
+	alignas(PACKET_RING_CACHE_LINE) std::atomic<size_t> _head;
+	size_t                                               _tailCache;
+
+	/// Consumer side: next slot to read, and the consumer's last view of _head
+	alignas(PACKET_RING_CACHE_LINE) std::atomic<size_t> _tail;
+	size_t                                               _headCache;
+
+	/// Statistics, written by the producer only
+	alignas(PACKET_RING_CACHE_LINE) std::atomic<uint32_t> _overflows;
+	std::atomic<uint32_t>                                 _highWatermark;
+
+	alignas(PACKET_RING_CACHE_LINE) T _slots[Capacity];
+};
+
+#endif
@@ -0,0 +1,502 @@
+// RHAsync.cpp
+//
+// C++20 coroutine interface to the RadioHead managers
+
+#include <RHAsync.h>
+
+#ifdef RH_HAVE_ASYNC
+
+#include <string.h>
+
+////////////////////////////////////////////////////////////////////
+// RHAsyncManager
+
+RHAsyncManager::RHAsyncManager(RHEventLoop& loop, RHReliableDatagram& manager, int eventFd)
+    :
+    _loop(loop),
+    _manager(manager),
+    _eventFd(eventFd),
+    _running(false),
+    _kicked(false),
+    _timer(RH_EVENT_TIMER_NONE),
+    _inboxDropped(0)
+{
+}
+
+RHAsyncManager::~RHAsyncManager()
+{
+    end();
+}
+
+bool RHAsyncManager::begin()
+{
+    end();
+    if (_eventFd >= 0 && !_loop.watch(_eventFd, EPOLLIN, ready, this))
+	return false;
+    _manager.setSendCallback(sent);
+    _running = true;
+    // Look at the radio once now: it may have received something before it was watched
+    kick();
+    return true;
+}
+
+void RHAsyncManager::end()
+{
+    if (!_running)
+	return;
+    _running = false;
+    if (_eventFd >= 0)
+	_loop.unwatch(_eventFd);
+    _loop.cancel(_timer);
+    _timer = RH_EVENT_TIMER_NONE;
+    _manager.setSendCallback(NULL);
+
+    // Complete everyone who is waiting, they are resumed after this returns
+    while (!_receivers.empty())
+    {
+	RecvAwaiter* r = _receivers.front();
+	_receivers.pop_front();
+	_loop.cancel(r->_timer);
+	r->_message.ok = false;
+	resume(r->_h);
+    }
+    while (!_sending.empty())
+    {
+	SendAwaiter* s = _sending.front();
+	_sending.pop_front();
+	_manager.cancelSend(s->_handle);
+	s->_acked = false;
+	resume(s->_h);
+    }
+    while (!_parked.empty())
+    {
+	SendAwaiter* s = _parked.front();
+	_parked.pop_front();
+	s->_acked = false;
+	resume(s->_h);
+    }
+    _inbox.clear();
+}
+
+RHAsyncManager::RecvAwaiter RHAsyncManager::recvfrom(long timeout, int from)
+{
+    return RecvAwaiter(this, timeout, from);
+}
+
+RHAsyncManager::SendAwaiter RHAsyncManager::send(uint8_t address, const uint8_t* buf, uint8_t len)
+{
+    return SendAwaiter(this, address, buf, len, 0);
+}
+
+RHAsyncManager::SendAwaiter RHAsyncManager::sendMessage(uint8_t address, const uint8_t* buf, uint8_t len, uint8_t flags)
+{
+    return SendAwaiter(this, address, buf, len, flags);
+}
+
+RHAsyncManager::SleepAwaiter RHAsyncManager::sleep(unsigned long ms)
+{
+    return SleepAwaiter(_loop, ms);
+}
+
+RHEventLoop& RHAsyncManager::loop()
+{
+    return _loop;
+}
+
+uint32_t RHAsyncManager::inboxDropped()
+{
+    return _inboxDropped;
+}
+
+size_t RHAsyncManager::receivers()
+{
+    return _receivers.size();
+}
+
+size_t RHAsyncManager::senders()
+{
+    return _sending.size() + _parked.size();
+}
+
+bool RHAsyncManager::receive(RHAsyncMessage& message)
+{
+    message.len = sizeof(message.data);
+    return _manager.recvfromAck(message.data, &message.len, &message.from, &message.to, &message.id, &message.flags);
+}
+
+uint8_t RHAsyncManager::startSend(const uint8_t* buf, uint8_t len, uint8_t address, uint8_t flags, void* arg)
+{
+    (void)flags; // The FLAGS header of RHReliableDatagram is its own
+    return _manager.sendtoAsync(buf, len, address, arg);
+}
+
+void RHAsyncManager::received()
+{
+}
+
+void RHAsyncManager::resume(std::coroutine_handle<> h)
+{
+    _loop.post(resumeHandle, h.address());
+}
+
+void RHAsyncManager::resumeHandle(void* arg)
+{
+    std::coroutine_handle<>::from_address(arg).resume();
+}
+
+void RHAsyncManager::ready(uint32_t events, void* arg)
+{
+    (void)events;
+    ((RHAsyncManager*)arg)->pump();
+}
+
+void RHAsyncManager::timer(void* arg)
+{
+    RHAsyncManager* m = (RHAsyncManager*)arg;
+    m->_timer = RH_EVENT_TIMER_NONE;
+    m->pump();
+}
+
+void RHAsyncManager::kicked(void* arg)
+{
+    RHAsyncManager* m = (RHAsyncManager*)arg;
+    m->_kicked = false;
+    if (m->_running)
+	m->pump();
+}
+
+void RHAsyncManager::kick()
+{
+    if (_kicked)
+	return;
+    _kicked = true;
+    _loop.post(kicked, this);
+}
+
+void RHAsyncManager::sent(uint8_t handle, uint8_t address, bool acked, void* arg)
+{
+    (void)handle;
+    (void)address;
+    SendAwaiter* s = (SendAwaiter*)arg;
+    if (!s)
+	return; // Not one of ours
+    RHAsyncManager* m = s->_manager;
+    m->_sending.remove(s);
+    s->_acked = acked;
+    m->resume(s->_h);
+    // The entry is free once this callback returns
+    if (!m->_parked.empty())
+	m->kick();
+}
+
+void RHAsyncManager::pump()
+{
+    if (_eventFd >= 0)
+	_manager.waitForEvent(0); // Consume the interrupts that woke us, then look at the radio
+
+    startParked();
+
+    RHAsyncMessage message;
+    while (_manager.available())
+    {
+	if (receive(message))
+	{
+	    message.ok = true;
+	    deliver(message);
+	}
+	received();
+    }
+
+    // One transmission per turn, so that received messages and other file descriptors are not
+    // held up by a long send table
+    if (_manager.service())
+    {
+	kick();
+	return;
+    }
+
+    // Come back when the send table has something due, or to poll the radio
+    int32_t timeout = _manager.serviceTimeout();
+    if (_eventFd < 0 && (timeout < 0 || timeout > RH_ASYNC_POLL_INTERVAL))
+	timeout = RH_ASYNC_POLL_INTERVAL;
+    _loop.cancel(_timer);
+    _timer = timeout >= 0 ? _loop.schedule(timeout, timer, this) : RH_EVENT_TIMER_NONE;
+}
+
+void RHAsyncManager::deliver(const RHAsyncMessage& message)
+{
+    for (std::list<RecvAwaiter*>::iterator it = _receivers.begin(); it != _receivers.end(); it++)
+    {
+	RecvAwaiter* r = *it;
+	if (r->_from >= 0 && r->_from != message.from)
+	    continue;
+	_receivers.erase(it);
+	_loop.cancel(r->_timer);
+	r->_message = message;
+	resume(r->_h);
+	return;
+    }
+
+    if (_inbox.size() >= RH_ASYNC_INBOX_LEN)
+    {
+	_inbox.pop_front();
+	_inboxDropped++;
+    }
+    _inbox.push_back(message);
+}
+
+void RHAsyncManager::startParked()
+{
+    while (!_parked.empty() && _manager.pendingSends() < RH_RELIABLE_MAX_PENDING)
+    {
+	SendAwaiter* s = _parked.front();
+	_parked.pop_front();
+	s->_handle = startSend(s->_buf, s->_len, s->_address, s->_flags, s);
+	if (s->_handle == RH_RELIABLE_NO_HANDLE)
+	{
+	    s->_acked = false;
+	    resume(s->_h);
+	}
+	else
+	{
+	    _sending.push_back(s);
+	}
+    }
+}
+
+////////////////////////////////////////////////////////////////////
+// RHAsyncManager::RecvAwaiter
+
+RHAsyncManager::RecvAwaiter::RecvAwaiter(RHAsyncManager* manager, long timeout, int from)
+    :
+    _manager(manager),
+    _timeout(timeout),
+    _from(from),
+    _timer(RH_EVENT_TIMER_NONE)
+{
+    _message.ok = false;
+    _message.len = 0;
+}
+
+bool RHAsyncManager::RecvAwaiter::await_ready()
+{
+    if (!_manager->_running)
+	return true; // ok is false
+    std::deque<RHAsyncMessage>& inbox = _manager->_inbox;
+    for (std::deque<RHAsyncMessage>::iterator it = inbox.begin(); it != inbox.end(); it++)
+    {
+	if (_from >= 0 && _from != it->from)
+	    continue;
+	_message = *it;
+	inbox.erase(it);
+	return true;
+    }
+    return false;
+}
+
+void RHAsyncManager::RecvAwaiter::await_suspend(std::coroutine_handle<> h)
+{
+    _h = h;
+    _manager->_receivers.push_back(this);
+    if (_timeout >= 0)
+	_timer = _manager->_loop.schedule(_timeout, timedOut, this);
+}
+
+void RHAsyncManager::RecvAwaiter::timedOut(void* arg)
+{
+    RecvAwaiter* r = (RecvAwaiter*)arg;
+    r->_timer = RH_EVENT_TIMER_NONE;
+    r->_manager->_receivers.remove(r);
+    r->_message.ok = false;
+    r->_manager->resume(r->_h);
+}
+
+////////////////////////////////////////////////////////////////////
+// RHAsyncManager::SendAwaiter
+
+RHAsyncManager::SendAwaiter::SendAwaiter(RHAsyncManager* manager, uint8_t address, const uint8_t* buf, uint8_t len, uint8_t flags)
+    :
+    _manager(manager),
+    _address(address),
+    _buf(buf),
+    _len(len),
+    _flags(flags),
+    _handle(RH_RELIABLE_NO_HANDLE),
+    _acked(false)
+{
+}
+
+bool RHAsyncManager::SendAwaiter::await_ready()
+{
+    // Nothing to wait for if it cannot be sent
+    return !_manager->_running || _len > RH_RELIABLE_MAX_MESSAGE_LEN;
+}
+
+bool RHAsyncManager::SendAwaiter::await_suspend(std::coroutine_handle<> h)
+{
+    _h = h;
+    return start();
+}
+
+bool RHAsyncManager::SendAwaiter::start()
+{
+    RHAsyncManager* m = _manager;
+    // Keep the order of the parked sends
+    if (m->_parked.empty())
+    {
+	_handle = m->startSend(_buf, _len, _address, _flags, this);
+	if (_handle != RH_RELIABLE_NO_HANDLE)
+	{
+	    m->_sending.push_back(this);
+	    m->kick(); // service() transmits it
+	    return true;
+	}
+	if (m->_manager.pendingSends() < RH_RELIABLE_MAX_PENDING)
+	    return false; // Rejected for another reason than a full table, eg no route
+    }
+    m->_parked.push_back(this);
+    return true;
+}
+
+////////////////////////////////////////////////////////////////////
+// RHAsyncManager::SleepAwaiter
+
+void RHAsyncManager::SleepAwaiter::await_suspend(std::coroutine_handle<> h)
+{
+    _loop.schedule(_ms, resumeHandle, h.address());
+}
+
+////////////////////////////////////////////////////////////////////
+// RHAsyncMesh
+
+RHAsyncMesh::RHAsyncMesh(RHEventLoop& loop, RHMesh& mesh, int eventFd)
+    :
+    RHAsyncManager(loop, mesh, eventFd),
+    _mesh(mesh)
+{
+}
+
+RHAsyncMesh::~RHAsyncMesh()
+{
+    end();
+}
+
+void RHAsyncMesh::end()
+{
+    while (!_discoveries.empty())
+    {
+	RouteAwaiter* r = _discoveries.front();
+	_discoveries.pop_front();
+	_loop.cancel(r->_timer);
+	r->_found = false;
+	resume(r->_h);
+    }
+    RHAsyncManager::end();
+}
+
+bool RHAsyncMesh::receive(RHAsyncMessage& message)
+{
+    message.len = sizeof(message.data);
+    return _mesh.recvfromAck(message.data, &message.len, &message.from, &message.to, &message.id, &message.flags);
+}
+
+uint8_t RHAsyncMesh::startSend(const uint8_t* buf, uint8_t len, uint8_t address, uint8_t flags, void* arg)
+{
+    return _mesh.sendtoAsync(buf, len, address, flags, arg);
+}
+
+void RHAsyncMesh::received()
+{
+    // A route discovery response adds its route while passing through RHMesh::recvfromAck()
+    std::list<RouteAwaiter*>::iterator it = _discoveries.begin();
+    while (it != _discoveries.end())
+    {
+	RouteAwaiter* r = *it;
+	if (!_mesh.getRouteTo(r->_address))
+	{
+	    it++;
+	    continue;
+	}
+	it = _discoveries.erase(it);
+	_loop.cancel(r->_timer);
+	r->_found = true;
+	resume(r->_h);
+    }
+}
+
+bool RHAsyncMesh::discovering(uint8_t address)
+{
+    for (std::list<RouteAwaiter*>::iterator it = _discoveries.begin(); it != _discoveries.end(); it++)
+	if ((*it)->_address == address)
+	    return true;
+    return false;
+}
+
+RHTask<bool> RHAsyncMesh::discover(uint8_t address, unsigned long timeout)
+{
+    if (_mesh.getRouteTo(address))
+	co_return true;
+    // Concurrent discoveries for the same node share the request already on its way
+    if (!discovering(address) && !_mesh.requestRoute(address))
+	co_return false;
+    bool found = co_await RouteAwaiter(this, address, timeout);
+    co_return found;
+}
+
+RHTask<uint8_t> RHAsyncMesh::send(uint8_t dest, const uint8_t* buf, uint8_t len, uint8_t flags)
+{
+    if (len > RH_MESH_MAX_MESSAGE_LEN)
+	co_return RH_ROUTER_ERROR_INVALID_LENGTH;
+    if (dest != RH_BROADCAST_ADDRESS)
+    {
+	bool found = co_await discover(dest);
+	if (!found)
+	    co_return RH_ROUTER_ERROR_NO_ROUTE;
+    }
+    bool acked = co_await sendMessage(dest, buf, len, flags);
+    if (!acked)
+    {
+	// Like RHMesh::routev(): the next hop is gone, find another route next time
+	if (dest != RH_BROADCAST_ADDRESS)
+	    _mesh.deleteRouteTo(dest);
+	co_return RH_ROUTER_ERROR_UNABLE_TO_DELIVER;
+    }
+    co_return RH_ROUTER_ERROR_NONE;
+}
+
+////////////////////////////////////////////////////////////////////
+// RHAsyncMesh::RouteAwaiter
+
+RHAsyncMesh::RouteAwaiter::RouteAwaiter(RHAsyncMesh* mesh, uint8_t address, unsigned long timeout)
+    :
+    _mesh(mesh),
+    _address(address),
+    _timeout(timeout),
+    _timer(RH_EVENT_TIMER_NONE),
+    _found(false)
+{
+}
+
+bool RHAsyncMesh::RouteAwaiter::await_ready()
+{
+    _found = _mesh->_mesh.getRouteTo(_address) != NULL;
+    return _found;
+}
+
+void RHAsyncMesh::RouteAwaiter::await_suspend(std::coroutine_handle<> h)
+{
+    _h = h;
+    _mesh->_discoveries.push_back(this);
+    _timer = _mesh->_loop.schedule(_timeout, timedOut, this);
+}
+
+void RHAsyncMesh::RouteAwaiter::timedOut(void* arg)
+{
+    RouteAwaiter* r = (RouteAwaiter*)arg;
+    r->_timer = RH_EVENT_TIMER_NONE;
+    r->_mesh->_discoveries.remove(r);
+    r->_found = false;
+    r->_mesh->resume(r->_h);
+}
+
+#endif
@@ -0,0 +1,456 @@
+// RHAsync.h
+//
+// C++20 coroutine interface to the RadioHead managers, driven by an RHEventLoop:
+// many conversations with different nodes interleave on one radio in one thread.
+
+#ifndef RHAsync_h
+#define RHAsync_h
+
+#include <RHEventLoop.h>
+#include <RHMesh.h>
+
+// Coroutines need a compiler in C++20 mode (g++ 10 or later with -std=c++20), the event loop
+// and the asynchronous send table of RHReliableDatagram
+#if defined(RH_HAVE_EPOLL) && defined(__cpp_impl_coroutine) && (RH_RELIABLE_MAX_PENDING > 0)
+#define RH_HAVE_ASYNC
+
+#include <coroutine>
+#include <exception>
+#include <type_traits>
+#include <utility>
+#include <deque>
+#include <list>
+
+// Number of received messages kept for recvfrom() when no coroutine is waiting for them.
+// When it is full the oldest is dropped
+#ifndef RH_ASYNC_INBOX_LEN
+#define RH_ASYNC_INBOX_LEN 16
+#endif
+
+// Without an interrupt file descriptor the radio is looked at every this many ms
+#ifndef RH_ASYNC_POLL_INTERVAL
+#define RH_ASYNC_POLL_INTERVAL 5
+#endif
+
+template <typename T = void> class RHTask;
+
+/// Shared part of the promise types of RHTask
+class RHTaskPromiseBase
+{
+public:
+    /// Tasks are lazy: they run when awaited or detached
+    std::suspend_always initial_suspend() noexcept { return {}; }
+
+    /// Resumes the awaiting coroutine, or frees a detached task
+    struct FinalAwaiter
+    {
+	bool await_ready() noexcept { return false; }
+	template <typename P>
+	std::coroutine_handle<> await_suspend(std::coroutine_handle<P> h) noexcept
+	{
+	    RHTaskPromiseBase& promise = h.promise();
+	    if (promise._continuation)
+		return promise._continuation;
+	    if (promise._detached)
+		h.destroy();
+	    return std::noop_coroutine();
+	}
+	void await_resume() noexcept {}
+    };
+    FinalAwaiter final_suspend() noexcept { return {}; }
+
+    /// RadioHead does not use exceptions
+    void unhandled_exception() { std::terminate(); }
+
+    std::coroutine_handle<> _continuation;
+    bool                    _detached = false;
+};
+
+/// Promise type of RHTask with a result
+template <typename T>
+class RHTaskPromise : public RHTaskPromiseBase
+{
+public:
+    RHTask<T> get_return_object();
+    void return_value(T value) { _value = std::move(value); }
+    T _value{};
+};
+
+/// Promise type of RHTask<void>
+template <>
+class RHTaskPromise<void> : public RHTaskPromiseBase
+{
+public:
+    RHTask<void> get_return_object();
+    void return_void() {}
+};
+
+/////////////////////////////////////////////////////////////////////
+/// \class RHTask RHAsync.h <RHAsync.h>
+/// \brief A coroutine returning T, started when it is awaited or detached
+///
+/// A function returning RHTask<T> that uses co_await or co_return is a coroutine.
+/// Another coroutine gets its result with co_await, or a plain function starts it with
+/// detach() and lets it run on its own. A task must not be destroyed while it is suspended
+/// in an RHAsyncManager operation: end() the manager first, which completes them all.
+template <typename T>
+class RHTask
+{
+public:
+    typedef RHTaskPromise<T> promise_type;
+    typedef std::coroutine_handle<promise_type> Handle;
+
+    explicit RHTask(Handle h) : _h(h) {}
+    RHTask(RHTask&& other) noexcept : _h(other._h) { other._h = nullptr; }
+    RHTask(const RHTask&) = delete;
+    RHTask& operator=(const RHTask&) = delete;
+    ~RHTask() { if (_h) _h.destroy(); }
+
+    /// Starts the task without anyone waiting for its result. It frees itself when it completes.
+    void detach()
+    {
+	Handle h = _h;
+	_h = nullptr;
+	h.promise()._detached = true;
+	h.resume();
+    }
+
+    /// \return true if the task has completed
+    bool done() { return !_h || _h.done(); }
+
+    bool await_ready() noexcept { return done(); }
+    std::coroutine_handle<> await_suspend(std::coroutine_handle<> caller) noexcept
+    {
+	_h.promise()._continuation = caller;
+	return _h; // Run the task now, it resumes the caller when it completes
+    }
+    T await_resume()
+    {
+	if constexpr (!std::is_void_v<T>)
+	    return std::move(_h.promise()._value);
+    }
+
+private:
+    Handle _h;
+};
+
+template <typename T>
+RHTask<T> RHTaskPromise<T>::get_return_object()
+{
+    return RHTask<T>(RHTask<T>::Handle::from_promise(*this));
+}
+
+inline RHTask<void> RHTaskPromise<void>::get_return_object()
+{
+    return RHTask<void>(RHTask<void>::Handle::from_promise(*this));
+}
+
+/// A message returned by RHAsyncManager::recvfrom()
+typedef struct
+{
+    bool        ok;                         ///< false if the receive timed out or the manager ended
+    uint8_t     from;                       ///< FROM header, the SOURCE address for RHAsyncMesh
+    uint8_t     to;                         ///< TO header, the DEST address for RHAsyncMesh
+    uint8_t     id;                         ///< ID header
+    uint8_t     flags;                      ///< FLAGS header
+    uint8_t     len;                        ///< Number of octets in data
+    uint8_t     data[RH_MAX_MESSAGE_LEN];   ///< Message data
+} RHAsyncMessage;
+
+/////////////////////////////////////////////////////////////////////
+/// \class RHAsyncManager RHAsync.h <RHAsync.h>
+/// \brief Awaitable receive and reliable send over an RHReliableDatagram
+///
+/// The manager watches the interrupt file descriptor of the driver in an RHEventLoop
+/// (or looks at the radio every RH_ASYNC_POLL_INTERVAL ms without one). When the radio
+/// has something, it receives with recvfromAck(), which acknowledges the message, and hands
+/// it to the first coroutine waiting in recvfrom() for that sender, or to the inbox if none is.
+/// send() queues the message with sendtoAsync() and suspends the coroutine until the ACK
+/// arrives or the retries are exhausted; the manager calls service() when the send table has
+/// something due. Messages to different nodes are therefore in flight at the same time, and
+/// a coroutine waiting for one node does not keep another from being served:
+///
+/// \code
+/// RHTask<void> session(RHAsyncManager& radio, uint8_t node)
+/// {
+///     uint8_t hello[] = "hello";
+///     if (!co_await radio.send(node, hello, sizeof(hello)))
+///         co_return;
+///     RHAsyncMessage reply = co_await radio.recvfrom(2000, node);
+///     if (reply.ok)
+///         printf("node %d answered %d octets\n", node, reply.len);
+/// }
+///
+/// RHEventLoop loop;
+/// loop.begin();
+/// RHReliableDatagram manager(rf95, 1);
+/// manager.init();
+/// RHAsyncManager radio(loop, manager, rf95.interruptFd());
+/// radio.begin();
+/// for (uint8_t node = 2; node < 100; node++)
+///     session(radio, node).detach();
+/// loop.run();
+/// \endcode
+///
+/// The manager sets the send callback of the RHReliableDatagram, and no other code should
+/// receive from it while the manager runs. Everything runs in the thread of the event loop;
+/// coroutines are resumed by posted calls, never from inside the manager. The radio itself
+/// is still driven by blocking calls: a transmission (and the ACK of a received message)
+/// holds up the loop for its time on air.
+class RHAsyncManager
+{
+public:
+    /// Constructor
+    /// \param[in] loop The event loop to run on
+    /// \param[in] manager The manager, initialised with init()
+    /// \param[in] eventFd Readable when the driver has something to report, eg RH_RF95::interruptFd().
+    /// -1 polls the radio every RH_ASYNC_POLL_INTERVAL ms instead.
+    RHAsyncManager(RHEventLoop& loop, RHReliableDatagram& manager, int eventFd = -1);
+
+    /// Destructor, calls end()
+    virtual ~RHAsyncManager();
+
+    /// Starts watching the radio
+    /// \return true if the event file descriptor could be watched (or the poll timer scheduled)
+    bool begin();
+
+    /// Stops watching the radio. Pending receives complete with ok false and pending sends
+    /// with false, their coroutines are resumed on the next turn of the loop.
+    virtual void end();
+
+    /// Awaits recvfrom()
+    class RecvAwaiter
+    {
+    public:
+	RecvAwaiter(RHAsyncManager* manager, long timeout, int from);
+	bool await_ready();
+	void await_suspend(std::coroutine_handle<> h);
+	RHAsyncMessage await_resume() { return _message; }
+    private:
+	friend class RHAsyncManager;
+	static void timedOut(void* arg);
+	RHAsyncManager*         _manager;
+	long                    _timeout;
+	int                     _from;
+	uint32_t                _timer;
+	std::coroutine_handle<> _h;
+	RHAsyncMessage          _message;
+    };
+
+    /// Awaits send()
+    class SendAwaiter
+    {
+    public:
+	SendAwaiter(RHAsyncManager* manager, uint8_t address, const uint8_t* buf, uint8_t len, uint8_t flags);
+	bool await_ready();
+	bool await_suspend(std::coroutine_handle<> h);
+	bool await_resume() { return _acked; }
+    private:
+	friend class RHAsyncManager;
+	/// Starts the send, or parks it while the send table is full
+	/// \return false if it failed at once
+	bool start();
+	RHAsyncManager*         _manager;
+	uint8_t                 _address;
+	const uint8_t*          _buf;
+	uint8_t                 _len;
+	uint8_t                 _flags;
+	uint8_t                 _handle;
+	bool                    _acked;
+	std::coroutine_handle<> _h;
+    };
+
+    /// Awaits sleep()
+    class SleepAwaiter
+    {
+    public:
+	SleepAwaiter(RHEventLoop& loop, unsigned long ms) : _loop(loop), _ms(ms) {}
+	bool await_ready() { return false; }
+	void await_suspend(std::coroutine_handle<> h);
+	void await_resume() {}
+    private:
+	RHEventLoop&            _loop;
+	unsigned long           _ms;
+    };
+
+    /// Waits for a message: co_await radio.recvfrom(timeout, from)
+    /// \param[in] timeout Maximum time to wait in milliseconds, negative waits forever
+    /// \param[in] from Only a message from this address, or negative for any
+    /// \return Awaitable giving the RHAsyncMessage, with ok false on timeout
+    RecvAwaiter recvfrom(long timeout = -1, int from = -1);
+
+    /// Sends a message reliably: co_await radio.send(address, buf, len)
+    /// \param[in] address Destination. Broadcasts are sent once and complete as acknowledged.
+    /// \param[in] buf The message. Must stay valid until the send completes, it is copied only
+    /// when the message gets an entry in the send table.
+    /// \param[in] len Number of octets in buf
+    /// \return Awaitable giving true if the message was acknowledged
+    SendAwaiter send(uint8_t address, const uint8_t* buf, uint8_t len);
+
+    /// Suspends the coroutine: co_await radio.sleep(ms)
+    /// \param[in] ms Milliseconds to sleep
+    /// \return Awaitable
+    SleepAwaiter sleep(unsigned long ms);
+
+    /// \return The event loop the manager runs on
+    RHEventLoop& loop();
+
+    /// \return Number of received messages dropped because the inbox was full
+    uint32_t inboxDropped();
+
+    /// \return Number of coroutines waiting in recvfrom()
+    size_t receivers();
+
+    /// \return Number of coroutines waiting in send(), in flight or for an entry in the send table
+    size_t senders();
+
+protected:
+    /// Receives one message from the manager. Called while the radio has something available.
+    /// \param[out] message Receives the message
+    /// \return true if a message for the application was received
+    virtual bool receive(RHAsyncMessage& message);
+
+    /// Queues a message with the asynchronous send of the manager
+    /// \return The handle, or RH_RELIABLE_NO_HANDLE
+    virtual uint8_t startSend(const uint8_t* buf, uint8_t len, uint8_t address, uint8_t flags, void* arg);
+
+    /// Called after each message the radio delivered, whether it was for the application or not
+    virtual void received();
+
+    /// Sends with flags, for subclasses whose messages carry them
+    SendAwaiter sendMessage(uint8_t address, const uint8_t* buf, uint8_t len, uint8_t flags);
+
+    /// Resumes a suspended coroutine on the next turn of the loop
+    void resume(std::coroutine_handle<> h);
+
+    RHEventLoop&                _loop;
+
+private:
+    /// Called by the event loop
+    static void ready(uint32_t events, void* arg);
+    static void timer(void* arg);
+    static void kicked(void* arg);
+    static void resumeHandle(void* arg);
+
+    /// The send callback of the manager
+    static void sent(uint8_t handle, uint8_t address, bool acked, void* arg);
+
+    /// Receives everything the radio has, runs the send table, and arranges the next look
+    void pump();
+
+    /// Runs pump() on the next turn of the loop
+    void kick();
+
+    /// Gives a message to a waiting coroutine or the inbox
+    void deliver(const RHAsyncMessage& message);
+
+    /// Starts the sends waiting for an entry in the send table
+    void startParked();
+
+    RHReliableDatagram&         _manager;
+    int                         _eventFd;
+    bool                        _running;
+    bool                        _kicked;
+    uint32_t                    _timer;
+    uint32_t                    _inboxDropped;
+    std::deque<RHAsyncMessage>  _inbox;
+    std::list<RecvAwaiter*>     _receivers;
+    /// Sends with an entry in the send table
+    std::list<SendAwaiter*>     _sending;
+    /// Sends waiting for an entry, in order
+    std::deque<SendAwaiter*>    _parked;
+};
+
+/////////////////////////////////////////////////////////////////////
+/// \class RHAsyncMesh RHAsync.h <RHAsync.h>
+/// \brief Awaitable receive, send and route discovery over an RHMesh
+///
+/// Like RHAsyncManager, but messages are routed end to end: recvfrom() gives the application
+/// messages for this node with their SOURCE and DEST addresses, send() discovers a route
+/// first if none is known, and discover() resolves a route on its own. Route discoveries of
+/// concurrent coroutines for the same node share one request. Forwarding messages for other
+/// nodes and answering their route discoveries still happen inside RHMesh::recvfromAck(),
+/// with blocking sends.
+///
+/// \code
+/// RHTask<void> poll(RHAsyncMesh& mesh, uint8_t node)
+/// {
+///     uint8_t query[] = { 1 };
+///     uint8_t error = co_await mesh.send(node, query, sizeof(query));
+///     if (error == RH_ROUTER_ERROR_NONE)
+///     {
+///         RHAsyncMessage answer = co_await mesh.recvfrom(5000, node);
+///         ...
+///     }
+/// }
+/// \endcode
+class RHAsyncMesh : public RHAsyncManager
+{
+public:
+    /// Constructor
+    /// \param[in] loop The event loop to run on
+    /// \param[in] mesh The mesh manager, initialised with init()
+    /// \param[in] eventFd Readable when the driver has something to report, or -1
+    RHAsyncMesh(RHEventLoop& loop, RHMesh& mesh, int eventFd = -1);
+
+    /// Destructor, calls end()
+    virtual ~RHAsyncMesh();
+
+    /// Like RHAsyncManager::end(), and pending route discoveries complete with false
+    virtual void end();
+
+    /// Awaits a route
+    class RouteAwaiter
+    {
+    public:
+	RouteAwaiter(RHAsyncMesh* mesh, uint8_t address, unsigned long timeout);
+	bool await_ready();
+	void await_suspend(std::coroutine_handle<> h);
+	bool await_resume() { return _found; }
+    private:
+	friend class RHAsyncMesh;
+	static void timedOut(void* arg);
+	RHAsyncMesh*            _mesh;
+	uint8_t                 _address;
+	unsigned long           _timeout;
+	uint32_t                _timer;
+	bool                    _found;
+	std::coroutine_handle<> _h;
+    };
+
+    /// Finds a route to a node, broadcasting a route discovery request if none is known:
+    /// co_await mesh.discover(address)
+    /// \param[in] address The node
+    /// \param[in] timeout Maximum time to wait for the answer in milliseconds
+    /// \return Task giving true if a route is known
+    RHTask<bool> discover(uint8_t address, unsigned long timeout = RH_MESH_ARP_TIMEOUT);
+
+    /// Sends an application message, discovering the route first if needed:
+    /// co_await mesh.send(dest, buf, len)
+    /// \param[in] dest The destination node, or RH_BROADCAST_ADDRESS for the nearby nodes
+    /// \param[in] buf The message. Must stay valid until the task completes.
+    /// \param[in] len Number of octets in buf, at most RH_MESH_MAX_MESSAGE_LEN
+    /// \param[in] flags Delivered end to end with the message
+    /// \return Task giving RH_ROUTER_ERROR_NONE when the next hop acknowledged the message,
+    /// RH_ROUTER_ERROR_INVALID_LENGTH, RH_ROUTER_ERROR_NO_ROUTE or RH_ROUTER_ERROR_UNABLE_TO_DELIVER
+    /// (the route is then deleted).
+    RHTask<uint8_t> send(uint8_t dest, const uint8_t* buf, uint8_t len, uint8_t flags = 0);
+
+protected:
+    virtual bool receive(RHAsyncMessage& message);
+    virtual uint8_t startSend(const uint8_t* buf, uint8_t len, uint8_t address, uint8_t flags, void* arg);
+
+    /// Completes the route discoveries that found their route
+    virtual void received();
+
+private:
+    /// \return true if a coroutine is already waiting for a route to address
+    bool discovering(uint8_t address);
+
+    RHMesh&                     _mesh;
+    std::list<RouteAwaiter*>    _discoveries;
+};
+
+#endif
+
+#endif
@@ -36,6 +36,12 @@ bool RHDatagram::sendto(uint8_t* buf, uint8_t len, uint8_t address)
     return _driver.send(buf, len);
 }
 
+bool RHDatagram::sendtov(const RHSegment* segments, uint8_t count, uint8_t address)
+{
+    setHeaderTo(address);
+    return _driver.sendv(segments, count);
+}
+
 bool RHDatagram::recvfrom(uint8_t* buf, uint8_t* len, uint8_t* from, uint8_t* to, uint8_t* id, uint8_t* flags)
 {
     if (_driver.recv(buf, len))
@@ -49,6 +55,13 @@ bool RHDatagram::recvfrom(uint8_t* buf, uint8_t* len, uint8_t* from, uint8_t* to
     return false;
 }
 
+#ifdef RH_HAVE_PACKET
+RHPacket* RHDatagram::recvfromPacket()
+{
+    return _driver.recvPacket();
+}
+#endif
+
 bool RHDatagram::available()
 {
     return _driver.available();
@@ -74,6 +87,11 @@ bool RHDatagram::waitAvailableTimeout(uint16_t timeout)
     return _driver.waitAvailableTimeout(timeout);
 }
 
+bool RHDatagram::waitForEvent(int timeout)
+{
+    return _driver.waitForEvent(timeout);
+}
+
 uint8_t RHDatagram::thisAddress()
 {
     return _thisAddress;
@@ -70,6 +70,13 @@ public:
     /// \return true if the message not too loing fot eh driver, and the message was transmitted.
     bool sendto(uint8_t* buf, uint8_t len, uint8_t address);
 
+    /// Like sendto(), for a message in segments, see RHGenericDriver::sendv()
+    /// \param[in] segments The pieces of the message, in order
+    /// \param[in] count Number of segments
+    /// \param[in] address The address to send the message to.
+    /// \return true if the message not too long for the driver, and the message was transmitted.
+    bool sendtov(const RHSegment* segments, uint8_t count, uint8_t address);
+
     /// Turns the receiver on if it not already on.
     /// If there is a valid message available for this node, copy it to buf and return true
     /// The SRC address is placed in *from if present and not NULL.
@@ -87,6 +94,13 @@ public:
     /// \return true if a valid message was copied to buf
     bool recvfrom(uint8_t* buf, uint8_t* len, uint8_t* from = NULL, uint8_t* to = NULL, uint8_t* id = NULL, uint8_t* flags = NULL);
 
+#ifdef RH_HAVE_PACKET
+    /// Like recvfrom(), but hands over the message as an RHPacket of the Driver instead of
+    /// copying it. The headers are in RHPacket::headerFrom() etc, the message in RHPacket::payload().
+    /// \return The packet, the caller must release() it, or NULL if no message is available
+    RHPacket* recvfromPacket();
+#endif
+
     /// Tests whether a new message is available
     /// from the Driver.
     /// On most drivers, this will also put the Driver into RHModeRx mode until
@@ -114,6 +128,13 @@ public:
     /// \return true if a message is available
     bool            waitAvailableTimeout(uint16_t timeout);
 
+    /// Blocks until the Driver has something new to report or the timeout expires,
+    /// see RHGenericDriver::waitForEvent(). With a timeout of 0 it only consumes pending events,
+    /// eg after an event loop reported the interrupt file descriptor of the driver readable.
+    /// \param[in] timeout Maximum time to wait in milliseconds. Negative waits until an event.
+    /// \return true if an event was seen or the Driver cannot tell, false on timeout
+    bool            waitForEvent(int timeout);
+
     /// Sets the TO header to be sent in all subsequent messages
     /// \param[in] to The new TO header value
     void           setHeaderTo(uint8_t to);
@@ -0,0 +1,509 @@
+// RHDutyCycle.cpp
+//
+// Keeps the transmissions of a driver within the duty cycle limits of the sub-band
+// it transmits in, with a token bucket of airtime per sub-band.
+
+#include <RHDutyCycle.h>
+
+// EU 863-870MHz sub-bands, ETSI EN 300 220 as in the LoRaWAN regional parameters
+static const RHDutyCycleBand EU868_BANDS[] =
+{
+    { 863000, 865000,   10 },
+    { 865000, 868000,  100 },
+    { 868000, 868600,  100 },
+    { 868700, 869200,   10 },
+    { 869400, 869650, 1000 },
+    { 869700, 870000,  100 },
+};
+
+RHDutyCycle::RHDutyCycle(RHGenericDriver& driver)
+    :
+    RHGenericDriver(),
+    _driver(driver),
+    _bandCount(0),
+    _band(RH_DUTY_CYCLE_NO_BAND),
+    _frequency(0),
+    _window(RH_DUTY_CYCLE_DEFAULT_WINDOW),
+    _maxDeferral(0),
+    _lastRefill(0),
+    _deferred(0),
+    _rejected(0),
+    _deferredSent(0),
+    _totalDeferral(0),
+    _maxDeferralSeen(0)
+#if RH_DUTY_CYCLE_QUEUE_LEN > 0
+    ,
+    _queueHead(0),
+    _queueCount(0),
+    _queueBytes(0)
+#endif
+{
+    setBands(EU868_BANDS, sizeof(EU868_BANDS) / sizeof(EU868_BANDS[0]));
+}
+
+bool RHDutyCycle::init()
+{
+    bool ret = _driver.init();
+    _lastRefill = millis();
+    copyState();
+    return ret;
+}
+
+bool RHDutyCycle::available()
+{
+    bool ret = _driver.available();
+    copyState();
+    return ret;
+}
+
+bool RHDutyCycle::recv(uint8_t* buf, uint8_t* len)
+{
+    bool ret = _driver.recv(buf, len);
+    copyState();
+    return ret;
+}
+
+#ifdef RH_HAVE_PACKET
+RHPacket* RHDutyCycle::recvPacket()
+{
+    RHPacket* packet = _driver.recvPacket();
+    copyState();
+    return packet;
+}
+#endif
+
+bool RHDutyCycle::send(const uint8_t* data, uint8_t len)
+{
+    RHSegment segment = { data, len };
+    return sendv(&segment, 1);
+}
+
+bool RHDutyCycle::sendv(const RHSegment* segments, uint8_t count)
+{
+    uint16_t total = segmentsLen(segments, count);
+    if (total > _driver.maxMessageLength())
+	return false;
+    uint8_t len = total;
+    uint32_t airtime = _driver.timeOnAir(len);
+    if (_band == RH_DUTY_CYCLE_NO_BAND)
+	return transmit(segments, count, _txHeaderTo, _txHeaderFrom, _txHeaderId, _txHeaderFlags, airtime, _band);
+
+    refill();
+    Bucket& b = _buckets[_band];
+#if RH_DUTY_CYCLE_QUEUE_LEN > 0
+    // Deferred messages go first
+    if (!_queueCount && b.tokens >= airtime)
+	return transmit(segments, count, _txHeaderTo, _txHeaderFrom, _txHeaderId, _txHeaderFlags, airtime, _band);
+
+    // Will the budget suffice within the maximum deferral, after everything
+    // already waiting in the same sub-band?
+    uint64_t needed = airtime;
+    for (uint8_t i = 0; i < _queueCount; i++)
+    {
+	Deferred& d = _queue[(_queueHead + i) % RH_DUTY_CYCLE_QUEUE_LEN];
+	if (d.band == _band)
+	    needed += d.airtime;
+    }
+    if (   airtime <= b.capacity
+	&& _queueCount < RH_DUTY_CYCLE_QUEUE_LEN
+	&& len <= RH_DUTY_CYCLE_MAX_MESSAGE_LEN
+	&& b.band.dutyCycle
+	&& (needed <= b.tokens || (needed - b.tokens) * 10 / b.band.dutyCycle <= _maxDeferral))
+    {
+	Deferred& d = _queue[(_queueHead + _queueCount) % RH_DUTY_CYCLE_QUEUE_LEN];
+	d.time = millis();
+	d.airtime = airtime;
+	d.band = _band;
+	d.to = _txHeaderTo;
+	d.from = _txHeaderFrom;
+	d.id = _txHeaderId;
+	d.flags = _txHeaderFlags;
+	d.len = len;
+	uint8_t* p = d.buf;
+	for (uint8_t i = 0; i < count; i++)
+	{
+	    memcpy(p, segments[i].data, segments[i].len);
+	    p += segments[i].len;
+	}
+	_queueCount++;
+	_queueBytes += len;
+	_deferred++;
+	service();
+	return true;
+    }
+#else
+    if (b.tokens >= airtime)
+	return transmit(segments, count, _txHeaderTo, _txHeaderFrom, _txHeaderId, _txHeaderFlags, airtime, _band);
+#endif
+    _rejected++;
+    return false;
+}
+
+bool RHDutyCycle::service()
+{
+#if RH_DUTY_CYCLE_QUEUE_LEN > 0
+    refill();
+    unsigned long now = millis();
+    while (_queueCount)
+    {
+	Deferred& d = _queue[_queueHead];
+	unsigned long waited = now - d.time;
+	bool due = d.band >= _bandCount || _buckets[d.band].tokens >= d.airtime;
+	if (!due && waited <= _maxDeferral)
+	    return false; // Keep waiting, and everything behind it too
+
+	_queueHead = (_queueHead + 1) % RH_DUTY_CYCLE_QUEUE_LEN;
+	_queueCount--;
+	_queueBytes -= d.len;
+	if (!due)
+	{
+	    // Waited too long
+	    _rejected++;
+	    continue;
+	}
+	_deferredSent++;
+	_totalDeferral += waited;
+	if (waited > _maxDeferralSeen)
+	    _maxDeferralSeen = waited;
+	RHSegment segment = { d.buf, d.len };
+	transmit(&segment, 1, d.to, d.from, d.id, d.flags, d.airtime, d.band);
+	return true;
+    }
+#endif
+    return false;
+}
+
+int32_t RHDutyCycle::serviceTimeout()
+{
+#if RH_DUTY_CYCLE_QUEUE_LEN > 0
+    if (!_queueCount)
+	return -1;
+    refill();
+    Deferred& d = _queue[_queueHead];
+    if (d.band >= _bandCount)
+	return 0;
+    Bucket& b = _buckets[d.band];
+    unsigned long waited = millis() - d.time;
+    if (b.tokens >= d.airtime || waited >= _maxDeferral)
+	return 0;
+    uint32_t fits = b.band.dutyCycle ? (d.airtime - b.tokens) * 10 / b.band.dutyCycle + 1 : 0xffffffff;
+    uint32_t expires = _maxDeferral - waited;
+    return (int32_t)(fits < expires ? fits : expires);
+#else
+    return -1;
+#endif
+}
+
+uint32_t RHDutyCycle::txDelay(uint8_t len)
+{
+    if (_band == RH_DUTY_CYCLE_NO_BAND)
+	return 0;
+    refill();
+    Bucket& b = _buckets[_band];
+    uint32_t airtime = _driver.timeOnAir(len);
+    if (airtime <= b.tokens)
+	return 0;
+    if (airtime > b.capacity || !b.band.dutyCycle)
+	return 0xffffffff;
+    // Rounded up, the refill is done in 10ms steps
+    return ((airtime - b.tokens) * 10 / b.band.dutyCycle + 19) / 10 * 10;
+}
+
+bool RHDutyCycle::transmit(const RHSegment* segments, uint8_t count, uint8_t to, uint8_t from, uint8_t id, uint8_t flags,
+			   uint32_t airtime, uint8_t band)
+{
+    _driver.setHeaderTo(to);
+    _driver.setHeaderFrom(from);
+    _driver.setHeaderId(id);
+    _driver.setHeaderFlags(flags, 0xff);
+    bool ret = _driver.sendv(segments, count);
+    if (ret && band < _bandCount)
+    {
+	Bucket& b = _buckets[band];
+	b.tokens = b.tokens > airtime ? b.tokens - airtime : 0;
+	b.used += airtime;
+    }
+    // Back to the headers of the next message
+    _driver.setHeaderTo(_txHeaderTo);
+    _driver.setHeaderFrom(_txHeaderFrom);
+    _driver.setHeaderId(_txHeaderId);
+    _driver.setHeaderFlags(_txHeaderFlags, 0xff);
+    copyState();
+    return ret;
+}
+
+void RHDutyCycle::refill()
+{
+    // In whole 10ms steps, so even a 0.01% duty cycle earns whole microseconds
+    unsigned long steps = (millis() - _lastRefill) / 10;
+    if (!steps)
+	return;
+    _lastRefill += steps * 10;
+    for (uint8_t i = 0; i < _bandCount; i++)
+    {
+	Bucket& b = _buckets[i];
+	uint64_t tokens = b.tokens + (uint64_t)steps * b.band.dutyCycle;
+	b.tokens = tokens > b.capacity ? b.capacity : (uint32_t)tokens;
+    }
+}
+
+void RHDutyCycle::copyState()
+{
+    _mode = _driver.mode();
+    _lastRssi = _driver.lastRssi();
+    _rxBad = _driver.rxBad();
+    _rxGood = _driver.rxGood();
+    _txGood = _driver.txGood();
+}
+
+uint8_t RHDutyCycle::maxMessageLength()
+{
+    return _driver.maxMessageLength();
+}
+
+uint32_t RHDutyCycle::timeOnAir(uint8_t len)
+{
+    return _driver.timeOnAir(len);
+}
+
+void RHDutyCycle::waitAvailable()
+{
+    _driver.waitAvailable();
+    copyState();
+}
+
+bool RHDutyCycle::waitAvailableTimeout(uint16_t timeout)
+{
+    bool ret = _driver.waitAvailableTimeout(timeout);
+    copyState();
+    return ret;
+}
+
+bool RHDutyCycle::waitPacketSent()
+{
+#if RH_DUTY_CYCLE_QUEUE_LEN > 0
+    while (_queueCount)
+    {
+	if (!service())
+	    delay(serviceTimeout() > 10 ? 10 : 1);
+	YIELD;
+    }
+#endif
+    bool ret = _driver.waitPacketSent();
+    copyState();
+    return ret;
+}
+
+bool RHDutyCycle::waitPacketSent(uint16_t timeout)
+{
+    unsigned long starttime = millis();
+#if RH_DUTY_CYCLE_QUEUE_LEN > 0
+    while (_queueCount)
+    {
+	if (millis() - starttime >= timeout)
+	    return false;
+	if (!service())
+	    delay(serviceTimeout() > 10 ? 10 : 1);
+	YIELD;
+    }
+#endif
+    unsigned long elapsed = millis() - starttime;
+    bool ret = _driver.waitPacketSent(elapsed < timeout ? timeout - elapsed : 0);
+    copyState();
+    return ret;
+}
+
+bool RHDutyCycle::packetSent()
+{
+    bool ret = _driver.packetSent();
+#if RH_DUTY_CYCLE_QUEUE_LEN > 0
+    // The next deferred message only once the wrapped driver can take it without waiting
+    if (ret && _queueCount)
+    {
+	service();
+	ret = false;
+    }
+#endif
+    copyState();
+    return ret;
+}
+
+bool RHDutyCycle::waitForEvent(int timeout)
+{
+    return _driver.waitForEvent(timeout);
+}
+
+bool RHDutyCycle::isChannelActive()
+{
+    return _driver.isChannelActive();
+}
+
+void RHDutyCycle::setThisAddress(uint8_t thisAddress)
+{
+    RHGenericDriver::setThisAddress(thisAddress);
+    _driver.setThisAddress(thisAddress);
+}
+
+void RHDutyCycle::setHeaderTo(uint8_t to)
+{
+    RHGenericDriver::setHeaderTo(to);
+    _driver.setHeaderTo(to);
+}
+
+void RHDutyCycle::setHeaderFrom(uint8_t from)
+{
+    RHGenericDriver::setHeaderFrom(from);
+    _driver.setHeaderFrom(from);
+}
+
+void RHDutyCycle::setHeaderId(uint8_t id)
+{
+    RHGenericDriver::setHeaderId(id);
+    _driver.setHeaderId(id);
+}
+
+void RHDutyCycle::setHeaderFlags(uint8_t set, uint8_t clear)
+{
+    RHGenericDriver::setHeaderFlags(set, clear);
+    _driver.setHeaderFlags(set, clear);
+}
+
+void RHDutyCycle::setPromiscuous(bool promiscuous)
+{
+    RHGenericDriver::setPromiscuous(promiscuous);
+    _driver.setPromiscuous(promiscuous);
+}
+
+uint8_t RHDutyCycle::headerTo()
+{
+    return _driver.headerTo();
+}
+
+uint8_t RHDutyCycle::headerFrom()
+{
+    return _driver.headerFrom();
+}
+
+uint8_t RHDutyCycle::headerId()
+{
+    return _driver.headerId();
+}
+
+uint8_t RHDutyCycle::headerFlags()
+{
+    return _driver.headerFlags();
+}
+
+bool RHDutyCycle::sleep()
+{
+    bool ret = _driver.sleep();
+    copyState();
+    return ret;
+}
+
+void RHDutyCycle::stats(RHDriverStats& stats)
+{
+    _driver.stats(stats);
+}
+
+bool RHDutyCycle::setBands(const RHDutyCycleBand* bands, uint8_t count)
+{
+    if (count > RH_DUTY_CYCLE_MAX_BANDS)
+	return false;
+    for (uint8_t i = 0; i < count; i++)
+    {
+	_buckets[i].band = bands[i];
+	_buckets[i].used = 0;
+    }
+    _bandCount = count;
+    setWindow(_window);
+    setFrequency(_frequency / 1000.0);
+    return true;
+}
+
+void RHDutyCycle::setFrequency(float centre)
+{
+    _frequency = centre * 1000 + 0.5;
+    _band = RH_DUTY_CYCLE_NO_BAND;
+    for (uint8_t i = 0; i < _bandCount; i++)
+	if (_frequency >= _buckets[i].band.low && _frequency <= _buckets[i].band.high)
+	    _band = i;
+}
+
+void RHDutyCycle::setWindow(uint16_t seconds)
+{
+    _window = seconds;
+    for (uint8_t i = 0; i < _bandCount; i++)
+    {
+	// dutyCycle is in 0.01%, so a second earns 100 * dutyCycle microseconds
+	uint64_t capacity = (uint64_t)seconds * 100 * _buckets[i].band.dutyCycle;
+	_buckets[i].capacity = capacity > 0xffffffff ? 0xffffffff : (uint32_t)capacity;
+	_buckets[i].tokens = _buckets[i].capacity;
+    }
+    _lastRefill = millis();
+}
+
+void RHDutyCycle::setMaxDeferral(unsigned long ms)
+{
+    _maxDeferral = ms;
+}
+
+uint8_t RHDutyCycle::band()
+{
+    return _band;
+}
+
+uint32_t RHDutyCycle::remaining(uint8_t band)
+{
+    if (band == RH_DUTY_CYCLE_NO_BAND)
+	band = _band;
+    if (band >= _bandCount)
+	return 0xffffffff;
+    refill();
+    return _buckets[band].tokens;
+}
+
+uint64_t RHDutyCycle::used(uint8_t band)
+{
+    if (band == RH_DUTY_CYCLE_NO_BAND)
+	band = _band;
+    return band < _bandCount ? _buckets[band].used : 0;
+}
+
+uint8_t RHDutyCycle::queued()
+{
+#if RH_DUTY_CYCLE_QUEUE_LEN > 0
+    return _queueCount;
+#else
+    return 0;
+#endif
+}
+
+uint16_t RHDutyCycle::queuedBytes()
+{
+#if RH_DUTY_CYCLE_QUEUE_LEN > 0
+    return _queueBytes;
+#else
+    return 0;
+#endif
+}
+
+uint32_t RHDutyCycle::deferred()
+{
+    return _deferred;
+}
+
+uint32_t RHDutyCycle::rejected()
+{
+    return _rejected;
+}
+
+unsigned long RHDutyCycle::avgDeferral()
+{
+    return _deferredSent ? _totalDeferral / _deferredSent : 0;
+}
+
+unsigned long RHDutyCycle::maxDeferral()
+{
+    return _maxDeferralSeen;
+}
@@ -0,0 +1,347 @@
+// RHDutyCycle.h
+//
+// Keeps the transmissions of a driver within the duty cycle limits of the sub-band
+// it transmits in, with a token bucket of airtime per sub-band.
+
+#ifndef RHDutyCycle_h
+#define RHDutyCycle_h
+
+#include <RHGenericDriver.h>
+
+// Number of sub-bands a RHDutyCycle keeps budgets for
+#define RH_DUTY_CYCLE_MAX_BANDS 8
+
+// Returned by band() when the frequency is in none of the sub-bands
+#define RH_DUTY_CYCLE_NO_BAND 0xff
+
+// Default time in seconds over which the duty cycle is measured: one hour, as in ETSI EN 300 220
+#define RH_DUTY_CYCLE_DEFAULT_WINDOW 3600
+
+// Number of messages send() can hold while they wait for their sub-band to have budget again.
+// Each entry keeps a copy of the message, so deferral is only enabled by default where memory
+// is plentiful. Can be pre-defined prior to including this header, 0 disables deferral.
+#ifndef RH_DUTY_CYCLE_QUEUE_LEN
+ #if (RH_PLATFORM == RH_PLATFORM_RASPI) || (RH_PLATFORM == RH_PLATFORM_UNIX)
+  #define RH_DUTY_CYCLE_QUEUE_LEN 8
+ #else
+  #define RH_DUTY_CYCLE_QUEUE_LEN 0
+ #endif
+#endif
+
+// Largest message that can be deferred, the largest payload of any RadioHead driver
+#define RH_DUTY_CYCLE_MAX_MESSAGE_LEN 251
+
+/// A sub-band with its duty cycle limit, for RHDutyCycle::setBands()
+typedef struct
+{
+    uint32_t    low;        ///< Lowest frequency in kHz
+    uint32_t    high;       ///< Highest frequency in kHz
+    uint16_t    dutyCycle;  ///< Share of the time the transmitter may be on, in units of 0.01%
+} RHDutyCycleBand;
+
+/////////////////////////////////////////////////////////////////////
+/// \class RHDutyCycle RHDutyCycle.h <RHDutyCycle.h>
+/// \brief Driver wrapper that enforces a transmit duty cycle per sub-band
+///
+/// RHDutyCycle is itself a RHGenericDriver and is passed to a manager (RHDatagram,
+/// RHReliableDatagram etc) in place of the driver it wraps. Reception and all header
+/// settings go straight through. Every message given to send() is charged with its time
+/// on air, as reported by RHGenericDriver::timeOnAir() of the wrapped driver, to the
+/// sub-band containing the frequency set with setFrequency().
+///
+/// The budget of each sub-band is a token bucket: it fills at the duty cycle rate, one
+/// microsecond of airtime per 100 microseconds at 1%, up to what the duty cycle allows over
+/// the measurement window (36s at 1% over the default hour). A message is sent when the bucket
+/// holds its airtime. Otherwise it is deferred if the bucket will have refilled within the maximum
+/// deferral set with setMaxDeferral() and there is room in the queue of RH_DUTY_CYCLE_QUEUE_LEN
+/// messages: send() returns true, and service() or waitPacketSent() send it once there is budget.
+/// Messages that can not wait that long are rejected, send() returns false.
+///
+/// The default sub-bands are those of the EU 863-870MHz band (ETSI EN 300 220, as in the LoRaWAN
+/// regional parameters):
+/// \code
+/// 863.0 - 865.0MHz    0.1%
+/// 865.0 - 868.0MHz    1%
+/// 868.0 - 868.6MHz    1%
+/// 868.7 - 869.2MHz    0.1%
+/// 869.4 - 869.65MHz   10%
+/// 869.7 - 870.0MHz    1%
+/// \endcode
+/// Frequencies outside all sub-bands are not limited. setBands() installs another plan.
+///
+/// \code
+/// RH_RF95 rf95;
+/// RHDutyCycle duty(rf95);
+/// RHReliableDatagram manager(duty, 1);
+/// manager.init();
+/// rf95.setFrequency(868.1);
+/// duty.setFrequency(868.1);
+/// duty.setMaxDeferral(30000);
+/// \endcode
+///
+/// Only the wrapped driver talks to the radio. lastRssi(), mode() and the packet counters, which are not
+/// virtual, are copied from it after each call, but driver specific functions (setFrequency(), lastSNR()
+/// etc) must still be called on the wrapped driver.
+class RHDutyCycle : public RHGenericDriver
+{
+public:
+    /// Constructor
+    /// \param[in] driver The driver whose transmissions are limited
+    RHDutyCycle(RHGenericDriver& driver);
+
+    /// Initialises the wrapped driver
+    /// \return true if initialisation succeeded.
+    virtual bool init();
+
+    /// \return true if the wrapped driver has a message available
+    virtual bool available();
+
+    /// Receives a message from the wrapped driver
+    /// \param[in] buf Location to copy the received message
+    /// \param[in,out] len Pointer to available space in buf. Set to the actual number of octets copied.
+    /// \return true if a valid message was copied to buf
+    virtual bool recv(uint8_t* buf, uint8_t* len);
+
+#ifdef RH_HAVE_PACKET
+    /// Receives a message from the wrapped driver as an RHPacket, without copying it
+    /// \return The packet of the wrapped driver, or NULL if no message is available
+    virtual RHPacket* recvPacket();
+#endif
+
+    /// Sends the message if the budget of the current sub-band allows it, else defers or rejects it.
+    /// Deferred messages keep the headers set when send() was called.
+    /// \param[in] data Array of data to be sent
+    /// \param[in] len Number of bytes of data to send (> 0)
+    /// \return true if the message was sent or deferred, false if it was rejected
+    virtual bool send(const uint8_t* data, uint8_t len);
+
+    /// Like send(), for a message in segments, see RHGenericDriver::sendv(). Messages sent at once
+    /// go to the wrapped driver in their segments, deferred ones are gathered into the queue.
+    /// \param[in] segments The pieces of the message, in order
+    /// \param[in] count Number of segments
+    /// \return true if the message was sent or deferred, false if it was rejected
+    virtual bool sendv(const RHSegment* segments, uint8_t count);
+
+    /// \return The maximum message length of the wrapped driver
+    virtual uint8_t maxMessageLength();
+
+    /// \param[in] len Number of octets of message data
+    /// \return Time on air as reported by the wrapped driver, in microseconds
+    virtual uint32_t timeOnAir(uint8_t len);
+
+    /// Starts the receiver of the wrapped driver and blocks until a message is available
+    virtual void waitAvailable();
+
+    /// Starts the receiver of the wrapped driver and blocks until a message is available or a timeout
+    /// \param[in] timeout Maximum time to wait in milliseconds.
+    /// \return true if a message is available
+    virtual bool waitAvailableTimeout(uint16_t timeout);
+
+    /// Blocks until all deferred messages are sent (or rejected after waiting the maximum deferral)
+    /// and the wrapped driver is no longer transmitting.
+    /// \return The result of waitPacketSent() of the wrapped driver
+    virtual bool waitPacketSent();
+
+    /// Blocks until all deferred messages are sent and the wrapped driver is no longer transmitting,
+    /// or until the timeout occurs
+    /// \param[in] timeout Maximum time to wait in milliseconds.
+    /// \return true if everything was sent within the timeout
+    virtual bool waitPacketSent(uint16_t timeout);
+
+    /// Sends deferred messages that are due, without waiting for the others
+    /// \return true if no message is deferred and the wrapped driver is no longer transmitting
+    virtual bool packetSent();
+
+    /// Waits on the wrapped driver's events, see RHGenericDriver::waitForEvent()
+    /// \param[in] timeout Maximum time to wait in milliseconds. Negative waits until an event.
+    /// \return The result of waitForEvent() of the wrapped driver
+    virtual bool waitForEvent(int timeout);
+
+    /// \return The result of isChannelActive() of the wrapped driver
+    virtual bool isChannelActive();
+
+    /// Sets the address of this node on this and the wrapped driver
+    /// \param[in] thisAddress The address of this node.
+    virtual void setThisAddress(uint8_t thisAddress);
+
+    /// Sets the TO header on this and the wrapped driver
+    /// \param[in] to The new TO header value
+    virtual void setHeaderTo(uint8_t to);
+
+    /// Sets the FROM header on this and the wrapped driver
+    /// \param[in] from The new FROM header value
+    virtual void setHeaderFrom(uint8_t from);
+
+    /// Sets the ID header on this and the wrapped driver
+    /// \param[in] id The new ID header value
+    virtual void setHeaderId(uint8_t id);
+
+    /// Sets and clears bits in the FLAGS header on this and the wrapped driver
+    /// \param[in] set bitmask of bits to be set.
+    /// \param[in] clear bitmask of flags to clear.
+    virtual void setHeaderFlags(uint8_t set, uint8_t clear = RH_FLAGS_APPLICATION_SPECIFIC);
+
+    /// Sets promiscuous mode on the wrapped driver
+    /// \param[in] promiscuous true if you wish to receive messages with any TO address
+    virtual void setPromiscuous(bool promiscuous);
+
+    /// \return The TO header of the last message received by the wrapped driver
+    virtual uint8_t headerTo();
+
+    /// \return The FROM header of the last message received by the wrapped driver
+    virtual uint8_t headerFrom();
+
+    /// \return The ID header of the last message received by the wrapped driver
+    virtual uint8_t headerId();
+
+    /// \return The FLAGS header of the last message received by the wrapped driver
+    virtual uint8_t headerFlags();
+
+    /// Puts the wrapped driver to sleep
+    /// \return The result of sleep() of the wrapped driver
+    virtual bool sleep();
+
+    /// Copies the statistics of the wrapped driver
+    /// \param[out] stats Receives the statistics
+    virtual void stats(RHDriverStats& stats);
+
+    /// Installs a sub-band plan instead of the default EU 863-870MHz one. The budgets start full.
+    /// \param[in] bands The sub-bands, copied
+    /// \param[in] count Number of sub-bands, at most RH_DUTY_CYCLE_MAX_BANDS
+    /// \return false if count is too large
+    bool setBands(const RHDutyCycleBand* bands, uint8_t count);
+
+    /// Sets the frequency the wrapped driver transmits on, which selects the sub-band charged.
+    /// Does not change the frequency of the driver.
+    /// \param[in] centre Frequency in MHz
+    void setFrequency(float centre);
+
+    /// Sets the time over which the duty cycle is measured, which gives the most airtime a
+    /// sub-band can spend in one burst. Defaults to RH_DUTY_CYCLE_DEFAULT_WINDOW. The budgets start full.
+    /// \param[in] seconds The window in seconds
+    void setWindow(uint16_t seconds);
+
+    /// Sets how long a message that is over budget may wait to be sent. 0, the default, rejects
+    /// every message that does not fit the budget at once.
+    /// \param[in] ms Maximum deferral in milliseconds
+    void setMaxDeferral(unsigned long ms);
+
+    /// Sends the oldest deferred message if its sub-band has the budget now and drops deferred
+    /// messages that waited longer than the maximum deferral. Call it frequently when messages
+    /// can be deferred and waitPacketSent() is not called.
+    /// \return true if a message was sent
+    bool service();
+
+    /// \param[in] len Number of octets of message data
+    /// \return Milliseconds until a message of len octets fits the budget of the current sub-band,
+    /// not counting deferred messages. 0 if it does now, 0xffffffff if it never will
+    uint32_t txDelay(uint8_t len);
+
+    /// \return Milliseconds until service() has a deferred message to send or drop, -1 if there is none.
+    /// Suitable as poll() timeout.
+    int32_t serviceTimeout();
+
+    /// \return The sub-band index of the current frequency, or RH_DUTY_CYCLE_NO_BAND
+    uint8_t band();
+
+    /// \param[in] band A sub-band index, by default the one of the current frequency
+    /// \return Airtime the sub-band can spend now, in microseconds. 0xffffffff for RH_DUTY_CYCLE_NO_BAND
+    uint32_t remaining(uint8_t band = RH_DUTY_CYCLE_NO_BAND);
+
+    /// \param[in] band A sub-band index, by default the one of the current frequency
+    /// \return Total airtime charged to the sub-band, in microseconds
+    uint64_t used(uint8_t band = RH_DUTY_CYCLE_NO_BAND);
+
+    /// \return Number of messages waiting in the deferral queue
+    uint8_t queued();
+
+    /// \return Number of octets of message data waiting in the deferral queue
+    uint16_t queuedBytes();
+
+    /// \return Number of messages that had to wait for budget
+    uint32_t deferred();
+
+    /// \return Number of messages rejected for lack of budget, including deferred ones that timed out
+    uint32_t rejected();
+
+    /// \return Average time deferred messages waited for budget, in milliseconds
+    unsigned long avgDeferral();
+
+    /// \return Longest time a deferred message waited for budget, in milliseconds
+    unsigned long maxDeferral();
+
+protected:
+    /// Adds the airtime earned since the last refill to all budgets
+    void refill();
+
+    /// Sends a message through the wrapped driver with the given headers and charges its airtime
+    /// to a sub-band. The current headers of the wrapped driver are restored afterwards.
+    bool transmit(const RHSegment* segments, uint8_t count, uint8_t to, uint8_t from, uint8_t id, uint8_t flags,
+		  uint32_t airtime, uint8_t band);
+
+    /// Copies the state of the wrapped driver read by non virtual functions
+    void copyState();
+
+private:
+    /// A sub-band and its budget
+    typedef struct
+    {
+	RHDutyCycleBand band;
+	uint32_t        tokens;     ///< Airtime available, in microseconds
+	uint32_t        capacity;   ///< Size of the bucket, in microseconds
+	uint64_t        used;       ///< Airtime charged, in microseconds
+    } Bucket;
+
+    /// The wrapped driver
+    RHGenericDriver&    _driver;
+
+    /// The sub-band plan and budgets
+    Bucket              _buckets[RH_DUTY_CYCLE_MAX_BANDS];
+    uint8_t             _bandCount;
+
+    /// Index of the sub-band of the current frequency
+    uint8_t             _band;
+
+    /// Frequency set with setFrequency(), in kHz
+    uint32_t            _frequency;
+
+    /// Window in seconds
+    uint16_t            _window;
+
+    /// Maximum deferral in ms
+    unsigned long       _maxDeferral;
+
+    /// millis() of the last refill
+    unsigned long       _lastRefill;
+
+    /// Statistics
+    uint32_t            _deferred;
+    uint32_t            _rejected;
+    uint32_t            _deferredSent;
+    uint64_t            _totalDeferral;
+    unsigned long       _maxDeferralSeen;
+
+#if RH_DUTY_CYCLE_QUEUE_LEN > 0
+    /// A deferred message
+    typedef struct
+    {
+	unsigned long   time;       ///< millis() when it was given to send()
+	uint32_t        airtime;    ///< Time on air in microseconds
+	uint8_t         band;       ///< Sub-band charged
+	uint8_t         to;
+	uint8_t         from;
+	uint8_t         id;
+	uint8_t         flags;
+	uint8_t         len;
+	uint8_t         buf[RH_DUTY_CYCLE_MAX_MESSAGE_LEN];
+    } Deferred;
+
+    /// The deferral queue
+    Deferred            _queue[RH_DUTY_CYCLE_QUEUE_LEN];
+    uint8_t             _queueHead;
+    uint8_t             _queueCount;
+    uint16_t            _queueBytes;
+#endif
+};
+
+#endif
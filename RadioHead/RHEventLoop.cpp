@@ -0,0 +1,171 @@
+// RHEventLoop.cpp
+//
+// Single threaded epoll loop of file descriptors, timers and deferred calls
+
+#include <RHEventLoop.h>
+
+#ifdef RH_HAVE_EPOLL
+
+#include <errno.h>
+#include <unistd.h>
+
+// Events fetched from epoll_wait() per turn, more are fetched on the next turn
+#define RH_EVENT_LOOP_MAX_EVENTS 16
+
+RHEventLoop::RHEventLoop()
+    :
+    _epfd(-1),
+    _stop(false)
+{
+}
+
+RHEventLoop::~RHEventLoop()
+{
+    end();
+}
+
+bool RHEventLoop::begin()
+{
+    end();
+    _epfd = epoll_create1(EPOLL_CLOEXEC);
+    if (_epfd < 0 || !_timers.begin())
+    {
+	end();
+	return false;
+    }
+
+    // The timerfd is told apart from the watches by its data.fd
+    struct epoll_event ev;
+    ev.events = EPOLLIN;
+    ev.data.fd = _timers.fd();
+    if (epoll_ctl(_epfd, EPOLL_CTL_ADD, _timers.fd(), &ev) < 0)
+    {
+	end();
+	return false;
+    }
+    return true;
+}
+
+void RHEventLoop::end()
+{
+    _timers.end();
+    if (_epfd >= 0)
+	close(_epfd);
+    _epfd = -1;
+    _watches.clear();
+    _posted.clear();
+}
+
+int RHEventLoop::fd()
+{
+    return _epfd;
+}
+
+bool RHEventLoop::watch(int fd, uint32_t events, RHEventCallback callback, void* arg)
+{
+    if (_epfd < 0 || fd < 0 || fd == _timers.fd())
+	return false;
+
+    struct epoll_event ev;
+    ev.events = events;
+    ev.data.fd = fd;
+    bool watched = _watches.find(fd) != _watches.end();
+    if (epoll_ctl(_epfd, watched ? EPOLL_CTL_MOD : EPOLL_CTL_ADD, fd, &ev) < 0)
+	return false;
+    Watch& w = _watches[fd];
+    w.callback = callback;
+    w.arg = arg;
+    return true;
+}
+
+void RHEventLoop::unwatch(int fd)
+{
+    std::map<int, Watch>::iterator it = _watches.find(fd);
+    if (it == _watches.end())
+	return;
+    // Fails harmlessly if fd was closed already, which removed it from the epoll set
+    epoll_ctl(_epfd, EPOLL_CTL_DEL, fd, NULL);
+    _watches.erase(it);
+}
+
+uint32_t RHEventLoop::schedule(unsigned long ms, RHTimerCallback callback, void* arg, unsigned long period)
+{
+    return _timers.schedule(ms, callback, arg, period);
+}
+
+void RHEventLoop::cancel(uint32_t id)
+{
+    _timers.cancel(id);
+}
+
+void RHEventLoop::post(RHTimerCallback callback, void* arg)
+{
+    Call call;
+    call.callback = callback;
+    call.arg = arg;
+    _posted.push_back(call);
+}
+
+int RHEventLoop::runOnce(int timeout)
+{
+    if (_epfd < 0)
+	return -1;
+
+    // Posted calls are due now, do not sleep
+    if (!_posted.empty())
+	timeout = 0;
+
+    struct epoll_event events[RH_EVENT_LOOP_MAX_EVENTS];
+    int n = epoll_wait(_epfd, events, RH_EVENT_LOOP_MAX_EVENTS, timeout);
+    if (n < 0)
+	return errno == EINTR ? 0 : -1;
+
+    int called = 0;
+    for (int i = 0; i < n; i++)
+    {
+	int fd = events[i].data.fd;
+	if (fd == _timers.fd())
+	    continue; // Expired timers run below, whether or not the timerfd fired in this turn
+	// Looked up again for each event: an earlier callback may have unwatched this fd
+	std::map<int, Watch>::iterator it = _watches.find(fd);
+	if (it == _watches.end())
+	    continue;
+	Watch w = it->second;
+	w.callback(events[i].events, w.arg);
+	called++;
+    }
+    called += _timers.run();
+    called += runPosted();
+    return called;
+}
+
+bool RHEventLoop::run()
+{
+    _stop = false;
+    while (!_stop)
+	if (runOnce(-1) < 0)
+	    return false;
+    return true;
+}
+
+void RHEventLoop::stop()
+{
+    _stop = true;
+}
+
+size_t RHEventLoop::pending()
+{
+    return _watches.size() + _timers.count() + _posted.size();
+}
+
+int RHEventLoop::runPosted()
+{
+    // Calls posted by these callbacks wait for the next turn
+    std::vector<Call> calls;
+    calls.swap(_posted);
+    for (size_t i = 0; i < calls.size(); i++)
+	calls[i].callback(calls[i].arg);
+    return calls.size();
+}
+
+#endif
@@ -0,0 +1,143 @@
+// RHEventLoop.h
+//
+// Single threaded epoll loop dispatching file descriptor events, timers and
+// deferred calls, the base of the RHAsync coroutine layer.
+
+#ifndef RHEventLoop_h
+#define RHEventLoop_h
+
+#include <RadioHead.h>
+
+#ifdef RH_HAVE_EPOLL
+
+#include <RHTimerService.h>
+#include <sys/epoll.h>
+#include <map>
+#include <vector>
+
+// Never returned by schedule(), for timer ids that hold no timer
+#define RH_EVENT_TIMER_NONE RH_TIMER_NONE
+
+/// Function called when a watched file descriptor is ready
+/// \param[in] events The epoll events that were reported (EPOLLIN, EPOLLOUT, EPOLLERR, EPOLLHUP...)
+/// \param[in] arg The arg passed to watch()
+typedef void (*RHEventCallback)(uint32_t events, void* arg);
+
+/////////////////////////////////////////////////////////////////////
+/// \class RHEventLoop RHEventLoop.h <RHEventLoop.h>
+/// \brief epoll based event loop for file descriptors, timers and deferred calls
+///
+/// One thread sleeps in epoll_wait() on everything it serves: interrupt file descriptors
+/// of radios (RH_RF95::interruptFd()), sockets, eventfds, signalfds. The timers are an
+/// RHTimerService whose timerfd is one of the watched file descriptors, so the thread sleeps
+/// in the kernel until something is due, and every session of a program can have its own timeouts.
+/// post() queues a call for the next turn of the loop, after the callbacks of the current one:
+/// the RHAsync coroutines are resumed that way, never from inside another callback.
+///
+/// \code
+/// RHEventLoop loop;
+/// loop.begin();
+/// loop.watch(rf95.interruptFd(), EPOLLIN, radioReady, &rf95);
+/// loop.schedule(1000, tick, NULL, 1000);
+/// loop.run();
+/// \endcode
+///
+/// A loop is not thread safe: all its functions must be called from the thread that runs it.
+/// Callbacks may watch, unwatch, schedule and cancel anything, including themselves.
+class RHEventLoop
+{
+public:
+    /// Constructor. Nothing is created until begin()
+    RHEventLoop();
+
+    /// Destructor, calls end()
+    ~RHEventLoop();
+
+    /// Creates the epoll instance and the timerfd
+    /// \return true if both could be created
+    bool begin();
+
+    /// Closes the epoll instance and the timerfd, forgets all watches, timers and posted calls.
+    /// The watched file descriptors are not closed.
+    void end();
+
+    /// \return The epoll file descriptor, readable while the loop has something to do, or -1
+    /// before begin(). Lets the loop itself be polled by an outer loop.
+    int fd();
+
+    /// Calls callback whenever fd is ready. The events are level triggered: the callback must read
+    /// or drain fd, or it is called again on the next turn.
+    /// \param[in] fd The file descriptor to watch
+    /// \param[in] events epoll events to wait for, usually EPOLLIN
+    /// \param[in] callback Function to call
+    /// \param[in] arg Passed to callback
+    /// \return true if fd is watched. Watching a file descriptor again replaces its events and callback.
+    bool watch(int fd, uint32_t events, RHEventCallback callback, void* arg);
+
+    /// Stops watching fd. Does nothing if it is not watched.
+    /// \param[in] fd The file descriptor passed to watch()
+    void unwatch(int fd);
+
+    /// Schedules a timer
+    /// \param[in] ms Milliseconds from now until the first expiry
+    /// \param[in] callback Function called on expiry
+    /// \param[in] arg Passed to callback
+    /// \param[in] period If not 0 the timer is repeated every period milliseconds until cancelled
+    /// \return Timer id for cancel(), never RH_EVENT_TIMER_NONE. Ids are not reused.
+    uint32_t schedule(unsigned long ms, RHTimerCallback callback, void* arg, unsigned long period = 0);
+
+    /// Cancels a timer. Cancelling an expired one shot timer or RH_EVENT_TIMER_NONE does nothing.
+    /// \param[in] id The id returned by schedule()
+    void cancel(uint32_t id);
+
+    /// Calls callback on the next turn of the loop, after everything that is due now
+    /// \param[in] callback Function to call
+    /// \param[in] arg Passed to callback
+    void post(RHTimerCallback callback, void* arg);
+
+    /// Waits for at most timeout milliseconds for events or timers, then calls the callbacks
+    /// of everything that is ready, the expired timers and the posted calls.
+    /// \param[in] timeout Maximum time to wait in milliseconds, negative waits until something happens
+    /// \return Number of callbacks called, -1 on error
+    int runOnce(int timeout = -1);
+
+    /// Calls runOnce() until stop() is called or it fails
+    /// \return true if stopped by stop(), false on error
+    bool run();
+
+    /// Makes run() return after the current turn. May be called from a callback.
+    void stop();
+
+    /// \return Number of watched file descriptors, scheduled timers and posted calls.
+    /// 0 means that run() would sleep forever.
+    size_t pending();
+
+private:
+    typedef struct
+    {
+	RHEventCallback callback;
+	void*           arg;
+    } Watch;
+
+    typedef struct
+    {
+	RHTimerCallback callback;
+	void*           arg;
+    } Call;
+
+    /// Calls the posted calls queued before this turn
+    int runPosted();
+
+    int                 _epfd;
+    bool                _stop;
+    /// The timers, their timerfd is watched like the other file descriptors
+    RHTimerService      _timers;
+
+    /// Watches by file descriptor, looked up for each event so a callback may unwatch others
+    std::map<int, Watch>                                _watches;
+    std::vector<Call>                                   _posted;
+};
+
+#endif
+
+#endif
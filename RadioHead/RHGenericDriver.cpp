@@ -16,8 +16,21 @@ RHGenericDriver::RHGenericDriver()
     _rxBad(0),
     _rxGood(0),
     _txGood(0),
+    _rxCrcError(0),
+    _rxTimeout(0),
+    _rxHeaderValid(0),
+    _rxOverrun(0),
+    _cadBusy(0),
     _cad_timeout(0)
 {
+#if RH_STATS_RSSI_BUCKETS > 0
+    for (uint8_t i = 0; i < RH_STATS_RSSI_BUCKETS; i++)
+	_rssiHistogram[i] = 0;
+#endif
+#if RH_STATS_SNR_BUCKETS > 0
+    for (uint8_t i = 0; i < RH_STATS_SNR_BUCKETS; i++)
+	_snrHistogram[i] = 0;
+#endif
 }
 
 bool RHGenericDriver::init()
@@ -29,7 +42,7 @@ bool RHGenericDriver::init()
 void RHGenericDriver::waitAvailable()
 {
     while (!available())
-	YIELD;
+	waitForEvent(-1);
 }
 
 // Blocks until a valid message is received or timeout expires
@@ -38,13 +51,14 @@ void RHGenericDriver::waitAvailable()
 bool RHGenericDriver::waitAvailableTimeout(uint16_t timeout)
 {
     unsigned long starttime = millis();
-    while ((millis() - starttime) < timeout)
+    unsigned long elapsed;
+    while ((elapsed = millis() - starttime) < timeout)
     {
         if (available())
 	{
            return true;
 	}
-	YIELD;
+	waitForEvent(timeout - elapsed);
     }
     return false;
 }
@@ -52,22 +66,42 @@ bool RHGenericDriver::waitAvailableTimeout(uint16_t timeout)
 bool RHGenericDriver::waitPacketSent()
 {
     while (_mode == RHModeTx)
-	YIELD; // Wait for any previous transmit to finish
+	waitForEvent(-1); // Wait for any previous transmit to finish
     return true;
 }
 
 bool RHGenericDriver::waitPacketSent(uint16_t timeout)
 {
     unsigned long starttime = millis();
-    while ((millis() - starttime) < timeout)
+    unsigned long elapsed;
+    while ((elapsed = millis() - starttime) < timeout)
     {
         if (_mode != RHModeTx) // Any previous transmit finished?
            return true;
-	YIELD;
+	waitForEvent(timeout - elapsed);
     }
     return false;
 }
 
+bool RHGenericDriver::packetSent()
+{
+    return _mode != RHModeTx;
+}
+
+bool RHGenericDriver::waitForEvent(int timeout)
+{
+#if RH_WAIT_POLL_INTERVAL > 0
+    // Nothing to block on, look again a little later
+    if (timeout < 0 || timeout > RH_WAIT_POLL_INTERVAL)
+	timeout = RH_WAIT_POLL_INTERVAL;
+    delay(timeout);
+#else
+    (void)timeout;
+    YIELD;
+#endif
+    return true;
+}
+
 // Wait until no channel activity detected or timeout
 bool RHGenericDriver::waitCAD()
 {
@@ -152,6 +186,54 @@ int8_t RHGenericDriver::lastRssi()
     return _lastRssi;
 }
 
+#ifdef RH_HAVE_PACKET
+RHPacket* RHGenericDriver::recvPacket()
+{
+    if (!available())
+	return NULL;
+    RHPacket* packet = _packetPool.alloc();
+    if (!packet)
+	return NULL;
+    uint8_t len = RH_PACKET_MAX_LEN - RH_PACKET_HEADER_LEN;
+    if (!recv(packet->data() + RH_PACKET_HEADER_LEN, &len))
+    {
+	packet->release();
+	return NULL;
+    }
+    packet->data()[0] = headerTo();
+    packet->data()[1] = headerFrom();
+    packet->data()[2] = headerId();
+    packet->data()[3] = headerFlags();
+    packet->setLen(len + RH_PACKET_HEADER_LEN);
+    packet->rssi = lastRssi();
+    packet->time = millis();
+    return packet;
+}
+#endif
+
+bool RHGenericDriver::sendv(const RHSegment* segments, uint8_t count)
+{
+    uint16_t len = segmentsLen(segments, count);
+    if (count > RH_MAX_SEGMENTS || len > maxMessageLength())
+	return false;
+    uint8_t buf[255]; // The most send() takes
+    uint8_t* p = buf;
+    for (uint8_t i = 0; i < count; i++)
+    {
+	memcpy(p, segments[i].data, segments[i].len);
+	p += segments[i].len;
+    }
+    return send(buf, len);
+}
+
+uint16_t RHGenericDriver::segmentsLen(const RHSegment* segments, uint8_t count)
+{
+    uint16_t len = 0;
+    for (uint8_t i = 0; i < count; i++)
+	len += segments[i].len;
+    return len;
+}
+
 RHGenericDriver::RHMode  RHGenericDriver::mode()
 {
     return _mode;
@@ -167,6 +249,12 @@ bool  RHGenericDriver::sleep()
     return false;
 }
 
+uint32_t RHGenericDriver::timeOnAir(uint8_t len)
+{
+    (void)len;
+    return 0;
+}
+
 // Diagnostic help
 void RHGenericDriver::printBuffer(const char* prompt, const uint8_t* buf, uint8_t len)
 {
@@ -188,21 +276,72 @@ void RHGenericDriver::printBuffer(const char* prompt, const uint8_t* buf, uint8_
 #endif
 }
 
-uint16_t RHGenericDriver::rxBad()
+uint64_t RHGenericDriver::rxBad()
 {
     return _rxBad;
 }
 
-uint16_t RHGenericDriver::rxGood()
+uint64_t RHGenericDriver::rxGood()
 {
     return _rxGood;
 }
 
-uint16_t RHGenericDriver::txGood()
+uint64_t RHGenericDriver::txGood()
 {
     return _txGood;
 }
 
+void RHGenericDriver::stats(RHDriverStats& stats)
+{
+    stats.rxGood = _rxGood;
+    stats.rxBad = _rxBad;
+    stats.rxCrcError = _rxCrcError;
+    stats.rxTimeout = _rxTimeout;
+    stats.rxHeaderValid = _rxHeaderValid;
+    stats.rxOverrun = _rxOverrun;
+    stats.txGood = _txGood;
+    stats.cadBusy = _cadBusy;
+#if RH_STATS_RSSI_BUCKETS > 0
+    for (uint8_t i = 0; i < RH_STATS_RSSI_BUCKETS; i++)
+	stats.rssi[i] = _rssiHistogram[i];
+#endif
+#if RH_STATS_SNR_BUCKETS > 0
+    for (uint8_t i = 0; i < RH_STATS_SNR_BUCKETS; i++)
+	stats.snr[i] = _snrHistogram[i];
+#endif
+}
+
+int16_t RHGenericDriver::rssiBucket(uint8_t bucket)
+{
+    return RH_STATS_RSSI_MIN + bucket * RH_STATS_RSSI_STEP;
+}
+
+int16_t RHGenericDriver::snrBucket(uint8_t bucket)
+{
+    return RH_STATS_SNR_MIN + bucket * RH_STATS_SNR_STEP;
+}
+
+#if (RH_STATS_RSSI_BUCKETS > 0) || (RH_STATS_SNR_BUCKETS > 0)
+// Index of the histogram bucket of value, the outer buckets take everything beyond them
+static uint8_t statsBucket(int16_t value, int16_t min, int16_t step, uint8_t buckets)
+{
+    if (value < min)
+	return 0;
+    int16_t bucket = (value - min) / step;
+    return bucket < buckets ? bucket : buckets - 1;
+}
+#endif
+
+void RHGenericDriver::countSignal(int16_t rssi, int16_t snr)
+{
+#if RH_STATS_RSSI_BUCKETS > 0
+    _rssiHistogram[statsBucket(rssi, RH_STATS_RSSI_MIN, RH_STATS_RSSI_STEP, RH_STATS_RSSI_BUCKETS)]++;
+#endif
+#if RH_STATS_SNR_BUCKETS > 0
+    _snrHistogram[statsBucket(snr, RH_STATS_SNR_MIN, RH_STATS_SNR_STEP, RH_STATS_SNR_BUCKETS)]++;
+#endif
+}
+
 void RHGenericDriver::setCADTimeout(unsigned long cad_timeout)
 {
     _cad_timeout = cad_timeout;
@@ -8,6 +8,66 @@
 
 #include <RadioHead.h>
 
+#ifdef RH_HAVE_ATOMIC
+#include <atomic>
+/// A driver statistics counter. 64 bit atomic where the platform has std::atomic, so other
+/// threads can read it while the driver counts, and it does not wrap in the life of the device
+typedef std::atomic<uint64_t> RHCounter;
+#else
+typedef volatile uint32_t RHCounter;
+#endif
+
+#ifdef RH_HAVE_PACKET
+#include <RHPacket.h>
+#endif
+
+// Number and range of the buckets of the RSSI and SNR histograms in RHDriverStats.
+// Bucket i counts values from MIN + i * STEP up to MIN + (i + 1) * STEP - 1, the first and
+// last buckets also count everything below and above. No histograms on small processors
+#if (RH_PLATFORM == RH_PLATFORM_RASPI) || (RH_PLATFORM == RH_PLATFORM_UNIX)
+ #define RH_STATS_RSSI_BUCKETS            16
+ #define RH_STATS_SNR_BUCKETS             16
+#else
+ #define RH_STATS_RSSI_BUCKETS            0
+ #define RH_STATS_SNR_BUCKETS             0
+#endif
+#define RH_STATS_RSSI_MIN                 -140
+#define RH_STATS_RSSI_STEP                8
+#define RH_STATS_SNR_MIN                  -20
+#define RH_STATS_SNR_STEP                 2
+
+/// Statistics of a driver, copied by RHGenericDriver::stats(). Counters a driver can not
+/// tell apart stay 0, eg only LoRa radios see valid headers.
+typedef struct
+{
+    uint64_t    rxGood;             ///< Packets received and accepted
+    uint64_t    rxBad;              ///< Packets received with errors, the rx error counters below and others
+    uint64_t    rxCrcError;         ///< Packets with a payload CRC error
+    uint64_t    rxTimeout;          ///< Receptions that timed out without a packet
+    uint64_t    rxHeaderValid;      ///< Valid packet headers detected, ie packets that started to arrive
+    uint64_t    rxOverrun;          ///< Packets lost because there was no room to keep them
+    uint64_t    txGood;             ///< Packets transmitted
+    uint64_t    cadBusy;            ///< Channel activity detections that found the channel in use
+#if RH_STATS_RSSI_BUCKETS > 0
+    uint64_t    rssi[RH_STATS_RSSI_BUCKETS]; ///< Accepted packets by RSSI, see RH_STATS_RSSI_MIN
+#endif
+#if RH_STATS_SNR_BUCKETS > 0
+    uint64_t    snr[RH_STATS_SNR_BUCKETS];   ///< Accepted packets by SNR, see RH_STATS_SNR_MIN
+#endif
+} RHDriverStats;
+
+// Maximum number of segments of a message sent with RHGenericDriver::sendv(): the application
+// data and a header for each manager layer, with room for the driver headers
+#define RH_MAX_SEGMENTS                   8
+
+/// One piece of a message passed to RHGenericDriver::sendv(). The managers put their header
+/// in front of the data of the layer above as another segment instead of copying the message
+typedef struct
+{
+    const uint8_t* data;            ///< The octets of the segment
+    uint8_t        len;             ///< Number of octets at data
+} RHSegment;
+
 // Defines bits of the FLAGS header reserved for use by the RadioHead library and 
 // the flags available for use by applications
 #define RH_FLAGS_RESERVED                 0xf0
@@ -17,6 +77,15 @@
 // Default timeout for waitCAD() in ms
 #define RH_CAD_DEFAULT_TIMEOUT            10000
 
+// How long the default waitForEvent() sleeps, in ms, before the wait functions look at the
+// radio again. 0 only YIELDs, which is right where interrupt handlers update the driver state.
+// On Linux a spin would keep a core and the SPI bus busy for the whole wait
+#if (RH_PLATFORM == RH_PLATFORM_RASPI) || (RH_PLATFORM == RH_PLATFORM_UNIX)
+ #define RH_WAIT_POLL_INTERVAL            1
+#else
+ #define RH_WAIT_POLL_INTERVAL            0
+#endif
+
 /////////////////////////////////////////////////////////////////////
 /// \class RHGenericDriver RHGenericDriver.h <RHGenericDriver.h>
 /// \brief Abstract base class for a RadioHead driver.
@@ -83,6 +152,17 @@ public:
     /// \return true if a valid message was copied to buf
     virtual bool recv(uint8_t* buf, uint8_t* len) = 0;
 
+#ifdef RH_HAVE_PACKET
+    /// Like recv(), but hands over the received message as an RHPacket from the pool of
+    /// this driver, with its headers and signal metadata, instead of copying it to a caller buffer.
+    /// The caller owns the packet and must release() it. This default copies the message
+    /// from recv() into a packet. Drivers that receive into packets (RH_RF95 with continuous
+    /// receive) override it and return the packet they read from the radio.
+    /// \return The packet, or NULL if no message is available or the pool is empty. In the latter
+    /// case the message stays available
+    virtual RHPacket* recvPacket();
+#endif
+
     /// Waits until any previous transmit packet is finished being transmitted with waitPacketSent().
     /// Then optionally waits for Channel Activity Detection (CAD) 
     /// to show the channnel is clear (if the radio supports CAD) by calling waitCAD().
@@ -96,11 +176,32 @@ public:
     /// if CAD was requested and the CAD timeout timed out before clear channel was detected.
     virtual bool send(const uint8_t* data, uint8_t len) = 0;
 
+    /// Like send(), but the message is the concatenation of count segments, so that each layer can
+    /// put its header in front of the message without copying it. Drivers that write the FIFO of the
+    /// radio (RH_RF95) stream the segments to it directly. This default gathers them into one
+    /// buffer for send().
+    /// \param[in] segments The pieces of the message, in order
+    /// \param[in] count Number of segments, at most RH_MAX_SEGMENTS
+    /// \return true if the message was valid and queued for transmit, as send()
+    virtual bool sendv(const RHSegment* segments, uint8_t count);
+
+    /// \param[in] segments The pieces of a message
+    /// \param[in] count Number of segments
+    /// \return Total number of octets in the segments
+    static uint16_t segmentsLen(const RHSegment* segments, uint8_t count);
+
     /// Returns the maximum message length 
     /// available in this Driver.
     /// \return The maximum legal message length
     virtual uint8_t maxMessageLength() = 0;
 
+    /// Returns how long the transmission of a message occupies the channel with the current
+    /// modem settings, including preamble and headers. Used by RHReliableDatagram as the lower
+    /// bound of its retransmit timeouts. Drivers that cannot tell return 0.
+    /// \param[in] len Number of octets of message data, as passed to send()
+    /// \return Time on air in microseconds, or 0 if not known
+    virtual uint32_t timeOnAir(uint8_t len);
+
     /// Starts the receiver and blocks until a valid received 
     /// message is available.
     virtual void            waitAvailable();
@@ -115,11 +216,28 @@ public:
     /// \return true if the radio completed transmission within the timeout period. False if it timed out.
     virtual bool            waitPacketSent(uint16_t timeout);
 
+    /// Tells without blocking whether the transmitter is done, for callers that start a
+    /// transmission and come back when the driver reports an event instead of waiting in
+    /// waitPacketSent(). Drivers that learn the end of a transmission only by asking the
+    /// radio override it.
+    /// \return true if the transmitter is no longer transmitting
+    virtual bool            packetSent();
+
     /// Starts the receiver and blocks until a received message is available or a timeout
     /// \param[in] timeout Maximum time to wait in milliseconds.
     /// \return true if a message is available
     virtual bool            waitAvailableTimeout(uint16_t timeout);
 
+    /// Blocks until the radio may have something new to report (a received packet, the end of a
+    /// transmission or of a CAD) or the timeout expires. waitAvailable(), waitAvailableTimeout() and
+    /// waitPacketSent() call it between their checks of the driver state, so that they sleep instead
+    /// of spinning. Drivers that can wait on their interrupt (eg a GPIO event file descriptor)
+    /// override it. This default YIELDs, or sleeps for RH_WAIT_POLL_INTERVAL ms where that is not 0.
+    /// An early return is harmless: callers check the state again and wait for the rest of their time.
+    /// \param[in] timeout Maximum time to wait in milliseconds. Negative waits until an event.
+    /// \return true if an event was seen or the driver cannot tell, false on timeout
+    virtual bool            waitForEvent(int timeout);
+
     // Bent G Christensen (bentor@gmail.com), 08/15/2016
     /// Channel Activity Detection (CAD).
     /// Blocks until channel activity is finished or CAD timeout occurs.
@@ -235,17 +353,32 @@ public:
     /// Caution: not all drivers can correctly report this count. Some underlying hardware only report
     /// good packets.
     /// \return The number of bad packets received.
-    uint16_t       rxBad();
+    uint64_t       rxBad();
 
     /// Returns the count of the number of 
     /// good received packets
     /// \return The number of good packets received.
-    uint16_t       rxGood();
+    uint64_t       rxGood();
 
     /// Returns the count of the number of 
     /// packets successfully transmitted (though not necessarily received by the destination)
     /// \return The number of packets successfully transmitted
-    uint16_t       txGood();
+    uint64_t       txGood();
+
+    /// Copies all statistics of the driver. With RH_HAVE_ATOMIC every counter is read atomically
+    /// and without a lock, so a metrics exporter on another thread can call this at any time
+    /// without holding up the thread driving the radio. The counters are read one after the
+    /// other: a packet counted during the copy may show in some of them and not yet in others.
+    /// \param[out] stats Receives the statistics
+    virtual void   stats(RHDriverStats& stats);
+
+    /// \param[in] bucket Index into RHDriverStats::rssi
+    /// \return The lowest RSSI counted in the bucket, in dBm
+    static int16_t rssiBucket(uint8_t bucket);
+
+    /// \param[in] bucket Index into RHDriverStats::snr
+    /// \return The lowest SNR counted in the bucket, in dB
+    static int16_t snrBucket(uint8_t bucket);
 
 protected:
 
@@ -285,18 +418,44 @@ protected:
     /// The value of the last received RSSI value, in some transport specific units
     volatile int8_t     _lastRssi;
 
+    /// Counts an accepted packet in the RSSI and SNR histograms
+    /// \param[in] rssi RSSI of the packet in dBm
+    /// \param[in] snr SNR of the packet in dB
+    void                countSignal(int16_t rssi, int16_t snr);
+
     /// Count of the number of bad messages (eg bad checksum etc) received
-    volatile uint16_t   _rxBad;
+    RHCounter           _rxBad;
 
     /// Count of the number of successfully transmitted messaged
-    volatile uint16_t   _rxGood;
+    RHCounter           _rxGood;
 
     /// Count of the number of bad messages (correct checksum etc) received
-    volatile uint16_t   _txGood;
+    RHCounter           _txGood;
+
+    /// Per cause counts of bad messages and other events, see RHDriverStats
+    RHCounter           _rxCrcError;
+    RHCounter           _rxTimeout;
+    RHCounter           _rxHeaderValid;
+    RHCounter           _rxOverrun;
+    RHCounter           _cadBusy;
+
+#if RH_STATS_RSSI_BUCKETS > 0
+    /// RSSI histogram of accepted packets
+    RHCounter           _rssiHistogram[RH_STATS_RSSI_BUCKETS];
+#endif
+#if RH_STATS_SNR_BUCKETS > 0
+    /// SNR histogram of accepted packets
+    RHCounter           _snrHistogram[RH_STATS_SNR_BUCKETS];
+#endif
 
     /// Channel activity detected
     volatile bool       _cad;
     unsigned int        _cad_timeout;
+
+#ifdef RH_HAVE_PACKET
+    /// Packets handed out by recvPacket()
+    RHPacketPool        _packetPool;
+#endif
     
 private:
 
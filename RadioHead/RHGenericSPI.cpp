@@ -14,6 +14,12 @@ RHGenericSPI::RHGenericSPI(Frequency frequency, BitOrder bitOrder, DataMode data
 {
 }
 
+void RHGenericSPI::transferBuffer(const uint8_t* src, uint8_t* dest, uint16_t len)
+{
+    while (len--)
+	*dest++ = transfer(*src++);
+}
+
 void RHGenericSPI::setBitOrder(BitOrder bitOrder)
 {
     _bitOrder = bitOrder;
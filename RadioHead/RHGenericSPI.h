@@ -89,6 +89,22 @@ public:
     /// \return The octet read from SPI while the data octet was sent
     virtual uint8_t transfer(uint8_t data) = 0;
 
+    /// Transfer a buffer of octets to and from the SPI interface in one full duplex transfer.
+    /// The default implementation calls transfer() for each octet. Subclasses that can
+    /// clock a whole buffer in one operation (a DMA or kernel transfer) should override this.
+    /// Slave select is not changed.
+    /// \param[in] src The octets to send, len octets
+    /// \param[out] dest The octets read while src was sent, len octets. May be the same buffer as src
+    /// \param[in] len Number of octets to transfer
+    virtual void transferBuffer(const uint8_t* src, uint8_t* dest, uint16_t len);
+
+    /// Called by RHSPIDriver before it selects its device for a transfer. Interfaces shared by
+    /// several drivers on different threads (RHSPIBus) take the bus here. The default does nothing.
+    virtual void beginTransaction() {};
+
+    /// Called by RHSPIDriver after it deselected its device. Releases what beginTransaction() took.
+    virtual void endTransaction() {};
+
     /// SPI Configuration methods
     /// Enable SPI interrupts (if supported)
     /// This can be used in an SPI slave to indicate when an SPI message has been received
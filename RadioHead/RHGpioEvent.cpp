@@ -0,0 +1,133 @@
+// RHGpioEvent.cpp
+//
+// Rising edge events from a GPIO line through the Linux GPIO character device
+
+#include <RHGpioEvent.h>
+
+#ifdef RH_HAVE_GPIO_EVENT
+
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <linux/gpio.h>
+
+RHGpioEvent::RHGpioEvent(uint8_t line, uint8_t chip)
+    :
+    _line(line),
+    _chip(chip),
+    _fd(-1),
+    _lastEventTime(0),
+    _events(0)
+{
+}
+
+RHGpioEvent::~RHGpioEvent()
+{
+    end();
+}
+
+void RHGpioEvent::setLine(uint8_t line, uint8_t chip)
+{
+    _line = line;
+    _chip = chip;
+}
+
+bool RHGpioEvent::begin()
+{
+    end();
+    if (_line == NOT_A_PIN)
+	return false;
+
+    char path[32];
+    snprintf(path, sizeof(path), "/dev/gpiochip%u", _chip);
+    int chipfd = open(path, O_RDONLY | O_CLOEXEC);
+    if (chipfd < 0)
+	return false;
+
+    // Uses the v1 line event ABI, available since Linux 4.8
+    struct gpioevent_request req;
+    memset(&req, 0, sizeof(req));
+    req.lineoffset = _line;
+    req.handleflags = GPIOHANDLE_REQUEST_INPUT;
+    req.eventflags = GPIOEVENT_REQUEST_RISING_EDGE;
+    strncpy(req.consumer_label, "RadioHead", sizeof(req.consumer_label) - 1);
+    int ret = ioctl(chipfd, GPIO_GET_LINEEVENT_IOCTL, &req);
+    close(chipfd);
+    if (ret < 0)
+	return false;
+
+    // Non blocking, so drain() can empty the kernel queue without hanging
+    fcntl(req.fd, F_SETFL, fcntl(req.fd, F_GETFL) | O_NONBLOCK);
+    _fd = req.fd;
+    _events = 0;
+    return true;
+}
+
+void RHGpioEvent::end()
+{
+    if (_fd >= 0)
+    {
+	close(_fd);
+	_fd = -1;
+    }
+}
+
+bool RHGpioEvent::isOpen()
+{
+    return _fd >= 0;
+}
+
+int RHGpioEvent::fd()
+{
+    return _fd;
+}
+
+int RHGpioEvent::wait(int timeout)
+{
+    if (_fd < 0)
+	return -1;
+
+    struct pollfd pfd;
+    pfd.fd = _fd;
+    pfd.events = POLLIN;
+    pfd.revents = 0;
+    int ret = poll(&pfd, 1, timeout);
+    if (ret < 0)
+	return errno == EINTR ? 0 : -1;
+    if (ret == 0)
+	return 0;
+    return drain();
+}
+
+int RHGpioEvent::drain()
+{
+    if (_fd < 0)
+	return 0;
+
+    struct gpioevent_data events[16];
+    int count = 0;
+    ssize_t len;
+    while ((len = read(_fd, events, sizeof(events))) > 0)
+    {
+	int n = len / sizeof(events[0]);
+	if (n > 0)
+	    _lastEventTime = events[n - 1].timestamp;
+	count += n;
+    }
+    _events += count;
+    return count;
+}
+
+uint64_t RHGpioEvent::lastEventTime()
+{
+    return _lastEventTime;
+}
+
+uint32_t RHGpioEvent::events()
+{
+    return _events;
+}
+
+#endif // RH_HAVE_GPIO_EVENT
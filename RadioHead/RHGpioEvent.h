@@ -0,0 +1,95 @@
+// RHGpioEvent.h
+//
+// Rising edge events from a GPIO line through the Linux GPIO character device
+// (/dev/gpiochipN), so that a driver can sleep until its radio raises an interrupt
+// instead of polling for it.
+
+#ifndef RHGpioEvent_h
+#define RHGpioEvent_h
+
+#include <RadioHead.h>
+
+#ifdef RH_HAVE_GPIO_EVENT
+
+/////////////////////////////////////////////////////////////////////
+/// \class RHGpioEvent RHGpioEvent.h <RHGpioEvent.h>
+/// \brief Rising edge events on a GPIO line, delivered through a file descriptor
+///
+/// Requests a GPIO line as an input with rising edge events from the kernel GPIO
+/// character device. The kernel timestamps and queues every edge, and fd() becomes
+/// readable when one is pending, so the caller can block in wait(), poll() or epoll
+/// with no CPU use while idle and wake up within the kernel's interrupt latency.
+///
+/// On the Raspberry Pi the line numbers of gpiochip0 are the BCM GPIO numbers, the same
+/// numbers used by the bcm2835 library and RasPiBoards.h.
+///
+/// Caution: the gpio-no-irq overlay disables GPIO interrupts in the kernel. With it,
+/// begin() fails and drivers fall back to polling.
+class RHGpioEvent
+{
+public:
+    /// Constructor. Does not touch the hardware until begin().
+    /// \param[in] line The GPIO line offset on the chip (BCM GPIO number on Raspberry Pi).
+    /// NOT_A_PIN disables the event source.
+    /// \param[in] chip The number N of /dev/gpiochipN
+    RHGpioEvent(uint8_t line = NOT_A_PIN, uint8_t chip = 0);
+
+    /// Destructor. Releases the line.
+    ~RHGpioEvent();
+
+    /// Sets the line and chip to use. Takes effect on the next begin().
+    /// \param[in] line The GPIO line offset on the chip
+    /// \param[in] chip The number N of /dev/gpiochipN
+    void setLine(uint8_t line, uint8_t chip = 0);
+
+    /// Requests the line as a rising edge event source.
+    /// \return true if the line could be requested
+    bool begin();
+
+    /// Releases the line.
+    void end();
+
+    /// \return true if begin() succeeded and the line is held
+    bool isOpen();
+
+    /// \return File descriptor that is readable while edge events are pending, or -1
+    int fd();
+
+    /// Blocks until at least one rising edge is pending or the timeout expires, then consumes
+    /// all pending edges.
+    /// \param[in] timeout Maximum time to wait in milliseconds. 0 does not block, negative waits forever.
+    /// \return the number of edges consumed, 0 on timeout, -1 on error
+    int wait(int timeout);
+
+    /// Consumes all pending edges without blocking. Call after fd() was reported readable by
+    /// an external poll() or epoll.
+    /// \return the number of edges consumed
+    int drain();
+
+    /// \return The kernel timestamp of the most recent edge in nanoseconds.
+    /// Since Linux 5.7 this is CLOCK_MONOTONIC, before that CLOCK_REALTIME.
+    uint64_t lastEventTime();
+
+    /// \return The total number of edges consumed since begin()
+    uint32_t events();
+
+private:
+    /// The line offset on the chip
+    uint8_t             _line;
+
+    /// The gpiochip number
+    uint8_t             _chip;
+
+    /// Line event file descriptor, or -1
+    int                 _fd;
+
+    /// Timestamp of the last edge in ns
+    uint64_t            _lastEventTime;
+
+    /// Count of consumed edges
+    uint32_t            _events;
+};
+
+#endif // RH_HAVE_GPIO_EVENT
+
+#endif
@@ -43,6 +43,15 @@ uint8_t RHHardwareSPI::transfer(uint8_t data)
     return SPI.transfer(data);
 }
 
+void RHHardwareSPI::transferBuffer(const uint8_t* src, uint8_t* dest, uint16_t len)
+{
+#if (RH_PLATFORM == RH_PLATFORM_RASPI)
+    SPI.transfernb(src, dest, len);
+#else
+    RHGenericSPI::transferBuffer(src, dest, len);
+#endif
+}
+
 void RHHardwareSPI::attachInterrupt() 
 {
 #if (RH_PLATFORM == RH_PLATFORM_ARDUINO)
@@ -34,6 +34,14 @@ public:
     /// \return The octet read from SPI while the data octet was sent
     uint8_t transfer(uint8_t data);
 
+    /// Transfer a buffer of octets to and from the SPI interface.
+    /// On Raspberry Pi the whole buffer is clocked by a single bcm2835_spi_transfernb() call,
+    /// on other platforms one octet at a time.
+    /// \param[in] src The octets to send, len octets
+    /// \param[out] dest The octets read while src was sent, len octets. May be the same buffer as src
+    /// \param[in] len Number of octets to transfer
+    void transferBuffer(const uint8_t* src, uint8_t* dest, uint16_t len);
+
     // SPI Configuration methods
     /// Enable SPI interrupts
     /// This can be used in an SPI slave to indicate when an SPI message has been received
@@ -30,7 +30,14 @@ RHMesh::RHMesh(RHGenericDriver& driver, uint8_t thisAddress)
 // waits for delivery to the next hop (but not for delivery to the final destination)
 uint8_t RHMesh::sendtoWait(uint8_t* buf, uint8_t len, uint8_t address, uint8_t flags)
 {
-    if (len > RH_MESH_MAX_MESSAGE_LEN)
+    RHSegment segment = { buf, len };
+    return sendtoWaitv(&segment, 1, address, flags);
+}
+
+////////////////////////////////////////////////////////////////////
+uint8_t RHMesh::sendtoWaitv(const RHSegment* segments, uint8_t count, uint8_t address, uint8_t flags)
+{
+    if (count >= RH_MAX_SEGMENTS - 1 || RHGenericDriver::segmentsLen(segments, count) > RH_MESH_MAX_MESSAGE_LEN)
 	return RH_ROUTER_ERROR_INVALID_LENGTH;
 
     if (address != RH_BROADCAST_ADDRESS)
@@ -40,25 +47,50 @@ uint8_t RHMesh::sendtoWait(uint8_t* buf, uint8_t len, uint8_t address, uint8_t f
 	    return RH_ROUTER_ERROR_NO_ROUTE;
     }
 
-    // Now have a route. Contruct an application layer message and send it via that route
-    MeshApplicationMessage* a = (MeshApplicationMessage*)&_tmpMessage;
-    a->header.msgType = RH_MESH_MESSAGE_TYPE_APPLICATION;
-    memcpy(a->data, buf, len);
-    return RHRouter::sendtoWait(_tmpMessage, sizeof(RHMesh::MeshMessageHeader) + len, address, flags);
+    // Now have a route. Put the application layer header in front of the data and send it via that route
+    MeshMessageHeader header;
+    header.msgType = RH_MESH_MESSAGE_TYPE_APPLICATION;
+    RHSegment message[RH_MAX_SEGMENTS];
+    message[0].data = (const uint8_t*)&header;
+    message[0].len = sizeof(MeshMessageHeader);
+    memcpy(message + 1, segments, count * sizeof(RHSegment));
+    return RHRouter::sendtoWaitv(message, count + 1, address, flags);
 }
 
+#if RH_RELIABLE_MAX_PENDING > 0
 ////////////////////////////////////////////////////////////////////
-bool RHMesh::doArp(uint8_t address)
+uint8_t RHMesh::sendtoAsync(const uint8_t* buf, uint8_t len, uint8_t dest, uint8_t flags, void* arg)
+{
+    if (len > RH_MESH_MAX_MESSAGE_LEN)
+	return RH_RELIABLE_NO_HANDLE;
+
+    // Not _tmpMessage, a blocking send may be using it
+    MeshApplicationMessage a;
+    a.header.msgType = RH_MESH_MESSAGE_TYPE_APPLICATION;
+    memcpy(a.data, buf, len);
+    return RHRouter::sendtoAsync((uint8_t*)&a, sizeof(RHMesh::MeshMessageHeader) + len, dest, flags, arg);
+}
+#endif
+
+////////////////////////////////////////////////////////////////////
+bool RHMesh::requestRoute(uint8_t address)
 {
-    // Need to discover a route
     // Broadcast a route discovery message with nothing in it
     MeshRouteDiscoveryMessage* p = (MeshRouteDiscoveryMessage*)&_tmpMessage;
     p->header.msgType = RH_MESH_MESSAGE_TYPE_ROUTE_DISCOVERY_REQUEST;
     p->destlen = 1; 
     p->dest = address; // Who we are looking for
     uint8_t error = RHRouter::sendtoWait((uint8_t*)p, sizeof(RHMesh::MeshMessageHeader) + 2, RH_BROADCAST_ADDRESS);
-    if (error !=  RH_ROUTER_ERROR_NONE)
+    return error == RH_ROUTER_ERROR_NONE;
+}
+
+////////////////////////////////////////////////////////////////////
+bool RHMesh::doArp(uint8_t address)
+{
+    // Need to discover a route
+    if (!requestRoute(address))
 	return false;
+    MeshRouteDiscoveryMessage* p = (MeshRouteDiscoveryMessage*)&_tmpMessage;
     
     // Wait for a reply, which will be unicast back to us
     // It will contain the complete route to the destination
@@ -120,24 +152,24 @@ void RHMesh::peekAtMessage(RoutedMessage* message, uint8_t messageLen)
 
 ////////////////////////////////////////////////////////////////////
 // This is called when a message is to be delivered to the next hop
-uint8_t RHMesh::route(RoutedMessage* message, uint8_t messageLen)
+uint8_t RHMesh::routev(RoutedMessageHeader* header, const RHSegment* segments, uint8_t count)
 {
-    uint8_t from = headerFrom(); // Might get clobbered during call to superclass route()
-    uint8_t ret = RHRouter::route(message, messageLen);
+    uint8_t from = headerFrom(); // Might get clobbered during call to superclass routev()
+    uint8_t ret = RHRouter::routev(header, segments, count);
     if (   ret == RH_ROUTER_ERROR_NO_ROUTE
 	|| ret == RH_ROUTER_ERROR_UNABLE_TO_DELIVER)
     {
 	// Cant deliver to the next hop. Delete the route
-	deleteRouteTo(message->header.dest);
-	if (message->header.source != _thisAddress)
+	deleteRouteTo(header->dest);
+	if (header->source != _thisAddress)
 	{
 	    // This is being proxied, so tell the originator about it
 	    MeshRouteFailureMessage* p = (MeshRouteFailureMessage*)&_tmpMessage;
 	    p->header.msgType = RH_MESH_MESSAGE_TYPE_ROUTE_FAILURE;
-	    p->dest = message->header.dest; // Who you were trying to deliver to
+	    p->dest = header->dest; // Who you were trying to deliver to
 	    // Make sure there is a route back towards whoever sent the original message
-	    addRouteTo(message->header.source, from);
-	    ret = RHRouter::sendtoWait((uint8_t*)p, sizeof(RHMesh::MeshMessageHeader) + 1, message->header.source);
+	    addRouteTo(header->source, from);
+	    ret = RHRouter::sendtoWait((uint8_t*)p, sizeof(RHMesh::MeshMessageHeader) + 1, header->source);
 	}
     }
     return ret;
@@ -152,6 +184,92 @@ bool RHMesh::isPhysicalAddress(uint8_t* address, uint8_t addresslen)
 }
 
 ////////////////////////////////////////////////////////////////////
+bool RHMesh::handleMeshMessage(uint8_t* message, uint8_t messageLen, uint8_t messageSize, uint8_t source, uint8_t dest, uint8_t from)
+{
+    MeshMessageHeader* p = (MeshMessageHeader*)message;
+
+    if (   messageLen >= 1 
+	&& p->msgType == RH_MESH_MESSAGE_TYPE_APPLICATION)
+    {
+	// Handle application layer messages, presumably for our caller
+	return true;
+    }
+    else if (   dest == RH_BROADCAST_ADDRESS 
+	     && messageLen > 1 
+	     && p->msgType == RH_MESH_MESSAGE_TYPE_ROUTE_DISCOVERY_REQUEST)
+    {
+	MeshRouteDiscoveryMessage* d = (MeshRouteDiscoveryMessage*)p;
+	// Handle Route discovery requests
+	// Message is an array of node addresses the route request has already passed through
+	// If it originally came from us, ignore it
+	if (source == _thisAddress)
+	    return false;
+	
+	uint8_t numRoutes = messageLen - sizeof(MeshMessageHeader) - 2;
+	uint8_t i;
+	// Are we already mentioned?
+	for (i = 0; i < numRoutes; i++)
+	    if (d->route[i] == _thisAddress)
+		return false; // Already been through us. Discard
+	
+	// Hasnt been past us yet, record routes back to the earlier nodes
+	addRouteTo(source, from); // The originator
+	for (i = 0; i < numRoutes; i++)
+	    addRouteTo(d->route[i], from);
+	if (isPhysicalAddress(&d->dest, d->destlen))
+	{
+	    // This route discovery is for us. Unicast the whole route back to the originator
+	    // as a RH_MESH_MESSAGE_TYPE_ROUTE_DISCOVERY_RESPONSE
+	    // We are certain to have a route there, because we just got it
+	    d->header.msgType = RH_MESH_MESSAGE_TYPE_ROUTE_DISCOVERY_RESPONSE;
+	    RHRouter::sendtoWait((uint8_t*)d, messageLen, source);
+	}
+	else if (i < _max_hops && messageLen < messageSize)
+	{
+	    // Its for someone else, rebroadcast it, after adding ourselves to the list
+	    d->route[numRoutes] = _thisAddress;
+	    messageLen++;
+	    // Have to impersonate the source
+	    // REVISIT: if this fails what can we do?
+	    RHRouter::sendtoFromSourceWait(message, messageLen, RH_BROADCAST_ADDRESS, source);
+	}
+    }
+    return false;
+}
+
+#ifdef RH_HAVE_PACKET
+RHPacket* RHMesh::recvfromAckPacket()
+{
+    RHPacket* packet = RHRouter::recvfromAckPacket();
+    if (!packet)
+	return NULL;
+    RoutedMessageHeader* header = routedHeader(packet);
+    // Route discoveries are answered or extended in the packet, the room left after
+    // the frame takes the address added to a rebroadcast
+    uint8_t messageLen = packet->payloadLen();
+    uint8_t messageSize = messageLen + (RH_PACKET_MAX_LEN - packet->len());
+    if (   handleMeshMessage(packet->payload(), messageLen, messageSize, header->source, header->dest, packet->headerFrom())
+	&& packet->pull(sizeof(MeshMessageHeader)))
+	return packet;
+    packet->release();
+    return NULL;
+}
+
+bool RHMesh::recvfromAck(uint8_t* buf, uint8_t* len, uint8_t* source, uint8_t* dest, uint8_t* id, uint8_t* flags)
+{
+    RHPacket* packet = recvfromAckPacket();
+    if (!packet)
+	return false;
+    RoutedMessageHeader* header = routedHeader(packet);
+    if (source) *source = header->source;
+    if (dest)   *dest   = header->dest;
+    if (id)     *id     = header->id;
+    if (flags)  *flags  = header->flags;
+    packet->copyPayload(buf, len);
+    packet->release();
+    return true;
+}
+#else
 bool RHMesh::recvfromAck(uint8_t* buf, uint8_t* len, uint8_t* source, uint8_t* dest, uint8_t* id, uint8_t* flags)
 {     
     uint8_t tmpMessageLen = sizeof(_tmpMessage);
@@ -159,69 +277,23 @@ bool RHMesh::recvfromAck(uint8_t* buf, uint8_t* len, uint8_t* source, uint8_t* d
     uint8_t _dest;
     uint8_t _id;
     uint8_t _flags;
-    if (RHRouter::recvfromAck(_tmpMessage, &tmpMessageLen, &_source, &_dest, &_id, &_flags))
+    if (RHRouter::recvfromAck(_tmpMessage, &tmpMessageLen, &_source, &_dest, &_id, &_flags)
+	&& handleMeshMessage(_tmpMessage, tmpMessageLen, sizeof(_tmpMessage), _source, _dest, headerFrom()))
     {
-	MeshMessageHeader* p = (MeshMessageHeader*)&_tmpMessage;
-
-	if (   tmpMessageLen >= 1 
-	    && p->msgType == RH_MESH_MESSAGE_TYPE_APPLICATION)
-	{
-	    MeshApplicationMessage* a = (MeshApplicationMessage*)p;
-	    // Handle application layer messages, presumably for our caller
-	    if (source) *source = _source;
-	    if (dest)   *dest   = _dest;
-	    if (id)     *id     = _id;
-	    if (flags)  *flags  = _flags;
-	    uint8_t msgLen = tmpMessageLen - sizeof(MeshMessageHeader);
-	    if (*len > msgLen)
-		*len = msgLen;
-	    memcpy(buf, a->data, *len);
-	    
-	    return true;
-	}
-	else if (   _dest == RH_BROADCAST_ADDRESS 
-		 && tmpMessageLen > 1 
-		 && p->msgType == RH_MESH_MESSAGE_TYPE_ROUTE_DISCOVERY_REQUEST)
-	{
-	    MeshRouteDiscoveryMessage* d = (MeshRouteDiscoveryMessage*)p;
-	    // Handle Route discovery requests
-	    // Message is an array of node addresses the route request has already passed through
-	    // If it originally came from us, ignore it
-	    if (_source == _thisAddress)
-		return false;
-	    
-	    uint8_t numRoutes = tmpMessageLen - sizeof(MeshMessageHeader) - 2;
-	    uint8_t i;
-	    // Are we already mentioned?
-	    for (i = 0; i < numRoutes; i++)
-		if (d->route[i] == _thisAddress)
-		    return false; // Already been through us. Discard
-	    
-	    // Hasnt been past us yet, record routes back to the earlier nodes
-	    addRouteTo(_source, headerFrom()); // The originator
-	    for (i = 0; i < numRoutes; i++)
-		addRouteTo(d->route[i], headerFrom());
-	    if (isPhysicalAddress(&d->dest, d->destlen))
-	    {
-		// This route discovery is for us. Unicast the whole route back to the originator
-		// as a RH_MESH_MESSAGE_TYPE_ROUTE_DISCOVERY_RESPONSE
-		// We are certain to have a route there, because we just got it
-		d->header.msgType = RH_MESH_MESSAGE_TYPE_ROUTE_DISCOVERY_RESPONSE;
-		RHRouter::sendtoWait((uint8_t*)d, tmpMessageLen, _source);
-	    }
-	    else if (i < _max_hops)
-	    {
-		// Its for someone else, rebroadcast it, after adding ourselves to the list
-		d->route[numRoutes] = _thisAddress;
-		tmpMessageLen++;
-		// Have to impersonate the source
-		// REVISIT: if this fails what can we do?
-		RHRouter::sendtoFromSourceWait(_tmpMessage, tmpMessageLen, RH_BROADCAST_ADDRESS, _source);
-	    }
-	}
+	MeshApplicationMessage* a = (MeshApplicationMessage*)&_tmpMessage;
+	if (source) *source = _source;
+	if (dest)   *dest   = _dest;
+	if (id)     *id     = _id;
+	if (flags)  *flags  = _flags;
+	uint8_t msgLen = tmpMessageLen - sizeof(MeshMessageHeader);
+	if (*len > msgLen)
+	    *len = msgLen;
+	memcpy(buf, a->data, *len);
+	return true;
     }
     return false;
 }
+#endif
 
 ////////////////////////////////////////////////////////////////////
 bool RHMesh::recvfromAckTimeout(uint8_t* buf, uint8_t* len, uint16_t timeout, uint8_t* from, uint8_t* to, uint8_t* id, uint8_t* flags)
@@ -174,6 +174,36 @@ public:
     ///           (usually because it dod not acknowledge due to being off the air or out of range
     uint8_t sendtoWait(uint8_t* buf, uint8_t len, uint8_t dest, uint8_t flags = 0);
 
+    /// Like sendtoWait(), for application data in segments, see RHGenericDriver::sendv().
+    /// The mesh and RHRouter headers are sent as segments in front of them, nothing is copied.
+    /// \param [in] segments The pieces of the application message data, in order
+    /// \param [in] count Number of segments, less than RH_MAX_SEGMENTS - 1
+    /// \param [in] dest The destination node address
+    /// \param [in] flags Optional flags delivered end-to-end to the dest address
+    /// \return The result code, as sendtoWait()
+    uint8_t sendtoWaitv(const RHSegment* segments, uint8_t count, uint8_t dest, uint8_t flags = 0);
+
+#if RH_RELIABLE_MAX_PENDING > 0
+    /// Queues an application layer message for the destination node and returns without waiting,
+    /// see RHRouter::sendtoAsync(). Does not discover routes: if no route to dest is known,
+    /// call requestRoute() and try again once getRouteTo() finds one.
+    /// \param [in] buf The application message data. Copied, can be reused at once.
+    /// \param [in] len Number of octets in the application message data. 0 is permitted
+    /// \param [in] dest The destination node address, or RH_BROADCAST_ADDRESS for the nearby nodes
+    /// \param [in] flags Optional flags delivered end-to-end to the dest address
+    /// \param [in] arg Passed to the send callback
+    /// \return Handle of the message to the next hop, or RH_RELIABLE_NO_HANDLE if the message
+    /// is too long, there is no route for dest or the asynchronous send table is full
+    uint8_t sendtoAsync(const uint8_t* buf, uint8_t len, uint8_t dest, uint8_t flags = 0, void* arg = NULL);
+#endif
+
+    /// Broadcasts a route discovery request for address and returns once it was transmitted,
+    /// without waiting for the answer. The answer is handled by recvfromAck(), which adds
+    /// the route to the routing table. doArp() is requestRoute() followed by that wait.
+    /// \param [in] address The physical address to resolve
+    /// \return true if the request was transmitted
+    bool requestRoute(uint8_t address);
+
     /// Starts the receiver if it is not running already, processes and possibly routes any received messages
     /// addressed to other nodes
     /// and delivers any messages addressed to this node.
@@ -198,6 +228,15 @@ public:
     /// \return true if a valid message was received for this node and copied to buf
     bool recvfromAck(uint8_t* buf, uint8_t* len, uint8_t* source = NULL, uint8_t* dest = NULL, uint8_t* id = NULL, uint8_t* flags = NULL);
 
+#ifdef RH_HAVE_PACKET
+    /// Like recvfromAck(), but hands over the application layer message as the RHPacket it was
+    /// received into. Route discoveries are handled in the packet as well.
+    /// \return The packet, with the application data in RHPacket::payload() and the SOURCE,
+    /// DEST, ID and FLAGS in RHRouter::routedHeader(). The caller must release() it.
+    /// NULL if no application layer message for this node is available
+    RHPacket* recvfromAckPacket();
+#endif
+
     /// Starts the receiver if it is not running already.
     /// Similar to recvfromAck(), this will block until either a valid application layer 
     /// message available for this node
@@ -221,12 +260,14 @@ protected:
     /// \param [in] messageLen Length of message in octets
     virtual void peekAtMessage(RoutedMessage* message, uint8_t messageLen);
 
-    /// Internal function that inspects messages being received and adjusts the routing table if necessary.
-    /// This is virtual, which lets subclasses override or intercept the route() function.
-    /// Called by sendtoWait after the message header has been filled in.
-    /// \param [in] message Pointer to the RHRouter message to be sent.
-    /// \param [in] messageLen Length of message in octets
-    virtual uint8_t route(RoutedMessage* message, uint8_t messageLen);
+    /// Internal function that inspects messages being sent and adjusts the routing table if necessary:
+    /// if the next hop can not be reached its route is deleted and the originator of a forwarded message
+    /// is told. This is virtual, which lets subclasses override or intercept the routev() function.
+    /// Called by sendtoWait after the message header has been filled in, and by route() for forwarded messages.
+    /// \param [in] header The RHRouter header of the message to be sent.
+    /// \param [in] segments The pieces of the data, in order
+    /// \param [in] count Number of segments
+    virtual uint8_t routev(RoutedMessageHeader* header, const RHSegment* segments, uint8_t count);
 
     /// Try to resolve a route for the given address. Blocks while discovering the route
     /// which may take up to 4000 msec.
@@ -247,6 +288,17 @@ protected:
     /// \return true if the physical address of this node is identical to address
     virtual bool isPhysicalAddress(uint8_t* address, uint8_t addresslen);
 
+    /// Handles a mesh message received for this node: answers or rebroadcasts route discovery
+    /// requests and tells application layer messages apart
+    /// \param [in] message Pointer to the mesh message, starting with its MeshMessageHeader
+    /// \param [in] messageLen Length of message in octets
+    /// \param [in] messageSize Space at message, a rebroadcast route discovery grows by one octet
+    /// \param [in] source The SOURCE of the message
+    /// \param [in] dest The DEST of the message
+    /// \param [in] from The node it was received from
+    /// \return true if it is an application layer message
+    bool handleMeshMessage(uint8_t* message, uint8_t messageLen, uint8_t messageSize, uint8_t source, uint8_t dest, uint8_t from);
+
 private:
     /// Temporary message buffer
     static uint8_t _tmpMessage[RH_ROUTER_MAX_MESSAGE_LEN];
@@ -0,0 +1,169 @@
+// RHPacket.cpp
+//
+// Received frames passed between the RadioHead layers without copying
+
+#include <RHPacket.h>
+
+#ifdef RH_HAVE_PACKET
+
+RHPacket::RHPacket()
+    :
+    rssi(0),
+    snr(0),
+    time(0),
+    rxDone(0),
+    _pool(NULL),
+    _next(NULL),
+    _len(0),
+    _offset(0)
+{
+}
+
+uint8_t RHPacket::headerTo()
+{
+    return _len >= RH_PACKET_HEADER_LEN ? _data[0] : 0;
+}
+
+uint8_t RHPacket::headerFrom()
+{
+    return _len >= RH_PACKET_HEADER_LEN ? _data[1] : 0;
+}
+
+uint8_t RHPacket::headerId()
+{
+    return _len >= RH_PACKET_HEADER_LEN ? _data[2] : 0;
+}
+
+uint8_t RHPacket::headerFlags()
+{
+    return _len >= RH_PACKET_HEADER_LEN ? _data[3] : 0;
+}
+
+uint8_t* RHPacket::data()
+{
+    return _data;
+}
+
+uint8_t RHPacket::len()
+{
+    return _len;
+}
+
+void RHPacket::setLen(uint8_t len)
+{
+    _len = len;
+    _offset = len < RH_PACKET_HEADER_LEN ? len : RH_PACKET_HEADER_LEN;
+}
+
+uint8_t* RHPacket::payload()
+{
+    return _data + _offset;
+}
+
+uint8_t RHPacket::payloadLen()
+{
+    return _len - _offset;
+}
+
+uint8_t* RHPacket::pull(uint8_t len)
+{
+    if (len > _len - _offset)
+	return NULL;
+    uint8_t* header = _data + _offset;
+    _offset += len;
+    return header;
+}
+
+uint8_t* RHPacket::at(uint8_t offset)
+{
+    return _data + offset;
+}
+
+void RHPacket::copyPayload(uint8_t* buf, uint8_t* len)
+{
+    if (!buf || !len)
+	return;
+    if (*len > _len - _offset)
+	*len = _len - _offset;
+    memcpy(buf, _data + _offset, *len);
+}
+
+void RHPacket::release()
+{
+    if (_pool)
+	_pool->free(this);
+}
+
+RHPacketPool::RHPacketPool(uint8_t size)
+    :
+    _packets(NULL),
+    _free(NULL),
+    _size(size),
+    _available(size)
+{
+    pthread_mutex_init(&_lock, NULL);
+}
+
+RHPacketPool::~RHPacketPool()
+{
+    delete[] _packets;
+    pthread_mutex_destroy(&_lock);
+}
+
+RHPacket* RHPacketPool::alloc()
+{
+    pthread_mutex_lock(&_lock);
+    if (!_packets && _size)
+    {
+	// Drivers that are never asked for packets cost no memory
+	_packets = new RHPacket[_size];
+	for (uint8_t i = 0; i < _size; i++)
+	{
+	    _packets[i]._pool = this;
+	    _packets[i]._next = i + 1 < _size ? &_packets[i + 1] : NULL;
+	}
+	_free = _packets;
+    }
+    RHPacket* packet = _free;
+    if (packet)
+    {
+	_free = packet->_next;
+	_available--;
+    }
+    pthread_mutex_unlock(&_lock);
+
+    if (packet)
+    {
+	packet->_next = NULL;
+	packet->setLen(0);
+	packet->rssi = 0;
+	packet->snr = 0;
+	packet->time = 0;
+	packet->rxDone = 0;
+    }
+    return packet;
+}
+
+void RHPacketPool::free(RHPacket* packet)
+{
+    pthread_mutex_lock(&_lock);
+    packet->_next = _free;
+    _free = packet;
+    _available++;
+    pthread_mutex_unlock(&_lock);
+}
+
+uint8_t RHPacketPool::available()
+{
+    pthread_mutex_lock(&_lock);
+    uint8_t available = _available;
+    pthread_mutex_unlock(&_lock);
+    return available;
+}
+
+uint8_t RHPacketPool::size()
+{
+    return _size;
+}
+
+#endif
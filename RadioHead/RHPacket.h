@@ -0,0 +1,151 @@
+// RHPacket.h
+//
+// Received frames handed from the driver up through the managers in place,
+// from a fixed pool of buffers, instead of being copied at every layer.
+
+#ifndef RHPacket_h
+#define RHPacket_h
+
+#include <RadioHead.h>
+
+#ifdef RH_HAVE_PACKET
+
+#include <pthread.h>
+
+// Octets of the TO, FROM, ID and FLAGS headers at the start of every frame
+#define RH_PACKET_HEADER_LEN 4
+
+// Largest frame a packet holds, headers included
+#define RH_PACKET_MAX_LEN 255
+
+// Number of packets in the pool of each driver: received messages waiting in its queue
+// and the packets held by the application. Can be pre-defined prior to including this header
+#ifndef RH_PACKET_POOL_LEN
+#define RH_PACKET_POOL_LEN 32
+#endif
+
+class RHPacketPool;
+
+/////////////////////////////////////////////////////////////////////
+/// \class RHPacket RHPacket.h <RHPacket.h>
+/// \brief A received frame with its metadata, parsed by each layer where it is
+///
+/// A packet holds the frame as it came from the radio: the TO, FROM, ID and FLAGS headers,
+/// then the headers of each manager, then the application data. Each layer takes its header
+/// with pull(), which returns a pointer to it inside the frame and moves payload() past it,
+/// so the layer above sees only its own part. Nothing is copied between the driver and the
+/// application: RH_RF95 reads the FIFO straight into a packet, and recvfromPacket() and
+/// recvfromAckPacket() of the managers hand that same packet up.
+///
+/// Packets are taken from the RHPacketPool of a driver and belong to whoever received them
+/// until release(). A pool has a fixed number of packets, a driver can not queue more received
+/// messages while all of them are held.
+class RHPacket
+{
+public:
+    /// Constructor, the frame is empty
+    RHPacket();
+
+    /// \return The TO header of the frame
+    uint8_t        headerTo();
+
+    /// \return The FROM header of the frame
+    uint8_t        headerFrom();
+
+    /// \return The ID header of the frame
+    uint8_t        headerId();
+
+    /// \return The FLAGS header of the frame
+    uint8_t        headerFlags();
+
+    /// \return The whole frame, starting with the TO header. Drivers read the frame into it
+    /// and then call setLen()
+    uint8_t*       data();
+
+    /// \return Number of octets in the frame
+    uint8_t        len();
+
+    /// Sets the length of the frame read into data() and puts payload() right after the
+    /// TO, FROM, ID and FLAGS headers
+    /// \param[in] len Number of octets in the frame, at least RH_PACKET_HEADER_LEN
+    void           setLen(uint8_t len);
+
+    /// \return The part of the frame the layers below have not pulled off
+    uint8_t*       payload();
+
+    /// \return Number of octets in payload()
+    uint8_t        payloadLen();
+
+    /// Takes a header of len octets off the front of payload()
+    /// \param[in] len Length of the header
+    /// \return Pointer to the header in the frame, or NULL if payload() is shorter than len
+    uint8_t*       pull(uint8_t len);
+
+    /// \param[in] offset Offset in the frame
+    /// \return Pointer to the octet at offset in the frame, to view the header of a lower layer
+    uint8_t*       at(uint8_t offset);
+
+    /// Copies payload() for a caller that wants the message in its own buffer
+    /// \param[in] buf Where to copy it to. Nothing is copied if buf or len are NULL
+    /// \param[in,out] len Available space in buf. Set to the number of octets copied
+    void           copyPayload(uint8_t* buf, uint8_t* len);
+
+    /// Gives the packet back to its pool. It must not be used afterwards
+    void           release();
+
+    int8_t         rssi;   ///< RSSI of the frame in dBm
+    int8_t         snr;    ///< SNR of the frame in dB, 0 if the driver can not tell
+    unsigned long  time;   ///< millis() when the driver read the frame from the radio
+    uint64_t       rxDone; ///< End of the reception, see RH_RF95::lastRxDoneTime(), 0 if not known
+
+private:
+    friend class RHPacketPool;
+
+    RHPacketPool*  _pool;
+    RHPacket*      _next;  ///< Next free packet of the pool
+    uint8_t        _len;
+    uint8_t        _offset; ///< Start of payload()
+    uint8_t        _data[RH_PACKET_MAX_LEN];
+};
+
+/////////////////////////////////////////////////////////////////////
+/// \class RHPacketPool RHPacket.h <RHPacket.h>
+/// \brief Fixed set of RHPacket buffers of a driver
+///
+/// The packets are allocated on the first alloc() and kept for the life of the pool, so
+/// receiving allocates no memory. alloc(), free() and available() take a mutex: a packet may
+/// be released by another thread than the one that received it.
+class RHPacketPool
+{
+public:
+    /// Constructor
+    /// \param[in] size Number of packets
+    RHPacketPool(uint8_t size = RH_PACKET_POOL_LEN);
+
+    /// Destructor. Packets still held become invalid
+    ~RHPacketPool();
+
+    /// \return A packet with an empty frame, or NULL if all packets are held
+    RHPacket*      alloc();
+
+    /// Gives a packet back, see RHPacket::release()
+    /// \param[in] packet A packet from alloc() of this pool
+    void           free(RHPacket* packet);
+
+    /// \return Number of packets not held
+    uint8_t        available();
+
+    /// \return Number of packets of the pool
+    uint8_t        size();
+
+private:
+    pthread_mutex_t _lock;
+    RHPacket*      _packets;
+    RHPacket*      _free;
+    uint8_t        _size;
+    uint8_t        _available;
+};
+
+#endif
+
+#endif
@@ -23,6 +23,14 @@ RHReliableDatagram::RHReliableDatagram(RHGenericDriver& driver, uint8_t thisAddr
     _timeout = RH_DEFAULT_TIMEOUT;
     _retries = RH_DEFAULT_RETRIES;
     memset(_seenIds, 0, sizeof(_seenIds));
+    _peerCount = 0;
+    _adaptiveTimeout = true;
+#if RH_RELIABLE_MAX_PENDING > 0
+    for (uint8_t i = 0; i < RH_RELIABLE_MAX_PENDING; i++)
+	_pending[i].state = SendFree;
+    _sendSerial = 0;
+    _sendCallback = NULL;
+#endif
 }
 
 ////////////////////////////////////////////////////////////////////
@@ -32,6 +40,12 @@ void RHReliableDatagram::setTimeout(uint16_t timeout)
     _timeout = timeout;
 }
 
+////////////////////////////////////////////////////////////////////
+void RHReliableDatagram::setAdaptiveTimeout(bool enable)
+{
+    _adaptiveTimeout = enable;
+}
+
 ////////////////////////////////////////////////////////////////////
 void RHReliableDatagram::setRetries(uint8_t retries)
 {
@@ -46,6 +60,12 @@ uint8_t RHReliableDatagram::retries()
 
 ////////////////////////////////////////////////////////////////////
 bool RHReliableDatagram::sendtoWait(uint8_t* buf, uint8_t len, uint8_t address)
+{
+    RHSegment segment = { buf, len };
+    return sendtoWaitv(&segment, 1, address);
+}
+
+bool RHReliableDatagram::sendtoWaitv(const RHSegment* segments, uint8_t count, uint8_t address)
 {
     // Assemble the message
     uint8_t thisSequenceNumber = ++_lastSequenceNumber;
@@ -54,25 +74,17 @@ bool RHReliableDatagram::sendtoWait(uint8_t* buf, uint8_t len, uint8_t address)
     {
 	setHeaderId(thisSequenceNumber);
 	setHeaderFlags(RH_FLAGS_NONE, RH_FLAGS_ACK); // Clear the ACK flag
-	sendto(buf, len, address);
+	sendtov(segments, count, address);
 	waitPacketSent();
 
 	// Never wait for ACKS to broadcasts:
 	if (address == RH_BROADCAST_ADDRESS)
 	    return true;
 
-	if (retries > 1)
-	    _retransmissions++;
 	unsigned long thisSendTime = millis(); // Timeout does not include original transmit time
+	unsigned long sentAt = micros();
 
-	// Compute a new timeout, random between _timeout and _timeout*2
-	// This is to prevent collisions on every retransmit
-	// if 2 nodes try to transmit at the same time
-#if (RH_PLATFORM == RH_PLATFORM_RASPI) // use standard library random(), bugs in random(min, max)
-	uint16_t timeout = _timeout + (_timeout * (random() & 0xFF) / 256);
-#else
-	uint16_t timeout = _timeout + (_timeout * random(0, 256) / 256);
-#endif
+	uint16_t timeout = transmitted(address, retries > 1);
 	int32_t timeLeft;
         while ((timeLeft = timeout - (millis() - thisSendTime)) > 0)
 	{
@@ -88,8 +100,17 @@ bool RHReliableDatagram::sendtoWait(uint8_t* buf, uint8_t len, uint8_t address)
 			   && (id == thisSequenceNumber))
 		    {
 			// Its the ACK we are waiting for
+			acked(address, micros() - sentAt, retries == 1);
 			return true;
 		    }
+#if RH_RELIABLE_MAX_PENDING > 0
+		    else if (   to == _thisAddress
+				&& (flags & RH_FLAGS_ACK)
+				&& matchAck(from, id))
+		    {
+			// The ACK of an asynchronous send
+		    }
+#endif
 		    else if (   !(flags & RH_FLAGS_ACK)
 				&& (id == _seenIds[from]))
 		    {
@@ -106,10 +127,68 @@ bool RHReliableDatagram::sendtoWait(uint8_t* buf, uint8_t len, uint8_t address)
 	YIELD;
     }
     // Retries exhausted
+    failed(address);
     return false;
 }
 
 ////////////////////////////////////////////////////////////////////
+bool RHReliableDatagram::acceptMessage(uint8_t from, uint8_t to, uint8_t id, uint8_t flags)
+{
+    // Never ACK an ACK
+    if (!(flags & RH_FLAGS_ACK))
+    {
+	// Its a normal message for this node, not an ACK
+	if (to != RH_BROADCAST_ADDRESS)
+	{
+	    // Its not a broadcast, so ACK it
+	    // Acknowledge message with ACK set in flags and ID set to received ID
+	    acknowledge(id, from);
+	}
+	// If we have not seen this message before, then we are interested in it
+	if (id != _seenIds[from])
+	{
+	    _seenIds[from] = id;
+	    return true;
+	}
+	// Else just re-ack it and wait for a new one
+    }
+#if RH_RELIABLE_MAX_PENDING > 0
+    else if (to == _thisAddress)
+    {
+	// Maybe the ACK of an asynchronous send
+	matchAck(from, id);
+    }
+#endif
+    return false;
+}
+
+#ifdef RH_HAVE_PACKET
+RHPacket* RHReliableDatagram::recvfromAckPacket()
+{
+    // The message stays in its packet while the ACK goes out through the driver buffer
+    RHPacket* packet = available() ? recvfromPacket() : NULL;
+    if (!packet)
+	return NULL;
+    if (acceptMessage(packet->headerFrom(), packet->headerTo(), packet->headerId(), packet->headerFlags()))
+	return packet;
+    packet->release();
+    return NULL;
+}
+
+bool RHReliableDatagram::recvfromAck(uint8_t* buf, uint8_t* len, uint8_t* from, uint8_t* to, uint8_t* id, uint8_t* flags)
+{
+    RHPacket* packet = recvfromAckPacket();
+    if (!packet)
+	return false;
+    packet->copyPayload(buf, len);
+    if (from)  *from =  packet->headerFrom();
+    if (to)    *to =    packet->headerTo();
+    if (id)    *id =    packet->headerId();
+    if (flags) *flags = packet->headerFlags();
+    packet->release();
+    return true;
+}
+#else
 bool RHReliableDatagram::recvfromAck(uint8_t* buf, uint8_t* len, uint8_t* from, uint8_t* to, uint8_t* id, uint8_t* flags)
 {  
     uint8_t _from;
@@ -117,34 +196,19 @@ bool RHReliableDatagram::recvfromAck(uint8_t* buf, uint8_t* len, uint8_t* from,
     uint8_t _id;
     uint8_t _flags;
     // Get the message before its clobbered by the ACK (shared rx and tx buffer in some drivers
-    if (available() && recvfrom(buf, len, &_from, &_to, &_id, &_flags))
+    if (available() && recvfrom(buf, len, &_from, &_to, &_id, &_flags)
+	&& acceptMessage(_from, _to, _id, _flags))
     {
-	// Never ACK an ACK
-	if (!(_flags & RH_FLAGS_ACK))
-	{
-	    // Its a normal message for this node, not an ACK
-	    if (_to != RH_BROADCAST_ADDRESS)
-	    {
-		// Its not a broadcast, so ACK it
-		// Acknowledge message with ACK set in flags and ID set to received ID
-		acknowledge(_id, _from);
-	    }
-	    // If we have not seen this message before, then we are interested in it
-	    if (_id != _seenIds[_from])
-	    {
-		if (from)  *from =  _from;
-		if (to)    *to =    _to;
-		if (id)    *id =    _id;
-		if (flags) *flags = _flags;
-		_seenIds[_from] = _id;
-		return true;
-	    }
-	    // Else just re-ack it and wait for a new one
-	}
+	if (from)  *from =  _from;
+	if (to)    *to =    _to;
+	if (id)    *id =    _id;
+	if (flags) *flags = _flags;
+	return true;
     }
     // No message for us available
     return false;
 }
+#endif
 
 bool RHReliableDatagram::recvfromAckTimeout(uint8_t* buf, uint8_t* len, uint16_t timeout, uint8_t* from, uint8_t* to, uint8_t* id, uint8_t* flags)
 {
@@ -172,6 +236,362 @@ void RHReliableDatagram::resetRetransmissions()
     _retransmissions = 0;
 }
  
+#if RH_RELIABLE_MAX_PENDING > 0
+uint8_t RHReliableDatagram::sendtoAsync(const uint8_t* buf, uint8_t len, uint8_t address, void* arg)
+{
+    if (len > RH_RELIABLE_MAX_MESSAGE_LEN || len > _driver.maxMessageLength())
+	return RH_RELIABLE_NO_HANDLE;
+    for (uint8_t i = 0; i < RH_RELIABLE_MAX_PENDING; i++)
+    {
+	PendingSend& p = _pending[i];
+	if (p.state != SendFree)
+	    continue;
+	memcpy(p.buf, buf, len);
+	p.len = len;
+	p.to = address;
+	p.attempts = 0;
+	p.arg = arg;
+	p.serial = _sendSerial++;
+	p.state = SendQueued;
+	return i;
+    }
+    return RH_RELIABLE_NO_HANDLE;
+}
+
+bool RHReliableDatagram::service()
+{
+    unsigned long now = millis();
+    PendingSend* onAir = NULL;
+    PendingSend* next = NULL;
+    uint8_t i, j;
+
+    // The radio sends one message at a time, the next one waits until the driver is done
+    for (i = 0; i < RH_RELIABLE_MAX_PENDING; i++)
+	if (_pending[i].state == SendTransmitting || _pending[i].state == SendCancelled)
+	    onAir = &_pending[i];
+    if (onAir && _driver.packetSent())
+    {
+	if (onAir->state == SendCancelled)
+	    onAir->state = SendFree;
+	else
+	    sent(*onAir);
+	onAir = NULL;
+    }
+
+    for (i = 0; i < RH_RELIABLE_MAX_PENDING; i++)
+    {
+	PendingSend& p = _pending[i];
+	if (p.state == SendWaitAck && (long) (now - p.deadline) >= 0)
+	{
+	    if (p.attempts > p.retries)
+	    {
+		failed(p.to);
+		p.state = SendFailed;
+	    }
+	    else if (!next || p.serial < next->serial)
+		next = &p;
+	}
+	else if (p.state == SendQueued && (!next || p.serial < next->serial))
+	{
+	    // Eligible unless an earlier message to the same node is still pending
+	    for (j = 0; j < RH_RELIABLE_MAX_PENDING; j++)
+	    {
+		PendingSend& q = _pending[j];
+		if (   q.to == p.to
+		    && (   q.state == SendTransmitting || q.state == SendWaitAck
+			|| (q.state == SendQueued && q.serial < p.serial)))
+		    break;
+	    }
+	    if (j == RH_RELIABLE_MAX_PENDING)
+		next = &p;
+	}
+    }
+
+    if (onAir)
+	next = NULL;
+    if (next)
+	transmit(*next);
+
+    if (_sendCallback)
+    {
+	for (i = 0; i < RH_RELIABLE_MAX_PENDING; i++)
+	{
+	    PendingSend& p = _pending[i];
+	    if (p.state != SendAcked && p.state != SendFailed)
+		continue;
+	    // Free the entry first, the callback may queue another message
+	    bool acked = p.state == SendAcked;
+	    p.state = SendFree;
+	    _sendCallback(i, p.to, acked, p.arg);
+	}
+    }
+    return next != NULL;
+}
+
+int32_t RHReliableDatagram::serviceTimeout()
+{
+    unsigned long now = millis();
+    int32_t timeout = -1;
+    // Nothing new goes out before the transmission in progress is over
+    int32_t radioFree = 0;
+    uint8_t i, j;
+    for (i = 0; i < RH_RELIABLE_MAX_PENDING; i++)
+    {
+	PendingSend& p = _pending[i];
+	if (p.state != SendTransmitting && p.state != SendCancelled)
+	    continue;
+	uint32_t airtime = _driver.timeOnAir(p.len);
+	unsigned long elapsed = micros() - p.sentAt;
+	// Past the time on air (or without one) look again every millisecond until the driver is done
+	radioFree = elapsed < airtime ? (airtime - elapsed + 999) / 1000 : 1;
+	timeout = radioFree;
+    }
+
+    for (i = 0; i < RH_RELIABLE_MAX_PENDING; i++)
+    {
+	PendingSend& p = _pending[i];
+	if (p.state == SendWaitAck)
+	{
+	    int32_t left = (int32_t) (p.deadline - now);
+	    if (left < radioFree)
+		left = radioFree;
+	    if (timeout < 0 || left < timeout)
+		timeout = left;
+	}
+	else if (p.state == SendQueued)
+	{
+	    // Due when the radio is free unless the destination is busy, then it is covered by
+	    // the busy entry
+	    for (j = 0; j < RH_RELIABLE_MAX_PENDING; j++)
+		if (   _pending[j].to == p.to
+		    && (_pending[j].state == SendTransmitting || _pending[j].state == SendWaitAck))
+		    break;
+	    if (j == RH_RELIABLE_MAX_PENDING && (timeout < 0 || radioFree < timeout))
+		timeout = radioFree;
+	}
+	else if ((p.state == SendAcked || p.state == SendFailed) && _sendCallback)
+	{
+	    return 0;
+	}
+    }
+    return timeout;
+}
+
+void RHReliableDatagram::setSendCallback(RHSendCallback callback)
+{
+    _sendCallback = callback;
+}
+
+RHReliableDatagram::SendState RHReliableDatagram::sendResult(uint8_t handle)
+{
+    if (handle >= RH_RELIABLE_MAX_PENDING)
+	return SendFree;
+    SendState state = (SendState) _pending[handle].state;
+    if (state == SendAcked || state == SendFailed)
+	_pending[handle].state = SendFree;
+    return state;
+}
+
+void RHReliableDatagram::cancelSend(uint8_t handle)
+{
+    if (handle >= RH_RELIABLE_MAX_PENDING)
+	return;
+    // Still on the air: the entry keeps the radio busy until service() sees it sent
+    if (_pending[handle].state == SendTransmitting)
+	_pending[handle].state = SendCancelled;
+    else if (_pending[handle].state != SendCancelled)
+	_pending[handle].state = SendFree;
+}
+
+uint8_t RHReliableDatagram::pendingSends()
+{
+    uint8_t count = 0;
+    for (uint8_t i = 0; i < RH_RELIABLE_MAX_PENDING; i++)
+	if (   _pending[i].state == SendQueued || _pending[i].state == SendTransmitting
+	    || _pending[i].state == SendWaitAck)
+	    count++;
+    return count;
+}
+
+bool RHReliableDatagram::matchAck(uint8_t from, uint8_t id)
+{
+    for (uint8_t i = 0; i < RH_RELIABLE_MAX_PENDING; i++)
+    {
+	PendingSend& p = _pending[i];
+	if ((p.state == SendWaitAck || p.state == SendTransmitting) && p.to == from && p.id == id)
+	{
+	    // An ACK seen before service() finished the attempt gives no round trip time
+	    acked(from, micros() - p.sentAt, p.attempts == 1 && p.state == SendWaitAck);
+	    p.state = SendAcked;
+	    return true;
+	}
+    }
+    return false;
+}
+
+void RHReliableDatagram::transmit(PendingSend& p)
+{
+    if (p.attempts == 0)
+    {
+	// A new message: the settings in effect now apply to all its transmissions
+	p.id = ++_lastSequenceNumber;
+	p.retries = _retries;
+    }
+    p.attempts++;
+    setHeaderId(p.id);
+    setHeaderFlags(RH_FLAGS_NONE, RH_FLAGS_ACK); // Clear the ACK flag
+    sendto(p.buf, p.len, p.to);
+    p.sentAt = micros();
+    p.state = SendTransmitting;
+}
+
+void RHReliableDatagram::sent(PendingSend& p)
+{
+    // Never wait for ACKS to broadcasts
+    if (p.to == RH_BROADCAST_ADDRESS)
+    {
+	p.state = SendAcked;
+	return;
+    }
+    // Timeout does not include the transmit time
+    p.sentAt = micros();
+    p.deadline = millis() + transmitted(p.to, p.attempts > 1);
+    p.state = SendWaitAck;
+}
+#endif
+
+bool RHReliableDatagram::peerStats(uint8_t address, PeerStats* stats)
+{
+    PeerStats* p = peer(address, false);
+    if (!p)
+	return false;
+    *stats = *p;
+    stats->timeout = peerTimeout(p);
+    return true;
+}
+
+uint8_t RHReliableDatagram::peerAddresses(uint8_t* addresses, uint8_t max)
+{
+    uint8_t i;
+    for (i = 0; i < _peerCount && i < max; i++)
+	addresses[i] = _peers[i].address;
+    return i;
+}
+
+RHReliableDatagram::PeerStats* RHReliableDatagram::peer(uint8_t address, bool create)
+{
+    uint8_t i;
+    for (i = 0; i < _peerCount; i++)
+	if (_peers[i].address == address)
+	    return &_peers[i];
+    if (!create)
+	return NULL;
+    if (_peerCount < RH_RELIABLE_MAX_PEERS)
+    {
+	i = _peerCount++;
+    }
+    else
+    {
+	// Replace the node sent to least recently
+	unsigned long now = millis();
+	i = 0;
+	for (uint8_t j = 1; j < _peerCount; j++)
+	    if (now - _peers[j].lastUsed > now - _peers[i].lastUsed)
+		i = j;
+    }
+    memset(&_peers[i], 0, sizeof(_peers[i]));
+    _peers[i].address = address;
+    return &_peers[i];
+}
+
+uint16_t RHReliableDatagram::peerTimeout(PeerStats* p)
+{
+    if (!_adaptiveTimeout)
+	return _timeout;
+
+    // Never shorter than it takes the receiver to send the ACK
+    uint32_t ackTime = _driver.timeOnAir(1);
+    uint32_t timeout = ackTime ? (ackTime + 999) / 1000 + RH_RELIABLE_TURNAROUND : 0;
+    if (p->samples)
+    {
+	// RFC 6298 with a clock granularity of 1ms
+	uint32_t variation = 4 * p->rttvar;
+	if (variation < 1000)
+	    variation = 1000;
+	uint32_t rto = (p->srtt + variation + 999) / 1000;
+	if (rto > timeout)
+	    timeout = rto;
+    }
+    else if (_timeout > timeout)
+    {
+	timeout = _timeout;
+    }
+    timeout <<= p->backoff;
+    return timeout > RH_RELIABLE_MAX_TIMEOUT ? RH_RELIABLE_MAX_TIMEOUT : timeout;
+}
+
+uint16_t RHReliableDatagram::transmitted(uint8_t address, bool retransmission)
+{
+    PeerStats* p = peer(address, true);
+    p->lastUsed = millis();
+    if (retransmission)
+    {
+	// The previous transmission timed out
+	_retransmissions++;
+	p->retransmissions++;
+	if (p->backoff < RH_RELIABLE_MAX_BACKOFF)
+	    p->backoff++;
+    }
+    else
+    {
+	p->sent++;
+    }
+
+    // Vary the timeout randomly, to prevent collisions on every retransmit
+    // if 2 nodes try to transmit at the same time
+    uint32_t timeout = peerTimeout(p);
+#if (RH_PLATFORM == RH_PLATFORM_RASPI) // use standard library random(), bugs in random(min, max)
+    uint32_t r = random() & 0xFF;
+#else
+    uint32_t r = random(0, 256);
+#endif
+    if (_adaptiveTimeout && p->samples)
+	// Between timeout and timeout*1.25: the estimate already has its margin
+	timeout += timeout * r / 1024;
+    else
+	// Between timeout and timeout*2, as with the fixed timeout
+	timeout += timeout * r / 256;
+    return timeout > 0xffff ? 0xffff : timeout;
+}
+
+void RHReliableDatagram::acked(uint8_t address, uint32_t rtt, bool firstAttempt)
+{
+    PeerStats* p = peer(address, true);
+    p->acked++;
+    p->backoff = 0;
+    if (!firstAttempt)
+	return;
+    if (p->samples++ == 0)
+    {
+	p->srtt = rtt;
+	p->rttvar = rtt / 2;
+    }
+    else
+    {
+	uint32_t delta = p->srtt > rtt ? p->srtt - rtt : rtt - p->srtt;
+	p->rttvar = p->rttvar - p->rttvar / 4 + delta / 4;
+	p->srtt = p->srtt - p->srtt / 8 + rtt / 8;
+    }
+}
+
+void RHReliableDatagram::failed(uint8_t address)
+{
+    PeerStats* p = peer(address, true);
+    p->failed++;
+    if (p->backoff < RH_RELIABLE_MAX_BACKOFF)
+	p->backoff++;
+}
+
 void RHReliableDatagram::acknowledge(uint8_t id, uint8_t from)
 {
     setHeaderId(id);
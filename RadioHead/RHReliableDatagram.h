@@ -20,6 +20,54 @@
 /// The default number of retries
 #define RH_DEFAULT_RETRIES 3
 
+// Number of messages sendtoAsync() can hold until they are acknowledged or fail.
+// Each entry keeps a copy of the message of up to RH_RELIABLE_MAX_MESSAGE_LEN octets,
+// so asynchronous sending is only enabled by default where memory is plentiful.
+// Can be pre-defined prior to including this header, 0 disables sendtoAsync().
+#ifndef RH_RELIABLE_MAX_PENDING
+ #if (RH_PLATFORM == RH_PLATFORM_RASPI) || (RH_PLATFORM == RH_PLATFORM_UNIX)
+  #define RH_RELIABLE_MAX_PENDING 16
+ #else
+  #define RH_RELIABLE_MAX_PENDING 0
+ #endif
+#endif
+
+// Largest message sendtoAsync() accepts, the largest payload of any RadioHead driver
+#ifndef RH_RELIABLE_MAX_MESSAGE_LEN
+ #define RH_RELIABLE_MAX_MESSAGE_LEN 251
+#endif
+
+// Returned by sendtoAsync() when the message could not be queued
+#define RH_RELIABLE_NO_HANDLE 0xff
+
+// Number of nodes whose round trip time and counters are kept. When the table is full,
+// the node sent to least recently is replaced.
+// Can be pre-defined prior to including this header.
+#ifndef RH_RELIABLE_MAX_PEERS
+ #if (RH_PLATFORM == RH_PLATFORM_RASPI) || (RH_PLATFORM == RH_PLATFORM_UNIX)
+  #define RH_RELIABLE_MAX_PEERS 32
+ #else
+  #define RH_RELIABLE_MAX_PEERS 4
+ #endif
+#endif
+
+// Upper limit of the adaptive retransmit timeout in milliseconds
+#define RH_RELIABLE_MAX_TIMEOUT 60000
+
+// Time in milliseconds a receiver is allowed to take from the end of a message to the start
+// of its ACK. Added to the time on air of the ACK for the lower limit of the adaptive timeout.
+#define RH_RELIABLE_TURNAROUND 10
+
+// Maximum number of times the adaptive timeout of a node is doubled after consecutive timeouts
+#define RH_RELIABLE_MAX_BACKOFF 6
+
+/// Function called by RHReliableDatagram::service() when an asynchronous send completes
+/// \param[in] handle The handle returned by sendtoAsync()
+/// \param[in] address The destination of the message
+/// \param[in] acked true if the message was acknowledged (or was a broadcast), false if all retries failed
+/// \param[in] arg The arg passed to sendtoAsync()
+typedef void (*RHSendCallback)(uint8_t handle, uint8_t address, bool acked, void* arg);
+
 /////////////////////////////////////////////////////////////////////
 /// \class RHReliableDatagram RHReliableDatagram.h <RHReliableDatagram.h>
 /// \brief RHDatagram subclass for sending addressed, acknowledged, retransmitted datagrams.
@@ -39,6 +87,24 @@
 /// The retransmit timeout is randomly varied between timeout and timeout*2 to prevent collisions on all
 /// retries when 2 nodes happen to start sending at the same time .
 ///
+/// \par Adaptive timeout
+///
+/// Unless disabled with setAdaptiveTimeout(), the retransmit timeout is not fixed but estimated
+/// for every node from the measured time between the end of a transmission and the arrival of its ACK,
+/// the same way TCP does (RFC 6298): a smoothed round trip time and its variation give a timeout of
+/// srtt + 4 * rttvar. Following Karn's rule, only messages acknowledged after their first transmission
+/// are measured, and every timeout doubles the timeout of that node until an ACK arrives. The timeout
+/// never drops below the time on air of the ACK as reported by the driver (RHGenericDriver::timeOnAir())
+/// plus RH_RELIABLE_TURNAROUND, so it follows the spreading factor and bandwidth of the modem without
+/// configuration. Until a node has been measured, the timeout set with setTimeout() applies,
+/// randomly varied between timeout and timeout*2 as before. The estimate of a measured node already
+/// has its margin, so the timeout actually used is only varied between timeout and timeout*1.25.
+/// peerStats() returns the estimate and the message counters of a node.
+///
+/// The adaptive timeout is enabled by default, which changes the behaviour of existing code: once a
+/// node has been measured, its retransmit timeout follows the round trip time instead of setTimeout().
+/// Call setAdaptiveTimeout(false) to keep the fixed timeout.
+///
 /// Each new message sent by sendtoWait() has its ID incremented.
 ///
 /// An ack consists of a message with:
@@ -59,7 +125,6 @@
 /// This will be recognised as "pure ALOHA". 
 /// The addition of Clear Channel Assessment (CCA) is desirable and planned.
 ///
-/// There is no message queuing or threading in RHReliableDatagram. 
 /// sendtoWait() waits until an acknowledgement is received, retransmitting
 /// up to (by default) 3 retries time with a default 200ms timeout. 
 /// During this transmit-acknowledge phase, any received message (other than the expected
@@ -69,6 +134,38 @@
 /// retransmit strategy and configuration lest they hang for a long time
 /// trying to reply to clients that are unreachable.
 ///
+/// \par Asynchronous sending
+///
+/// Where RH_RELIABLE_MAX_PENDING is not 0 (by default on RasPi and Unix), sendtoAsync()
+/// queues a message instead and returns at once. Each queued message has an entry in a
+/// fixed table with its own sequence number, retransmit deadline and attempt count.
+/// service(), called from the main loop, transmits new messages and retransmits those
+/// whose deadline has passed, and recvfromAck() matches every incoming ACK against the whole
+/// table, so messages to many nodes are in flight at the same time and the node keeps
+/// receiving while it waits for their acknowledgements. Completion is reported through the
+/// callback set with setSendCallback(), or, without a callback, by sendResult().
+///
+/// service() does not wait for a transmission to end either: it starts the transmitter and
+/// returns, and a later call finishes the attempt once RHGenericDriver::packetSent() reports
+/// the driver done, which is when the ACK timeout starts. Call it again when the driver has an
+/// event (eg RH_RF95::interruptFd() becomes readable) or after serviceTimeout().
+///
+/// Only one message per destination is on the air at a time: later messages to the same node
+/// wait in the table until the earlier one completes. This keeps them in order and matches the
+/// duplicate detection of the receiver, which only remembers the last ID seen from each node.
+///
+/// \code
+/// manager.setSendCallback(sent);
+/// manager.sendtoAsync(data, sizeof(data), 2, NULL);
+/// manager.sendtoAsync(data, sizeof(data), 3, NULL);
+/// while (1)
+/// {
+///     if (manager.recvfromAck(buf, &len, &from))
+///         handle(buf, len, from);
+///     manager.service();
+/// }
+/// \endcode
+///
 /// Caution: if you have a radio network with a mixture of slow and fast
 /// processors and ReliableDatagrams, you may be affected by race conditions
 /// where the fast processor acknowledges a message before the sender is ready
@@ -92,9 +189,18 @@ public:
     /// Caution: if you are using slow packet rates and long packets 
     /// you may need to change the timeout for reliable operations.
     /// The actual timeout is randomly varied between timeout and timeout*2.
+    /// With the adaptive timeout, this is only the timeout for nodes whose round trip time
+    /// has not been measured yet. Measured nodes use their estimate, varied between it and
+    /// 1.25 times it.
     /// \param[in] timeout The new timeout period in milliseconds
     void setTimeout(uint16_t timeout);
 
+    /// Enables or disables the adaptive per node retransmit timeout. Enabled at construction time.
+    /// When disabled, the timeout set with setTimeout() is used for all nodes, as in earlier versions.
+    /// Round trip times and counters are maintained either way.
+    /// \param[in] enable true to adapt the timeout to the measured round trip times
+    void setAdaptiveTimeout(bool enable);
+
     /// Sets the maximum number of retries. Defaults to 3 at construction time. 
     /// If set to 0, each message will only ever be sent once.
     /// sendtoWait will give up and return false if there is no ack received after all transmissions time out
@@ -119,6 +225,14 @@ public:
     /// \return true if the message was transmitted and an acknowledgement was received.
     bool sendtoWait(uint8_t* buf, uint8_t len, uint8_t address);
 
+    /// Like sendtoWait(), for a message in segments, see RHGenericDriver::sendv(). RHRouter and RHMesh
+    /// send their headers and the application data this way, without assembling the message first.
+    /// \param[in] segments The pieces of the message, in order
+    /// \param[in] count Number of segments
+    /// \param[in] address The address to send the message to.
+    /// \return true if the message was transmitted and an acknowledgement was received.
+    bool sendtoWaitv(const RHSegment* segments, uint8_t count, uint8_t address);
+
     /// If there is a valid message available for this node, send an acknowledgement to the SRC
     /// address (blocking until this is complete), then copy the message to buf and return true
     /// else return false. 
@@ -139,6 +253,15 @@ public:
     /// \return true if a valid message was copied to buf
     bool recvfromAck(uint8_t* buf, uint8_t* len, uint8_t* from = NULL, uint8_t* to = NULL, uint8_t* id = NULL, uint8_t* flags = NULL);
 
+#ifdef RH_HAVE_PACKET
+    /// Like recvfromAck(), but hands over the message as the RHPacket it was received into
+    /// instead of copying it. ACKs, duplicates and the ACKs of asynchronous sends are handled
+    /// the same way. recvfromAck() is a copy of this.
+    /// \return The packet with the message in RHPacket::payload(), the caller must release() it,
+    /// or NULL if no new message for this node is available
+    RHPacket* recvfromAckPacket();
+#endif
+
     /// Similar to recvfromAck(), this will block until either a valid message available for this node
     /// or the timeout expires. Starts the receiver automatically.
     /// You should be sure to call this function frequently enough to not miss any messages
@@ -163,6 +286,93 @@ public:
     /// to 0. 
     void resetRetransmissions(); 
 
+    /// Round trip estimate and message counters of one node, as returned by peerStats()
+    typedef struct
+    {
+	uint8_t         address;         ///< Address of the node
+	uint8_t         backoff;         ///< Consecutive timeouts, each one doubles the timeout
+	uint16_t        timeout;         ///< Retransmit timeout in milliseconds, before the random variation
+	uint32_t        srtt;            ///< Smoothed round trip time in microseconds, 0 until measured
+	uint32_t        rttvar;          ///< Round trip time variation in microseconds
+	uint32_t        samples;         ///< Number of round trip times measured
+	uint32_t        sent;            ///< Messages sent, not counting retransmissions
+	uint32_t        retransmissions; ///< Retransmissions
+	uint32_t        acked;           ///< Messages acknowledged
+	uint32_t        failed;          ///< Messages not acknowledged after all retries
+	unsigned long   lastUsed;        ///< millis() of the last transmission
+    } PeerStats;
+
+    /// Returns the round trip estimate and counters of a node.
+    /// \param[in] address The address of the node
+    /// \param[out] stats Set to the state of the node, with timeout computed for now
+    /// \return false if nothing was sent to the node (or it was dropped from the table)
+    bool peerStats(uint8_t address, PeerStats* stats);
+
+    /// Lists the nodes peerStats() knows about.
+    /// \param[out] addresses Set to the addresses of up to max nodes
+    /// \param[in] max Number of entries in addresses
+    /// \return Number of addresses set
+    uint8_t peerAddresses(uint8_t* addresses, uint8_t max);
+
+#if RH_RELIABLE_MAX_PENDING > 0
+    /// State of an asynchronous send, as returned by sendResult()
+    typedef enum
+    {
+	SendFree = 0,         ///< Handle not in use (or result already collected)
+	SendQueued,           ///< Waiting for an earlier message to the same node, or for service()
+	SendTransmitting,     ///< Being transmitted, service() starts the ACK timeout once it is sent
+	SendWaitAck,          ///< Transmitted, waiting for the ACK or the retransmit deadline
+	SendAcked,            ///< Acknowledged (or broadcast), result not yet reported
+	SendFailed,           ///< No ACK after all retries, result not yet reported
+	SendCancelled         ///< Given up while being transmitted, free once it is sent
+    } SendState;
+
+    /// Queues a message for reliable delivery and returns without waiting.
+    /// The message is copied, buf can be reused at once. It is transmitted by a later call
+    /// to service() and retransmitted with the same rules as sendtoWait(), the retries and
+    /// timeout in effect when the message is first transmitted apply.
+    /// \param[in] buf Pointer to the binary message to send
+    /// \param[in] len Number of octets to send, at most maxMessageLength()
+    /// \param[in] address The address to send the message to. Broadcasts are sent once and complete as acked.
+    /// \param[in] arg Passed to the send callback
+    /// \return Handle identifying the message in the callback and sendResult(), or
+    /// RH_RELIABLE_NO_HANDLE if the message is too long or all RH_RELIABLE_MAX_PENDING entries are in use
+    uint8_t sendtoAsync(const uint8_t* buf, uint8_t len, uint8_t address, void* arg = NULL);
+
+    /// Finishes the transmission in progress if the driver is done with it. Then, with the radio
+    /// free, starts transmitting the oldest message that is due: a retransmission whose deadline
+    /// has passed, else a queued message to a node with nothing on the air. Completes messages
+    /// that were acknowledged or ran out of retries and calls the send callback for them. Never
+    /// waits for the end of a transmission. Call it frequently, together with recvfromAck(),
+    /// which matches the ACKs.
+    /// \return true if a transmission was started
+    bool service();
+
+    /// \return Milliseconds until service() has something to do, 0 if it has now, -1 if no
+    /// message is pending. Suitable as poll() timeout. While a message is transmitted this is
+    /// the rest of its time on air, when the driver can tell it.
+    int32_t serviceTimeout();
+
+    /// Sets the function service() calls when an asynchronous send completes. With a callback,
+    /// the handle is free again as soon as the callback returns. Without one the result is
+    /// held until collected with sendResult().
+    /// \param[in] callback The function to call, or NULL to collect results with sendResult()
+    void setSendCallback(RHSendCallback callback);
+
+    /// Returns the state of an asynchronous send. Collecting SendAcked or SendFailed frees the handle.
+    /// \param[in] handle The handle returned by sendtoAsync()
+    /// \return The state of the message
+    SendState sendResult(uint8_t handle);
+
+    /// Gives up on a message. The send callback is not called for it. A message that is being
+    /// transmitted keeps its entry, and the radio, until service() finds it sent.
+    /// \param[in] handle The handle returned by sendtoAsync()
+    void cancelSend(uint8_t handle);
+
+    /// \return Number of asynchronous sends not yet completed
+    uint8_t pendingSends();
+#endif
+
 protected:
     /// Send an ACK for the message id to the given from address
     /// Blocks until the ACK has been sent
@@ -173,7 +383,78 @@ protected:
     /// \return true if there is a message received and it is a new message
     bool haveNewMessage();
 
+    /// Handles the headers of a received message: ACKs it unless it is an ACK or a broadcast,
+    /// matches the ACKs of asynchronous sends and drops duplicates
+    /// \param[in] from The FROM header
+    /// \param[in] to The TO header
+    /// \param[in] id The ID header
+    /// \param[in] flags The FLAGS header
+    /// \return true if it is a new message for the application
+    bool acceptMessage(uint8_t from, uint8_t to, uint8_t id, uint8_t flags);
+
 private:
+    /// Finds the entry of a node in the peer table
+    /// \param[in] address The address of the node
+    /// \param[in] create If true and the node is not in the table, replace the least recently used entry
+    /// \return The entry, or NULL
+    PeerStats* peer(uint8_t address, bool create);
+
+    /// \return The retransmit timeout of a node in milliseconds, before the random variation
+    uint16_t peerTimeout(PeerStats* p);
+
+    /// Counts a transmission to a node
+    /// \param[in] address The destination
+    /// \param[in] retransmission true if this is not the first transmission of the message
+    /// \return A retransmit timeout for the node with random variation, in milliseconds
+    uint16_t transmitted(uint8_t address, bool retransmission);
+
+    /// Counts an ACK from a node and updates its round trip estimate
+    /// \param[in] address The node
+    /// \param[in] rtt Time from the end of the transmission to the ACK in microseconds
+    /// \param[in] firstAttempt true if the message was transmitted once only. Otherwise it is not
+    /// known which transmission was acknowledged, and rtt is not used (Karn's rule)
+    void acked(uint8_t address, uint32_t rtt, bool firstAttempt);
+
+    /// Counts a message to a node that was not acknowledged after all retries
+    void failed(uint8_t address);
+
+#if RH_RELIABLE_MAX_PENDING > 0
+    /// An entry of the asynchronous send table
+    typedef struct
+    {
+	uint8_t         state;      ///< SendState
+	uint8_t         to;         ///< Destination
+	uint8_t         id;         ///< Sequence number, assigned on first transmission
+	uint8_t         attempts;   ///< Transmissions so far
+	uint8_t         retries;    ///< Retries allowed
+	uint8_t         len;        ///< Length of buf
+	uint32_t        serial;     ///< Order of sendtoAsync() calls
+	unsigned long   deadline;   ///< millis() when an unacknowledged message is retransmitted
+	unsigned long   sentAt;     ///< micros() at the start, then at the end of the last transmission
+	void*           arg;        ///< Passed to the callback
+	uint8_t         buf[RH_RELIABLE_MAX_MESSAGE_LEN];
+    } PendingSend;
+
+    /// Marks the entry waiting for an ACK with this id from this node as acknowledged
+    /// \return true if there was one
+    bool matchAck(uint8_t from, uint8_t id);
+
+    /// Starts transmitting an entry
+    void transmit(PendingSend& p);
+
+    /// Finishes the transmission of an entry once the driver has sent it: sets its retransmit deadline
+    void sent(PendingSend& p);
+
+    /// The asynchronous send table
+    PendingSend     _pending[RH_RELIABLE_MAX_PENDING];
+
+    /// Serial number of the next sendtoAsync()
+    uint32_t        _sendSerial;
+
+    /// Called by service() on completion, if not NULL
+    RHSendCallback  _sendCallback;
+#endif
+
     /// Count of retransmissions we have had to send
     uint32_t _retransmissions;
 
@@ -194,6 +475,13 @@ private:
     /// (this is generally due to lost ACKs, causing the sender to retransmit, even though we have already
     /// received that message)
     uint8_t _seenIds[256];
+
+    /// Round trip estimates and counters, _peerCount entries used
+    PeerStats _peers[RH_RELIABLE_MAX_PEERS];
+    uint8_t _peerCount;
+
+    /// True if the retransmit timeout adapts to the round trip time
+    bool _adaptiveTimeout;
 };
 
 /// @example rf22_reliable_datagram_client.pde
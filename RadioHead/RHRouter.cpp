@@ -156,38 +156,95 @@ uint8_t RHRouter::sendtoWait(uint8_t* buf, uint8_t len, uint8_t dest, uint8_t fl
     return sendtoFromSourceWait(buf, len, dest, _thisAddress, flags);
 }
 
+////////////////////////////////////////////////////////////////////
+uint8_t RHRouter::sendtoWaitv(const RHSegment* segments, uint8_t count, uint8_t dest, uint8_t flags)
+{
+    return sendtoFromSourceWaitv(segments, count, dest, _thisAddress, flags);
+}
+
 ////////////////////////////////////////////////////////////////////
 // Waits for delivery to the next hop (but not for delivery to the final destination)
 uint8_t RHRouter::sendtoFromSourceWait(uint8_t* buf, uint8_t len, uint8_t dest, uint8_t source, uint8_t flags)
 {
-    if (((uint16_t)len + sizeof(RoutedMessageHeader)) > _driver.maxMessageLength())
+    RHSegment segment = { buf, len };
+    return sendtoFromSourceWaitv(&segment, 1, dest, source, flags);
+}
+
+////////////////////////////////////////////////////////////////////
+uint8_t RHRouter::sendtoFromSourceWaitv(const RHSegment* segments, uint8_t count, uint8_t dest, uint8_t source, uint8_t flags)
+{
+    if (   count >= RH_MAX_SEGMENTS
+	|| RHGenericDriver::segmentsLen(segments, count) + sizeof(RoutedMessageHeader) > _driver.maxMessageLength())
 	return RH_ROUTER_ERROR_INVALID_LENGTH;
 
-    // Construct a RH RouterMessage message
-    _tmpMessage.header.source = source;
-    _tmpMessage.header.dest = dest;
-    _tmpMessage.header.hops = 0;
-    _tmpMessage.header.id = _lastE2ESequenceNumber++;
-    _tmpMessage.header.flags = flags;
-    memcpy(_tmpMessage.data, buf, len);
+    // Construct the RH RouterMessage header, the data stays where it is
+    RoutedMessageHeader header;
+    header.source = source;
+    header.dest = dest;
+    header.hops = 0;
+    header.id = _lastE2ESequenceNumber++;
+    header.flags = flags;
+
+    return routev(&header, segments, count);
+}
+
+#if RH_RELIABLE_MAX_PENDING > 0
+////////////////////////////////////////////////////////////////////
+uint8_t RHRouter::sendtoAsync(const uint8_t* buf, uint8_t len, uint8_t dest, uint8_t flags, void* arg)
+{
+    if (((uint16_t)len + sizeof(RoutedMessageHeader)) > _driver.maxMessageLength())
+	return RH_RELIABLE_NO_HANDLE;
+
+    uint8_t next_hop = RH_BROADCAST_ADDRESS;
+    if (dest != RH_BROADCAST_ADDRESS)
+    {
+	RoutingTableEntry* route = getRouteTo(dest);
+	if (!route)
+	    return RH_RELIABLE_NO_HANDLE;
+	next_hop = route->next_hop;
+    }
+
+    // Not _tmpMessage, a blocking send may be using it. sendtoAsync() copies the message
+    RoutedMessage message;
+    message.header.source = _thisAddress;
+    message.header.dest = dest;
+    message.header.hops = 0;
+    message.header.id = _lastE2ESequenceNumber++;
+    message.header.flags = flags;
+    memcpy(message.data, buf, len);
 
-    return route(&_tmpMessage, sizeof(RoutedMessageHeader)+len);
+    return RHReliableDatagram::sendtoAsync((uint8_t*)&message, sizeof(RoutedMessageHeader) + len, next_hop, arg);
 }
+#endif
 
 ////////////////////////////////////////////////////////////////////
 uint8_t RHRouter::route(RoutedMessage* message, uint8_t messageLen)
+{
+    RHSegment segment = { message->data, (uint8_t)(messageLen - sizeof(RoutedMessageHeader)) };
+    return routev(&message->header, &segment, 1);
+}
+
+////////////////////////////////////////////////////////////////////
+uint8_t RHRouter::routev(RoutedMessageHeader* header, const RHSegment* segments, uint8_t count)
 {
     // Reliably deliver it if possible. See if we have a route:
     uint8_t next_hop = RH_BROADCAST_ADDRESS;
-    if (message->header.dest != RH_BROADCAST_ADDRESS)
+    if (header->dest != RH_BROADCAST_ADDRESS)
     {
-	RoutingTableEntry* route = getRouteTo(message->header.dest);
+	RoutingTableEntry* route = getRouteTo(header->dest);
 	if (!route)
 	    return RH_ROUTER_ERROR_NO_ROUTE;
 	next_hop = route->next_hop;
     }
 
-    if (!RHReliableDatagram::sendtoWait((uint8_t*)message, messageLen, next_hop))
+    // The header goes out as the first segment
+    if (count >= RH_MAX_SEGMENTS)
+	return RH_ROUTER_ERROR_INVALID_LENGTH;
+    RHSegment message[RH_MAX_SEGMENTS];
+    message[0].data = (const uint8_t*)header;
+    message[0].len = sizeof(RoutedMessageHeader);
+    memcpy(message + 1, segments, count * sizeof(RHSegment));
+    if (!RHReliableDatagram::sendtoWaitv(message, count + 1, next_hop))
 	return RH_ROUTER_ERROR_UNABLE_TO_DELIVER;
 
     return RH_ROUTER_ERROR_NONE;
@@ -201,92 +258,131 @@ void RHRouter::peekAtMessage(RoutedMessage* message, uint8_t messageLen)
 }
 
 ////////////////////////////////////////////////////////////////////
-bool RHRouter::recvfromAck(uint8_t* buf, uint8_t* len, uint8_t* source, uint8_t* dest, uint8_t* id, uint8_t* flags)
-{  
-    uint8_t tmpMessageLen = sizeof(_tmpMessage);
-    uint8_t _from;
-    uint8_t _to;
-    uint8_t _id;
-    uint8_t _flags;
-    if (RHReliableDatagram::recvfromAck((uint8_t*)&_tmpMessage, &tmpMessageLen, &_from, &_to, &_id, &_flags))
-    {
-	// Here we simulate networks with limited visibility between nodes
-	// so we can test routing
+bool RHRouter::handleReceived(RoutedMessage* message, uint8_t messageLen, uint8_t from)
+{
+    // Here we simulate networks with limited visibility between nodes
+    // so we can test routing
 #ifdef RH_TEST_NETWORK
-	if (
+    if (
 #if RH_TEST_NETWORK==1
-	    // This network looks like 1-2-3-4
-	       (_thisAddress == 1 && _from == 2)
-	    || (_thisAddress == 2 && (_from == 1 || _from == 3))
-	    || (_thisAddress == 3 && (_from == 2 || _from == 4))
-	    || (_thisAddress == 4 && _from == 3)
+	// This network looks like 1-2-3-4
+	   (_thisAddress == 1 && from == 2)
+	|| (_thisAddress == 2 && (from == 1 || from == 3))
+	|| (_thisAddress == 3 && (from == 2 || from == 4))
+	|| (_thisAddress == 4 && from == 3)
 	    
 #elif RH_TEST_NETWORK==2
-	       // This network looks like 1-2-4
-	       //                         | | |
-	       //                         --3--
-	       (_thisAddress == 1 && (_from == 2 || _from == 3))
-	    ||  _thisAddress == 2
-	    ||  _thisAddress == 3
-	    || (_thisAddress == 4 && (_from == 2 || _from == 3))
+	   // This network looks like 1-2-4
+	   //                         | | |
+	   //                         --3--
+	   (_thisAddress == 1 && (from == 2 || from == 3))
+	||  _thisAddress == 2
+	||  _thisAddress == 3
+	|| (_thisAddress == 4 && (from == 2 || from == 3))
 
 #elif RH_TEST_NETWORK==3
-	       // This network looks like 1-2-4
-	       //                         |   |
-	       //                         --3--
-	       (_thisAddress == 1 && (_from == 2 || _from == 3))
-	    || (_thisAddress == 2 && (_from == 1 || _from == 4))
-	    || (_thisAddress == 3 && (_from == 1 || _from == 4))
-	    || (_thisAddress == 4 && (_from == 2 || _from == 3))
+	   // This network looks like 1-2-4
+	   //                         |   |
+	   //                         --3--
+	   (_thisAddress == 1 && (from == 2 || from == 3))
+	|| (_thisAddress == 2 && (from == 1 || from == 4))
+	|| (_thisAddress == 3 && (from == 1 || from == 4))
+	|| (_thisAddress == 4 && (from == 2 || from == 3))
 
 #elif RH_TEST_NETWORK==4
-	       // This network looks like 1-2-3
-	       //                           |
-	       //                           4
-	       (_thisAddress == 1 && _from == 2)
-	    ||  _thisAddress == 2
-	    || (_thisAddress == 3 && _from == 2)
-	    || (_thisAddress == 4 && _from == 2)
+	   // This network looks like 1-2-3
+	   //                           |
+	   //                           4
+	   (_thisAddress == 1 && from == 2)
+	||  _thisAddress == 2
+	|| (_thisAddress == 3 && from == 2)
+	|| (_thisAddress == 4 && from == 2)
 
 #endif
 )
-	{
-	    // OK
-	}
-	else
-	{
-	    return false; // Pretend we got nothing
-	}
+    {
+	// OK
+    }
+    else
+    {
+	return false; // Pretend we got nothing
+    }
 #endif
 
-	peekAtMessage(&_tmpMessage, tmpMessageLen);
-	// See if its for us or has to be routed
-	if (_tmpMessage.header.dest == _thisAddress || _tmpMessage.header.dest == RH_BROADCAST_ADDRESS)
-	{
-	    // Deliver it here
-	    if (source) *source  = _tmpMessage.header.source;
-	    if (dest)   *dest    = _tmpMessage.header.dest;
-	    if (id)     *id      = _tmpMessage.header.id;
-	    if (flags)  *flags   = _tmpMessage.header.flags;
-	    uint8_t msgLen = tmpMessageLen - sizeof(RoutedMessageHeader);
-	    if (*len > msgLen)
-		*len = msgLen;
-	    memcpy(buf, _tmpMessage.data, *len);
-	    return true; // Its for you!
-	}
-	else if (   _tmpMessage.header.dest != RH_BROADCAST_ADDRESS
-		 && _tmpMessage.header.hops++ < _max_hops)
-	{
-	    // Maybe it has to be routed to the next hop
-	    // REVISIT: if it fails due to no route or unable to deliver to the next hop, 
-	    // tell the originator. BUT HOW?
-	    route(&_tmpMessage, tmpMessageLen);
-	}
-	// Discard it and maybe wait for another
+    peekAtMessage(message, messageLen);
+    // See if its for us or has to be routed
+    if (message->header.dest == _thisAddress || message->header.dest == RH_BROADCAST_ADDRESS)
+	return true; // Its for you!
+    else if (   message->header.dest != RH_BROADCAST_ADDRESS
+	     && message->header.hops++ < _max_hops)
+    {
+	// Maybe it has to be routed to the next hop
+	// REVISIT: if it fails due to no route or unable to deliver to the next hop, 
+	// tell the originator. BUT HOW?
+	route(message, messageLen);
     }
+    // Discard it and maybe wait for another
     return false;
 }
 
+#ifdef RH_HAVE_PACKET
+RHRouter::RoutedMessageHeader* RHRouter::routedHeader(RHPacket* packet)
+{
+    return (RoutedMessageHeader*)packet->at(RH_PACKET_HEADER_LEN);
+}
+
+RHPacket* RHRouter::recvfromAckPacket()
+{
+    RHPacket* packet = RHReliableDatagram::recvfromAckPacket();
+    if (!packet)
+	return NULL;
+    // The routed message is viewed and forwarded where it was received, the payload
+    // left for the application starts after its header
+    uint8_t messageLen = packet->payloadLen();
+    RoutedMessage* message = (RoutedMessage*)packet->pull(sizeof(RoutedMessageHeader));
+    if (message && handleReceived(message, messageLen, packet->headerFrom()))
+	return packet;
+    packet->release();
+    return NULL;
+}
+
+bool RHRouter::recvfromAck(uint8_t* buf, uint8_t* len, uint8_t* source, uint8_t* dest, uint8_t* id, uint8_t* flags)
+{
+    RHPacket* packet = recvfromAckPacket();
+    if (!packet)
+	return false;
+    RoutedMessageHeader* header = routedHeader(packet);
+    if (source) *source  = header->source;
+    if (dest)   *dest    = header->dest;
+    if (id)     *id      = header->id;
+    if (flags)  *flags   = header->flags;
+    packet->copyPayload(buf, len);
+    packet->release();
+    return true;
+}
+#else
+bool RHRouter::recvfromAck(uint8_t* buf, uint8_t* len, uint8_t* source, uint8_t* dest, uint8_t* id, uint8_t* flags)
+{  
+    uint8_t tmpMessageLen = sizeof(_tmpMessage);
+    uint8_t _from;
+    if (RHReliableDatagram::recvfromAck((uint8_t*)&_tmpMessage, &tmpMessageLen, &_from)
+	&& handleReceived(&_tmpMessage, tmpMessageLen, _from))
+    {
+	// Deliver it here
+	if (source) *source  = _tmpMessage.header.source;
+	if (dest)   *dest    = _tmpMessage.header.dest;
+	if (id)     *id      = _tmpMessage.header.id;
+	if (flags)  *flags   = _tmpMessage.header.flags;
+	uint8_t msgLen = tmpMessageLen - sizeof(RoutedMessageHeader);
+	if (*len > msgLen)
+	    *len = msgLen;
+	memcpy(buf, _tmpMessage.data, *len);
+	return true;
+    }
+    return false;
+}
+#endif
+
 ////////////////////////////////////////////////////////////////////
 bool RHRouter::recvfromAckTimeout(uint8_t* buf, uint8_t* len, uint16_t timeout, uint8_t* source, uint8_t* dest, uint8_t* id, uint8_t* flags)
 {  
@@ -231,6 +231,15 @@ public:
     ///           (usually because it dod not acknowledge due to being off the air or out of range
     uint8_t sendtoWait(uint8_t* buf, uint8_t len, uint8_t dest, uint8_t flags = 0);
 
+    /// Like sendtoWait(), for application data in segments, see RHGenericDriver::sendv().
+    /// The RHRouter header is sent as another segment in front of them, nothing is copied.
+    /// \param [in] segments The pieces of the application message data, in order
+    /// \param [in] count Number of segments, less than RH_MAX_SEGMENTS
+    /// \param [in] dest The destination node address
+    /// \param [in] flags Optional flags delivered end-to-end to the dest address
+    /// \return The result code, as sendtoWait()
+    uint8_t sendtoWaitv(const RHSegment* segments, uint8_t count, uint8_t dest, uint8_t flags = 0);
+
     /// Similar to sendtoWait() above, but spoofs the source address.
     /// For internal use only during routing
     /// \param [in] buf The application message data.
@@ -247,6 +256,30 @@ public:
     ///           (usually because it dod not acknowledge due to being off the air or out of range
     uint8_t sendtoFromSourceWait(uint8_t* buf, uint8_t len, uint8_t dest, uint8_t source, uint8_t flags = 0);
 
+    /// Like sendtoFromSourceWait(), for application data in segments
+    /// \param [in] segments The pieces of the application message data, in order
+    /// \param [in] count Number of segments, less than RH_MAX_SEGMENTS
+    /// \param [in] dest The destination node address.
+    /// \param [in] source The (fake) originating node address.
+    /// \param [in] flags Optional flags delivered end-to-end to the dest address
+    /// \return The result code, as sendtoFromSourceWait()
+    uint8_t sendtoFromSourceWaitv(const RHSegment* segments, uint8_t count, uint8_t dest, uint8_t source, uint8_t flags = 0);
+
+#if RH_RELIABLE_MAX_PENDING > 0
+    /// Like sendtoWait(), but queues the message to the next hop with RHReliableDatagram::sendtoAsync()
+    /// and returns without waiting. The routing table is looked up now, the message is
+    /// transmitted by a later service() and its completion reported like that of sendtoAsync()
+    /// (for the next hop, not the final dest address).
+    /// \param [in] buf The application message data. Copied, can be reused at once.
+    /// \param [in] len Number of octets in the application message data. 0 is permitted
+    /// \param [in] dest The destination node address
+    /// \param [in] flags Optional flags delivered end-to-end to the dest address
+    /// \param [in] arg Passed to the send callback
+    /// \return Handle of the message to the next hop, or RH_RELIABLE_NO_HANDLE if the message
+    /// is too long, there is no route for dest or the asynchronous send table is full
+    uint8_t sendtoAsync(const uint8_t* buf, uint8_t len, uint8_t dest, uint8_t flags = 0, void* arg = NULL);
+#endif
+
     /// Starts the receiver if it is not running already.
     /// If there is a valid message available for this node (or RH_BROADCAST_ADDRESS), 
     /// send an acknowledgement to the last hop
@@ -269,6 +302,19 @@ public:
     /// \return true if a valid message was recvived for this node copied to buf
     bool recvfromAck(uint8_t* buf, uint8_t* len, uint8_t* source = NULL, uint8_t* dest = NULL, uint8_t* id = NULL, uint8_t* flags = NULL);
 
+#ifdef RH_HAVE_PACKET
+    /// Like recvfromAck(), but hands over the message as the RHPacket it was received into.
+    /// Messages for other nodes are routed on from the packet, without copying them either.
+    /// \return The packet, with the application data in RHPacket::payload() and the SOURCE,
+    /// DEST, ID and FLAGS in routedHeader(). The caller must release() it.
+    /// NULL if no message for this node is available
+    RHPacket* recvfromAckPacket();
+
+    /// \param[in] packet A packet from recvfromAckPacket()
+    /// \return The end-to-end header of the message in the packet
+    static RoutedMessageHeader* routedHeader(RHPacket* packet);
+#endif
+
     /// Starts the receiver if it is not running already.
     /// Similar to recvfromAck(), this will block until either a valid message available for this node
     /// or the timeout expires. 
@@ -294,11 +340,28 @@ protected:
 
     /// Finds the next-hop route and sends the message via RHReliableDatagram::sendtoWait().
     /// This is virtual, which lets subclasses override or intercept the route() function.
-    /// Called by sendtoWait after the message header has been filled in.
+    /// Called to forward received messages. The default passes the message on to routev()
     /// \param [in] message Pointer to the RHRouter message to be sent.
     /// \param [in] messageLen Length of message in octets
     virtual uint8_t route(RoutedMessage* message, uint8_t messageLen);
 
+    /// Finds the next-hop route and sends the header and the segments of the data after it
+    /// via RHReliableDatagram::sendtoWaitv(). Every message sent or forwarded goes through here:
+    /// called by sendtoWait() after the message header has been filled in, and by route().
+    /// Virtual, so subclasses can override or intercept it.
+    /// \param [in] header The RHRouter header of the message
+    /// \param [in] segments The pieces of the data, in order
+    /// \param [in] count Number of segments, less than RH_MAX_SEGMENTS
+    virtual uint8_t routev(RoutedMessageHeader* header, const RHSegment* segments, uint8_t count);
+
+    /// Handles a message received from the next hop: lets peekAtMessage() see it, and routes it
+    /// on, in place, if it is for another node
+    /// \param [in] message Pointer to the RHRouter message that was received
+    /// \param [in] messageLen Length of message in octets
+    /// \param [in] from The node it was received from
+    /// \return true if it is for this node
+    bool handleReceived(RoutedMessage* message, uint8_t messageLen, uint8_t from);
+
     /// Deletes a specific rout entry from therouting table
     /// \param [in] index The 0 based index of the routing table entry to delete
     void deleteRoute(uint8_t index);
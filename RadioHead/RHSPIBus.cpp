@@ -0,0 +1,112 @@
+// RHSPIBus.cpp
+//
+// Shares one SPI interface between several drivers that may run on different threads.
+
+#include <RHSPIBus.h>
+
+#ifdef RH_HAVE_SPI_BUS
+
+RHSPIBus::RHSPIBus(RHGenericSPI& spi)
+    :
+    RHGenericSPI(),
+    _spi(spi),
+    _users(0),
+    _slaveCount(0),
+    _transactions(0),
+    _contended(0)
+{
+    pthread_mutex_init(&_lock, NULL);
+}
+
+RHSPIBus::~RHSPIBus()
+{
+    pthread_mutex_destroy(&_lock);
+}
+
+bool RHSPIBus::addSlaveSelect(uint8_t pin)
+{
+    for (uint8_t i = 0; i < _slaveCount; i++)
+	if (_slaves[i] == pin)
+	    return true;
+    if (_slaveCount >= RH_SPI_BUS_MAX_SLAVES)
+	return false;
+    _slaves[_slaveCount++] = pin;
+    return true;
+}
+
+uint8_t RHSPIBus::transfer(uint8_t data)
+{
+    return _spi.transfer(data);
+}
+
+void RHSPIBus::transferBuffer(const uint8_t* src, uint8_t* dest, uint16_t len)
+{
+    _spi.transferBuffer(src, dest, len);
+}
+
+void RHSPIBus::begin()
+{
+    pthread_mutex_lock(&_lock);
+    if (_users++ == 0)
+    {
+	_spi.begin();
+	// Every device is deselected before the first transaction on the bus
+	for (uint8_t i = 0; i < _slaveCount; i++)
+	{
+	    pinMode(_slaves[i], OUTPUT);
+	    digitalWrite(_slaves[i], HIGH);
+	}
+    }
+    pthread_mutex_unlock(&_lock);
+}
+
+void RHSPIBus::end()
+{
+    pthread_mutex_lock(&_lock);
+    if (_users && --_users == 0)
+	_spi.end();
+    pthread_mutex_unlock(&_lock);
+}
+
+void RHSPIBus::beginTransaction()
+{
+    // Uncontended this is a single atomic operation
+    if (pthread_mutex_trylock(&_lock) != 0)
+    {
+	pthread_mutex_lock(&_lock);
+	_contended.fetch_add(1, std::memory_order_relaxed);
+    }
+    _transactions.fetch_add(1, std::memory_order_relaxed);
+}
+
+void RHSPIBus::endTransaction()
+{
+    pthread_mutex_unlock(&_lock);
+}
+
+void RHSPIBus::setBitOrder(BitOrder bitOrder)
+{
+    _spi.setBitOrder(bitOrder);
+}
+
+void RHSPIBus::setDataMode(DataMode dataMode)
+{
+    _spi.setDataMode(dataMode);
+}
+
+void RHSPIBus::setFrequency(Frequency frequency)
+{
+    _spi.setFrequency(frequency);
+}
+
+uint32_t RHSPIBus::transactions()
+{
+    return _transactions.load(std::memory_order_relaxed);
+}
+
+uint32_t RHSPIBus::contended()
+{
+    return _contended.load(std::memory_order_relaxed);
+}
+
+#endif
@@ -0,0 +1,120 @@
+// RHSPIBus.h
+//
+// Shares one SPI interface between several drivers that may run on different threads.
+
+#ifndef RHSPIBus_h
+#define RHSPIBus_h
+
+#include <RHGenericSPI.h>
+
+#ifdef RH_HAVE_SPI_BUS
+
+#include <pthread.h>
+#include <atomic>
+
+// Maximum number of slave select pins one bus deselects in begin()
+#define RH_SPI_BUS_MAX_SLAVES 8
+
+/////////////////////////////////////////////////////////////////////
+/// \class RHSPIBus RHSPIBus.h <RHSPIBus.h>
+/// \brief Arbitrates one SPI interface between several RHSPIDriver instances
+///
+/// The bus wraps the RHGenericSPI that talks to the controller (RHHardwareSPI or RHSpidevSPI)
+/// and is itself passed to the drivers in its place. RHSPIDriver brackets every register access
+/// and burst with beginTransaction() and endTransaction(), so the bus holds a mutex from the
+/// moment a driver pulls its slave select low until it releases it. Drivers serviced by
+/// different threads then never interleave on the bus, and a thread only waits while another
+/// one is in the middle of a transfer.
+///
+/// begin() starts the underlying interface only once, however many drivers call it from their
+/// init(), and then drives all slave select pins registered with addSlaveSelect() high. Since
+/// the controller is not reinitialised later, the slave select pins of other modules stay
+/// deselected without being set up again for every transaction.
+///
+/// \code
+/// RHSPIBus bus(hardware_spi);
+/// RH_RF95 rf95a(8, 25, bus);
+/// RH_RF95 rf95b(7, 16, bus);
+/// bus.addSlaveSelect(8);
+/// bus.addSlaveSelect(7);
+/// \endcode
+class RHSPIBus : public RHGenericSPI
+{
+public:
+    /// Constructor
+    /// \param[in] spi The SPI interface shared on this bus
+    RHSPIBus(RHGenericSPI& spi);
+
+    /// Destructor
+    ~RHSPIBus();
+
+    /// Registers the slave select pin of a device on this bus, so begin() deselects it
+    /// before any device is accessed. Call before the first begin().
+    /// \param[in] pin The slave select pin
+    /// \return false if RH_SPI_BUS_MAX_SLAVES pins are already registered
+    bool addSlaveSelect(uint8_t pin);
+
+    /// Transfer a single octet. Call between beginTransaction() and endTransaction()
+    /// \param[in] data The octet to send
+    /// \return The octet read from SPI while the data octet was sent
+    uint8_t transfer(uint8_t data);
+
+    /// Transfer a buffer in one full duplex transfer. Call between beginTransaction() and endTransaction()
+    /// \param[in] src The octets to send, len octets
+    /// \param[out] dest The octets read while src was sent, len octets. May be the same buffer as src
+    /// \param[in] len Number of octets to transfer
+    void transferBuffer(const uint8_t* src, uint8_t* dest, uint16_t len);
+
+    /// Starts the underlying interface on the first call and deselects all registered slaves.
+    /// Later calls do nothing.
+    void begin();
+
+    /// Stops the underlying interface once every begin() has been matched by an end()
+    void end();
+
+    /// Waits until the bus is free and takes it
+    void beginTransaction();
+
+    /// Releases the bus
+    void endTransaction();
+
+    /// Sets the bit order of the underlying interface
+    /// \param[in] bitOrder Bit order to be used: one of RHGenericSPI::BitOrder
+    void setBitOrder(BitOrder bitOrder);
+
+    /// Sets the data mode of the underlying interface
+    /// \param[in] dataMode The mode to use: one of RHGenericSPI::DataMode
+    void setDataMode(DataMode dataMode);
+
+    /// Sets the frequency of the underlying interface
+    /// \param[in] frequency The data rate to use: one of RHGenericSPI::Frequency
+    void setFrequency(Frequency frequency);
+
+    /// \return Number of transactions since construction
+    uint32_t transactions();
+
+    /// \return Number of transactions that had to wait for another one to finish
+    uint32_t contended();
+
+private:
+    /// The interface all transfers go to
+    RHGenericSPI&       _spi;
+
+    /// Held from beginTransaction() to endTransaction()
+    pthread_mutex_t     _lock;
+
+    /// Number of begin() calls not yet matched by end()
+    uint16_t            _users;
+
+    /// Slave select pins deselected by begin()
+    uint8_t             _slaves[RH_SPI_BUS_MAX_SLAVES];
+    uint8_t             _slaveCount;
+
+    /// Statistics, only changed with _lock held but read by any thread
+    std::atomic<uint32_t> _transactions;
+    std::atomic<uint32_t> _contended;
+};
+
+#endif
+
+#endif
@@ -29,56 +29,76 @@ bool RHSPIDriver::init()
 
 uint8_t RHSPIDriver::spiRead(uint8_t reg)
 {
-    uint8_t val;
-    RPI_CE0_CE1_FIX;
+    uint8_t buf[2];
+    buf[0] = reg & ~RH_SPI_WRITE_MASK; // Send the address with the write mask off
+    buf[1] = 0; // The written value is ignored, reg value is read
+    _spi.beginTransaction();
     ATOMIC_BLOCK_START;
     digitalWrite(_slaveSelectPin, LOW);
-    _spi.transfer(reg & ~RH_SPI_WRITE_MASK); // Send the address with the write mask off
-    val = _spi.transfer(0); // The written value is ignored, reg value is read
+    _spi.transferBuffer(buf, buf, sizeof(buf));
     digitalWrite(_slaveSelectPin, HIGH);
     ATOMIC_BLOCK_END;
-    return val;
+    _spi.endTransaction();
+    return buf[1];
 }
 
 uint8_t RHSPIDriver::spiWrite(uint8_t reg, uint8_t val)
 {
-    uint8_t status = 0;
-    RPI_CE0_CE1_FIX;
+    uint8_t buf[2];
+    buf[0] = reg | RH_SPI_WRITE_MASK; // Send the address with the write mask on
+    buf[1] = val; // New value follows
+    _spi.beginTransaction();
     ATOMIC_BLOCK_START;
     digitalWrite(_slaveSelectPin, LOW);
-    status = _spi.transfer(reg | RH_SPI_WRITE_MASK); // Send the address with the write mask on
-    _spi.transfer(val); // New value follows
+    _spi.transferBuffer(buf, buf, sizeof(buf));
     digitalWrite(_slaveSelectPin, HIGH);
     ATOMIC_BLOCK_END;
-    return status;
+    _spi.endTransaction();
+    return buf[0];
 }
 
 uint8_t RHSPIDriver::spiBurstRead(uint8_t reg, uint8_t* dest, uint8_t len)
 {
-    uint8_t status = 0;
-    RPI_CE0_CE1_FIX;
+    // Address and data go out as one transfer
+    uint8_t buf[RH_SPI_MAX_BURST + 1];
+    buf[0] = reg & ~RH_SPI_WRITE_MASK; // Send the start address with the write mask off
+    memset(buf + 1, 0, len);
+    _spi.beginTransaction();
     ATOMIC_BLOCK_START;
     digitalWrite(_slaveSelectPin, LOW);
-    status = _spi.transfer(reg & ~RH_SPI_WRITE_MASK); // Send the start address with the write mask off
-    while (len--)
-	*dest++ = _spi.transfer(0);
+    _spi.transferBuffer(buf, buf, len + 1);
     digitalWrite(_slaveSelectPin, HIGH);
     ATOMIC_BLOCK_END;
-    return status;
+    _spi.endTransaction();
+    memcpy(dest, buf + 1, len);
+    return buf[0];
 }
 
 uint8_t RHSPIDriver::spiBurstWrite(uint8_t reg, const uint8_t* src, uint8_t len)
 {
-    uint8_t status = 0;
-    RPI_CE0_CE1_FIX;
+    RHSegment segment = { src, len };
+    return spiBurstWritev(reg, &segment, 1);
+}
+
+uint8_t RHSPIDriver::spiBurstWritev(uint8_t reg, const RHSegment* segments, uint8_t count)
+{
+    // Address and all segments go out as one transfer
+    uint8_t buf[RH_SPI_MAX_BURST + 1];
+    buf[0] = reg | RH_SPI_WRITE_MASK; // Send the start address with the write mask on
+    uint16_t len = 0;
+    for (uint8_t i = 0; i < count && len + segments[i].len <= RH_SPI_MAX_BURST; i++)
+    {
+	memcpy(buf + 1 + len, segments[i].data, segments[i].len);
+	len += segments[i].len;
+    }
+    _spi.beginTransaction();
     ATOMIC_BLOCK_START;
     digitalWrite(_slaveSelectPin, LOW);
-    status = _spi.transfer(reg | RH_SPI_WRITE_MASK); // Send the start address with the write mask on
-    while (len--)
-	_spi.transfer(*src++);
+    _spi.transferBuffer(buf, buf, len + 1);
     digitalWrite(_slaveSelectPin, HIGH);
     ATOMIC_BLOCK_END;
-    return status;
+    _spi.endTransaction();
+    return buf[0];
 }
 
 void RHSPIDriver::setSlaveSelectPin(uint8_t slaveSelectPin)
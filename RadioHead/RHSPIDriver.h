@@ -12,21 +12,8 @@
 // This is the bit in the SPI address that marks it as a write
 #define RH_SPI_WRITE_MASK 0x80
 
-#if (RH_PLATFORM == RH_PLATFORM_RASPI)
-#define RPI_CE0_CE1_FIX { \
-          if (_slaveSelectPin!=7) {   \
-            bcm2835_gpio_fsel(7,BCM2835_GPIO_FSEL_OUTP); \
-            bcm2835_gpio_write(7,HIGH); \
-          }                           \
-          if (_slaveSelectPin!=8) {   \
-            bcm2835_gpio_fsel(8,BCM2835_GPIO_FSEL_OUTP); \
-            bcm2835_gpio_write(8,HIGH); \
-          }                           \
-        }
-#else
-#define RPI_CE0_CE1_FIX {}
-#endif
-
+// Maximum number of data octets in one burst read or write
+#define RH_SPI_MAX_BURST 255
 
 class RHGenericSPI;
 
@@ -42,6 +29,9 @@ class RHGenericSPI;
 ///
 /// SPI bus access is protected by ATOMIC_BLOCK_START and ATOMIC_BLOCK_END, which will ensure interrupts 
 /// are disabled during access.
+/// Each access is also bracketed by RHGenericSPI::beginTransaction() and RHGenericSPI::endTransaction(),
+/// so drivers sharing an RHSPIBus from different threads get the bus to themselves while their
+/// slave select is low.
 /// 
 /// The read and write routines implement commonly used SPI conventions: specifically that the MSB
 /// of the first byte transmitted indicates that it is a write and the remaining bits indicate the rehgister to access)
@@ -93,6 +83,15 @@ public:
     ///  it may or may not be meaningfule depending on the the type of device being accessed.
     uint8_t           spiBurstWrite(uint8_t reg, const uint8_t* src, uint8_t len);
 
+    /// Writes the segments one after the other to consecutive registers, or a FIFO, in one burst
+    /// with slave select held low for the whole message
+    /// \param[in] reg Register number of the first register
+    /// \param[in] segments The values to write, at most RH_SPI_MAX_BURST octets in all
+    /// \param[in] count Number of segments
+    /// \return Some devices return a status byte during the first data transfer. This byte is returned.
+    ///  it may or may not be meaningfule depending on the the type of device being accessed.
+    uint8_t           spiBurstWritev(uint8_t reg, const RHSegment* segments, uint8_t count);
+
     /// Set or change the pin to be used for SPI slave select.
     /// This can be called at any time to change the
     /// pin that will be used for slave select in subsquent SPI operations.
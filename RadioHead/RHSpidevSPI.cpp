@@ -0,0 +1,145 @@
+// RHSpidevSPI.cpp
+//
+// SPI bus access through the Linux spidev driver
+
+#include <RHSpidevSPI.h>
+
+#ifdef RH_HAVE_SPIDEV
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <linux/spi/spidev.h>
+
+RHSpidevSPI::RHSpidevSPI(const char* device, uint32_t speed, BitOrder bitOrder, DataMode dataMode)
+    :
+    RHGenericSPI(Frequency8MHz, bitOrder, dataMode),
+    _fd(-1),
+    _speed(0)
+{
+    setDevice(device);
+    setSpeed(speed);
+}
+
+RHSpidevSPI::~RHSpidevSPI()
+{
+    end();
+}
+
+uint8_t RHSpidevSPI::transfer(uint8_t data)
+{
+    transferBuffer(&data, &data, 1);
+    return data;
+}
+
+void RHSpidevSPI::transferBuffer(const uint8_t* src, uint8_t* dest, uint16_t len)
+{
+    struct spi_ioc_transfer xfer;
+    memset(&xfer, 0, sizeof(xfer));
+    xfer.tx_buf = (unsigned long)src;
+    xfer.rx_buf = (unsigned long)dest;
+    xfer.len = len;
+    xfer.speed_hz = _speed;
+    xfer.bits_per_word = 8;
+    if (_fd < 0 || ioctl(_fd, SPI_IOC_MESSAGE(1), &xfer) < 0)
+	memset(dest, 0, len);
+}
+
+void RHSpidevSPI::begin()
+{
+    end();
+    _fd = open(_device, O_RDWR | O_CLOEXEC);
+    if (_fd < 0)
+	return;
+
+    uint8_t mode;
+    if (_dataMode == DataMode1)
+	mode = SPI_MODE_1;
+    else if (_dataMode == DataMode2)
+	mode = SPI_MODE_2;
+    else if (_dataMode == DataMode3)
+	mode = SPI_MODE_3;
+    else
+	mode = SPI_MODE_0;
+
+    // The driver toggles its slave select pin itself. Controllers that cannot
+    // leave chip select alone still work if the kernel CS is a different pin
+    uint8_t modeNoCs = mode | SPI_NO_CS;
+    if (ioctl(_fd, SPI_IOC_WR_MODE, &modeNoCs) < 0 && ioctl(_fd, SPI_IOC_WR_MODE, &mode) < 0)
+    {
+	end();
+	return;
+    }
+
+    uint8_t lsbFirst = (_bitOrder == BitOrderLSBFirst);
+    uint8_t bits = 8;
+    if (ioctl(_fd, SPI_IOC_WR_LSB_FIRST, &lsbFirst) < 0
+	|| ioctl(_fd, SPI_IOC_WR_BITS_PER_WORD, &bits) < 0
+	|| ioctl(_fd, SPI_IOC_WR_MAX_SPEED_HZ, &_speed) < 0)
+    {
+	end();
+	return;
+    }
+
+    // Same as SPIClass::begin(): the spi0 overlay gives CE0 and CE1 to the controller
+    SPIClass::deselectChipEnables();
+}
+
+void RHSpidevSPI::end()
+{
+    if (_fd >= 0)
+	close(_fd);
+    _fd = -1;
+}
+
+void RHSpidevSPI::setSpeed(uint32_t speed)
+{
+    if (speed == 0 || speed > RH_SPIDEV_MAX_SPEED)
+	speed = RH_SPIDEV_MAX_SPEED;
+    _speed = speed;
+    // Each transfer carries its own speed, this only sets the default of the device
+    if (_fd >= 0)
+	ioctl(_fd, SPI_IOC_WR_MAX_SPEED_HZ, &_speed);
+}
+
+void RHSpidevSPI::setFrequency(Frequency frequency)
+{
+    RHGenericSPI::setFrequency(frequency);
+    switch (frequency)
+    {
+	case Frequency1MHz:
+	default:
+	    setSpeed(1000000);
+	    break;
+	case Frequency2MHz:
+	    setSpeed(2000000);
+	    break;
+	case Frequency4MHz:
+	    setSpeed(4000000);
+	    break;
+	case Frequency8MHz:
+	    setSpeed(8000000);
+	    break;
+	case Frequency16MHz:
+	    setSpeed(RH_SPIDEV_MAX_SPEED);
+	    break;
+    }
+}
+
+void RHSpidevSPI::setDevice(const char* device)
+{
+    strncpy(_device, device ? device : RH_SPIDEV_DEFAULT_DEVICE, sizeof(_device) - 1);
+    _device[sizeof(_device) - 1] = '\0';
+}
+
+bool RHSpidevSPI::isOpen()
+{
+    return _fd >= 0;
+}
+
+uint32_t RHSpidevSPI::speed()
+{
+    return _speed;
+}
+
+#endif // RH_HAVE_SPIDEV
@@ -0,0 +1,106 @@
+// RHSpidevSPI.h
+//
+// SPI bus access through the Linux spidev driver (/dev/spidevX.Y), transferring
+// whole register bursts in one kernel call.
+
+#ifndef RHSpidevSPI_h
+#define RHSpidevSPI_h
+
+#include <RHGenericSPI.h>
+
+#ifdef RH_HAVE_SPIDEV
+
+// Default device, SPI0 with chip select 0 (needs dtparam=spi=on on Raspberry Pi)
+#define RH_SPIDEV_DEFAULT_DEVICE "/dev/spidev0.0"
+
+// Fastest SPI clock the SX127x supports, 10MHz
+#define RH_SPIDEV_MAX_SPEED      10000000
+
+/////////////////////////////////////////////////////////////////////
+/// \class RHSpidevSPI RHSpidevSPI.h <RHSpidevSPI.h>
+/// \brief Encapsulate a Linux spidev SPI bus interface
+///
+/// This concrete subclass of RHGenericSPI uses the kernel SPI driver through a spidev device
+/// node. transferBuffer() sends a complete RHSPIDriver transaction (address octet plus up to
+/// 255 data octets) as a single SPI_IOC_MESSAGE, so reading the whole FIFO of a radio is one
+/// system call instead of one bcm2835 call per octet, and the controller can run it with DMA.
+///
+/// The clock can be set in Hz with setSpeed(), up to RH_SPIDEV_MAX_SPEED. setFrequency()
+/// maps the generic RHGenericSPI::Frequency values, Frequency16MHz is limited to 10MHz.
+///
+/// Slave select stays with the driver: RHSPIDriver drives its slaveSelectPin as a GPIO around
+/// each transaction as with RHHardwareSPI, and the kernel is asked not to touch chip select
+/// (SPI_NO_CS). This also means several radios can share one spidev node, each with its own
+/// slave select pin.
+///
+/// Use it by passing an instance to the driver constructor:
+/// \code
+/// RHSpidevSPI spi("/dev/spidev0.0", 8000000);
+/// RH_RF95 rf95(RF_CS_PIN, RF_IRQ_PIN, spi);
+/// \endcode
+/// Do not use RHHardwareSPI (the bcm2835 SPI functions) at the same time: both drive the same controller.
+class RHSpidevSPI : public RHGenericSPI
+{
+public:
+    /// Constructor. Does not open the device until begin().
+    /// \param[in] device Path of the spidev device node
+    /// \param[in] speed SPI clock in Hz, limited to RH_SPIDEV_MAX_SPEED
+    /// \param[in] bitOrder Select the SPI bus bit order, one of RHGenericSPI::BitOrderMSBFirst or
+    /// RHGenericSPI::BitOrderLSBFirst.
+    /// \param[in] dataMode Selects the SPI bus data mode. One of RHGenericSPI::DataMode
+    RHSpidevSPI(const char* device = RH_SPIDEV_DEFAULT_DEVICE, uint32_t speed = 8000000,
+		BitOrder bitOrder = BitOrderMSBFirst, DataMode dataMode = DataMode0);
+
+    /// Destructor. Closes the device.
+    ~RHSpidevSPI();
+
+    /// Transfer a single octet to and from the SPI interface
+    /// \param[in] data The octet to send
+    /// \return The octet read from SPI while the data octet was sent
+    uint8_t transfer(uint8_t data);
+
+    /// Transfer a buffer of octets to and from the SPI interface as one SPI_IOC_MESSAGE
+    /// \param[in] src The octets to send, len octets
+    /// \param[out] dest The octets read while src was sent, len octets. May be the same buffer as src
+    /// \param[in] len Number of octets to transfer
+    void transferBuffer(const uint8_t* src, uint8_t* dest, uint16_t len);
+
+    /// Opens the device and configures mode, bit order and speed.
+    /// On failure isOpen() returns false and all transfers read 0.
+    void begin();
+
+    /// Closes the device.
+    void end();
+
+    /// Sets the SPI clock. Takes effect immediately.
+    /// \param[in] speed SPI clock in Hz, limited to RH_SPIDEV_MAX_SPEED
+    void setSpeed(uint32_t speed);
+
+    /// Sets the SPI clock from one of the generic frequencies. Takes effect immediately.
+    /// \param[in] frequency The data rate to use: one of RHGenericSPI::Frequency
+    void setFrequency(Frequency frequency);
+
+    /// Sets the device to open on the next begin()
+    /// \param[in] device Path of the spidev device node
+    void setDevice(const char* device);
+
+    /// \return true if the device is open
+    bool isOpen();
+
+    /// \return The SPI clock in Hz
+    uint32_t speed();
+
+private:
+    /// Path of the device node
+    char                _device[32];
+
+    /// Device file descriptor, or -1
+    int                 _fd;
+
+    /// SPI clock in Hz
+    uint32_t            _speed;
+};
+
+#endif // RH_HAVE_SPIDEV
+
+#endif
@@ -0,0 +1,161 @@
+// RHTimerService.cpp
+//
+// Timers multiplexed on a single Linux timerfd
+
+#include <RHTimerService.h>
+
+#ifdef RH_HAVE_TIMERFD
+
+#include <time.h>
+#include <unistd.h>
+#include <sys/timerfd.h>
+
+RHTimerService::RHTimerService()
+    :
+    _fd(-1),
+    _nextId(RH_TIMER_NONE)
+{
+}
+
+RHTimerService::~RHTimerService()
+{
+    end();
+}
+
+bool RHTimerService::begin()
+{
+    end();
+    _fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+    return _fd >= 0;
+}
+
+void RHTimerService::end()
+{
+    if (_fd >= 0)
+	close(_fd);
+    _fd = -1;
+    _queue.clear();
+    _timers.clear();
+}
+
+int RHTimerService::fd()
+{
+    return _fd;
+}
+
+uint32_t RHTimerService::schedule(unsigned long ms, RHTimerCallback callback, void* arg, unsigned long period)
+{
+    if (++_nextId == RH_TIMER_NONE)
+	++_nextId;
+    uint64_t due = monotonicMicros() + (uint64_t) ms * 1000;
+    Timer timer;
+    timer.period = period;
+    timer.callback = callback;
+    timer.arg = arg;
+    _timers[_nextId] = std::make_pair(due, timer);
+    _queue.insert(std::make_pair(due, _nextId));
+    if (_queue.begin()->second == _nextId)
+	rearm(); // New earliest timer
+    return _nextId;
+}
+
+void RHTimerService::cancel(uint32_t id)
+{
+    std::map<uint32_t, std::pair<uint64_t, Timer> >::iterator it = _timers.find(id);
+    if (it == _timers.end())
+	return;
+    bool first = _queue.begin()->second == id;
+    _queue.erase(std::make_pair(it->second.first, id));
+    _timers.erase(it);
+    if (first)
+	rearm();
+}
+
+bool RHTimerService::pending(uint32_t id)
+{
+    return _timers.find(id) != _timers.end();
+}
+
+size_t RHTimerService::count()
+{
+    return _timers.size();
+}
+
+int RHTimerService::timeout()
+{
+    if (_queue.empty())
+	return -1;
+    uint64_t t = monotonicMicros();
+    uint64_t due = _queue.begin()->first;
+    return due > t ? (int) ((due - t + 999) / 1000) : 0;
+}
+
+int RHTimerService::run()
+{
+    if (_fd >= 0)
+    {
+	// Clear the readable state, the expiry count is not needed
+	uint64_t expirations;
+	if (read(_fd, &expirations, sizeof(expirations)) < 0)
+	    expirations = 0;
+    }
+
+    int called = 0;
+    uint64_t t = monotonicMicros();
+    // Timers a callback schedules for now run in the next call
+    uint32_t last = _nextId;
+    std::set<std::pair<uint64_t, uint32_t> >::iterator next = _queue.begin();
+    while (next != _queue.end() && next->first <= t)
+    {
+	std::pair<uint64_t, uint32_t> key = *next;
+	uint32_t id = key.second;
+	if ((int32_t) (id - last) > 0)
+	{
+	    // Older timers due now may sort after it
+	    ++next;
+	    continue;
+	}
+	_queue.erase(next);
+	std::map<uint32_t, std::pair<uint64_t, Timer> >::iterator it = _timers.find(id);
+	Timer timer = it->second.second;
+	if (timer.period)
+	{
+	    // Keep the phase, skip periods missed while the thread was busy
+	    uint64_t period = (uint64_t) timer.period * 1000;
+	    uint64_t due = it->second.first;
+	    due += ((t - due) / period + 1) * period;
+	    it->second.first = due;
+	    _queue.insert(std::make_pair(due, id));
+	}
+	else
+	{
+	    _timers.erase(it);
+	}
+	timer.callback(timer.arg);
+	called++;
+	// The callback may have cancelled or scheduled anything, find the place again
+	next = _queue.upper_bound(key);
+    }
+    rearm();
+    return called;
+}
+
+void RHTimerService::rearm()
+{
+    if (_fd < 0)
+	return;
+
+    // An all zero it_value disarms the timer
+    struct itimerspec spec = { { 0, 0 }, { 0, 0 } };
+    if (!_queue.empty())
+    {
+	uint64_t next = _queue.begin()->first;
+	spec.it_value.tv_sec = next / 1000000;
+	spec.it_value.tv_nsec = (next % 1000000) * 1000;
+	if (spec.it_value.tv_sec == 0 && spec.it_value.tv_nsec == 0)
+	    spec.it_value.tv_nsec = 1;
+    }
+    timerfd_settime(_fd, TFD_TIMER_ABSTIME, &spec, NULL);
+}
+
+#endif
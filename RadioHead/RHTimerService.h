@@ -0,0 +1,114 @@
+// RHTimerService.h
+//
+// One shot and periodic timers multiplexed on a single Linux timerfd, so a thread
+// can sleep in poll() on its radio and its timers at the same time.
+
+#ifndef RHTimerService_h
+#define RHTimerService_h
+
+#include <RadioHead.h>
+
+#ifdef RH_HAVE_TIMERFD
+
+#include <map>
+#include <set>
+
+// Never returned by schedule(), for timer ids that hold no timer
+#define RH_TIMER_NONE 0
+
+/// Function called when a timer expires
+typedef void (*RHTimerCallback)(void* arg);
+
+/////////////////////////////////////////////////////////////////////
+/// \class RHTimerService RHTimerService.h <RHTimerService.h>
+/// \brief Timers on CLOCK_MONOTONIC for a poll() based loop
+///
+/// Timers run on monotonicMicros() and are kept ordered by expiry. There is no fixed
+/// limit, every session of a program can have its own timeouts. The timerfd is always
+/// armed for the earliest one, so fd() becomes readable exactly when something is due
+/// and a thread that has nothing else to do sleeps in the kernel instead of waking up
+/// periodically to check. After poll() reported fd() readable (or at any time), run()
+/// calls the callbacks of all expired timers, in order of expiry, and rearms periodic ones.
+///
+/// \code
+/// RHTimerService timers;
+/// timers.begin();
+/// uint32_t led = timers.schedule(200, ledOff, NULL);
+/// struct pollfd pfd[2] = { { rf95.interruptFd(), POLLIN, 0 }, { timers.fd(), POLLIN, 0 } };
+/// poll(pfd, 2, -1);
+/// if (pfd[1].revents)
+///     timers.run();
+/// \endcode
+///
+/// A service is not thread safe: schedule(), cancel() and run() must be called from
+/// the thread that owns it. Callbacks run inside run() and may schedule or cancel timers.
+class RHTimerService
+{
+public:
+    /// Constructor. No timerfd is created until begin()
+    RHTimerService();
+
+    /// Destructor, calls end()
+    ~RHTimerService();
+
+    /// Creates the timerfd
+    /// \return true if it could be created
+    bool begin();
+
+    /// Closes the timerfd and cancels all timers
+    void end();
+
+    /// \return File descriptor readable while a timer is due, or -1 before begin()
+    int fd();
+
+    /// Schedules a timer
+    /// \param[in] ms Milliseconds from now until the first expiry
+    /// \param[in] callback Function called on expiry
+    /// \param[in] arg Passed to callback
+    /// \param[in] period If not 0 the timer is repeated every period milliseconds until cancelled
+    /// \return Timer id for cancel(), never RH_TIMER_NONE. Ids are not reused.
+    uint32_t schedule(unsigned long ms, RHTimerCallback callback, void* arg, unsigned long period = 0);
+
+    /// Cancels a timer. Cancelling an expired one shot timer or RH_TIMER_NONE does nothing.
+    /// \param[in] id The id returned by schedule()
+    void cancel(uint32_t id);
+
+    /// \param[in] id The id returned by schedule()
+    /// \return true if the timer has not expired yet (or is periodic) and was not cancelled
+    bool pending(uint32_t id);
+
+    /// \return Number of scheduled timers
+    size_t count();
+
+    /// \return Milliseconds until the next timer expires, rounded up, 0 if one is due,
+    /// -1 if none is scheduled. Suitable as poll() timeout when fd() is not polled.
+    int timeout();
+
+    /// Calls the callbacks of all expired timers. Timers that the callbacks schedule for
+    /// now wait for the next call, so a periodic 0 ms timer cannot keep it busy forever.
+    /// \return Number of callbacks called
+    int run();
+
+private:
+    typedef struct
+    {
+	unsigned long   period;     ///< Repeat interval in ms, 0 for one shot
+	RHTimerCallback callback;
+	void*           arg;
+    } Timer;
+
+    /// Arms the timerfd for the earliest timer, or disarms it
+    void rearm();
+
+    int                 _fd;
+    uint32_t            _nextId;
+
+    /// Timers ordered by expiry, then id
+    std::set<std::pair<uint64_t, uint32_t> >            _queue;
+    /// Timers by id, with their expiry for finding them in _queue
+    std::map<uint32_t, std::pair<uint64_t, Timer> >     _timers;
+};
+
+#endif
+
+#endif
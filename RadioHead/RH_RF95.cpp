@@ -28,12 +28,43 @@ PROGMEM static const RH_RF95::ModemConfig MODEM_CONFIG_TABLE[] =
 RH_RF95::RH_RF95(uint8_t slaveSelectPin, uint8_t interruptPin, RHGenericSPI& spi)
     :
     RHSPIDriver(slaveSelectPin, spi),
-    _rxBufValid(0)
+#ifdef RH_HAVE_GPIO_EVENT
+    _irqEvent(interruptPin),
+#endif
+    _rxBufValid(0),
+    _lastSNR(0),
+    _lastRxTime(0),
+    _rxFilter(false),
+    _acceptBroadcast(true),
+    _preambleLength(8),
+    _txTimeOnAir(0),
+    _rxTimeOnAir(0),
+    _txStart(0),
+    _txDuration(0),
+    _lastRxDone(0)
+#ifdef RH_HAVE_MONOTONIC_CLOCK
+    ,
+    _rxDoneFloor(0),
+    _txTime(0)
+#endif
+#if RH_RF95_RX_QUEUE_LEN > 0
+    ,
+    _continuousRx(false),
+    _rxPacket(NULL),
+    _rxQueueHead(0),
+    _rxQueueCount(0),
+    _rxQueueOverruns(0)
+#endif
 {
 #ifndef RH_RF95_IRQLESS
     _interruptPin = interruptPin;
     _myInterruptIndex = 0xff; // Not allocated yet
 #endif
+    memset(_acceptTo, 0, sizeof(_acceptTo));
+    for (uint8_t i = 0; i < RxDropReasons; i++)
+	_rxDropped[i] = 0;
+    memcpy_P(&_modemConfig, &MODEM_CONFIG_TABLE[Bw125Cr45Sf128], sizeof(_modemConfig));
+    updateTiming();
 }
 
 bool RH_RF95::init()
@@ -105,6 +136,12 @@ bool RH_RF95::init()
 
 #endif // ndef RH_RF95_IRQLESS
 
+#ifdef RH_HAVE_GPIO_EVENT
+    // There are no interrupt handlers on Linux, but we can sleep until DIO0 rises
+    // through the GPIO character device. If the line cannot be requested,
+    // interruptFd() returns -1 and callers keep polling available()
+    _irqEvent.begin();
+#endif
 
     // Set up FIFO
     // We configure so that we can use the entire 256 byte FIFO for either receive
@@ -141,45 +178,7 @@ bool RH_RF95::init()
 #ifndef RH_RF95_IRQLESS
 void RH_RF95::handleInterrupt()
 {
-    // Read the interrupt register
-    uint8_t irq_flags = spiRead(RH_RF95_REG_12_IRQ_FLAGS);
-    if (_mode == RHModeRx && irq_flags & (RH_RF95_RX_TIMEOUT | RH_RF95_PAYLOAD_CRC_ERROR))
-    {
-	_rxBad++;
-    }
-    else if (_mode == RHModeRx && irq_flags & RH_RF95_RX_DONE)
-    {
-	// Have received a packet
-	uint8_t len = spiRead(RH_RF95_REG_13_RX_NB_BYTES);
-
-	// Reset the fifo read ptr to the beginning of the packet
-	spiWrite(RH_RF95_REG_0D_FIFO_ADDR_PTR, spiRead(RH_RF95_REG_10_FIFO_RX_CURRENT_ADDR));
-	spiBurstRead(RH_RF95_REG_00_FIFO, _buf, len);
-	_bufLen = len;
-	spiWrite(RH_RF95_REG_12_IRQ_FLAGS, 0xff); // Clear all IRQ flags
-
-	// Remember the RSSI of this packet
-	// this is according to the doc, but is it really correct?
-	// weakest receiveable signals are reported RSSI at about -66
-	_lastRssi = spiRead(RH_RF95_REG_1A_PKT_RSSI_VALUE) - 137;
-
-	// We have received a message.
-	validateRxBuf(); 
-	if (_rxBufValid)
-	    setModeIdle(); // Got one 
-    }
-    else if (_mode == RHModeTx && irq_flags & RH_RF95_TX_DONE)
-    {
-	_txGood++;
-	setModeIdle();
-    }
-    else if (_mode == RHModeCad && irq_flags & RH_RF95_CAD_DONE)
-    {
-        _cad = irq_flags & RH_RF95_CAD_DETECTED;
-        setModeIdle();
-    }
-    
-    spiWrite(RH_RF95_REG_12_IRQ_FLAGS, 0xff); // Clear all IRQ flags
+    serviceIrq(true);
 }
 #endif // ndef RH_RF95_IRQLESS
 
@@ -214,51 +213,227 @@ void RH_RF95::validateRxBuf()
     _rxHeaderFrom  = _buf[1];
     _rxHeaderId    = _buf[2];
     _rxHeaderFlags = _buf[3];
-    if (_promiscuous ||
-	_rxHeaderTo == _thisAddress ||
-	_rxHeaderTo == RH_BROADCAST_ADDRESS)
+    if (acceptHeaderTo(_rxHeaderTo))
     {
 	_rxGood++;
+	countSignal(_lastRssi, _lastSNR);
 	_rxBufValid = true;
     }
 }
 
-bool RH_RF95::available()
+bool RH_RF95::acceptHeaderTo(uint8_t to)
 {
-#ifdef RH_RF95_IRQLESS
-    // Read the interrupt register
-    uint8_t irq_flags = spiRead(RH_RF95_REG_12_IRQ_FLAGS);
-    if (_mode == RHModeRx && irq_flags & RH_RF95_RX_DONE)
+    if (_rxFilter)
+	return (_acceptBroadcast && to == RH_BROADCAST_ADDRESS) ||
+	    (_acceptTo[to >> 3] & (1 << (to & 7)));
+    return _promiscuous ||
+	to == _thisAddress ||
+	to == RH_BROADCAST_ADDRESS;
+}
+
+uint8_t RH_RF95::readRxPacket(const uint8_t* status, uint8_t* buf)
+{
+    uint8_t len = status[RH_RF95_REG_13_RX_NB_BYTES - RH_RF95_REG_10_FIFO_RX_CURRENT_ADDR];
+    _rxTimeOnAir += packetTimeOnAir(len);
+    if (len < RH_RF95_HEADER_LEN)
     {
-    // Have received a packet
-    uint8_t len = spiRead(RH_RF95_REG_13_RX_NB_BYTES);
+	_rxDropped[RxDropShort]++;
+	return 0;
+    }
 
     // Reset the fifo read ptr to the beginning of the packet
-    spiWrite(RH_RF95_REG_0D_FIFO_ADDR_PTR, spiRead(RH_RF95_REG_10_FIFO_RX_CURRENT_ADDR));
-    spiBurstRead(RH_RF95_REG_00_FIFO, _buf, len);
-    _bufLen = len;
-    spiWrite(RH_RF95_REG_12_IRQ_FLAGS, 0xff); // Clear all IRQ flags
-
-    // Remember the RSSI of this packet
-    // this is according to the doc, but is it really correct?
-    // weakest receiveable signals are reported RSSI at about -66
-    _lastRssi = spiRead(RH_RF95_REG_1A_PKT_RSSI_VALUE) - 137;
-
-    // We have received a message.
-    validateRxBuf(); 
-    if (_rxBufValid)
-        setModeIdle(); // Got one 
+    spiWrite(RH_RF95_REG_0D_FIFO_ADDR_PTR, status[0]);
+    if (!_rxFilter && _promiscuous)
+    {
+	// Everything is accepted, get it all at once
+	spiBurstRead(RH_RF95_REG_00_FIFO, buf, len);
+	return len;
+    }
+
+    // Headers first, the fifo read ptr then points at the payload
+    spiBurstRead(RH_RF95_REG_00_FIFO, buf, RH_RF95_HEADER_LEN);
+    if (!acceptHeaderTo(buf[0]))
+    {
+	_rxDropped[RxDropAddress]++;
+	return 0;
+    }
+    if (len > RH_RF95_HEADER_LEN)
+	spiBurstRead(RH_RF95_REG_00_FIFO, buf + RH_RF95_HEADER_LEN, len - RH_RF95_HEADER_LEN);
+    return len;
+}
+
+// Handle whatever the radio flagged in RH_RF95_REG_12_IRQ_FLAGS, with as few SPI transactions
+// as possible: the status registers 0x10 to 0x1a (rx current address, irq flags, byte count,
+// packet SNR and RSSI) come in one burst, a received packet in a second one, and the flags
+// that were handled are cleared with a single write
+void RH_RF95::serviceIrq(bool handleTxDone)
+{
+    uint8_t status[RH_RF95_RX_STATUS_LEN];
+    spiBurstRead(RH_RF95_REG_10_FIFO_RX_CURRENT_ADDR, status, sizeof(status));
+    uint8_t irq_flags = status[RH_RF95_REG_12_IRQ_FLAGS - RH_RF95_REG_10_FIFO_RX_CURRENT_ADDR];
+    if (!irq_flags)
+	return; // Nothing happened, nothing to clear
+
+    if (_mode == RHModeRx && irq_flags & RH_RF95_VALID_HEADER)
+	_rxHeaderValid++;
+
+    if (_mode == RHModeRx && irq_flags & (RH_RF95_RX_TIMEOUT | RH_RF95_PAYLOAD_CRC_ERROR))
+    {
+	_rxBad++;
+	if (irq_flags & RH_RF95_PAYLOAD_CRC_ERROR)
+	{
+	    _rxCrcError++;
+	    _rxDropped[RxDropCrc]++;
+	}
+	else
+	    _rxTimeout++;
+    }
+#if RH_RF95_RX_QUEUE_LEN > 0
+    else if (_mode == RHModeRx && irq_flags & RH_RF95_RX_DONE && _continuousRx)
+    {
+	// Stay in RXCONTINUOUS, the next packet is already being received into the FIFO
+	queueRx(status);
+    }
+#endif
+    else if (_mode == RHModeRx && irq_flags & RH_RF95_RX_DONE)
+    {
+	// Have received a packet
+	uint8_t len = readRxPacket(status, _buf);
+	if (len)
+	{
+	    _bufLen = len;
+
+	    // SNR is signed, in steps of 0.25dB
+	    _lastSNR = (int8_t)status[RH_RF95_REG_19_PKT_SNR_VALUE - RH_RF95_REG_10_FIFO_RX_CURRENT_ADDR] / 4;
+
+	    // Remember the RSSI of this packet
+	    // this is according to the doc, but is it really correct?
+	    // weakest receiveable signals are reported RSSI at about -66
+	    _lastRssi = status[RH_RF95_REG_1A_PKT_RSSI_VALUE - RH_RF95_REG_10_FIFO_RX_CURRENT_ADDR] - 137;
+	    _lastRxTime = millis();
+	    _lastRxDone = rxDoneTime();
+
+	    // We have received a message.
+	    validateRxBuf(); 
+	    if (_rxBufValid)
+		setModeIdle(); // Got one 
+	}
+    }
+    else if (handleTxDone && _mode == RHModeTx && irq_flags & RH_RF95_TX_DONE)
+    {
+	_txGood++;
+	setModeIdle();
     }
     else if (_mode == RHModeCad && irq_flags & RH_RF95_CAD_DONE)
     {
         _cad = irq_flags & RH_RF95_CAD_DETECTED;
+        if (_cad)
+            _cadBusy++;
         setModeIdle();
     }
-    
-    spiWrite(RH_RF95_REG_12_IRQ_FLAGS, 0xff); // Clear all IRQ flags
+
+    if (!handleTxDone)
+	irq_flags &= ~RH_RF95_TX_DONE;
+    // Clear only the flags we have seen, anything raised since then stays pending
+    if (irq_flags)
+	spiWrite(RH_RF95_REG_12_IRQ_FLAGS, irq_flags);
+}
+
+#if RH_RF95_RX_QUEUE_LEN > 0
+void RH_RF95::queueRx(const uint8_t* status)
+{
+    if (_rxQueueCount >= RH_RF95_RX_QUEUE_LEN)
+    {
+	// Leave the packet in the FIFO, it will be overwritten
+	_rxQueueOverruns++;
+	_rxOverrun++;
+	_rxDropped[RxDropQueueFull]++;
+	return;
+    }
+    RHPacket* packet = _packetPool.alloc();
+    if (!packet)
+    {
+	// The application holds all packets, same as a full queue
+	_rxQueueOverruns++;
+	_rxOverrun++;
+	_rxDropped[RxDropQueueFull]++;
+	return;
+    }
+    uint8_t len = readRxPacket(status, packet->data());
+    if (!len)
+    {
+	packet->release();
+	return; // Too short or not for us
+    }
+
+    packet->setLen(len);
+    packet->snr = (int8_t)status[RH_RF95_REG_19_PKT_SNR_VALUE - RH_RF95_REG_10_FIFO_RX_CURRENT_ADDR] / 4;
+    packet->rssi = status[RH_RF95_REG_1A_PKT_RSSI_VALUE - RH_RF95_REG_10_FIFO_RX_CURRENT_ADDR] - 137;
+    packet->time = millis();
+    packet->rxDone = rxDoneTime();
+    _rxGood++;
+    countSignal(packet->rssi, packet->snr);
+    _rxQueue[(_rxQueueHead + _rxQueueCount) % RH_RF95_RX_QUEUE_LEN] = packet;
+    _rxQueueCount++;
+}
+
+void RH_RF95::dequeueRx()
+{
+    ATOMIC_BLOCK_START;
+    if (!_rxBufValid && _rxQueueCount)
+    {
+	// The packet stays where the FIFO was read into, recv() copies from it
+	_rxPacket = _rxQueue[_rxQueueHead];
+	_bufLen = _rxPacket->len();
+	_rxHeaderTo    = _rxPacket->headerTo();
+	_rxHeaderFrom  = _rxPacket->headerFrom();
+	_rxHeaderId    = _rxPacket->headerId();
+	_rxHeaderFlags = _rxPacket->headerFlags();
+	_lastRssi = _rxPacket->rssi;
+	_lastSNR = _rxPacket->snr;
+	_lastRxTime = _rxPacket->time;
+	_lastRxDone = _rxPacket->rxDone;
+	_rxBufValid = true;
+	_rxQueueHead = (_rxQueueHead + 1) % RH_RF95_RX_QUEUE_LEN;
+	_rxQueueCount--;
+    }
+    ATOMIC_BLOCK_END;
+}
+
+void RH_RF95::setContinuousRx(bool enable)
+{
+    ATOMIC_BLOCK_START;
+    _continuousRx = enable;
+    for (uint8_t i = 0; i < _rxQueueCount; i++)
+	_rxQueue[(_rxQueueHead + i) % RH_RF95_RX_QUEUE_LEN]->release();
+    _rxQueueHead = 0;
+    _rxQueueCount = 0;
+    ATOMIC_BLOCK_END;
+}
+
+uint8_t RH_RF95::rxQueued()
+{
+    return _rxQueueCount;
+}
+
+uint32_t RH_RF95::rxQueueOverruns()
+{
+    return _rxQueueOverruns;
+}
+#endif
+
+bool RH_RF95::available()
+{
+#ifdef RH_RF95_IRQLESS
+    // TxDone is left to waitPacketSent()
+    serviceIrq(false);
 
 #endif // defined RH_RF95_IRQLESS
 
+#if RH_RF95_RX_QUEUE_LEN > 0
+    dequeueRx();
+#endif
+
     if (_mode == RHModeTx)
 	return false;
     setModeRx();
@@ -270,6 +445,11 @@ void RH_RF95::clearRxBuf()
     ATOMIC_BLOCK_START;
     _rxBufValid = false;
     _bufLen = 0;
+#if RH_RF95_RX_QUEUE_LEN > 0
+    if (_rxPacket)
+	_rxPacket->release();
+    _rxPacket = NULL;
+#endif
     ATOMIC_BLOCK_END;
 }
 
@@ -280,19 +460,53 @@ bool RH_RF95::recv(uint8_t* buf, uint8_t* len)
     if (buf && len)
     {
 	ATOMIC_BLOCK_START;
+	const uint8_t* rxBuf = _buf;
+#if RH_RF95_RX_QUEUE_LEN > 0
+	if (_rxPacket)
+	    rxBuf = _rxPacket->data();
+#endif
 	// Skip the 4 headers that are at the beginning of the rxBuf
 	if (*len > _bufLen-RH_RF95_HEADER_LEN)
 	    *len = _bufLen-RH_RF95_HEADER_LEN;
-	memcpy(buf, _buf+RH_RF95_HEADER_LEN, *len);
+	memcpy(buf, rxBuf+RH_RF95_HEADER_LEN, *len);
 	ATOMIC_BLOCK_END;
     }
     clearRxBuf(); // This message accepted and cleared
     return true;
 }
 
+#ifdef RH_HAVE_PACKET
+RHPacket* RH_RF95::recvPacket()
+{
+    if (!available())
+	return NULL;
+#if RH_RF95_RX_QUEUE_LEN > 0
+    if (_rxPacket)
+    {
+	RHPacket* packet;
+	ATOMIC_BLOCK_START;
+	packet = _rxPacket;
+	_rxPacket = NULL; // Handed over, not released by clearRxBuf()
+	ATOMIC_BLOCK_END;
+	clearRxBuf();
+	return packet;
+    }
+#endif
+    // Received into _buf without continuous receive
+    return RHGenericDriver::recvPacket();
+}
+#endif
+
 bool RH_RF95::send(const uint8_t* data, uint8_t len)
 {
-    if (len > RH_RF95_MAX_MESSAGE_LEN)
+    RHSegment segment = { data, len };
+    return sendv(&segment, 1);
+}
+
+bool RH_RF95::sendv(const RHSegment* segments, uint8_t count)
+{
+    uint16_t len = segmentsLen(segments, count);
+    if (len > RH_RF95_MAX_MESSAGE_LEN || count > RH_MAX_SEGMENTS)
 	return false;
 
     waitPacketSent(); // Make sure we dont interrupt an outgoing message
@@ -303,15 +517,25 @@ bool RH_RF95::send(const uint8_t* data, uint8_t len)
 
     // Position at the beginning of the FIFO
     spiWrite(RH_RF95_REG_0D_FIFO_ADDR_PTR, 0);
-    // The headers
-    spiWrite(RH_RF95_REG_00_FIFO, _txHeaderTo);
-    spiWrite(RH_RF95_REG_00_FIFO, _txHeaderFrom);
-    spiWrite(RH_RF95_REG_00_FIFO, _txHeaderId);
-    spiWrite(RH_RF95_REG_00_FIFO, _txHeaderFlags);
-    // The message data
-    spiBurstWrite(RH_RF95_REG_00_FIFO, data, len);
+    // The headers and the message data in one burst
+    uint8_t headers[RH_RF95_HEADER_LEN] = { _txHeaderTo, _txHeaderFrom, _txHeaderId, _txHeaderFlags };
+    RHSegment fifo[RH_MAX_SEGMENTS + 1];
+    fifo[0].data = headers;
+    fifo[0].len = sizeof(headers);
+    memcpy(fifo + 1, segments, count * sizeof(RHSegment));
+    spiBurstWritev(RH_RF95_REG_00_FIFO, fifo, count + 1);
     spiWrite(RH_RF95_REG_22_PAYLOAD_LENGTH, len + RH_RF95_HEADER_LEN);
 
+#ifdef RH_HAVE_MONOTONIC_CLOCK
+    // Everything is in place, only the mode change is left for the set time
+    if (_txTime)
+	delayUntilMicros(_txTime);
+    _txTime = 0;
+#endif
+
+    _txDuration = timeOnAir(len);
+    _txTimeOnAir += _txDuration;
+    _txStart = micros();
     setModeTx(); // Start the transmitter
     // when Tx is done, interruptHandler will fire and radio mode will return to STANDBY
     return true;
@@ -326,11 +550,55 @@ bool RH_RF95::waitPacketSent()
     if (_mode != RHModeTx)
     return false;
 
-    while (!(spiRead(RH_RF95_REG_12_IRQ_FLAGS) & RH_RF95_TX_DONE)){
-      YIELD;
+    return waitTxDone(-1);
+}
+
+bool RH_RF95::waitPacketSent(uint16_t timeout)
+{
+    if (_mode != RHModeTx)
+	return true;
+
+    return waitTxDone(timeout);
+}
+
+bool RH_RF95::packetSent()
+{
+    if (_mode != RHModeTx)
+	return true;
+
+    // Returns at once before the end of the time on air, else reads the flags once
+    return waitTxDone(0);
+}
+
+bool RH_RF95::waitTxDone(int timeout)
+{
+    unsigned long starttime = millis();
+
+    // The transmission cannot be over before its time on air, sleep
+    // through it instead of polling the radio all the time
+    unsigned long elapsed = micros() - _txStart;
+    if (elapsed < _txDuration)
+    {
+	unsigned long rest = _txDuration - elapsed;
+	if (timeout >= 0 && rest > (unsigned long)timeout * 1000)
+	{
+	    delayMicroseconds((unsigned long)timeout * 1000);
+	    return false;
+	}
+	delayMicroseconds(rest);
+    }
+
+    // Then sleep until DIO0 signals TxDone. Another thread polling interruptFd() may consume
+    // the edge first, so never wait on it for long before looking at the flags again
+    while (!(spiRead(RH_RF95_REG_12_IRQ_FLAGS) & RH_RF95_TX_DONE))
+    {
+	if (timeout >= 0 && millis() - starttime >= (unsigned long)timeout)
+	    return false;
+	waitForEvent(RH_WAIT_POLL_INTERVAL);
     }
 
     // A transmitter message has been fully sent
+    spiWrite(RH_RF95_REG_12_IRQ_FLAGS, RH_RF95_TX_DONE); // available() leaves it to us
     _txGood++;
     setModeIdle(); // Clears FIFO
     return true;
@@ -394,6 +662,9 @@ void RH_RF95::setModeRx()
     {
 	spiWrite(RH_RF95_REG_01_OP_MODE, RH_RF95_MODE_RXCONTINUOUS);
 	spiWrite(RH_RF95_REG_40_DIO_MAPPING1, 0x00); // Interrupt on RxDone
+#ifdef RH_HAVE_MONOTONIC_CLOCK
+	_rxDoneFloor = monotonicMicros(); // Edges before are TxDone or CadDone
+#endif
 	_mode = RHModeRx;
     }
 }
@@ -456,6 +727,8 @@ void RH_RF95::setModemRegisters(const ModemConfig* config)
     spiWrite(RH_RF95_REG_1D_MODEM_CONFIG1,       config->reg_1d);
     spiWrite(RH_RF95_REG_1E_MODEM_CONFIG2,       config->reg_1e);
     spiWrite(RH_RF95_REG_26_MODEM_CONFIG3,       config->reg_26);
+    _modemConfig = *config;
+    updateTiming();
 }
 
 // Set one of the canned FSK Modem configs
@@ -489,6 +762,69 @@ void RH_RF95::setPreambleLength(uint16_t bytes)
 {
     spiWrite(RH_RF95_REG_20_PREAMBLE_MSB, bytes >> 8);
     spiWrite(RH_RF95_REG_21_PREAMBLE_LSB, bytes & 0xff);
+    _preambleLength = bytes;
+    updateTiming();
+}
+
+void RH_RF95::updateTiming()
+{
+    // Every bandwidth is 500kHz divided by one of these, so a symbol, 2^SF / BW,
+    // lasts 2^SF * divider * 2 microseconds exactly
+    static const uint8_t bwDivider[] = { 64, 48, 32, 24, 16, 12, 8, 4, 2, 1 };
+    uint8_t bw = _modemConfig.reg_1d >> 4;
+    if (bw >= sizeof(bwDivider))
+	bw = sizeof(bwDivider) - 1; // Reserved values
+    uint8_t sf = _modemConfig.reg_1e >> 4;
+    uint8_t cr = (_modemConfig.reg_1d & RH_RF95_CODING_RATE) >> 1; // 1 to 4 for 4/5 to 4/8
+    bool implicitHeader = _modemConfig.reg_1d & RH_RF95_IMPLICIT_HEADER_MODE_ON;
+    bool crc = _modemConfig.reg_1e & RH_RF95_PAYLOAD_CRC_ON;
+    bool lowDataRate = _modemConfig.reg_26 & RH_RF95_LOW_DATA_RATE_OPTIMIZE;
+
+    _symbolTime = ((uint32_t)1 << sf) * bwDivider[bw] * 2;
+    // The preamble is 4.25 symbols longer than programmed, then come 8 symbols
+    // with the header, if any, and the start of the payload
+    uint64_t fixedTime = (uint64_t)(_preambleLength + 4 + 8) * _symbolTime + _symbolTime / 4;
+    _fixedTime = fixedTime > 0xffffffff ? 0xffffffff : (uint32_t)fixedTime;
+    // The rest goes in blocks of 4 + CR symbols, each carrying 4 * (SF - 2 * DE) bits
+    _payloadBits = 28 - 4 * sf + (crc ? 16 : 0) - (implicitHeader ? 20 : 0);
+    _blockBits = 4 * (sf - (lowDataRate ? 2 : 0));
+    _blockSymbols = 4 + cr;
+}
+
+uint32_t RH_RF95::packetTimeOnAir(uint8_t octets)
+{
+    int16_t bits = 8 * octets + _payloadBits;
+    uint32_t blocks = (bits > 0 && _blockBits) ? (bits + _blockBits - 1) / _blockBits : 0;
+    uint64_t time = (uint64_t)blocks * _blockSymbols * _symbolTime + _fixedTime;
+    return time > 0xffffffff ? 0xffffffff : (uint32_t)time;
+}
+
+uint32_t RH_RF95::timeOnAir(uint8_t len)
+{
+    return packetTimeOnAir(len + RH_RF95_HEADER_LEN);
+}
+
+uint32_t RH_RF95::symbolTime()
+{
+    return _symbolTime;
+}
+
+uint64_t RH_RF95::txTimeOnAir()
+{
+    return _txTimeOnAir;
+}
+
+uint64_t RH_RF95::rxTimeOnAir()
+{
+    return _rxTimeOnAir;
+}
+
+bool RH_RF95::isReceiving()
+{
+    if (_mode != RHModeRx)
+	return false;
+    return spiRead(RH_RF95_REG_18_MODEM_STAT)
+	& (RH_RF95_MODEM_STATUS_SIGNAL_SYNCHRONIZED | RH_RF95_MODEM_STATUS_HEADER_INFO_VALID);
 }
 
 bool RH_RF95::isChannelActive()
@@ -501,12 +837,130 @@ bool RH_RF95::isChannelActive()
         _mode = RHModeCad;
     }
 
+#ifdef RH_RF95_IRQLESS
+    // No interrupt handler ends the CAD: read the flags whenever DIO0 (CadDone) may have risen
+    unsigned long starttime = millis();
+    while (true)
+    {
+	serviceIrq(false);
+	if (_mode != RHModeCad)
+	    break;
+	if (millis() - starttime > RH_RF95_CAD_WAIT_TIMEOUT)
+	{
+	    // The radio never finished, do not report activity that was not seen
+	    _cad = false;
+	    setModeIdle();
+	    break;
+	}
+	waitForEvent(RH_WAIT_POLL_INTERVAL);
+    }
+#else
     while (_mode == RHModeCad)
         YIELD;
+#endif
 
     return _cad;
 }
 
+#ifdef RH_HAVE_GPIO_EVENT
+int RH_RF95::interruptFd()
+{
+    return _irqEvent.fd();
+}
+
+bool RH_RF95::waitInterrupt(int timeout)
+{
+    if (!_irqEvent.isOpen())
+	return true; // No events, caller has to poll
+    return _irqEvent.wait(timeout) > 0;
+}
+
+bool RH_RF95::waitForEvent(int timeout)
+{
+    if (!_irqEvent.isOpen())
+	return RHGenericDriver::waitForEvent(timeout);
+    return _irqEvent.wait(timeout) > 0;
+}
+
+RHGpioEvent& RH_RF95::interruptEvent()
+{
+    return _irqEvent;
+}
+#endif
+
+void RH_RF95::setRxFilter(bool enable)
+{
+    _rxFilter = enable;
+}
+
+void RH_RF95::acceptTo(uint8_t address, bool accept)
+{
+    if (accept)
+	_acceptTo[address >> 3] |= (1 << (address & 7));
+    else
+	_acceptTo[address >> 3] &= ~(1 << (address & 7));
+}
+
+void RH_RF95::clearAcceptTo()
+{
+    memset(_acceptTo, 0, sizeof(_acceptTo));
+}
+
+void RH_RF95::setAcceptBroadcast(bool accept)
+{
+    _acceptBroadcast = accept;
+}
+
+uint64_t RH_RF95::rxDropped(RxDropReason reason)
+{
+    if (reason >= RxDropReasons)
+	return 0;
+    return _rxDropped[reason];
+}
+
+int8_t RH_RF95::lastSNR()
+{
+    return _lastSNR;
+}
+
+unsigned long RH_RF95::lastRxTime()
+{
+    return _lastRxTime;
+}
+
+uint64_t RH_RF95::lastRxDoneTime()
+{
+    return _lastRxDone;
+}
+
+uint64_t RH_RF95::rxDoneTime()
+{
+#ifdef RH_HAVE_MONOTONIC_CLOCK
+    uint64_t now = monotonicMicros();
+#ifdef RH_HAVE_GPIO_EVENT
+    // The kernel took the time of the DIO0 edge in its interrupt handler, before the thread
+    // woke up and got the SPI bus. Only an edge since receive mode was entered, not used for an
+    // earlier packet and not ahead of us (CLOCK_REALTIME before Linux 5.7) is this RxDone
+    uint64_t edge = _irqEvent.lastEventTime() / 1000;
+    if (edge > _rxDoneFloor && edge <= now)
+    {
+	_rxDoneFloor = edge;
+	return edge;
+    }
+#endif
+    return now;
+#else
+    return micros();
+#endif
+}
+
+#ifdef RH_HAVE_MONOTONIC_CLOCK
+void RH_RF95::setTxTime(uint64_t when)
+{
+    _txTime = when;
+}
+#endif
+
 void RH_RF95::enableTCXO()
 {
     while ((spiRead(RH_RF95_REG_4B_TCXO) & RH_RF95_TCXO_TCXO_INPUT_ON) != RH_RF95_TCXO_TCXO_INPUT_ON)
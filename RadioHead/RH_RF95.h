@@ -13,6 +13,7 @@
 #define RH_RF95_h
 
 #include <RHSPIDriver.h>
+#include <RHGpioEvent.h>
 
 // If you don't want to use interupts (mainly to win one I/O pin) then
 // you just need to uncomment this line, if you're on Raspberry PI 
@@ -26,6 +27,12 @@
 #endif
 #endif // RH_PLATFORM_RASPI PI
 
+// Without interrupts isChannelActive() reads the CadDone flag itself. A CAD takes about two
+// symbols, 70ms at SF12 and 125kHz: give up on a radio that has not finished after this many ms
+#ifndef RH_RF95_CAD_WAIT_TIMEOUT
+#define RH_RF95_CAD_WAIT_TIMEOUT 500
+#endif
+
 // This is the maximum number of interrupts the driver can support
 // Most Arduinos can handle 2, Megas can handle more
 #define RH_RF95_NUM_INTERRUPTS 3
@@ -48,6 +55,22 @@
  #define RH_RF95_MAX_MESSAGE_LEN (RH_RF95_MAX_PAYLOAD_LEN - RH_RF95_HEADER_LEN)
 #endif
 
+// Number of received packets that can be queued in continuous receive mode
+// (see RH_RF95::setContinuousRx()). Queued packets are RHPacket buffers from the pool of
+// the driver, so the queue needs RH_HAVE_PACKET and RH_PACKET_POOL_LEN should leave room
+// for the packets the application holds.
+// Can be pre-defined prior to including this header, 0 disables the queue.
+#ifndef RH_RF95_RX_QUEUE_LEN
+ #ifdef RH_HAVE_PACKET
+  #define RH_RF95_RX_QUEUE_LEN 16
+ #else
+  #define RH_RF95_RX_QUEUE_LEN 0
+ #endif
+#endif
+#if (RH_RF95_RX_QUEUE_LEN > 0) && !defined(RH_HAVE_PACKET)
+ #error RH_RF95_RX_QUEUE_LEN needs RH_HAVE_PACKET
+#endif
+
 // The crystal oscillator frequency of the module
 #define RH_RF95_FXOSC 32000000.0
 
@@ -108,6 +131,10 @@
 #define RH_RF95_REG_63_AGC_THRESH2                         0x63
 #define RH_RF95_REG_64_AGC_THRESH3                         0x64
 
+// The status registers read in one burst after an interrupt,
+// RH_RF95_REG_10_FIFO_RX_CURRENT_ADDR to RH_RF95_REG_1A_PKT_RSSI_VALUE
+#define RH_RF95_RX_STATUS_LEN (RH_RF95_REG_1A_PKT_RSSI_VALUE - RH_RF95_REG_10_FIFO_RX_CURRENT_ADDR + 1)
+
 // RH_RF95_REG_01_OP_MODE                             0x01
 #define RH_RF95_LONG_RANGE_MODE                       0x80
 #define RH_RF95_ACCESS_SHARED_REG                     0x40
@@ -232,6 +259,10 @@
 #define RH_RF95_PAYLOAD_CRC_ON                        0x04
 #define RH_RF95_SYM_TIMEOUT_MSB                       0x03
 
+// RH_RF95_REG_26_MODEM_CONFIG3                       0x26
+#define RH_RF95_LOW_DATA_RATE_OPTIMIZE                0x08
+#define RH_RF95_AGC_AUTO_ON                           0x04
+
 // RH_RF95_REG_4B_TCXO                                0x4b
 #define RH_RF95_TCXO_TCXO_INPUT_ON                    0x10
 
@@ -584,6 +615,16 @@ public:
 	Bw125Cr48Sf4096,           ///< Bw = 125 kHz, Cr = 4/8, Sf = 4096chips/symbol, CRC on. Slow+long range
     } ModemConfigChoice;
 
+    /// Reasons for dropping a received packet, see rxDropped()
+    typedef enum
+    {
+	RxDropCrc = 0,          ///< Payload CRC error reported by the radio
+	RxDropShort,            ///< Shorter than the 4 RadioHead headers
+	RxDropAddress,          ///< TO header not accepted (address, promiscuous mode or accept set)
+	RxDropQueueFull,        ///< No room in the receive queue (continuous receive only)
+	RxDropReasons           ///< Number of reasons, not a reason
+    } RxDropReason;
+
     /// Constructor. You can have multiple instances, but each instance must have its own
     /// interrupt and slave select pin. After constructing, you must call init() to initialise the interface
     /// and the radio module. A maximum of 3 instances can co-exist on one processor, provided there are sufficient
@@ -654,6 +695,22 @@ public:
     /// \return true if a valid message was copied to buf
     virtual bool    recv(uint8_t* buf, uint8_t* len);
 
+    /// Like send(), but for a message in segments, see RHGenericDriver::sendv(). The TO, FROM, ID and
+    /// FLAGS headers and all segments are written to the FIFO in a single SPI burst.
+    /// send() is sendv() of one segment.
+    /// \param[in] segments The pieces of the message, in order
+    /// \param[in] count Number of segments, at most RH_MAX_SEGMENTS
+    /// \return true if the message length is valid and it was queued for transmit
+    virtual bool    sendv(const RHSegment* segments, uint8_t count);
+
+#ifdef RH_HAVE_PACKET
+    /// Hands over the available message as an RHPacket. With continuous receive this is the
+    /// packet the FIFO was read into, with its RSSI, SNR, receive time and RxDone time, so
+    /// the message is not copied at all. Otherwise it is copied like RHGenericDriver::recvPacket()
+    /// \return The packet, the caller must release() it, or NULL if no message is available
+    virtual RHPacket* recvPacket();
+#endif
+
     /// Waits until any previous transmit packet is finished being transmitted with waitPacketSent().
     /// Then optionally waits for Channel Activity Detection (CAD) 
     /// to show the channnel is clear (if the radio supports CAD) by calling waitCAD().
@@ -671,6 +728,16 @@ public:
     /// \return true on success, false if the chip is not in transmit mode or other transmit failure
 #ifdef RH_RF95_IRQLESS
     virtual bool   waitPacketSent();
+
+    /// Blocks until the current message (if any) has been transmitted or the timeout expires.
+    /// \param[in] timeout Maximum time to wait in milliseconds.
+    /// \return true if the radio completed transmission within the timeout period (or was not
+    /// transmitting). False if it timed out.
+    virtual bool   waitPacketSent(uint16_t timeout);
+
+    /// Looks at the TxDone flag once, without waiting, and completes the transmission if it is set
+    /// \return true if the radio is not transmitting (any more)
+    virtual bool   packetSent();
 #endif
 
     /// Sets the length of the preamble
@@ -686,6 +753,34 @@ public:
     /// \return The maximum legal message length
     virtual uint8_t maxMessageLength();
 
+    /// Returns the time on air of a message with the modem configuration and preamble length
+    /// last set, after the formula in section 4.1.1.7 of the SX1276 datasheet. Takes the spreading
+    /// factor, bandwidth, coding rate, header mode, payload CRC and low data rate optimisation
+    /// into account. The parts that only depend on the configuration are worked out when it is set,
+    /// so this is a handful of integer operations.
+    /// \param[in] len Number of octets of message data, as passed to send(), not counting the RadioHead headers
+    /// \return Time on air in microseconds
+    virtual uint32_t timeOnAir(uint8_t len);
+
+    /// \return Duration of one LoRa symbol with the current modem configuration in microseconds
+    uint32_t       symbolTime();
+
+    /// Returns the total time the transmitter was on, worked out by timeOnAir() for every message sent
+    /// \return Transmit time since construction in microseconds
+    uint64_t       txTimeOnAir();
+
+    /// Returns the total time the channel was occupied by packets this radio received, including
+    /// those dropped because they were too short, not addressed to this node or did not fit in
+    /// the receive queue, but not those with CRC errors, whose length is not known
+    /// \return Receive time since construction in microseconds
+    uint64_t       rxTimeOnAir();
+
+    /// Tells whether the receiver has locked onto a packet that is still coming in, from the
+    /// modem status register. Transmitting now would lose that packet, so a caller with
+    /// something to send can wait for its RxDone first.
+    /// \return true if in receive mode and the modem is synchronised to a preamble or has a valid header
+    bool           isReceiving();
+
     /// Sets the transmitter and receiver 
     /// centre frequency.
     /// \param[in] centre Frequency in MHz. 137.0 to 1020.0. Caution: RFM95/96/97/98 comes in several
@@ -751,6 +846,113 @@ public:
     /// Caution, this function has not been tested by us.
     void enableTCXO();
 
+    /// Returns the Signal-to-Noise Ratio of the last received message, as measured by the receiver.
+    /// \return SNR of the last received message in dB
+    int8_t         lastSNR();
+
+    /// Returns the time the last received message was read from the radio.
+    /// With continuous receive this is when it was queued, not when it was taken from the queue.
+    /// \return millis() at the time the message was read from the radio
+    unsigned long  lastRxTime();
+
+    /// Returns when the radio finished receiving the last received message (RxDone). With DIO0
+    /// events from the GPIO character device this is the kernel timestamp of the DIO0 edge, taken
+    /// in the interrupt handler, otherwise the time the driver noticed the packet, which when
+    /// polling can be a polling interval later. Unlike lastRxTime() it is precise enough to time
+    /// a reply into a short receive window of the sender, see setTxTime().
+    /// \return monotonicMicros() at RxDone (micros() on platforms without RH_HAVE_MONOTONIC_CLOCK)
+    uint64_t       lastRxDoneTime();
+
+#ifdef RH_HAVE_MONOTONIC_CLOCK
+    /// Makes the next send() start the transmitter at a given time instead of at once. send() loads
+    /// the message into the FIFO first and then sleeps until the time, so starting the transmission
+    /// only takes the one SPI write of the mode register. Call it a few ms before the time, from a
+    /// thread with a real-time priority for sub-millisecond accuracy. If the time has passed when the
+    /// FIFO is loaded the transmitter starts at once. Applies to one send() only.
+    /// \param[in] when monotonicMicros() at which to start the transmitter, 0 for at once
+    void           setTxTime(uint64_t when);
+#endif
+
+    /// Enables or disables filtered receive.
+    /// Normally a received packet is accepted if the driver is promiscuous or its TO header is
+    /// this node's address or the broadcast address. With filtered receive, it is accepted only if
+    /// its TO header is in the accept set (see acceptTo() and setAcceptBroadcast()), whatever
+    /// setPromiscuous() and setThisAddress() say.
+    /// Whenever packets can be rejected, only the 4 header octets are read from the FIFO first, and the
+    /// payload is fetched only for accepted packets. Rejected packets cost one short SPI transaction.
+    /// \param[in] enable true to enable filtered receive
+    void           setRxFilter(bool enable);
+
+    /// Adds an address to or removes it from the accept set of filtered receive.
+    /// The accept set is a bitmap, all 256 addresses can be accepted independently.
+    /// \param[in] address The TO header address
+    /// \param[in] accept true to accept packets to address, false to reject them
+    void           acceptTo(uint8_t address, bool accept = true);
+
+    /// Removes all addresses from the accept set of filtered receive
+    void           clearAcceptTo();
+
+    /// Sets whether filtered receive accepts packets sent to RH_BROADCAST_ADDRESS,
+    /// independent of the accept set. The default is true.
+    /// \param[in] accept true to accept broadcasts
+    void           setAcceptBroadcast(bool accept);
+
+    /// Returns the number of received packets dropped for a reason
+    /// \param[in] reason One of RxDropReason
+    /// \return The number of packets dropped for reason
+    uint64_t       rxDropped(RxDropReason reason);
+
+#if RH_RF95_RX_QUEUE_LEN > 0
+    /// Enables or disables continuous receive.
+    /// Normally the radio goes to idle as soon as it received a valid message and is deaf until
+    /// the message is taken with recv(). With continuous receive it stays in RXCONTINUOUS and each
+    /// valid message is read, with its RSSI, SNR and receive time, into an RHPacket from the pool
+    /// of the driver and put in a queue of RH_RF95_RX_QUEUE_LEN packets. available() and recv()
+    /// (or recvPacket()) then work through the queue oldest first.
+    /// If the queue is full, or all packets of the pool are held, when a message arrives, the new
+    /// message is dropped and counted by rxQueueOverruns() (and rxDropped(RxDropQueueFull)).
+    /// Disabling discards any queued messages.
+    /// \param[in] enable true to enable continuous receive
+    void           setContinuousRx(bool enable);
+
+    /// \return Number of messages waiting in the receive queue, not counting the one
+    /// currently available()
+    uint8_t        rxQueued();
+
+    /// \return Number of received messages dropped because the receive queue was full
+    uint32_t       rxQueueOverruns();
+#endif
+
+#ifdef RH_HAVE_GPIO_EVENT
+    /// Returns a file descriptor that becomes readable on each rising edge of DIO0
+    /// (RxDone, TxDone or CadDone, depending on the mode), for use with poll() or epoll.
+    /// init() requests the interruptPin passed to the constructor from the Linux GPIO character
+    /// device. If that failed (no interruptPin, kernel GPIO interrupts disabled by the gpio-no-irq
+    /// overlay etc), returns -1 and the caller must poll available() instead.
+    /// After the descriptor was reported readable, call interruptEvent().drain() before available().
+    /// \return The file descriptor, or -1 if DIO0 events are not available
+    int            interruptFd();
+
+    /// Blocks until DIO0 raises an interrupt or the timeout expires.
+    /// Returns true immediately if DIO0 events are not available, so a caller loop of
+    /// waitInterrupt() and available() works in both cases.
+    /// \param[in] timeout Maximum time to wait in milliseconds. Negative waits forever.
+    /// \return true if an interrupt was seen (or events are not available), false on timeout
+    bool           waitInterrupt(int timeout);
+
+    /// Blocks until DIO0 raises an interrupt or the timeout expires, so that waitAvailable(),
+    /// waitAvailableTimeout(), waitPacketSent() and isChannelActive() sleep until the radio has
+    /// something to report instead of reading its IRQ flags over and over.
+    /// Falls back to RHGenericDriver::waitForEvent() if DIO0 events are not available.
+    /// \param[in] timeout Maximum time to wait in milliseconds. Negative waits forever.
+    /// \return true if an interrupt was seen (or events are not available), false on timeout
+    virtual bool   waitForEvent(int timeout);
+
+    /// Gives access to the DIO0 event source, eg for the kernel timestamp of the last interrupt.
+    /// \return Reference to the DIO0 event source
+    RHGpioEvent&   interruptEvent();
+#endif
+
 protected:
     /// This is a low level function to handle the interrupts for one instance of RH_RF95.
     /// Called automatically by isr*()
@@ -762,9 +964,53 @@ protected:
     /// Examine the revceive buffer to determine whether the message is for this node
     void validateRxBuf();
 
+    /// Checks the TO header of a received message against this node's address
+    /// \return true if the message should be accepted
+    bool acceptHeaderTo(uint8_t to);
+
     /// Clear our local receive buffer
     void clearRxBuf();
 
+    /// Handles the pending IRQ flags: reads the status registers in one burst, reads a received
+    /// packet into the buffer (or the receive queue) and clears the flags that were handled.
+    /// Used by handleInterrupt() and, with RH_RF95_IRQLESS, by available().
+    /// \param[in] handleTxDone If false, TxDone is neither handled nor cleared (left for waitPacketSent())
+    void serviceIrq(bool handleTxDone);
+
+#ifdef RH_RF95_IRQLESS
+    /// Sleeps through the time on air of the current transmission, then waits for TxDone.
+    /// \param[in] timeout Maximum time to wait in milliseconds. Negative waits forever.
+    /// \return true when TxDone was seen, false on timeout
+    bool           waitTxDone(int timeout);
+#endif
+
+    /// \return The RxDone time of the packet being read, see lastRxDoneTime()
+    uint64_t       rxDoneTime();
+
+    /// Works out the _symbolTime, _fixedTime and payload block parameters for timeOnAir()
+    /// from _modemConfig and _preambleLength
+    void updateTiming();
+
+    /// \param[in] octets Length of the whole packet, including the RadioHead headers
+    /// \return Time on air in microseconds
+    uint32_t packetTimeOnAir(uint8_t octets);
+
+    /// Reads the packet announced by the status registers from the FIFO, headers first if it may
+    /// be rejected. Counts rejected packets in _rxDropped.
+    /// \param[in] status The status registers read by serviceIrq()
+    /// \param[out] buf Where to put the packet including headers, RH_RF95_MAX_PAYLOAD_LEN octets
+    /// \return The number of octets read, or 0 if the packet was rejected
+    uint8_t readRxPacket(const uint8_t* status, uint8_t* buf);
+
+#if RH_RF95_RX_QUEUE_LEN > 0
+    /// Reads a received message from the FIFO into a packet at the tail of the receive queue.
+    /// \param[in] status The status registers read by serviceIrq()
+    void queueRx(const uint8_t* status);
+
+    /// Makes the oldest queued message the available one, if there is none.
+    void dequeueRx();
+#endif
+
 private:
 
 #ifndef RH_RF95_IRQLESS
@@ -792,6 +1038,11 @@ private:
 
 #endif
 
+#ifdef RH_HAVE_GPIO_EVENT
+    /// DIO0 rising edges from the Linux GPIO character device
+    RHGpioEvent         _irqEvent;
+#endif
+
     /// Number of octets in the buffer
     volatile uint8_t    _bufLen;
     
@@ -800,6 +1051,76 @@ private:
 
     /// True when there is a valid message in the buffer
     volatile bool       _rxBufValid;
+
+    /// SNR of the last received message in dB
+    volatile int8_t     _lastSNR;
+
+    /// millis() when the last received message was read from the radio
+    volatile unsigned long _lastRxTime;
+
+    /// True if filtered receive is enabled
+    bool                _rxFilter;
+
+    /// True if filtered receive accepts broadcasts
+    bool                _acceptBroadcast;
+
+    /// The modem configuration registers last written by setModemRegisters()
+    ModemConfig         _modemConfig;
+
+    /// The preamble length last set by setPreambleLength()
+    uint16_t            _preambleLength;
+
+    /// Timing of the modem configuration and preamble, worked out by updateTiming()
+    uint32_t            _symbolTime;        ///< Symbol duration in microseconds
+    uint32_t            _fixedTime;         ///< Preamble and the 8 symbols every packet has, in microseconds
+    int16_t             _payloadBits;       ///< Added to 8 * octets for the bits in the payload blocks
+    uint8_t             _blockBits;         ///< Bits per payload block, 4 * (SF - 2 * DE)
+    uint8_t             _blockSymbols;      ///< Symbols per payload block, 4 + CR
+
+    /// Time on air of everything sent and received, see txTimeOnAir() and rxTimeOnAir()
+    uint64_t            _txTimeOnAir;
+    volatile uint64_t   _rxTimeOnAir;
+
+    /// micros() when the last transmission started, and its time on air
+    unsigned long       _txStart;
+    uint32_t            _txDuration;
+
+    /// RxDone of the last received message, see lastRxDoneTime()
+    volatile uint64_t   _lastRxDone;
+
+#ifdef RH_HAVE_MONOTONIC_CLOCK
+    /// DIO0 edges older than this are not an RxDone: receive mode was entered or the edge was used since
+    uint64_t            _rxDoneFloor;
+
+    /// When the next send() starts the transmitter, 0 for at once
+    uint64_t            _txTime;
+#endif
+
+    /// Accept set of filtered receive, one bit per TO address
+    uint8_t             _acceptTo[256 / 8];
+
+    /// Count of dropped packets, per RxDropReason
+    RHCounter           _rxDropped[RxDropReasons];
+
+#if RH_RF95_RX_QUEUE_LEN > 0
+    /// True if continuous receive with the queue is enabled
+    bool                _continuousRx;
+
+    /// The receive queue
+    RHPacket*           _rxQueue[RH_RF95_RX_QUEUE_LEN];
+
+    /// The available message when it came from the queue, NULL if it is in _buf
+    RHPacket*           _rxPacket;
+
+    /// Index of the oldest queued message
+    volatile uint8_t    _rxQueueHead;
+
+    /// Number of queued messages
+    volatile uint8_t    _rxQueueCount;
+
+    /// Count of messages dropped because the queue was full
+    RHCounter           _rxQueueOverruns;
+#endif
 };
 
 /// @example rf95_client.pde
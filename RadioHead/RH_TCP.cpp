@@ -23,7 +23,8 @@ RH_TCP::RH_TCP(const char* server)
     : _server(server),
       _rxBufLen(0),
       _rxBufValid(false),
-      _socket(-1)
+      _socket(-1),
+      _bitRate(RH_TCP_DEFAULT_BIT_RATE)
 {
 }
     
@@ -258,7 +259,10 @@ bool RH_TCP::send(const uint8_t* data, uint8_t len)
 	return false;  // Check channel activity (prob not possible for this driver?)
 
     bool ret = sendPacket(data, len);
-    delay(10); // Wait for transmit to succeed. REVISIT: depends on length and speed
+    // Take as long as the transmission would
+    uint32_t time = timeOnAir(len);
+    if (time)
+	delay((time + 999) / 1000);
     return ret;
 }
 
@@ -267,6 +271,18 @@ uint8_t RH_TCP::maxMessageLength()
     return RH_TCP_MAX_MESSAGE_LEN;
 }
 
+void RH_TCP::setBitRate(uint32_t bitRate)
+{
+    _bitRate = bitRate;
+}
+
+uint32_t RH_TCP::timeOnAir(uint8_t len)
+{
+    if (!_bitRate)
+	return 0;
+    return (uint32_t)((uint64_t)(len + RH_TCP_HEADER_LEN) * 8 * 1000000 / _bitRate);
+}
+
 void RH_TCP::setThisAddress(uint8_t address)
 {
     RHGenericDriver::setThisAddress(address);
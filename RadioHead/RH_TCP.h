@@ -8,6 +8,9 @@
 #include <RHGenericDriver.h>
 #include <RHTcpProtocol.h>
 
+// Default bit rate of the simulated radio, see RH_TCP::setBitRate()
+#define RH_TCP_DEFAULT_BIT_RATE 9600
+
 /////////////////////////////////////////////////////////////////////
 /// \class RH_TCP RH_TCP.h <RH_TCP.h>
 /// \brief Driver to send and receive unaddressed, unreliable datagrams via sockets on a Linux simulator
@@ -123,6 +126,17 @@ public:
     /// \return The maximum legal message length
     virtual uint8_t maxMessageLength();
 
+    /// Sets the bit rate of the simulated radio. send() takes as long as a radio
+    /// with this bit rate needs to transmit the message, headers included, so timing
+    /// dependent code behaves in the simulator as it would on air. Defaults to RH_TCP_DEFAULT_BIT_RATE.
+    /// \param[in] bitRate Bits per second, 0 to send without delay
+    void setBitRate(uint32_t bitRate);
+
+    /// Returns the time on air of a message at the bit rate set with setBitRate()
+    /// \param[in] len Number of octets of message data, as passed to send()
+    /// \return Time on air in microseconds, 0 if the bit rate is 0
+    virtual uint32_t timeOnAir(uint8_t len);
+
     /// Sets the address of this node. Defaults to 0xFF. Subclasses or the user may want to change this.
     /// This will be used to test the adddress in incoming messages. In non-promiscuous mode,
     /// only messages with a TO header the same as thisAddress or the broadcast addess (0xFF) will be accepted.
@@ -179,6 +193,9 @@ private:
     /// Buf is filled but not validated
     volatile bool   _rxBufFull;
 
+    /// Bit rate of the simulated radio in bits per second
+    uint32_t        _bitRate;
+
 };
 
 /// @example simulator_reliable_datagram_client.pde
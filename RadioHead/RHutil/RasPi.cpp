@@ -9,12 +9,20 @@
 #include <RadioHead.h>
 
 #if (RH_PLATFORM == RH_PLATFORM_RASPI)
-#include <sys/time.h>
+#include <errno.h>
 #include <time.h>
 #include "RasPi.h"
 
-//Initialize the values for sanity
-timeval RHStartTime;
+// Monotonic time in microseconds, not moved by NTP or date changes
+uint64_t monotonicMicros()
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+// millis() and micros() count from program start
+static const uint64_t RHStartTime = monotonicMicros();
 
 void SPIClass::begin()
 {
@@ -37,8 +45,19 @@ void SPIClass::begin(uint16_t divider, uint8_t bitOrder, uint8_t dataMode)
 
   //bcm2835_spi_chipSelect(BCM2835_SPI_CS_NONE); // RH Library code control CS line
 
-  //Initialize a timestamp for millis calculation
-  gettimeofday(&RHStartTime, NULL);
+  // bcm2835_spi_begin() hands CE0 and CE1 to the controller
+  deselectChipEnables();
+}
+
+void SPIClass::deselectChipEnables()
+{
+  // The controller (or the kernel spidev driver) owning CE0 (GPIO8) and CE1 (GPIO7)
+  // may pulse them during transfers to other slaves. RH drivers select their
+  // slaves as GPIOs, so turn both back into deselected outputs once
+  bcm2835_gpio_fsel(8, BCM2835_GPIO_FSEL_OUTP);
+  bcm2835_gpio_write(8, HIGH);
+  bcm2835_gpio_fsel(7, BCM2835_GPIO_FSEL_OUTP);
+  bcm2835_gpio_write(7, HIGH);
 }
 
 void SPIClass::end()
@@ -78,6 +97,13 @@ byte SPIClass::transfer(byte _data)
   return data;
 }
 
+void SPIClass::transfernb(const uint8_t* tbuf, uint8_t* rbuf, uint32_t len)
+{
+  bcm2835_spi_chipSelect(BCM2835_SPI_CS_NONE);
+  //Transfer len bytes in one go, tbuf and rbuf may be the same buffer
+  bcm2835_spi_transfernb((char*)tbuf, (char*)rbuf, len);
+}
+
 void pinMode(unsigned char pin, unsigned char mode)
 {
   if (pin == NOT_A_PIN)
@@ -110,31 +136,55 @@ unsigned char digitalRead(unsigned char pin) {
 
 unsigned long millis()
 {
-  //Declare a variable to store current time
-  struct timeval RHCurrentTime;
-  //Get current time
-  gettimeofday(&RHCurrentTime,NULL);
-  //Calculate the difference between our start time and the end time
-  unsigned long difference = ((RHCurrentTime.tv_sec - RHStartTime.tv_sec) * 1000);
-  difference += ((RHCurrentTime.tv_usec - RHStartTime.tv_usec)/1000);
-  //Return the calculated value
-  return difference;
+  return (monotonicMicros() - RHStartTime) / 1000;
 }
 
-void delay (unsigned long ms)
+unsigned long micros()
+{
+  return monotonicMicros() - RHStartTime;
+}
+
+// Sleeps until an absolute monotonic time, so signals do not shorten the sleep
+static void sleepUntil(struct timespec& ts)
+{
+  while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) == EINTR)
+    ;
+}
+
+static void sleepMicros(uint64_t us)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  uint64_t ns = ts.tv_nsec + us * 1000;
+  ts.tv_sec += ns / 1000000000;
+  ts.tv_nsec = ns % 1000000000;
+  sleepUntil(ts);
+}
+
+void delayUntilMicros(uint64_t us)
 {
-  //Implement Delay function
   struct timespec ts;
-  ts.tv_sec=0;
-  ts.tv_nsec=(ms * 1000);
-  nanosleep(&ts,&ts);
+  ts.tv_sec = us / 1000000;
+  ts.tv_nsec = (us % 1000000) * 1000;
+  sleepUntil(ts);
+}
+
+void delay (unsigned long ms)
+{
+  sleepMicros((uint64_t)ms * 1000);
+}
+
+void delayMicroseconds(unsigned int us)
+{
+  sleepMicros(us);
 }
 
 long random(long min, long max)
 {
-  long diff = max - min;
-  long ret = diff * rand() + min;
-  return ret;
+  // Arduino semantics: min to max - 1
+  if (max <= min)
+    return min;
+  return min + rand() % (max - min);
 }
 
 // Dump a buffer trying to display ASCII or HEX
@@ -169,10 +219,6 @@ void printbuffer(uint8_t buff[], int len)
 void SerialSimulator::begin(int baud)
 {
   //No implementation neccesary - Serial emulation on Linux = standard console
-  //
-  //Initialize a timestamp for millis calculation - we do this here as well in case SPI
-  //isn't used for some reason
-  gettimeofday(&RHStartTime, NULL);
 }
 
 size_t SerialSimulator::println(const char* s)
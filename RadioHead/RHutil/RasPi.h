@@ -41,6 +41,7 @@ class SPIClass
 {
   public:
     static byte transfer(byte _data);
+    static void transfernb(const uint8_t* tbuf, uint8_t* rbuf, uint32_t len);
     // SPI Configuration methods
     static void begin(); // Default
     static void begin(uint16_t, uint8_t, uint8_t);
@@ -48,6 +49,8 @@ class SPIClass
     static void setBitOrder(uint8_t);
     static void setDataMode(uint8_t);
     static void setClockDivider(uint16_t);
+    // Makes CE0 and CE1 deselected GPIO outputs, for RH drivers selecting their slaves as GPIOs
+    static void deselectChipEnables();
 };
 
 extern SPIClass SPI;
@@ -81,10 +84,25 @@ void digitalWrite(unsigned char pin, unsigned char value);
 
 unsigned char digitalRead(unsigned char pin) ;
 
+// Milliseconds since program start, from CLOCK_MONOTONIC
 unsigned long millis();
 
+// Microseconds since program start, from CLOCK_MONOTONIC
+unsigned long micros();
+
+// Sleeps for at least delay milliseconds
 void delay (unsigned long delay);
 
+// Sleeps for at least us microseconds
+void delayMicroseconds(unsigned int us);
+
+// CLOCK_MONOTONIC in microseconds. Unlike micros() it does not wrap and does not
+// count from program start, so it compares with kernel timestamps and other threads
+uint64_t monotonicMicros();
+
+// Sleeps until monotonicMicros() reaches us, returns at once if it has already
+void delayUntilMicros(uint64_t us);
+
 long random(long min, long max);
 
 void printbuffer(uint8_t buff[], int len);
@@ -853,6 +853,23 @@
 #elif (RH_PLATFORM == RH_PLATFORM_RASPI)
  #define RH_HAVE_HARDWARE_SPI
  #define RH_HAVE_SERIAL
+ // Interrupt lines can be waited on through the Linux GPIO character device
+ #define RH_HAVE_GPIO_EVENT
+ // SPI can also go through the kernel spidev driver
+ #define RH_HAVE_SPIDEV
+ // Several drivers on different threads can share one SPI interface through RHSPIBus
+ #define RH_HAVE_SPI_BUS
+ // Timers for poll() loops through a timerfd, see RHTimerService
+ #define RH_HAVE_TIMERFD
+ // Single threaded epoll loop of file descriptors and timers, see RHEventLoop and RHAsync
+ #define RH_HAVE_EPOLL
+ // 64 bit CLOCK_MONOTONIC time and sleeps to an absolute time, see monotonicMicros()
+ #define RH_HAVE_MONOTONIC_CLOCK
+ // std::atomic driver statistics, see RHGenericDriver::stats(). ARMv6 (Pi 1 and Zero)
+ // has no 64 bit atomic instructions, link with -latomic there
+ #define RH_HAVE_ATOMIC
+ // Received frames passed up through the managers without copying, see RHPacket
+ #define RH_HAVE_PACKET
  #define PROGMEM
  #include <RHutil/RasPi.h>
  #include <string.h>
@@ -868,6 +885,8 @@
  // Simulate the sketch on Linux and OSX
  #include <RHutil/simulator.h>
  #define RH_HAVE_SERIAL
+ #define RH_HAVE_ATOMIC
+ #define RH_HAVE_PACKET
 #include <netinet/in.h> // For htons and friends
 
 #else
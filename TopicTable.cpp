@@ -0,0 +1,150 @@
+// TopicTable.cpp
+//
+// MQTT topics of the radiohead gateway, one per sending node.
+
+#include <stdio.h>
+#include <string.h>
+
+#include "TopicTable.h"
+
+TopicTable::TopicTable()
+	:
+	_gateway(0)
+{
+	for (int i = 0; i < 256; i++)
+		snprintf(_decimal[i], sizeof(_decimal[i]), "%u", i);
+}
+
+bool TopicTable::build(const char* tmpl, const char* prefix, uint8_t gateway)
+{
+	_prefix = prefix ? prefix : "";
+	_gateway = gateway;
+	for (int node = 0; node < 256; node++)
+	{
+		if (!compile(tmpl, node, _entries[node]))
+			return false;
+	}
+	return true;
+}
+
+bool TopicTable::setNode(uint8_t node, const char* tmpl)
+{
+	return compile(tmpl, node, _entries[node]);
+}
+
+const char* TopicTable::topic(uint8_t from, uint8_t to, uint8_t id, uint8_t flags, char* buf) const
+{
+	const Entry& entry = _entries[from];
+	if (entry.parts.empty())
+		return entry.text.c_str();
+
+	// compile() made sure the longest expansion fits
+	char* p = buf;
+	for (size_t i = 0; i < entry.parts.size(); i++)
+	{
+		const Part& part = entry.parts[i];
+		memcpy(p, part.literal.data(), part.literal.size());
+		p += part.literal.size();
+		const char* value;
+		switch (part.field)
+		{
+		case FieldTo:
+			value = _decimal[to];
+			break;
+		case FieldId:
+			value = _decimal[id];
+			break;
+		case FieldFlags:
+			value = _decimal[flags];
+			break;
+		default:
+			continue;
+		}
+		while (*value)
+			*p++ = *value++;
+	}
+	*p = '\0';
+	return buf;
+}
+
+const char* TopicTable::error() const
+{
+	return _error.c_str();
+}
+
+bool TopicTable::compile(const char* tmpl, uint8_t node, Entry& entry)
+{
+	entry.text.clear();
+	entry.parts.clear();
+	if (!tmpl || !*tmpl)
+	{
+		_error = "empty topic template";
+		return false;
+	}
+
+	// Longest possible expansion: literals plus 3 digits per header field
+	size_t maxLen = 0;
+	std::string literal;
+	for (const char* p = tmpl; *p; p++)
+	{
+		if (*p != '{')
+		{
+			literal += *p;
+			continue;
+		}
+		const char* end = strchr(p, '}');
+		if (!end)
+		{
+			_error = std::string("unterminated placeholder in topic template ") + tmpl;
+			return false;
+		}
+		std::string name(p + 1, end - p - 1);
+		p = end;
+
+		if (name == "prefix")
+			literal += _prefix;
+		else if (name == "gateway")
+			literal += _decimal[_gateway];
+		else if (name == "from")
+			literal += _decimal[node];
+		else
+		{
+			Part part;
+			if (name == "to")
+				part.field = FieldTo;
+			else if (name == "id")
+				part.field = FieldId;
+			else if (name == "flags")
+				part.field = FieldFlags;
+			else
+			{
+				_error = "unknown placeholder {" + name + "} in topic template " + tmpl;
+				return false;
+			}
+			maxLen += literal.size() + 3;
+			part.literal.swap(literal);
+			entry.parts.push_back(part);
+		}
+	}
+	maxLen += literal.size();
+	if (maxLen >= TOPIC_TABLE_MAX_LEN)
+	{
+		_error = std::string("topic template too long: ") + tmpl;
+		entry.parts.clear();
+		return false;
+	}
+
+	if (entry.parts.empty())
+	{
+		// Constant for this node
+		entry.text.swap(literal);
+	}
+	else if (!literal.empty())
+	{
+		Part part;
+		part.field = FieldNone;
+		part.literal.swap(literal);
+		entry.parts.push_back(part);
+	}
+	return true;
+}
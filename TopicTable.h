@@ -0,0 +1,106 @@
+// TopicTable.h
+//
+// MQTT topics of the radiohead gateway, one per sending node, compiled once
+// at startup from the configured templates.
+
+#ifndef TopicTable_h
+#define TopicTable_h
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string>
+#include <vector>
+
+// Longest topic a template may expand to, including the terminating 0
+#define TOPIC_TABLE_MAX_LEN 256
+
+// Template used when the ini file does not set one: the old "<topic>/<from>"
+#define TOPIC_TABLE_DEFAULT_TEMPLATE "{prefix}/{from}"
+
+/////////////////////////////////////////////////////////////////////
+/// \class TopicTable TopicTable.h <TopicTable.h>
+/// \brief Precomputed MQTT topic for each of the 256 node addresses
+///
+/// A topic template is a string with placeholders in braces:
+/// - {prefix}  the configured topic prefix
+/// - {gateway} the node id of the gateway
+/// - {from}    the FROM header of the packet
+/// - {to}      the TO header of the packet
+/// - {id}      the ID header of the packet
+/// - {flags}   the FLAGS header of the packet
+///
+/// build() compiles the default template for every node and setNode() replaces
+/// the template of a single node. Placeholders known at startup ({prefix},
+/// {gateway}, {from}) are substituted when the table is built, so for the
+/// usual templates topic() just returns a prebuilt string. The others are kept
+/// as a list of literal parts and header fields, which topic() concatenates
+/// from a table of preformatted numbers, without parsing or printf.
+class TopicTable
+{
+public:
+	TopicTable();
+
+	/// Compiles tmpl for all 256 nodes, replacing any earlier build() or setNode().
+	/// \param[in] tmpl Topic template
+	/// \param[in] prefix Replaces {prefix}
+	/// \param[in] gateway Replaces {gateway}
+	/// \return false if tmpl is invalid or too long, see error()
+	bool build(const char* tmpl, const char* prefix, uint8_t gateway);
+
+	/// Compiles tmpl for one node, overriding the template given to build().
+	/// Call after build().
+	/// \param[in] node FROM address of the node
+	/// \param[in] tmpl Topic template
+	/// \return false if tmpl is invalid or too long, see error()
+	bool setNode(uint8_t node, const char* tmpl);
+
+	/// Returns the topic for a packet.
+	/// \param[in] from FROM header
+	/// \param[in] to TO header
+	/// \param[in] id ID header
+	/// \param[in] flags FLAGS header
+	/// \param[out] buf TOPIC_TABLE_MAX_LEN octets, used only if the topic depends on to, id or flags
+	/// \return The topic, either a string owned by the table or buf
+	const char* topic(uint8_t from, uint8_t to, uint8_t id, uint8_t flags, char* buf) const;
+
+	/// \return Description of the last build() or setNode() failure
+	const char* error() const;
+
+private:
+	/// Packet header inserted after a literal part
+	typedef enum
+	{
+		FieldNone = 0,
+		FieldTo,
+		FieldId,
+		FieldFlags
+	} Field;
+
+	/// A literal part, followed by the value of a header
+	typedef struct
+	{
+		std::string literal;
+		Field       field;
+	} Part;
+
+	/// Compiled template of one node. If parts is empty the topic is constant and
+	/// held in text, otherwise it is the concatenation of parts.
+	typedef struct
+	{
+		std::string         text;
+		std::vector<Part>   parts;
+	} Entry;
+
+	/// Compiles tmpl for node into entry
+	bool compile(const char* tmpl, uint8_t node, Entry& entry);
+
+	std::string         _prefix;
+	uint8_t             _gateway;
+	Entry               _entries[256];
+	std::string         _error;
+
+	/// Decimal representation of 0..255
+	char                _decimal[256][4];
+};
+
+#endif
@@ -0,0 +1,484 @@
+// radiohead_bench.cpp
+//
+// Benchmarks for the radiohead gateway on Raspberry Pi
+// Uses the bcm2835 library and the same board definitions as radiohead_gateway
+// Build with:
+// make radiohead_bench
+// Run with:
+// sudo ./radiohead_bench [options] <test>
+//
+// Options:
+// -t <seconds>	Duration of each run, default 30
+// -f <MHz>	Frequency to listen on, default 868.0
+// -s <spi>	SPI interface: bcm2835 (default) or spidev
+// -d <device>	spidev device, default /dev/spidev0.0
+// -c <Hz>	spidev clock, default 8000000
+// -l <octets>	Packet length for the spi and journal tests, default 64
+// -j <path>	Journal file for the journal test, default /tmp/radiohead_bench.journal
+//
+// Tests:
+// irq
+//	Compares waiting for DIO0 through the GPIO character device with the
+//	bcm2835 edge detect polling used before (5ms loop). Each mode runs while
+//	the module listens and reports wakeups, CPU time and, for received
+//	packets, the IRQ-to-read latency.
+// spi
+//	With the module in standby, measures the time of a full 255 octet FIFO
+//	read (half the duration) and of the register sequence RH_RF95 runs for
+//	each received packet, the one register at a time sequence used before and
+//	the coalesced one (a quarter each), with the resulting maximum packets per
+//	second.
+//	Run it once with -s bcm2835
+//	and once with -s spidev to compare the two interfaces.
+// idle
+//	Measures how long delay() and delayMicroseconds() really sleep, then runs
+//	the idle receive loops of the gateway while nothing is received: polling
+//	available() with delay(5) between rounds, and sleeping in poll() on DIO0
+//	and a timer service with a LED style 200ms timer (half the time each).
+//	Reports CPU use and wakeups of both.
+// journal
+//	Measures the time to append a packet to the store-and-forward journal,
+//	next to the time to read the same packet from the FIFO (half each).
+
+#include <bcm2835.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <signal.h>
+#include <time.h>
+#include <unistd.h>
+#include <poll.h>
+#include <sys/resource.h>
+
+#include "RadioHead/RH_RF95.h"
+#include "RadioHead/RHSpidevSPI.h"
+#include "RadioHead/RHTimerService.h"
+
+#include "PacketJournal.h"
+
+// Board used, see radiohead_gateway.cpp
+#define BOARD_DRAGINO_PIHAT
+
+#include "RasPiBoards.h"
+
+RHSpidevSPI spidev_spi;
+
+// Created in main() on the selected SPI interface
+RH_RF95 *rf95;
+
+//Flag for Ctrl-C
+volatile sig_atomic_t force_exit = false;
+
+void sig_handler(int) {
+	force_exit = true;
+}
+
+// Current time of the given clock in ns
+static uint64_t now_ns(clockid_t clock) {
+	struct timespec ts;
+	clock_gettime(clock, &ts);
+	return (uint64_t) ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+// User + system CPU time used by this process in µs
+static uint64_t cpu_us() {
+	struct rusage ru;
+	getrusage(RUSAGE_SELF, &ru);
+	return (uint64_t) (ru.ru_utime.tv_sec + ru.ru_stime.tv_sec) * 1000000ULL
+			+ ru.ru_utime.tv_usec + ru.ru_stime.tv_usec;
+}
+
+// Accumulated results of one benchmark run
+typedef struct {
+	const char *name;
+	uint64_t elapsed_us;
+	uint64_t cpu_us;
+	uint32_t wakeups;
+	uint32_t packets;
+	uint64_t latency_sum_us;
+	uint64_t latency_max_us;
+} BenchResult;
+
+static void print_result(const BenchResult *r) {
+	printf("%-8s %8.1fs  cpu %6.2f%%  wakeups/s %8.1f  packets %5u",
+			r->name, r->elapsed_us / 1e6,
+			r->elapsed_us ? 100.0 * r->cpu_us / r->elapsed_us : 0.0,
+			r->elapsed_us ? r->wakeups * 1e6 / r->elapsed_us : 0.0,
+			r->packets);
+	if (r->packets)
+		printf("  latency avg %7.1fus max %7lluus", (double) r->latency_sum_us / r->packets,
+				(unsigned long long) r->latency_max_us);
+	printf("\n");
+}
+
+static void record_packet(BenchResult *r, uint64_t latency_us) {
+	uint8_t buf[RH_RF95_MAX_MESSAGE_LEN];
+	uint8_t len = sizeof(buf);
+	rf95->recv(buf, &len);
+	r->packets++;
+	r->latency_sum_us += latency_us;
+	if (latency_us > r->latency_max_us)
+		r->latency_max_us = latency_us;
+}
+
+// Polling mode as in the original gateway loop: check the bcm2835 edge detect
+// flag every 5 ms. The edge happened some time after the previous poll, so the
+// reported latency is an upper bound
+static void bench_irq_poll(unsigned seconds, BenchResult *r) {
+	r->name = "poll";
+	bcm2835_gpio_ren(RF_IRQ_PIN);
+	bcm2835_gpio_set_eds(RF_IRQ_PIN);
+
+	uint64_t start = now_ns(CLOCK_MONOTONIC);
+	uint64_t cpu = cpu_us();
+	uint64_t last_poll = start;
+	while (!force_exit && now_ns(CLOCK_MONOTONIC) - start < seconds * 1000000000ULL) {
+		r->wakeups++;
+		uint64_t poll_time = now_ns(CLOCK_MONOTONIC);
+		if (bcm2835_gpio_eds(RF_IRQ_PIN)) {
+			bcm2835_gpio_set_eds(RF_IRQ_PIN);
+			if (rf95->available())
+				record_packet(r, (now_ns(CLOCK_MONOTONIC) - last_poll) / 1000);
+		}
+		last_poll = poll_time;
+		bcm2835_delay(5);
+	}
+	r->elapsed_us = (now_ns(CLOCK_MONOTONIC) - start) / 1000;
+	r->cpu_us = cpu_us() - cpu;
+	bcm2835_gpio_clr_ren(RF_IRQ_PIN);
+}
+
+// Event mode: block on the line event fd. The kernel timestamps each edge, so
+// the latency is measured from the interrupt itself
+static void bench_irq_event(unsigned seconds, BenchResult *r) {
+	r->name = "event";
+	RHGpioEvent &event = rf95->interruptEvent();
+
+	uint64_t start = now_ns(CLOCK_MONOTONIC);
+	uint64_t cpu = cpu_us();
+	while (!force_exit && now_ns(CLOCK_MONOTONIC) - start < seconds * 1000000000ULL) {
+		int edges = event.wait(1000);
+		r->wakeups++;
+		if (edges > 0 && rf95->available()) {
+			// Kernels before 5.7 timestamp with CLOCK_REALTIME
+			uint64_t edge = event.lastEventTime();
+			uint64_t mono = now_ns(CLOCK_MONOTONIC);
+			uint64_t latency = (edge <= mono && mono - edge < 10000000000ULL)
+					? mono - edge : now_ns(CLOCK_REALTIME) - edge;
+			record_packet(r, latency / 1000);
+		}
+	}
+	r->elapsed_us = (now_ns(CLOCK_MONOTONIC) - start) / 1000;
+	r->cpu_us = cpu_us() - cpu;
+}
+
+static int bench_irq(unsigned seconds) {
+	BenchResult poll_result, event_result;
+	memset(&poll_result, 0, sizeof(poll_result));
+	memset(&event_result, 0, sizeof(event_result));
+
+	if (rf95->interruptFd() < 0) {
+		fprintf(stderr, "DIO0 events not available on GPIO%d, is the gpio-no-irq overlay loaded?\n", RF_IRQ_PIN);
+		return 1;
+	}
+
+	// The kernel and the bcm2835 library must not both drive edge detection
+	printf("Polling for %us...\n", seconds);
+	rf95->interruptEvent().end();
+	bench_irq_poll(seconds, &poll_result);
+
+	printf("Waiting on line events for %us...\n", seconds);
+	if (!rf95->interruptEvent().begin()) {
+		fprintf(stderr, "Could not request GPIO%d again\n", RF_IRQ_PIN);
+		return 1;
+	}
+	bench_irq_event(seconds, &event_result);
+
+	print_result(&poll_result);
+	print_result(&event_result);
+	return 0;
+}
+
+// Register sequence RH_RF95 used for one received packet of len octets before
+// the status registers were read in one burst
+static void spi_packet_registers(uint8_t len) {
+	uint8_t buf[RH_RF95_FIFO_SIZE];
+	rf95->spiRead(RH_RF95_REG_12_IRQ_FLAGS);
+	rf95->spiRead(RH_RF95_REG_13_RX_NB_BYTES);
+	rf95->spiWrite(RH_RF95_REG_0D_FIFO_ADDR_PTR, rf95->spiRead(RH_RF95_REG_10_FIFO_RX_CURRENT_ADDR));
+	rf95->spiBurstRead(RH_RF95_REG_00_FIFO, buf, len);
+	rf95->spiWrite(RH_RF95_REG_12_IRQ_FLAGS, 0xff);
+	rf95->spiRead(RH_RF95_REG_1A_PKT_RSSI_VALUE);
+	rf95->spiWrite(RH_RF95_REG_12_IRQ_FLAGS, 0xff);
+}
+
+// Register sequence of RH_RF95 for one received packet of len octets
+static void spi_packet_coalesced(uint8_t len) {
+	uint8_t buf[RH_RF95_FIFO_SIZE];
+	uint8_t status[RH_RF95_RX_STATUS_LEN];
+	rf95->spiBurstRead(RH_RF95_REG_10_FIFO_RX_CURRENT_ADDR, status, sizeof(status));
+	rf95->spiWrite(RH_RF95_REG_0D_FIFO_ADDR_PTR, status[0]);
+	rf95->spiBurstRead(RH_RF95_REG_00_FIFO, buf, len);
+	rf95->spiWrite(RH_RF95_REG_12_IRQ_FLAGS, RH_RF95_RX_DONE);
+}
+
+// Runs one packet read sequence repeatedly for the given time and prints the result
+static void bench_spi_packet(const char *name, void (*sequence)(uint8_t), uint8_t len, uint64_t duration_ns) {
+	uint64_t start = now_ns(CLOCK_MONOTONIC);
+	uint64_t cpu = cpu_us();
+	uint32_t packets = 0;
+	while (!force_exit && now_ns(CLOCK_MONOTONIC) - start < duration_ns) {
+		sequence(len);
+		packets++;
+	}
+	uint64_t elapsed = (now_ns(CLOCK_MONOTONIC) - start) / 1000;
+	uint64_t used = cpu_us() - cpu;
+	if (!packets || !elapsed)
+		return;
+	printf("Packet read %-10s (%3u octets) %8.1fus  cpu %6.2f%%  max %8.0f packets/s\n", name, len,
+			(double) elapsed / packets, 100.0 * used / elapsed, packets * 1e6 / elapsed);
+}
+
+static int bench_spi(unsigned seconds, uint8_t packet_len) {
+	uint8_t buf[RH_RF95_FIFO_SIZE];
+	// Standby keeps the FIFO accessible and nothing arrives meanwhile
+	rf95->setModeIdle();
+
+	uint64_t start = now_ns(CLOCK_MONOTONIC);
+	uint64_t cpu = cpu_us();
+	uint32_t fifo_reads = 0;
+	while (!force_exit && now_ns(CLOCK_MONOTONIC) - start < seconds * 500000000ULL) {
+		rf95->spiWrite(RH_RF95_REG_0D_FIFO_ADDR_PTR, 0);
+		rf95->spiBurstRead(RH_RF95_REG_00_FIFO, buf, 255);
+		fifo_reads++;
+	}
+	uint64_t fifo_elapsed = (now_ns(CLOCK_MONOTONIC) - start) / 1000;
+	uint64_t fifo_cpu = cpu_us() - cpu;
+
+	if (!fifo_reads || !fifo_elapsed)
+		return 1;
+	printf("FIFO read (255 octets)  %8.1fus  cpu %6.2f%%\n",
+			(double) fifo_elapsed / fifo_reads, 100.0 * fifo_cpu / fifo_elapsed);
+
+	bench_spi_packet("registers", spi_packet_registers, packet_len, seconds * 250000000ULL);
+	bench_spi_packet("coalesced", spi_packet_coalesced, packet_len, seconds * 250000000ULL);
+	return 0;
+}
+
+// Prints the average time delay() or delayMicroseconds() slept for the given value
+static void bench_sleep(const char *name, void (*sleep)(unsigned long), unsigned long value) {
+	const int rounds = 20;
+	uint64_t start = now_ns(CLOCK_MONOTONIC);
+	for (int i = 0; i < rounds; i++)
+		sleep(value);
+	printf("%s(%lu) sleeps %10.1fus\n", name, value, (now_ns(CLOCK_MONOTONIC) - start) / 1000.0 / rounds);
+}
+
+static void sleep_ms(unsigned long ms) {
+	delay(ms);
+}
+
+static void sleep_us(unsigned long us) {
+	delayMicroseconds(us);
+}
+
+// Timer callback of the idle test, counts the wakeups it causes
+static void idle_timer(void *arg) {
+	((BenchResult *) arg)->wakeups++;
+}
+
+static int bench_idle(unsigned seconds) {
+	bench_sleep("delay", sleep_ms, 1);
+	bench_sleep("delay", sleep_ms, 5);
+	bench_sleep("delayMicroseconds", sleep_us, 100);
+
+	BenchResult polled, timed;
+	memset(&polled, 0, sizeof(polled));
+	memset(&timed, 0, sizeof(timed));
+
+	// Gateway loop without DIO0 events
+	polled.name = "delay";
+	uint64_t start = now_ns(CLOCK_MONOTONIC);
+	uint64_t cpu = cpu_us();
+	while (!force_exit && now_ns(CLOCK_MONOTONIC) - start < seconds * 500000000ULL) {
+		polled.wakeups++;
+		if (rf95->available())
+			record_packet(&polled, 0);
+		delay(5);
+	}
+	polled.elapsed_us = (now_ns(CLOCK_MONOTONIC) - start) / 1000;
+	polled.cpu_us = cpu_us() - cpu;
+
+	// Gateway loop with DIO0 events and the LED timer
+	timed.name = "timerfd";
+	RHTimerService timers;
+	if (!timers.begin()) {
+		perror("timerfd");
+		return 1;
+	}
+	timers.schedule(200, idle_timer, &timed, 200);
+	struct pollfd fds[2] = {
+		{ rf95->interruptFd(), POLLIN, 0 },
+		{ timers.fd(), POLLIN, 0 },
+	};
+	start = now_ns(CLOCK_MONOTONIC);
+	cpu = cpu_us();
+	while (!force_exit && now_ns(CLOCK_MONOTONIC) - start < seconds * 500000000ULL) {
+		if (poll(fds, 2, 1000) <= 0)
+			continue;
+		if (fds[1].revents)
+			timers.run();
+		if (fds[0].revents) {
+			timed.wakeups++;
+			rf95->interruptEvent().drain();
+			while (rf95->available())
+				record_packet(&timed, 0);
+		}
+	}
+	timed.elapsed_us = (now_ns(CLOCK_MONOTONIC) - start) / 1000;
+	timed.cpu_us = cpu_us() - cpu;
+
+	print_result(&polled);
+	print_result(&timed);
+	if (fds[0].fd < 0)
+		printf("DIO0 events not available, the timerfd run only woke up for the timer\n");
+	return 0;
+}
+
+// Read sequence for the journal comparison
+static void spi_packet_fifo(uint8_t len) {
+	uint8_t buf[RH_RF95_FIFO_SIZE];
+	rf95->spiWrite(RH_RF95_REG_0D_FIFO_ADDR_PTR, 0);
+	rf95->spiBurstRead(RH_RF95_REG_00_FIFO, buf, len);
+}
+
+static int bench_journal(unsigned seconds, uint8_t packet_len, const char *path) {
+	PacketJournal journal;
+	if (!journal.open(path)) {
+		fprintf(stderr, "journal %s\n", journal.error());
+		return 1;
+	}
+	uint8_t payload[RH_RF95_FIFO_SIZE];
+	memset(payload, 0x55, sizeof(payload));
+
+	uint64_t start = now_ns(CLOCK_MONOTONIC);
+	uint64_t cpu = cpu_us();
+	uint32_t appends = 0;
+	while (!force_exit && now_ns(CLOCK_MONOTONIC) - start < seconds * 500000000ULL) {
+		journal.append("radiohead/bench/12", payload, packet_len);
+		appends++;
+	}
+	uint64_t elapsed = (now_ns(CLOCK_MONOTONIC) - start) / 1000;
+	uint64_t used = cpu_us() - cpu;
+	journal.close();
+	unlink(path);
+	if (!appends || !elapsed)
+		return 1;
+	printf("Journal append (%3u octets) %8.1fus  cpu %6.2f%%  max %8.0f packets/s\n", packet_len,
+			(double) elapsed / appends, 100.0 * used / elapsed, appends * 1e6 / elapsed);
+
+	rf95->setModeIdle();
+	bench_spi_packet("fifo", spi_packet_fifo, packet_len, seconds * 500000000ULL);
+	return 0;
+}
+
+static void usage() {
+	fprintf(stderr, "usage: radiohead_bench [-t seconds] [-f MHz] [-s bcm2835|spidev] [-d device] [-c Hz] [-l octets] [-j path] irq|spi|idle|journal\n");
+}
+
+//Main Function
+int main(int argc, char *argv[]) {
+	unsigned seconds = 30;
+	float frequency = 868.0;
+	const char *spi = "bcm2835";
+	uint8_t packet_len = 64;
+	const char *journal_path = "/tmp/radiohead_bench.journal";
+	int opt;
+	while ((opt = getopt(argc, argv, "t:f:s:d:c:l:j:")) != -1) {
+		switch (opt) {
+		case 't':
+			seconds = atoi(optarg);
+			break;
+		case 'f':
+			frequency = atof(optarg);
+			break;
+		case 's':
+			spi = optarg;
+			break;
+		case 'd':
+			spidev_spi.setDevice(optarg);
+			break;
+		case 'c':
+			spidev_spi.setSpeed(atol(optarg));
+			break;
+		case 'l':
+			packet_len = atoi(optarg);
+			break;
+		case 'j':
+			journal_path = optarg;
+			break;
+		default:
+			usage();
+			return 1;
+		}
+	}
+	if (optind >= argc) {
+		usage();
+		return 1;
+	}
+	const char *test = argv[optind];
+	bool use_spidev = strcmp(spi, "spidev") == 0;
+
+	signal(SIGINT, sig_handler);
+
+	if (!bcm2835_init()) {
+		fprintf(stderr, "bcm2835_init() failed\n");
+		return 1;
+	}
+
+	RH_RF95 radio(RF_CS_PIN, RF_IRQ_PIN, use_spidev ? (RHGenericSPI&) spidev_spi : (RHGenericSPI&) hardware_spi);
+	rf95 = &radio;
+
+#ifdef RF_IRQ_PIN
+	pinMode(RF_IRQ_PIN, INPUT);
+	bcm2835_gpio_set_pud(RF_IRQ_PIN, BCM2835_GPIO_PUD_DOWN);
+#endif
+
+#ifdef RF_RST_PIN
+	pinMode(RF_RST_PIN, OUTPUT);
+	digitalWrite(RF_RST_PIN, LOW);
+	bcm2835_delay(150);
+	digitalWrite(RF_RST_PIN, HIGH);
+	bcm2835_delay(100);
+#endif
+
+	if (!rf95->init()) {
+		fprintf(stderr, "RF95 module init failed, Please verify wiring/module\n");
+		bcm2835_close();
+		return 1;
+	}
+	if (use_spidev)
+		printf("SPI spidev @ %uHz\n", spidev_spi.speed());
+	else
+		printf("SPI bcm2835\n");
+	rf95->setFrequency(frequency);
+	rf95->setPromiscuous(true);
+	rf95->setModeRx();
+
+	int rc;
+	if (strcmp(test, "irq") == 0) {
+		rc = bench_irq(seconds);
+	} else if (strcmp(test, "spi") == 0) {
+		rc = bench_spi(seconds, packet_len);
+	} else if (strcmp(test, "idle") == 0) {
+		rc = bench_idle(seconds);
+	} else if (strcmp(test, "journal") == 0) {
+		rc = bench_journal(seconds, packet_len, journal_path);
+	} else {
+		usage();
+		rc = 1;
+	}
+
+	bcm2835_close();
+	return rc;
+}
@@ -18,14 +18,32 @@
 #include <stdio.h>
 #include <signal.h>
 #include <unistd.h>
+#include <pthread.h>
+#include <sched.h>
+#include <sys/eventfd.h>
+#include <sys/signalfd.h>
+#include <sys/mman.h>
+#include <thread>
+#include <atomic>
+#include <mutex>
+#include <condition_variable>
 
 #include "RadioHead/RH_RF95.h"
 #include "RadioHead/RHDatagram.h"
-
-#include <MQTTClient.h>
+#include "RadioHead/RHSpidevSPI.h"
+#include "RadioHead/RHSPIBus.h"
+#include "RadioHead/RHEventLoop.h"
+#include "RadioHead/RHDutyCycle.h"
 
 #include "SimpleIni/SimpleIni.h"
 
+#include "MqttPublisher.h"
+#include "PacketRing.h"
+#include "TopicTable.h"
+#include "PacketBatch.h"
+#include "PacketJournal.h"
+#include "DownlinkQueue.h"
+
 // define hardware used change to fit your need
 // Uncomment the board you have, if not listed
 // uncommment custom board and set wiring tin custom section
@@ -46,37 +64,787 @@
 // see https://github.com/dragino/Lora
 #define BOARD_DRAGINO_PIHAT
 
-#define TIMEOUT 10000L
-
 // Now we include RasPi_Boards.h so this will expose defined
 // constants with CS/IRQ/RESET/on board LED pins definition
 #include "../RasPiBoards.h"
 
-const int QOS = 1;
+// Pins a board does not have
+#ifndef RF_IRQ_PIN
+#define RF_IRQ_PIN NOT_A_PIN
+#endif
+#ifndef RF_RST_PIN
+#define RF_RST_PIN NOT_A_PIN
+#endif
+#ifndef RF_LED_PIN
+#define RF_LED_PIN NOT_A_PIN
+#endif
+
+// Maximum number of RF95 modules, one [radio.N] section each
+#define MAX_RADIOS 3
+
+// Default CS, IRQ, RST and LED pins of radio N, from the board definition
+static const uint8_t board_pins[MAX_RADIOS][4] = {
+#if defined (BOARD_PI_LORA_GATEWAY)
+	{ MOD1_CS_PIN, MOD1_IRQ_PIN, MOD1_RST_PIN, MOD1_LED_PIN },
+	{ MOD2_CS_PIN, MOD2_IRQ_PIN, MOD2_RST_PIN, MOD2_LED_PIN },
+	{ MOD3_CS_PIN, MOD3_IRQ_PIN, MOD3_RST_PIN, MOD3_LED_PIN },
+#else
+	{ RF_CS_PIN, RF_IRQ_PIN, RF_RST_PIN, RF_LED_PIN },
+	{ NOT_A_PIN, NOT_A_PIN, NOT_A_PIN, NOT_A_PIN },
+	{ NOT_A_PIN, NOT_A_PIN, NOT_A_PIN, NOT_A_PIN },
+#endif
+};
+
+// Modem configurations by the name used in the ini file
+static const struct {
+	const char *name;
+	RH_RF95::ModemConfigChoice config;
+} modem_configs[] = {
+	{ "Bw125Cr45Sf128", RH_RF95::Bw125Cr45Sf128 },
+	{ "Bw500Cr45Sf128", RH_RF95::Bw500Cr45Sf128 },
+	{ "Bw31_25Cr48Sf512", RH_RF95::Bw31_25Cr48Sf512 },
+	{ "Bw125Cr48Sf4096", RH_RF95::Bw125Cr48Sf4096 },
+};
 
-// Create an instance of a rf95
-RH_RF95 rf95(RF_CS_PIN, RF_IRQ_PIN);
-//RH_RF95 rf95(RF_CS_PIN);
+// SPI through the kernel spidev driver, used instead of the bcm2835
+// SPI functions when the ini file sets spi=spidev
+RHSpidevSPI spidev_spi;
 
 // Ini file
 CSimpleIniA ini;
 
-// Our MQTT Client Configuration
-//#define MQTT_TIMEOUT 3000L
+// Number of received packets that can wait for the publisher
+#define RX_RING_SIZE 64
+
+// Milliseconds between checks whether an uplink that holds back a downlink is
+// over, its RxDone usually wakes the radio thread before
+#define DOWNLINK_RX_BUSY_RETRY 10
+
+// One RF95 module, the thread servicing it and the ring handing its packets
+// to the publishing thread
+typedef struct {
+	unsigned index;                             // N of the [radio.N] section
+	uint8_t cs_pin;
+	uint8_t irq_pin;
+	uint8_t rst_pin;
+	uint8_t led_pin;
+	float frequency;
+	RH_RF95::ModemConfigChoice modem_config;
+	int8_t tx_power;
+	bool duty_cycle;                            // Limit transmissions to the sub-band duty cycle
+	unsigned long max_deferral;                 // ms a transmission may wait for duty cycle budget
+	RH_RF95 *rf95;
+	RHDutyCycle *duty;                          // Between rf95 and manager
+	RHDatagram *manager;
+	bool up;                                    // Module initialised and serviced
+	PacketRing<RadioPacket, RX_RING_SIZE> ring;
+	DownlinkQueue *downlinks;                   // Messages to send, NULL without downlinks
+	int tx_event_fd;                            // Signalled when a downlink was queued
+	uint8_t tx_id;                              // ID header of the next downlink
+	uint32_t tx_sent;
+	uint32_t tx_failed;
+	std::mutex lock;                            // Held by the thread driving the module
+	std::thread thread;
+	RHEventLoop loop;                           // Of the radio thread
+	uint32_t led_timer;                         // Switches the LED off after a packet
+	uint32_t service_timer;                     // Next deferred transmission or downlink retry
+	// Receive window downlink, handed from the radio thread to the TX thread
+	std::thread tx_thread;
+	std::mutex window_lock;
+	std::condition_variable window_ready;
+	Downlink window;                            // Message for the next receive window
+	uint64_t window_at;                         // monotonicMicros() the window opens, 0 if none
+	uint32_t window_sent;
+	uint32_t window_missed;                     // Not sent in the window after an uplink
+	uint64_t window_late_sum;                   // Transmitter start after window_at, in us
+	uint32_t window_late_max;
+} Radio;
 
-//Flag for Ctrl-C
-volatile sig_atomic_t force_exit = false;
+Radio radios[MAX_RADIOS];
+unsigned radio_count = 0;
 
-void sig_handler(int sig) {
-	printf("\n%s Break received, exiting!\n", __BASEFILE__);
-	force_exit = true;
+// Signalled by the radio threads whenever they committed a packet to their ring
+int rx_event_fd = -1;
+
+// Signalled once when the gateway shuts down. Nobody reads it, so it stays
+// readable for the event loops of all radio threads
+int exit_event_fd = -1;
+
+// Downlinks: messages published to <downlink_topic>/<node>[/<priority>] are sent
+// to the node by the radio that last heard from it
+std::string downlink_topic;
+unsigned long downlink_ttl = DOWNLINK_QUEUE_DEFAULT_TTL;
+uint8_t downlink_priority = 0;
+// Set once the radio threads run, messages arriving before are rejected
+std::atomic<bool> downlinks_ready(false);
+// 1 + index in radios of the radio that last received from a node, 0 if none did
+std::atomic<uint8_t> node_radio[256];
+
+// Receive windows: a node with an rx_delay only listens that many microseconds
+// after the end of each of its uplinks. Its downlinks wait in window_downlinks
+// until it sends, then go out on the radio that heard it, rx_delay after RxDone
+uint32_t node_rx_delay[256];
+DownlinkQueue *window_downlinks = NULL;
+// The TX thread wakes up this long before a window to get the module and load the FIFO
+uint32_t window_lead = 3000;
+
+// Set by the main thread on SIGINT or SIGTERM
+std::atomic<bool> force_exit(false);
+
+// Switches the LED of a radio off, scheduled by its thread after a packet
+void led_off(void *arg) {
+	Radio *radio = (Radio *) arg;
+	digitalWrite(radio->led_pin, LOW);
 }
 
-//Main Function
-int main(int argc, const char *argv[]) {
-	unsigned long led_blink = 0;
+// Sends the queued downlinks of a radio the channel and duty cycle budget allow now.
+// Each one is sent to completion and the module is put back into receive mode at
+// once. A downlink that can not go yet stays in the queue, where a more urgent one
+// can overtake it. Returns the milliseconds until it should be tried again, -1 if
+// nothing waits
+int send_downlinks(Radio *radio) {
+	if (!radio->downlinks)
+		return -1;
+	RH_RF95 *rf95 = radio->rf95;
+	RHDutyCycle *duty = radio->duty;
+	Downlink downlink;
+	while (radio->downlinks->peek(downlink)) {
+		// Transmitting now would destroy the uplink coming in
+		if (rf95->isReceiving())
+			return DOWNLINK_RX_BUSY_RETRY;
+		// Never queue behind the duty cycle, deferred messages go first
+		if (duty->queued())
+			return duty->serviceTimeout();
+		uint32_t wait = duty->txDelay(downlink.len);
+		if (wait == 0xffffffff) {
+			// Longer than the whole budget of the sub-band, it never fits
+			radio->downlinks->remove(downlink.seq);
+			radio->tx_failed++;
+			continue;
+		}
+		if (wait)
+			return wait > 1000 ? 1000 : wait;
+		// A receive window has to find the module free
+		uint64_t now = monotonicMicros();
+		uint64_t window_at;
+		{
+			std::lock_guard<std::mutex> guard(radio->window_lock);
+			window_at = radio->window_at;
+		}
+		if (window_at && now + rf95->timeOnAir(downlink.len) + window_lead >= window_at)
+			return window_at > now ? (window_at - now) / 1000 + 1 : 1;
+		if (!radio->downlinks->remove(downlink.seq))
+			continue; // Expired meanwhile
+
+		// The module sends only what the manager hands it, CAD included if set
+		radio->manager->setHeaderId(radio->tx_id++);
+		if (radio->manager->sendto(downlink.payload, downlink.len, downlink.node) && rf95->waitPacketSent())
+			radio->tx_sent++;
+		else
+			radio->tx_failed++;
+		rf95->setModeRx();
+	}
+	return -1;
+}
+
+// Hands the next downlink of a node that just sent a packet to the TX thread of the
+// radio, to go out in the node's receive window rx_delay after rxdone. Called by
+// the radio thread with the radio locked
+void schedule_window(Radio *radio, uint8_t node, uint64_t rxdone) {
+	Downlink downlink;
+	if (!window_downlinks || !node_rx_delay[node] || !window_downlinks->peek(downlink, node))
+		return;
+	uint64_t at = rxdone + node_rx_delay[node];
+	std::lock_guard<std::mutex> guard(radio->window_lock);
+	// Another window is still waiting, the packet sat in the receive queue too long
+	// or the duty cycle does not allow it: the message waits for the next uplink
+	if (radio->window_at || monotonicMicros() + window_lead > at
+			|| radio->duty->queued() || radio->duty->txDelay(downlink.len)) {
+		radio->window_missed++;
+		return;
+	}
+	if (!window_downlinks->remove(downlink.seq))
+		return;
+	radio->window = downlink;
+	radio->window_at = at;
+	radio->window_ready.notify_one();
+}
+
+// TX thread: sends the receive window downlinks of one radio. It runs with a
+// real-time priority and sleeps until shortly before the window, takes the module
+// from the radio thread and has the driver start the transmitter at the exact time
+void tx_thread(Radio *radio) {
+	RH_RF95 *rf95 = radio->rf95;
+	std::unique_lock<std::mutex> guard(radio->window_lock);
+	while (!force_exit) {
+		if (!radio->window_at) {
+			// The timeout only bounds the time to notice force_exit
+			radio->window_ready.wait_for(guard, std::chrono::seconds(1));
+			continue;
+		}
+		uint64_t at = radio->window_at;
+		guard.unlock();
+
+		delayUntilMicros(at - window_lead);
+		uint64_t started = 0;
+		bool sent = false;
+		{
+			std::lock_guard<std::mutex> radio_guard(radio->lock);
+			// The radio thread may have had the duty cycle defer a message since the
+			// window was scheduled. That one goes first, ours would only be queued
+			// behind it and miss the window
+			RHDutyCycle *duty = radio->duty;
+			if (!duty->queued() && !duty->txDelay(radio->window.len)) {
+				rf95->setTxTime(at);
+				radio->manager->setHeaderId(radio->tx_id++);
+				sent = radio->manager->sendto(radio->window.payload, radio->window.len, radio->window.node);
+				started = monotonicMicros();
+				sent = sent && rf95->waitPacketSent();
+			}
+			// The driver clears the start time when it transmits, a send that did
+			// not get there must not hold back the next one
+			rf95->setTxTime(0);
+			rf95->setModeRx();
+		}
+
+		guard.lock();
+		if (sent) {
+			uint32_t late = started > at ? started - at : 0;
+			radio->window_sent++;
+			radio->window_late_sum += late;
+			if (late > radio->window_late_max)
+				radio->window_late_max = late;
+		} else {
+			// Try again in the window after the next uplink of the node
+			radio->window_missed++;
+			window_downlinks->restore(radio->window);
+		}
+		radio->window_at = 0;
+	}
+}
+
+void radio_service_due(void *arg);
+
+// Services one module: reads the packets it received if irq is set, sends
+// what waited for duty cycle budget and the queued downlinks, and sets the
+// timer for the next transmission that waits. Called by the radio thread
+void service_radio(Radio *radio, bool irq) {
+	RHDutyCycle *duty = radio->duty;
+	RHDatagram *manager = radio->manager;
+
+	// The TX thread takes the module for a receive window, otherwise it is ours
+	std::unique_lock<std::mutex> radio_guard(radio->lock);
+
+	// Rising edge fired ?
+	if (irq) {
+		while (manager->available()) {
+			digitalWrite(radio->led_pin, HIGH);
+			radio->loop.cancel(radio->led_timer);
+			radio->led_timer = radio->loop.schedule(200, led_off, radio);
+			// The packet the driver read the FIFO into, copied once into the ring slot
+			RHPacket *rx = manager->recvfromPacket();
+			if (!rx)
+				break;
+			RadioPacket *packet = radio->ring.claim();
+			if (!packet) {
+				// Publisher is not keeping up, the ring counts the overflow
+				rx->release();
+				continue;
+			}
+			packet->radio = radio->index;
+			packet->rssi = rx->rssi;
+			packet->snr = rx->snr;
+			packet->from = rx->headerFrom();
+			packet->to = rx->headerTo();
+			packet->id = rx->headerId();
+			packet->flags = rx->headerFlags();
+			packet->len = sizeof(packet->payload);
+			rx->copyPayload(packet->payload, &packet->len);
+			// The packet may have waited in the driver queue, date it back
+			// to when it was read from the radio
+			unsigned long age = millis() - rx->time;
+			uint64_t rxdone = rx->rxDone;
+			rx->release();
+			clock_gettime(CLOCK_REALTIME, &packet->timestamp);
+			packet->timestamp.tv_sec -= age / 1000;
+			packet->timestamp.tv_nsec -= (age % 1000) * 1000000L;
+			if (packet->timestamp.tv_nsec < 0) {
+				packet->timestamp.tv_sec--;
+				packet->timestamp.tv_nsec += 1000000000L;
+			}
+			uint8_t from = packet->from;
+			radio->ring.commit();
+			uint64_t one = 1;
+			if (write(rx_event_fd, &one, sizeof(one)) < 0)
+				perror("rx_event_fd");
+			node_radio[from] = radio - radios + 1;
+			// The node listens for a reply right after its uplink
+			schedule_window(radio, from, rxdone);
+		}
+	}
+
+	// Send what waited for duty cycle budget and is due now
+	duty->service();
+
+	// Downlinks go out between receptions
+	int timeout = send_downlinks(radio);
+	radio_guard.unlock();
+
+	// Come back when a transmission waiting for duty cycle budget or a
+	// waiting downlink is due
+	int deferred = duty->serviceTimeout();
+	if (deferred >= 0 && (timeout < 0 || deferred < timeout))
+		timeout = deferred;
+	radio->loop.cancel(radio->service_timer);
+	radio->service_timer = timeout >= 0 ? radio->loop.schedule(timeout, radio_service_due, radio) : RH_EVENT_TIMER_NONE;
+}
+
+// DIO0 rose, the kernel queued the edge for us
+void radio_irq(uint32_t, void *arg) {
+	Radio *radio = (Radio *) arg;
+	radio->rf95->interruptEvent().drain();
+	service_radio(radio, true);
+}
+
+// No GPIO events (eg gpio-no-irq overlay): called every few ms. With an IRQ
+// pin its edge detect flag is polled instead of reading the module IRQ
+// registers over SPI each time
+void radio_poll(void *arg) {
+	Radio *radio = (Radio *) arg;
+	bool irq = true;
+	if (radio->irq_pin != NOT_A_PIN) {
+		irq = bcm2835_gpio_eds(radio->irq_pin);
+		// Now clear the eds flag by setting it to 1
+		if (irq)
+			bcm2835_gpio_set_eds(radio->irq_pin);
+	}
+	service_radio(radio, irq);
+}
+
+// A downlink was queued for the radio
+void radio_downlink(uint32_t, void *arg) {
+	Radio *radio = (Radio *) arg;
+	uint64_t count;
+	if (read(radio->tx_event_fd, &count, sizeof(count)) < 0)
+		perror("tx_event_fd");
+	service_radio(radio, false);
+}
+
+// The service timer of a radio expired
+void radio_service_due(void *arg) {
+	Radio *radio = (Radio *) arg;
+	radio->service_timer = RH_EVENT_TIMER_NONE;
+	service_radio(radio, false);
+}
+
+// The gateway shuts down
+void radio_exit(uint32_t, void *arg) {
+	Radio *radio = (Radio *) arg;
+	radio->loop.stop();
+}
+
+// Radio thread: services one module and hands every packet addressed to us
+// to the publishing thread through the ring of the radio. It does no logging
+// and no network I/O, so the module is back in receive mode as fast as possible.
+// With DIO0 events it sleeps in epoll_wait() until a packet arrives, a downlink
+// is queued, a timer (LED, deferred transmission) expires or the gateway exits
+void radio_thread(Radio *radio) {
+	RHEventLoop &loop = radio->loop;
+	if (!loop.begin()) {
+		perror("Radio event loop");
+		return;
+	}
+	radio->led_timer = RH_EVENT_TIMER_NONE;
+	radio->service_timer = RH_EVENT_TIMER_NONE;
+	loop.watch(exit_event_fd, EPOLLIN, radio_exit, radio);
+	if (radio->tx_event_fd >= 0)
+		loop.watch(radio->tx_event_fd, EPOLLIN, radio_downlink, radio);
+	if (radio->rf95->interruptFd() >= 0) {
+		loop.watch(radio->rf95->interruptFd(), EPOLLIN, radio_irq, radio);
+	} else {
+		// Let OS doing other tasks when polling
+		// For timed critical application you can reduce this period,
+		// but this will charge CPU usage, take care and monitor
+		loop.schedule(5, radio_poll, radio, 5);
+	}
+	loop.run();
+	loop.end();
+}
+
+// Resets and configures one module
+bool init_radio(Radio *radio, uint8_t node_id) {
+	printf("Radio %u CS=GPIO%d", radio->index, radio->cs_pin);
+
+	pinMode(radio->led_pin, OUTPUT);
+	digitalWrite(radio->led_pin, HIGH);
+
+	if (radio->irq_pin != NOT_A_PIN) {
+		printf(", IRQ=GPIO%d", radio->irq_pin);
+		// IRQ Pin input/pull down
+		pinMode(radio->irq_pin, INPUT);
+		bcm2835_gpio_set_pud(radio->irq_pin, BCM2835_GPIO_PUD_DOWN);
+		// Rising edge detection is set up after the module init, once we know
+		// whether the kernel delivers DIO0 events
+	}
+
+	if (radio->rst_pin != NOT_A_PIN) {
+		printf(", RST=GPIO%d", radio->rst_pin);
+		// Pulse a reset on module
+		pinMode(radio->rst_pin, OUTPUT);
+		digitalWrite(radio->rst_pin, LOW);
+		bcm2835_delay(150);
+		digitalWrite(radio->rst_pin, HIGH);
+		bcm2835_delay(100);
+	}
+
+	if (radio->led_pin != NOT_A_PIN)
+		printf(", LED=GPIO%d", radio->led_pin);
+	digitalWrite(radio->led_pin, LOW);
+	printf(" @ %3.2fMHz\n", radio->frequency);
+
+	printf("Init RF95 module %u ", radio->index);
+	RH_RF95 &rf95 = *radio->rf95;
+	if (!radio->manager->init()) {
+		printf("failed\n");
+		return false;
+	}
+	printf("OK\n");
+
+	// Defaults after init are 434.0MHz, 13dBm, Bw = 125 kHz, Cr = 4/5, Sf = 128chips/symbol, CRC on
+	// The default transmitter power is 13dBm, using PA_BOOST.
+	// If you are using RFM95/96/97/98 modules which uses the PA_BOOST transmitter pin, then
+	// you can set transmitter powers from 5 to 23 dBm:
+	// rf95.setTxPower(23, false);
+	// If you are using Modtronix inAir4 or inAir9,or any other module which uses the
+	// transmitter RFO pins and not the PA_BOOST pins
+	// then you can configure the power transmitter power for -1 to 14 dBm and with useRFO true.
+	// Failure to do that will result in extremely low transmit powers.
+	// rf95.setTxPower(14, true);
+
+	// RF95 Modules don't have RFO pin connected, so just use PA_BOOST
+	// check your country max power useable, in EU it's +14dB
+	rf95.setTxPower(radio->tx_power, false);
+	rf95.setModemConfig(radio->modem_config);
+	printf("Radio %u symbol %.3fms, time on air %.1fms for 10 bytes, %.1fms for %u bytes\n", radio->index,
+			rf95.symbolTime() / 1000.0, rf95.timeOnAir(10) / 1000.0,
+			rf95.timeOnAir(RH_RF95_MAX_MESSAGE_LEN) / 1000.0, RH_RF95_MAX_MESSAGE_LEN);
+
+	// You can optionally require this module to wait until Channel Activity
+	// Detection shows no activity on the channel before transmitting by setting
+	// the CAD timeout to non-zero:
+	//rf95.setCADTimeout(10000);
+
+	// Adjust Frequency
+	rf95.setFrequency(radio->frequency);
+
+	// Duty cycle budget of the sub-band, without sub-bands nothing is limited
+	RHDutyCycle &duty = *radio->duty;
+	if (!radio->duty_cycle)
+		duty.setBands(NULL, 0);
+	duty.setFrequency(radio->frequency);
+	duty.setMaxDeferral(radio->max_deferral);
+	if (duty.band() == RH_DUTY_CYCLE_NO_BAND)
+		printf("Radio %u transmissions not duty cycle limited\n", radio->index);
+	else
+		printf("Radio %u duty cycle sub-band %u, %.1fs airtime per hour\n", radio->index,
+				duty.band(), duty.remaining() / 1e6);
+
+	// If we need to send something
+	// rf95.setThisAddress(node_id);
+	rf95.setHeaderFrom(node_id);
+
+	// Only packets addressed to us are read from the module, the
+	// driver drops all others after reading their headers
+	rf95.setRxFilter(true);
+	rf95.acceptTo(node_id);
+	rf95.setAcceptBroadcast(false);
+
+	// Stay in receive mode while packets wait to be read, so a burst of
+	// uplinks arriving close together is not lost
+	rf95.setContinuousRx(true);
+
+	if (rf95.interruptFd() >= 0) {
+		printf("DIO0 interrupts from /dev/gpiochip0 line %d\n", radio->irq_pin);
+	} else if (radio->irq_pin != NOT_A_PIN) {
+		// No kernel events, fall back to the bcm2835 edge detect flag
+		printf("DIO0 interrupts not available, polling GPIO%d\n", radio->irq_pin);
+		bcm2835_gpio_ren(radio->irq_pin);
+	}
+
+	// We're ready to listen for incoming message
+	rf95.setModeRx();
+	return true;
+}
+
+// Store-and-forward journal, open if the ini file sets [journal] path
+PacketJournal journal;
+
+// Hands a message to the publisher, or to the journal while the broker is
+// away. Once something is journaled, newer messages are journaled behind it
+// until replay_journal() has caught up, so the broker sees them in order
+void publish_message(MqttPublisher &publisher, const char *topic, const uint8_t *data, size_t len) {
+	// Never blocks: the publisher thread does the broker I/O
+	if (journal.empty() && (!journal.isOpen() || publisher.isConnected()) && publisher.publish(topic, data, len)) {
+		printf("queued\n");
+	} else if (journal.append(topic, data, len)) {
+		printf("journaled, %u waiting\n", journal.records());
+	} else {
+		printf("failed, queue full\n");
+	}
+}
+
+// Moves journaled messages to the publisher while it is connected and has room
+void replay_journal(MqttPublisher &publisher) {
+	PacketJournal::Record record;
+	while (publisher.isConnected() && journal.front(record)) {
+		char topic[256];
+		memcpy(topic, record.topic, record.topicLen);
+		topic[record.topicLen] = '\0';
+		if (!publisher.publish(topic, record.data, record.len))
+			break;
+		journal.pop();
+	}
+}
 
-	signal(SIGINT, sig_handler);
+// Publishes the driver statistics of every radio as JSON to <topic>/<N>. The
+// counters are read without locking while the radio threads keep counting
+void publish_stats(MqttPublisher &publisher, const std::string &topic) {
+	for (unsigned i = 0; i < radio_count; i++) {
+		Radio &radio = radios[i];
+		if (!radio.up)
+			continue;
+		RHDriverStats stats;
+		radio.rf95->stats(stats);
+		char json[1536];
+		int len = snprintf(json, sizeof(json),
+				"{\"radio\":%u,\"rx_good\":%llu,\"rx_bad\":%llu,\"rx_crc_error\":%llu,\"rx_timeout\":%llu,"
+				"\"rx_header_valid\":%llu,\"rx_overrun\":%llu,\"tx_good\":%llu,\"cad_busy\":%llu,"
+				"\"rssi_min\":%d,\"rssi_step\":%d,\"rssi\":[",
+				radio.index, (unsigned long long) stats.rxGood, (unsigned long long) stats.rxBad,
+				(unsigned long long) stats.rxCrcError, (unsigned long long) stats.rxTimeout,
+				(unsigned long long) stats.rxHeaderValid, (unsigned long long) stats.rxOverrun,
+				(unsigned long long) stats.txGood, (unsigned long long) stats.cadBusy,
+				RH_STATS_RSSI_MIN, RH_STATS_RSSI_STEP);
+		for (unsigned b = 0; b < RH_STATS_RSSI_BUCKETS; b++)
+			len += snprintf(json + len, sizeof(json) - len, "%s%llu", b ? "," : "", (unsigned long long) stats.rssi[b]);
+		len += snprintf(json + len, sizeof(json) - len, "],\"snr_min\":%d,\"snr_step\":%d,\"snr\":[",
+				RH_STATS_SNR_MIN, RH_STATS_SNR_STEP);
+		for (unsigned b = 0; b < RH_STATS_SNR_BUCKETS; b++)
+			len += snprintf(json + len, sizeof(json) - len, "%s%llu", b ? "," : "", (unsigned long long) stats.snr[b]);
+		len += snprintf(json + len, sizeof(json) - len, "]}");
+
+		char radio_topic[256];
+		snprintf(radio_topic, sizeof(radio_topic), "%s/%u", topic.c_str(), radio.index);
+		// Statistics are sampled again soon, not worth journaling
+		if (publisher.isConnected())
+			publisher.publish(radio_topic, (const uint8_t *) json, len);
+	}
+}
+
+// Publishes the current batch, if any
+void publish_batch(MqttPublisher &publisher, PacketBatch &batch, const char *topic, std::vector<uint8_t> &message) {
+	uint16_t count = batch.take(message);
+	if (!count)
+		return;
+	printf("Publish mqtt batch of %u packets, %u bytes ", count, (unsigned) message.size());
+	publish_message(publisher, topic, message.data(), message.size());
+}
+
+// Called on the MQTT client thread for every message on the downlink topic. Queues
+// it for the radio that last heard from the node, the first one if none did
+void downlink_arrived(const char *topic, const uint8_t *payload, size_t len, void *) {
+	unsigned node = 0, priority = downlink_priority;
+	char end = 0;
+	int n = 0;
+	if (strncmp(topic, downlink_topic.c_str(), downlink_topic.size()) == 0)
+		n = sscanf(topic + downlink_topic.size(), "/%u%c%u%c", &node, &end, &priority, &end);
+	if (!(n == 1 || (n == 3 && end == '/')) || node > 255 || priority > 255) {
+		printf("Downlink on %s ignored, topic not %s/<node>[/<priority>]\n", topic, downlink_topic.c_str());
+		return;
+	}
+	if (!downlinks_ready) {
+		printf("Downlink for node %u dropped, radios not ready\n", node);
+		return;
+	}
+
+	if (node_rx_delay[node]) {
+		// Waits for the next uplink of the node
+		if (window_downlinks->push(node, priority, downlink_ttl, payload, len))
+			printf("Downlink of %u bytes for node %u priority %u queued for its receive window\n", (unsigned) len, node, priority);
+		else
+			printf("Downlink of %u bytes for node %u dropped, %s\n", (unsigned) len, node,
+					len > RH_RF95_MAX_MESSAGE_LEN ? "too long" : "queue full");
+		return;
+	}
+
+	Radio *radio = NULL;
+	unsigned heard = node_radio[node];
+	if (heard && radios[heard - 1].up)
+		radio = &radios[heard - 1];
+	for (unsigned i = 0; !radio && i < radio_count; i++) {
+		if (radios[i].up)
+			radio = &radios[i];
+	}
+	if (!radio->downlinks->push(node, priority, downlink_ttl, payload, len)) {
+		printf("Downlink of %u bytes for node %u dropped, %s\n", (unsigned) len, node,
+				len > RH_RF95_MAX_MESSAGE_LEN ? "too long" : "queue full");
+		return;
+	}
+	printf("Downlink of %u bytes for node %u priority %u queued on radio %u\n", (unsigned) len, node, priority, radio->index);
+	uint64_t one = 1;
+	if (write(radio->tx_event_fd, &one, sizeof(one)) < 0)
+		perror("tx_event_fd");
+}
+
+// Prints the driver statistics of a radio. They are read without locking, so
+// this may be called while the radio thread runs
+void print_driver_stats(Radio &radio) {
+	RHDriverStats stats;
+	radio.rf95->stats(stats);
+	printf("Radio %u headers=%llu crc errors=%llu timeouts=%llu overruns=%llu tx=%llu cad busy=%llu\n", radio.index,
+			(unsigned long long) stats.rxHeaderValid, (unsigned long long) stats.rxCrcError,
+			(unsigned long long) stats.rxTimeout, (unsigned long long) stats.rxOverrun,
+			(unsigned long long) stats.txGood, (unsigned long long) stats.cadBusy);
+	printf("Radio %u RSSI", radio.index);
+	for (unsigned b = 0; b < RH_STATS_RSSI_BUCKETS; b++)
+		if (stats.rssi[b])
+			printf(" %d:%llu", RH_RF95::rssiBucket(b), (unsigned long long) stats.rssi[b]);
+	printf(", SNR");
+	for (unsigned b = 0; b < RH_STATS_SNR_BUCKETS; b++)
+		if (stats.snr[b])
+			printf(" %d:%llu", RH_RF95::snrBucket(b), (unsigned long long) stats.snr[b]);
+	printf("\n");
+}
+
+// Main thread state, shared with the callbacks of its event loop
+typedef struct {
+	RHEventLoop loop;
+	MqttPublisher *publisher;
+	TopicTable *topics;
+	bool batching;
+	PacketBatch *batch;
+	std::string batch_topic;
+	std::vector<uint8_t> batch_message;
+	uint32_t batch_timer;                       // Publishes the batch when its window closes
+	std::string stats_topic;
+	int signal_fd;
+	uint32_t synced;                            // journal.appended() at the last sync
+} Gateway;
+
+// Publishes the batch once it is due, then waits for the next one
+void batch_due(void *arg) {
+	Gateway *gw = (Gateway *) arg;
+	gw->batch_timer = RH_EVENT_TIMER_NONE;
+	if (gw->batch->due())
+		publish_batch(*gw->publisher, *gw->batch, gw->batch_topic.c_str(), gw->batch_message);
+	// Not due yet (the timer rounds to ms) or a new batch was started meanwhile
+	int timeout = gw->batch->timeout();
+	if (timeout >= 0)
+		gw->batch_timer = gw->loop.schedule(timeout, batch_due, gw);
+}
+
+// Logs and publishes, or batches, the packets waiting in the rings of the radios
+void publish_packets(Gateway *gw) {
+	// Take turns between the radios, one packet each, so a busy channel
+	// does not hold back the others
+	bool more = true;
+	while (more) {
+		more = false;
+		for (unsigned i = 0; i < radio_count; i++) {
+			RadioPacket *packet = radios[i].ring.front();
+			if (!packet)
+				continue;
+			more = true;
+			printf("Packet received on radio %u\n", packet->radio);
+			printf("\tHeader from: %u\n", packet->from);
+			printf("\tHeader to: %u\n", packet->to);
+			printf("\tHeader id: %u\n", packet->id);
+			printf("\tTimestamp: %s", ctime(&packet->timestamp.tv_sec));
+			printf("\tPacket[%02d] %ddB SNR %ddB:\n\t", packet->len, packet->rssi, packet->snr);
+			printbuffer(packet->payload, packet->len);
+			printf("\n");
+
+			if (gw->batching) {
+				if (gw->batch->add(*packet))
+					publish_batch(*gw->publisher, *gw->batch, gw->batch_topic.c_str(), gw->batch_message);
+				radios[i].ring.pop();
+				continue;
+			}
+
+			char topic_buf[TOPIC_TABLE_MAX_LEN];
+			const char *topic = gw->topics->topic(packet->from, packet->to, packet->id, packet->flags, topic_buf);
+
+			printf("Publish mqtt message ");
+			publish_message(*gw->publisher, topic, packet->payload, packet->len);
+			radios[i].ring.pop();
+		}
+	}
+	if (gw->batch_timer == RH_EVENT_TIMER_NONE && gw->batch->timeout() >= 0)
+		gw->batch_timer = gw->loop.schedule(gw->batch->timeout(), batch_due, gw);
+}
+
+// A radio thread committed packets to its ring
+void packets_ready(uint32_t, void *arg) {
+	Gateway *gw = (Gateway *) arg;
+	uint64_t count;
+	if (read(rx_event_fd, &count, sizeof(count)) < 0)
+		perror("rx_event_fd");
+	publish_packets(gw);
+}
+
+// The publisher connected or has room again, the journal can move on
+void publisher_ready(uint32_t, void *arg) {
+	Gateway *gw = (Gateway *) arg;
+	uint64_t count;
+	if (read(gw->publisher->eventFd(), &count, sizeof(count)) < 0)
+		perror("publisher eventfd");
+	replay_journal(*gw->publisher);
+}
+
+void stats_due(void *arg) {
+	Gateway *gw = (Gateway *) arg;
+	publish_stats(*gw->publisher, gw->stats_topic);
+}
+
+// Writes the journal to disk if something was appended since the last time
+void journal_sync_due(void *arg) {
+	Gateway *gw = (Gateway *) arg;
+	if (journal.appended() != gw->synced) {
+		journal.sync();
+		gw->synced = journal.appended();
+	}
+}
+
+// SIGINT (Ctrl-C) and SIGTERM (systemd) stop the gateway, SIGHUP prints the
+// driver statistics and writes the journal to disk
+void signal_received(uint32_t, void *arg) {
+	Gateway *gw = (Gateway *) arg;
+	struct signalfd_siginfo info;
+	if (read(gw->signal_fd, &info, sizeof(info)) != sizeof(info))
+		return;
+	if (info.ssi_signo == SIGHUP) {
+		for (unsigned i = 0; i < radio_count; i++) {
+			if (radios[i].up)
+				print_driver_stats(radios[i]);
+		}
+		if (journal.isOpen())
+			journal_sync_due(gw);
+		return;
+	}
+	printf("\n%s %s received, exiting!\n", __BASEFILE__, info.ssi_signo == SIGINT ? "Break" : "SIGTERM");
+	gw->loop.stop();
+}
+
+//Main Function
+int main(int, const char *[]) {
+	// The signals are taken from a signalfd by the event loop of the main thread.
+	// They are blocked before any thread is started, so no thread gets them
+	sigset_t signals;
+	sigemptyset(&signals);
+	sigaddset(&signals, SIGINT);
+	sigaddset(&signals, SIGTERM);
+	sigaddset(&signals, SIGHUP);
+	pthread_sigmask(SIG_BLOCK, &signals, NULL);
 	printf("Starting %s\n", __BASEFILE__);
 
 	ini.SetUnicode();
@@ -105,215 +873,376 @@ int main(int argc, const char *argv[]) {
 	const char *node_id = ini.GetValue("lora", "node_id", NULL);
 	printf("\tlora_node_id=%s\n", node_id);
 	const char *frequency = ini.GetValue("lora", "frequency", NULL);
-	printf("\tlora_frequency=%s\n\n", frequency);
+	printf("\tlora_frequency=%s\n", frequency);
+	const char *spi = ini.GetValue("lora", "spi", "bcm2835");
+	printf("\tlora_spi=%s\n", spi);
 
 	uint8_t lora_node_id = (uint8_t) atoi(node_id);
-	float lora_frequency = atof(frequency);
 
-	if (!bcm2835_init()) {
-		fprintf(stderr, "%s bcm2835_init() failed\n\n", __BASEFILE__);
+	// MQTT topic of each node, compiled once. [mqtt] topic_template applies to all
+	// nodes, a [node.N] section with a topic key overrides it for node N
+	const char *topic_template = ini.GetValue("mqtt", "topic_template", TOPIC_TABLE_DEFAULT_TEMPLATE);
+	printf("\tmqtt_topic_template=%s\n", topic_template);
+	TopicTable topics;
+	if (!topics.build(topic_template, mqtt_topic, lora_node_id)) {
+		fprintf(stderr, "Invalid [mqtt] topic_template: %s\n", topics.error());
 		return 1;
 	}
+	CSimpleIniA::TNamesDepend sections;
+	ini.GetAllSections(sections);
+	for (CSimpleIniA::TNamesDepend::const_iterator it = sections.begin(); it != sections.end(); ++it) {
+		unsigned node;
+		char end;
+		if (sscanf(it->pItem, "node.%u%c", &node, &end) != 1 || node > 255)
+			continue;
+		const char *node_topic = ini.GetValue(it->pItem, "topic", NULL);
+		if (!node_topic)
+			continue;
+		printf("\tnode %u topic=%s\n", node, node_topic);
+		if (!topics.setNode(node, node_topic)) {
+			fprintf(stderr, "Invalid topic in [%s]: %s\n", it->pItem, topics.error());
+			return 1;
+		}
+	}
 
-	printf("RF95 CS=GPIO%d", RF_CS_PIN);
+	// Batching: with batch_max_packets > 1 packets are collected and published
+	// together to batch_topic, at most batch_max_delay_ms after the first one
+	uint16_t batch_max_packets = ini.GetLongValue("mqtt", "batch_max_packets", 1);
+	unsigned long batch_max_delay = ini.GetLongValue("mqtt", "batch_max_delay_ms", PACKET_BATCH_DEFAULT_MAX_DELAY);
+	std::string batch_topic = ini.GetValue("mqtt", "batch_topic", (std::string(mqtt_topic ? mqtt_topic : "") + "/batch").c_str());
+	const char *batch_format = ini.GetValue("mqtt", "batch_format", "binary");
+	bool batching = batch_max_packets > 1;
+	PacketBatch batch(strcmp(batch_format, "json") == 0 ? PacketBatch::FormatJson : PacketBatch::FormatBinary,
+			batch_max_packets, batch_max_delay);
+	if (batching)
+		printf("\tbatch of %u packets / %lums as %s to %s\n", batch_max_packets, batch_max_delay,
+				batch_format, batch_topic.c_str());
 
-#ifdef RF_LED_PIN
-	pinMode(RF_LED_PIN, OUTPUT);
-	digitalWrite(RF_LED_PIN, HIGH);
-#endif
+	// Downlinks: messages published below [downlink] topic, by default <topic>/down,
+	// are sent to the node, the most urgent first, dropped after ttl_ms
+	bool downlink = ini.GetBoolValue("downlink", "enabled", true);
+	downlink_topic = ini.GetValue("downlink", "topic", (std::string(mqtt_topic ? mqtt_topic : "") + "/down").c_str());
+	downlink_ttl = ini.GetLongValue("downlink", "ttl_ms", DOWNLINK_QUEUE_DEFAULT_TTL);
+	downlink_priority = (uint8_t) ini.GetLongValue("downlink", "priority", 0);
+	uint16_t downlink_queue_size = ini.GetLongValue("downlink", "queue_size", DOWNLINK_QUEUE_DEFAULT_SIZE);
+	if (downlink)
+		printf("\tdownlink %s/<node>[/<priority>], ttl %lums, priority %u, queue of %u\n", downlink_topic.c_str(),
+				downlink_ttl, downlink_priority, downlink_queue_size);
+	// Receive windows: nodes with an rx_delay_ms, from [downlink] or their [node.N]
+	// section, get their downlinks that long after the end of their next uplink
+	unsigned long rx_delay = ini.GetLongValue("downlink", "rx_delay_ms", 0);
+	window_lead = ini.GetLongValue("downlink", "rx_window_lead_us", window_lead);
+	int tx_priority = ini.GetLongValue("downlink", "tx_priority", 50);
+	bool rx_windows = false;
+	for (unsigned node = 0; node < 256; node++) {
+		char section[16];
+		snprintf(section, sizeof(section), "node.%u", node);
+		node_rx_delay[node] = ini.GetLongValue(section, "rx_delay_ms", rx_delay) * 1000;
+		if (node_rx_delay[node]) {
+			rx_windows = downlink;
+			if (node_rx_delay[node] != rx_delay * 1000)
+				printf("\tnode %u rx_delay=%lums\n", node, (unsigned long) node_rx_delay[node] / 1000);
+		}
+	}
+	if (rx_windows) {
+		window_downlinks = new DownlinkQueue(downlink_queue_size);
+		printf("\treceive windows rx_delay %lums, TX thread priority %d wakes %uus early\n", rx_delay, tx_priority, window_lead);
+	}
 
-#ifdef RF_IRQ_PIN
-	printf(", IRQ=GPIO%d", RF_IRQ_PIN);
-	// IRQ Pin input/pull down
-	pinMode(RF_IRQ_PIN, INPUT);
-	bcm2835_gpio_set_pud(RF_IRQ_PIN, BCM2835_GPIO_PUD_DOWN);
-	// Now we can enable Rising edge detection
-	bcm2835_gpio_ren (RF_IRQ_PIN);
-#endif
+	// Telemetry: with stats_interval_s the driver statistics of each radio are
+	// published to <stats_topic>/<N>
+	long stats_interval = ini.GetLongValue("mqtt", "stats_interval_s", 0);
+	std::string stats_topic = ini.GetValue("mqtt", "stats_topic", (std::string(mqtt_topic ? mqtt_topic : "") + "/stats").c_str());
+	if (stats_interval > 0)
+		printf("\tstats every %lds to %s/<radio>\n", stats_interval, stats_topic.c_str());
 
-#ifdef RF_RST_PIN
-	printf(", RST=GPIO%d", RF_RST_PIN);
-	// Pulse a reset on module
-	pinMode(RF_RST_PIN, OUTPUT);
-	digitalWrite(RF_RST_PIN, LOW);
-	bcm2835_delay(150);
-	digitalWrite(RF_RST_PIN, HIGH);
-	bcm2835_delay(100);
-#endif
+	// Store-and-forward: messages the broker can not take are kept in a
+	// memory mapped journal, flushed to disk every journal_sync_ms
+	const char *journal_path = ini.GetValue("journal", "path", NULL);
+	size_t journal_size = ini.GetLongValue("journal", "size", PACKET_JOURNAL_DEFAULT_SIZE);
+	long journal_sync = ini.GetLongValue("journal", "sync_ms", 1000);
+	if (journal_path) {
+		printf("\tjournal %s, %u bytes, sync every %ldms\n", journal_path, (unsigned) journal_size, journal_sync);
+		if (!journal.open(journal_path, journal_size))
+			fprintf(stderr, "%s journal %s, messages are dropped while the broker is away\n",
+					__BASEFILE__, journal.error());
+		else if (journal.recovered())
+			printf("\tjournal holds %u messages from the last run\n", journal.recovered());
+	}
 
-#ifdef RF_LED_PIN
-	printf(", LED=GPIO%d", RF_LED_PIN);
-	digitalWrite(RF_LED_PIN, LOW);
-#endif
+	// Radios: one [radio.N] section per module, N from 1 to MAX_RADIOS. Keys
+	// missing there are taken from [lora], pins from the board definition.
+	// Without any [radio.N] section the board module is set up from [lora]
+	bool radio_sections = false;
+	for (unsigned n = 1; n <= MAX_RADIOS; n++) {
+		char section[16];
+		snprintf(section, sizeof(section), "radio.%u", n);
+		if (ini.GetSection(section))
+			radio_sections = true;
+	}
+	for (unsigned n = 1; n <= MAX_RADIOS; n++) {
+		char section[16];
+		snprintf(section, sizeof(section), "radio.%u", n);
+		if (radio_sections ? !ini.GetSection(section) : n > 1)
+			continue;
+		Radio &radio = radios[radio_count++];
+		radio.index = n;
+		radio.cs_pin = ini.GetLongValue(section, "cs_pin", board_pins[n - 1][0]);
+		radio.irq_pin = ini.GetLongValue(section, "irq_pin", board_pins[n - 1][1]);
+		radio.rst_pin = ini.GetLongValue(section, "rst_pin", board_pins[n - 1][2]);
+		radio.led_pin = ini.GetLongValue(section, "led_pin", board_pins[n - 1][3]);
+		radio.frequency = atof(ini.GetValue(section, "frequency", frequency));
+		radio.tx_power = ini.GetLongValue(section, "tx_power", ini.GetLongValue("lora", "tx_power", 14));
+		radio.duty_cycle = ini.GetBoolValue(section, "duty_cycle", ini.GetBoolValue("lora", "duty_cycle", true));
+		radio.max_deferral = ini.GetLongValue(section, "max_deferral_ms", ini.GetLongValue("lora", "max_deferral_ms", 0));
+		radio.downlinks = downlink ? new DownlinkQueue(downlink_queue_size) : NULL;
+		radio.tx_event_fd = -1;
+		const char *modem_config = ini.GetValue(section, "modem_config", ini.GetValue("lora", "modem_config", "Bw125Cr45Sf128"));
+		size_t m;
+		for (m = 0; m < sizeof(modem_configs) / sizeof(modem_configs[0]); m++) {
+			if (strcmp(modem_config, modem_configs[m].name) == 0)
+				break;
+		}
+		if (m == sizeof(modem_configs) / sizeof(modem_configs[0])) {
+			fprintf(stderr, "Invalid modem_config %s for radio %u\n", modem_config, n);
+			return 1;
+		}
+		radio.modem_config = modem_configs[m].config;
+		if (radio.cs_pin == NOT_A_PIN) {
+			fprintf(stderr, "No cs_pin for radio %u\n", n);
+			return 1;
+		}
+		printf("\tradio %u %3.2fMHz %s %ddBm\n", n, radio.frequency, modem_config, radio.tx_power);
+	}
+	printf("\n");
 
-	printf(" OK NodeID=%u @ %3.2fMHz\n", lora_node_id, lora_frequency);
+	if (!bcm2835_init()) {
+		fprintf(stderr, "%s bcm2835_init() failed\n\n", __BASEFILE__);
+		return 1;
+	}
+
+	// Create an instance of a rf95 per module on the configured SPI interface
+	bool use_spidev = strcmp(spi, "spidev") == 0;
+	if (use_spidev) {
+		spidev_spi.setDevice(ini.GetValue("lora", "spi_device", RH_SPIDEV_DEFAULT_DEVICE));
+		spidev_spi.setSpeed(ini.GetLongValue("lora", "spi_speed", 8000000));
+	}
+	// The modules share the bus: it deselects all of them once at startup and
+	// gives each SPI transaction of a radio thread exclusive access
+	RHSPIBus spi_bus(use_spidev ? (RHGenericSPI&) spidev_spi : (RHGenericSPI&) hardware_spi);
+	for (unsigned i = 0; i < radio_count; i++) {
+		spi_bus.addSlaveSelect(radios[i].cs_pin);
+		radios[i].rf95 = new RH_RF95(radios[i].cs_pin, radios[i].irq_pin, spi_bus);
+		// Every transmission of the manager is charged to the duty cycle budget
+		radios[i].duty = new RHDutyCycle(*radios[i].rf95);
+		radios[i].manager = new RHDatagram(*radios[i].duty, lora_node_id);
+	}
+	printf("Gateway NodeID=%u, %u radio%s\n", lora_node_id, radio_count, radio_count > 1 ? "s" : "");
 
 	printf("Create MQTT client ");
-	MQTTClient client;
-	MQTTClient_connectOptions connOpts = MQTTClient_connectOptions_initializer;
-	MQTTClient_message pubmsg = MQTTClient_message_initializer;
-	MQTTClient_deliveryToken token;
+	MqttPublisher publisher(mqtt_dest_addr, mqtt_client_id,
+			(uint16_t) ini.GetLongValue("mqtt", "queue_size", MQTT_PUBLISHER_DEFAULT_QUEUE_SIZE),
+			(uint16_t) ini.GetLongValue("mqtt", "max_inflight", MQTT_PUBLISHER_DEFAULT_MAX_INFLIGHT));
+	publisher.setKeepAlive(ini.GetLongValue("mqtt", "keep_alive", MQTT_PUBLISHER_DEFAULT_KEEPALIVE));
+	publisher.setBackoff(ini.GetLongValue("mqtt", "reconnect_min_ms", MQTT_PUBLISHER_DEFAULT_BACKOFF_MIN),
+			ini.GetLongValue("mqtt", "reconnect_max_ms", MQTT_PUBLISHER_DEFAULT_BACKOFF_MAX));
 
-	int rc;
+	if (downlink)
+		publisher.subscribe((downlink_topic + "/#").c_str(), downlink_arrived, NULL);
 
-	if ((rc = MQTTClient_create(&client, mqtt_dest_addr, mqtt_client_id, MQTTCLIENT_PERSISTENCE_NONE, NULL)) == MQTTCLIENT_SUCCESS) {
+	// The publisher connects in the background and keeps the session open,
+	// reconnecting with backoff whenever the broker goes away
+	if (publisher.begin()) {
 		printf("OK\n");
 	} else {
 		printf("failed\n");
 		exit(EXIT_FAILURE);
 	}
 
-	connOpts.keepAliveInterval = 1200;
-	connOpts.cleansession = 1;
-
-	printf("Connect to mqtt server ");
-	printf(mqtt_dest_addr);
-	if ((rc = MQTTClient_connect(client, &connOpts)) == MQTTCLIENT_SUCCESS) {
-		printf(" OK\n");
-	} else {
-		printf(" failed\n");
+	unsigned radios_up = 0;
+	for (unsigned i = 0; i < radio_count; i++) {
+		radios[i].up = init_radio(&radios[i], lora_node_id);
+		if (radios[i].up) {
+			radios_up++;
+			continue;
+		}
+		// Leave it out, the others still work
+		fprintf(stderr, "RF95 module %u init failed, Please verify wiring/module\n", radios[i].index);
+		if (use_spidev && !spidev_spi.isOpen())
+			fprintf(stderr, "Could not open %s, is SPI enabled (dtparam=spi=on)?\n",
+					ini.GetValue("lora", "spi_device", RH_SPIDEV_DEFAULT_DEVICE));
 	}
+	if (radios_up) {
+		if (use_spidev)
+			printf("SPI %s @ %uHz\n", ini.GetValue("lora", "spi_device", RH_SPIDEV_DEFAULT_DEVICE), spidev_spi.speed());
 
-	printf("Init RF95 module ");
-	RHDatagram manager(rf95, lora_node_id);
-	if (!manager.init()) {
-		printf("failed\n");
-		fprintf(stderr, "RF95 module init failed, Please verify wiring/module\n");
-	} else {
-		printf("OK\n");
-		// Defaults after init are 434.0MHz, 13dBm, Bw = 125 kHz, Cr = 4/5, Sf = 128chips/symbol, CRC on
-		// The default transmitter power is 13dBm, using PA_BOOST.
-		// If you are using RFM95/96/97/98 modules which uses the PA_BOOST transmitter pin, then
-		// you can set transmitter powers from 5 to 23 dBm:
-		// rf95.setTxPower(23, false);
-		// If you are using Modtronix inAir4 or inAir9,or any other module which uses the
-		// transmitter RFO pins and not the PA_BOOST pins
-		// then you can configure the power transmitter power for -1 to 14 dBm and with useRFO true.
-		// Failure to do that will result in extremely low transmit powers.
-		// rf95.setTxPower(14, true);
-
-		// RF95 Modules don't have RFO pin connected, so just use PA_BOOST
-		// check your country max power useable, in EU it's +14dB
-		rf95.setTxPower(14, false);
-
-		// You can optionally require this module to wait until Channel Activity
-		// Detection shows no activity on the channel before transmitting by setting
-		// the CAD timeout to non-zero:
-		//rf95.setCADTimeout(10000);
-
-		// Adjust Frequency
-		printf("Set lora frequency to %f\n", lora_frequency);
-		rf95.setFrequency(lora_frequency);
-
-		// If we need to send something
-		// rf95.setThisAddress(lora_node_id);
-		rf95.setHeaderFrom(lora_node_id);
-
-		// Be sure to grab all node packet
-		// we're sniffing to display, it's a demo
-		rf95.setPromiscuous(true);
-
-		// We're ready to listen for incoming message
-		printf("Set send/receive mode to receive\n");
-		rf95.setModeRx();
+		rx_event_fd = eventfd(0, EFD_NONBLOCK);
+		exit_event_fd = eventfd(0, EFD_NONBLOCK);
+		if (rx_event_fd < 0 || exit_event_fd < 0) {
+			perror("eventfd");
+			exit(EXIT_FAILURE);
+		}
+		// Wakes a radio thread sleeping in epoll_wait() when a downlink is queued for it
+		for (unsigned i = 0; i < radio_count; i++) {
+			if (!radios[i].up || !radios[i].downlinks)
+				continue;
+			radios[i].tx_event_fd = eventfd(0, EFD_NONBLOCK);
+			if (radios[i].tx_event_fd < 0) {
+				perror("eventfd");
+				exit(EXIT_FAILURE);
+			}
+		}
 
-		//Begin the main body of code
-		while (!force_exit) {
-			// We have a IRQ pin ,pool it instead reading
-			// Modules IRQ registers from SPI in each loop
-
-			// Rising edge fired ?
-#ifdef RF_IRQ_PIN
-			if (bcm2835_gpio_eds(RF_IRQ_PIN)) {
-				// Now clear the eds flag by setting it to 1
-				bcm2835_gpio_set_eds(RF_IRQ_PIN);
-				//printf("Packet Received, Rising event detect for pin GPIO%d\n", RF_IRQ_PIN);
-#endif
-				printf("Listening...\n");
+		// Everything the main thread does is started by its event loop: packets
+		// from the radio threads, the publisher getting ready for the journal,
+		// the batch window, the statistics and journal timers and the signals
+		Gateway gw;
+		gw.publisher = &publisher;
+		gw.topics = &topics;
+		gw.batching = batching;
+		gw.batch = &batch;
+		gw.batch_topic = batch_topic;
+		gw.batch_timer = RH_EVENT_TIMER_NONE;
+		gw.stats_topic = stats_topic;
+		gw.synced = journal.appended();
+		gw.signal_fd = signalfd(-1, &signals, SFD_NONBLOCK | SFD_CLOEXEC);
+		if (gw.signal_fd < 0 || !gw.loop.begin()) {
+			perror("Event loop");
+			exit(EXIT_FAILURE);
+		}
+		gw.loop.watch(gw.signal_fd, EPOLLIN, signal_received, &gw);
+		gw.loop.watch(rx_event_fd, EPOLLIN, packets_ready, &gw);
+		gw.loop.watch(publisher.eventFd(), EPOLLIN, publisher_ready, &gw);
+		if (stats_interval > 0)
+			gw.loop.schedule(stats_interval * 1000, stats_due, &gw, stats_interval * 1000);
+		if (journal.isOpen() && journal_sync > 0)
+			gw.loop.schedule(journal_sync, journal_sync_due, &gw, journal_sync);
 
-				if (manager.available()) {
-#ifdef RF_LED_PIN
-					led_blink = millis();
-					digitalWrite(RF_LED_PIN, HIGH);
-#endif
-					// Should be a message for us now
-					uint8_t buf[RH_RF95_MAX_MESSAGE_LEN];
-					uint8_t len = sizeof(buf);
-					uint8_t from = (uint8_t)manager.headerFrom();
-					printf("\tHeader from: %u\n", from);
-					uint8_t to = manager.headerTo();
-					printf("\tHeader to: %u\n", to);
-					uint8_t id = manager.headerId();
-					printf("\tHeader id: %u\n", id);
-					uint8_t flags = manager.headerFlags();
-					int8_t rssi = rf95.lastRssi();
-
-					if (to == lora_node_id)
-					{
-						printf("Receiving lora payload ");
-						if (manager.recvfrom(buf, &len, &from)) {
-							printf("OK\n");
-							time_t now = time(NULL);
-							printf("\tTimestamp: %s", ctime(&now));
-							printf("\tPacket[%02d] %ddB:\n\t", len, rssi);
-							printbuffer(buf, len);
-							printf("\n");
-
-							char topic[127];
-							sprintf(topic, "%s/%u", mqtt_topic, from);
-							pubmsg.payload = buf;
-							pubmsg.payloadlen = len;
-							pubmsg.qos = QOS;
-							pubmsg.retained = 0;
-
-							if (!MQTTClient_isConnected(client))
-							{
-								printf("Connect to mqtt server ");
-								printf(mqtt_dest_addr);
-								if ((rc = MQTTClient_connect(client, &connOpts)) == MQTTCLIENT_SUCCESS) {
-									printf(" OK\n");
-								} else {
-									printf(" failed\n");
-								}
-							}
-							printf("Publish mqtt message ");
-							if ((rc = MQTTClient_publishMessage(client, topic, &pubmsg, &token)) != MQTTCLIENT_SUCCESS) {
-								printf("failed\n");
-							}
-							rc = MQTTClient_waitForCompletion(client, token, TIMEOUT);
-							printf("OK\n");
-
-							MQTTClient_disconnect(client, 1000);
-						} else {
-							printf("failed\n");
-						}
-					}
-				}
-#ifdef RF_IRQ_PIN
+		// Each radio is serviced on its own thread, this one only logs and
+		// publishes, so a slow broker or console never delays reception
+		for (unsigned i = 0; i < radio_count; i++) {
+			if (radios[i].up)
+				radios[i].thread = std::thread(radio_thread, &radios[i]);
+		}
+		if (rx_windows) {
+			// A page fault in the TX thread would cost more than the window allows
+			if (mlockall(MCL_CURRENT | MCL_FUTURE) < 0)
+				perror("mlockall");
+			for (unsigned i = 0; i < radio_count; i++) {
+				if (!radios[i].up)
+					continue;
+				radios[i].tx_thread = std::thread(tx_thread, &radios[i]);
+				struct sched_param param;
+				param.sched_priority = tx_priority;
+				int rc = pthread_setschedparam(radios[i].tx_thread.native_handle(), SCHED_FIFO, &param);
+				if (rc)
+					fprintf(stderr, "Radio %u TX thread not real-time, receive windows may be missed: %s\n",
+							radios[i].index, strerror(rc));
 			}
-#endif
+		}
+		downlinks_ready = downlink;
+
+		//Begin the main body of code
+		if (!gw.loop.run())
+			perror("Event loop");
 
-#ifdef RF_LED_PIN
-			// Led blink timer expiration ?
-			if (led_blink && millis() - led_blink > 200) {
-				led_blink = 0;
-				digitalWrite(RF_LED_PIN, LOW);
+		// Stop the radio threads at once
+		force_exit = true;
+		uint64_t one = 1;
+		if (write(exit_event_fd, &one, sizeof(one)) < 0)
+			perror("exit_event_fd");
+		downlinks_ready = false;
+		for (unsigned i = 0; i < radio_count; i++) {
+			if (radios[i].thread.joinable())
+				radios[i].thread.join();
+			if (radios[i].tx_thread.joinable()) {
+				radios[i].window_ready.notify_one();
+				radios[i].tx_thread.join();
 			}
-#endif
-			// Let OS doing other tasks
-			// For timed critical application you can reduce or delete
-			// this delay, but this will charge CPU usage, take care and monitor
-			bcm2835_delay(5);
 		}
+		// The packets the radio threads read before they stopped and whatever
+		// is left in the batch go out before the publisher drains
+		publish_packets(&gw);
+		publish_batch(publisher, batch, gw.batch_topic.c_str(), gw.batch_message);
+		replay_journal(publisher);
+		gw.loop.end();
+		close(gw.signal_fd);
+		close(rx_event_fd);
+		close(exit_event_fd);
+		for (unsigned i = 0; i < radio_count; i++) {
+			Radio &radio = radios[i];
+			if (!radio.up)
+				continue;
+			printf("Radio %u RX ring overflows=%u high watermark=%u/%u\n", radio.index,
+					radio.ring.overflows(), radio.ring.highWatermark(), (unsigned) radio.ring.capacity());
+			printf("Radio %u RF95 rx good=%llu, dropped crc=%llu short=%llu address=%llu queue full=%llu\n", radio.index,
+					(unsigned long long) radio.rf95->rxGood(),
+					(unsigned long long) radio.rf95->rxDropped(RH_RF95::RxDropCrc),
+					(unsigned long long) radio.rf95->rxDropped(RH_RF95::RxDropShort),
+					(unsigned long long) radio.rf95->rxDropped(RH_RF95::RxDropAddress),
+					(unsigned long long) radio.rf95->rxDropped(RH_RF95::RxDropQueueFull));
+			print_driver_stats(radio);
+			// millis() counts from the start of the program
+			unsigned long runtime = millis();
+			printf("Radio %u time on air rx=%.1fs (%.2f%%) tx=%.1fs (%.2f%%)\n", radio.index,
+					radio.rf95->rxTimeOnAir() / 1e6, runtime ? radio.rf95->rxTimeOnAir() / (runtime * 10.0) : 0.0,
+					radio.rf95->txTimeOnAir() / 1e6, runtime ? radio.rf95->txTimeOnAir() / (runtime * 10.0) : 0.0);
+			RHDutyCycle &duty = *radio.duty;
+			if (duty.band() != RH_DUTY_CYCLE_NO_BAND)
+				printf("Radio %u duty cycle budget left=%.1fs used=%.1fs, deferred=%u (avg %lums max %lums) rejected=%u, %u waiting (%u bytes)\n",
+						radio.index, duty.remaining() / 1e6, duty.used() / 1e6, duty.deferred(),
+						duty.avgDeferral(), duty.maxDeferral(), duty.rejected(), duty.queued(), duty.queuedBytes());
+			DownlinkQueue *downlinks = radio.downlinks;
+			if (downlinks)
+				printf("Radio %u downlinks sent=%u failed=%u expired=%u dropped=%u, latency avg=%lums max=%lums, %u waiting\n",
+						radio.index, radio.tx_sent, radio.tx_failed, downlinks->expired(), downlinks->dropped(),
+						downlinks->avgLatency(), downlinks->maxLatency(), downlinks->size());
+			if (rx_windows)
+				printf("Radio %u receive window downlinks sent=%u missed=%u, transmitter late avg=%uus max=%uus\n",
+						radio.index, radio.window_sent, radio.window_missed,
+						radio.window_sent ? (unsigned) (radio.window_late_sum / radio.window_sent) : 0, radio.window_late_max);
+		}
+		printf("SPI transactions=%u contended=%u\n", spi_bus.transactions(), spi_bus.contended());
 	}
-	MQTTClient_disconnect(client, 1000);
-	MQTTClient_destroy(&client);
+	publisher.end();
+	printf("MQTT published=%u delivered=%u dropped=%u received=%u reconnects=%u\n",
+			publisher.published(), publisher.delivered(), publisher.dropped(), publisher.received(), publisher.reconnects());
+	if (journal.isOpen()) {
+		// Messages the broker did not acknowledge while the publisher drained are
+		// kept for the next run, behind those still waiting in the journal
+		std::string topic;
+		std::vector<uint8_t> payload;
+		unsigned kept = 0;
+		while (publisher.takeUndelivered(topic, payload) && journal.append(topic.c_str(), payload.data(), payload.size()))
+			kept++;
+		if (kept)
+			printf("MQTT %u undelivered messages journaled\n", kept);
+	}
+	if (window_downlinks)
+		printf("Receive window queue expired=%u dropped=%u, %u waiting\n",
+				window_downlinks->expired(), window_downlinks->dropped(), window_downlinks->size());
+	// Closed only now, the MQTT client thread may have queued a downlink until end()
+	for (unsigned i = 0; i < radio_count; i++) {
+		if (radios[i].tx_event_fd >= 0)
+			close(radios[i].tx_event_fd);
+	}
+	if (journal.isOpen()) {
+		printf("Journal appended=%u replayed=%u overwritten=%u, %u messages (%u bytes) kept for the next run\n",
+				journal.appended(), journal.replayed(), journal.overwritten(), journal.records(), (unsigned) journal.used());
+		journal.close();
+	}
+	if (batching)
+		printf("Batches=%u packets=%u largest=%u packets/%u bytes, latency avg=%lums max=%lums\n",
+				batch.batches(), batch.packets(), batch.maxBatchPackets(), (unsigned) batch.maxBatchSize(),
+				batch.avgLatency(), batch.maxLatency());
 
-#ifdef RF_LED_PIN
-	digitalWrite(RF_LED_PIN, LOW);
-#endif
 	printf("\n%s ending\n", __BASEFILE__);
-	bcm2835_gpio_clr_ren(RF_IRQ_PIN);
+	for (unsigned i = 0; i < radio_count; i++) {
+		Radio &radio = radios[i];
+		digitalWrite(radio.led_pin, LOW);
+		if (radio.up && radio.rf95->interruptFd() < 0 && radio.irq_pin != NOT_A_PIN)
+			bcm2835_gpio_clr_ren(radio.irq_pin);
+	}
 	bcm2835_close();
 	return 0;
 }
@@ -0,0 +1,16 @@
+// FakeClock.h
+//
+// millis(), micros() and the sleeps of the RadioHead Raspberry Pi layer on a
+// clock that only the test moves, for tests of timeouts and budgets that span
+// seconds or hours. Link fake_clock.o instead of RasPi.o.
+
+#ifndef FakeClock_h
+#define FakeClock_h
+
+#include <stdint.h>
+
+// Moves the clock forward. The sleeps (delay(), delayMicroseconds(),
+// delayUntilMicros()) move it too, instead of sleeping
+void fake_clock_advance(uint64_t us);
+
+#endif
@@ -0,0 +1,150 @@
+// FakeDriver.h
+//
+// RadioHead driver without a radio for the host tests: sent messages are kept
+// for the test to look at, received ones are handed in by the test.
+
+#ifndef FakeDriver_h
+#define FakeDriver_h
+
+#include <deque>
+#include <vector>
+
+#include <RHGenericDriver.h>
+
+/// A message with its RadioHead headers, as sent or to be received
+typedef struct
+{
+	uint8_t              to;
+	uint8_t              from;
+	uint8_t              id;
+	uint8_t              flags;
+	std::vector<uint8_t> data;
+} FakeMessage;
+
+/////////////////////////////////////////////////////////////////////
+/// \class FakeDriver FakeDriver.h <FakeDriver.h>
+/// \brief Driver that records what is sent and receives what the test queues
+///
+/// Every message has the same time on air, set with setAirtime(). With setTxTime()
+/// a transmission keeps the driver in RHModeTx that long, by micros(), so callers
+/// see it as on the air until packetSent() or waitPacketSent() find it over.
+class FakeDriver : public RHGenericDriver
+{
+public:
+	FakeDriver()
+		:
+		_airtime(0),
+		_txTime(0),
+		_txEnd(0)
+	{
+		_mode = RHModeIdle;
+	}
+
+	bool init() {
+		return true;
+	}
+
+	bool available() {
+		if (_mode == RHModeTx && !packetSent())
+			return false;
+		return !inbox.empty();
+	}
+
+	bool recv(uint8_t *buf, uint8_t *len) {
+		if (!available())
+			return false;
+		FakeMessage message = inbox.front();
+		inbox.pop_front();
+		_rxHeaderTo = message.to;
+		_rxHeaderFrom = message.from;
+		_rxHeaderId = message.id;
+		_rxHeaderFlags = message.flags;
+		_rxGood++;
+		if (buf && len) {
+			if (*len > message.data.size())
+				*len = message.data.size();
+			memcpy(buf, message.data.data(), *len);
+		}
+		return true;
+	}
+
+	bool send(const uint8_t *data, uint8_t len) {
+		waitPacketSent();
+		FakeMessage message;
+		message.to = _txHeaderTo;
+		message.from = _txHeaderFrom;
+		message.id = _txHeaderId;
+		message.flags = _txHeaderFlags;
+		message.data.assign(data, data + len);
+		sent.push_back(message);
+		_txGood++;
+		if (_txTime) {
+			_mode = RHModeTx;
+			_txEnd = micros() + _txTime;
+		}
+		return true;
+	}
+
+	uint8_t maxMessageLength() {
+		return 251;
+	}
+
+	uint32_t timeOnAir(uint8_t) {
+		return _airtime;
+	}
+
+	bool packetSent() {
+		if (_mode == RHModeTx && (long) (micros() - _txEnd) >= 0)
+			_mode = RHModeIdle;
+		return _mode != RHModeTx;
+	}
+
+	bool waitPacketSent() {
+		while (!packetSent())
+			delayMicroseconds(_txEnd - micros());
+		return true;
+	}
+
+	bool waitPacketSent(uint16_t timeout) {
+		unsigned long start = millis();
+		while (!packetSent()) {
+			if (millis() - start >= timeout)
+				return false;
+			delay(1);
+		}
+		return true;
+	}
+
+	/// Sets the time on air reported for every message
+	/// \param[in] us Microseconds
+	void setAirtime(uint32_t us) {
+		_airtime = us;
+	}
+
+	/// Sets how long send() keeps the driver in RHModeTx, 0 for not at all
+	/// \param[in] us Microseconds
+	void setTxTime(uint32_t us) {
+		_txTime = us;
+	}
+
+	/// Queues a message for available() and recv()
+	void receive(uint8_t to, uint8_t from, uint8_t id, uint8_t flags, const uint8_t *data, uint8_t len) {
+		FakeMessage message;
+		message.to = to;
+		message.from = from;
+		message.id = id;
+		message.flags = flags;
+		message.data.assign(data, data + len);
+		inbox.push_back(message);
+	}
+
+	std::deque<FakeMessage>  inbox;  ///< Messages to be received, oldest first
+	std::vector<FakeMessage> sent;   ///< Messages sent, oldest first
+
+private:
+	uint32_t      _airtime;
+	uint32_t      _txTime;
+	unsigned long _txEnd;
+};
+
+#endif
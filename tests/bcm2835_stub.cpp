@@ -0,0 +1,44 @@
+// bcm2835_stub.cpp
+//
+// The bcm2835 functions RadioHead calls, doing nothing, so the host tests link
+// without the library and run without /dev/mem. SPI reads return zeros.
+
+#include <string.h>
+#include <bcm2835.h>
+
+void bcm2835_gpio_fsel(uint8_t, uint8_t) {
+}
+
+void bcm2835_gpio_write(uint8_t, uint8_t) {
+}
+
+uint8_t bcm2835_gpio_lev(uint8_t) {
+	return LOW;
+}
+
+int bcm2835_spi_begin(void) {
+	return 1;
+}
+
+void bcm2835_spi_end(void) {
+}
+
+void bcm2835_spi_setBitOrder(uint8_t) {
+}
+
+void bcm2835_spi_setClockDivider(uint16_t) {
+}
+
+void bcm2835_spi_setDataMode(uint8_t) {
+}
+
+void bcm2835_spi_chipSelect(uint8_t) {
+}
+
+uint8_t bcm2835_spi_transfer(uint8_t) {
+	return 0;
+}
+
+void bcm2835_spi_transfernb(char *, char *rbuf, uint32_t len) {
+	memset(rbuf, 0, len);
+}
@@ -0,0 +1,44 @@
+// test.h
+//
+// Checks for the host tests. Each test is a small program that exits with the
+// number of failed checks, run by "make test". They need the bcm2835 headers but
+// no radio, no root and no bcm2835 library: tests/bcm2835_stub.cpp stands in for it.
+
+#ifndef test_h
+#define test_h
+
+#include <stdio.h>
+#include <stdint.h>
+
+static int test_failures = 0;
+
+// Reports a failed condition and goes on with the test
+#define CHECK(cond) \
+	do { \
+		if (!(cond)) { \
+			fprintf(stderr, "%s:%d: CHECK(%s) failed\n", __FILE__, __LINE__, #cond); \
+			test_failures++; \
+		} \
+	} while (0)
+
+// Reports two integers that differ, with their values
+#define CHECK_EQ(a, b) \
+	do { \
+		long long test_a = (long long) (a), test_b = (long long) (b); \
+		if (test_a != test_b) { \
+			fprintf(stderr, "%s:%d: CHECK_EQ(%s, %s) failed: %lld != %lld\n", \
+					__FILE__, __LINE__, #a, #b, test_a, test_b); \
+			test_failures++; \
+		} \
+	} while (0)
+
+// Prints the result, for the return of main()
+static inline int test_result(const char *name) {
+	if (test_failures)
+		printf("%s: %d check(s) failed\n", name, test_failures);
+	else
+		printf("%s: ok\n", name);
+	return test_failures;
+}
+
+#endif
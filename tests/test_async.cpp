@@ -0,0 +1,196 @@
+// test_async.cpp
+//
+// RHAsyncManager coroutines over two fake drivers on the fake clock: a request
+// and its reply, a lost transmission that is retransmitted, a send that is never
+// acknowledged, a receive that times out, awaited tasks with results and end().
+// Needs C++20 for the coroutines, like RHAsync.cpp.
+
+#include <RHAsync.h>
+
+#include "FakeClock.h"
+#include "FakeDriver.h"
+#include "test.h"
+
+// Fake milliseconds a test may take before it counts as hung
+#define TEST_LIMIT 10000
+
+// Two nodes, 1 and 2, on the same channel
+static RHEventLoop loop;
+static FakeDriver drivers[2];
+static size_t carried[2];
+// Transmissions of node 1 lost before they reach node 2
+static int lose;
+
+// Hands what each node sent to the other one
+static void air() {
+	for (int i = 0; i < 2; i++) {
+		FakeDriver &peer = drivers[1 - i];
+		for (; carried[i] < drivers[i].sent.size(); carried[i]++) {
+			FakeMessage &m = drivers[i].sent[carried[i]];
+			if (i == 0 && lose > 0) {
+				lose--;
+				continue;
+			}
+			if (m.to == 2 - i || m.to == RH_BROADCAST_ADDRESS)
+				peer.receive(m.to, m.from, m.id, m.flags, m.data.data(), m.data.size());
+		}
+	}
+}
+
+// Runs the loop in 1ms steps of the fake clock until *done or TEST_LIMIT
+static unsigned long run_until(const bool *done) {
+	unsigned long start = millis();
+	while (!*done && millis() - start < TEST_LIMIT) {
+		air();
+		loop.runOnce(0);
+		fake_clock_advance(1000);
+	}
+	CHECK(*done);
+	return millis() - start;
+}
+
+static bool answering;
+
+// Answers every message with its first octet times 10, after 20ms
+static RHTask<void> server(RHAsyncManager &radio) {
+	answering = true;
+	while (true) {
+		RHAsyncMessage request = co_await radio.recvfrom();
+		if (!request.ok)
+			break;
+		uint8_t answer[] = { (uint8_t) (request.data[0] * 10) };
+		co_await radio.sleep(20);
+		co_await radio.send(request.from, answer, sizeof(answer));
+	}
+	answering = false;
+}
+
+typedef struct {
+	bool    done;
+	bool    sent;
+	bool    answered;
+	uint8_t answer;
+} Exchange;
+
+static RHTask<void> client(RHAsyncManager &radio, uint8_t value, Exchange *result) {
+	uint8_t request[] = { value };
+	result->sent = co_await radio.send(2, request, sizeof(request));
+	RHAsyncMessage reply = co_await radio.recvfrom(1000, 2);
+	result->answered = reply.ok;
+	result->answer = reply.len ? reply.data[0] : 0;
+	result->done = true;
+}
+
+static void test_exchange(RHAsyncManager &radio, RHReliableDatagram &manager) {
+	Exchange first = {}, second = {};
+	client(radio, 3, &first).detach();
+	client(radio, 4, &second).detach();
+	run_until(&second.done);
+	CHECK(first.done);
+	CHECK(first.sent && first.answered);
+	CHECK_EQ(first.answer, 30);
+	CHECK(second.sent && second.answered);
+	CHECK_EQ(second.answer, 40);
+	CHECK_EQ(manager.retransmissions(), 0);
+	CHECK_EQ(radio.receivers(), 0);
+	CHECK_EQ(radio.senders(), 0);
+
+	// The first transmission is lost, the retransmission gets through. The ACK of
+	// the last answer is still to be carried, it must not be the one lost
+	Exchange lost = {};
+	air();
+	lose = 1;
+	client(radio, 5, &lost).detach();
+	run_until(&lost.done);
+	CHECK(lost.sent && lost.answered);
+	CHECK_EQ(lost.answer, 50);
+	CHECK_EQ(manager.retransmissions(), 1);
+}
+
+static bool failed_done, failed_sent;
+
+static RHTask<void> send_unanswered(RHAsyncManager &radio) {
+	uint8_t request[] = { 1 };
+	failed_sent = co_await radio.send(3, request, sizeof(request));
+	failed_done = true;
+}
+
+static void test_ack_timeout(RHAsyncManager &radio, RHReliableDatagram &manager) {
+	// Node 3 does not exist: 1 + 1 retry, each waiting 200ms and up to as long again
+	manager.setRetries(1);
+	size_t before = drivers[0].sent.size();
+	failed_done = false;
+	failed_sent = true;
+	send_unanswered(radio).detach();
+	unsigned long took = run_until(&failed_done);
+	CHECK(!failed_sent);
+	CHECK(took >= 400 && took <= 1200);
+	CHECK_EQ(drivers[0].sent.size() - before, 2);
+	manager.setRetries(3);
+}
+
+static bool timeout_done, timeout_ok;
+
+static RHTask<void> receive_nothing(RHAsyncManager &radio) {
+	RHAsyncMessage message = co_await radio.recvfrom(100, 3);
+	timeout_ok = message.ok;
+	timeout_done = true;
+}
+
+static void test_receive_timeout(RHAsyncManager &radio) {
+	timeout_done = false;
+	timeout_ok = true;
+	receive_nothing(radio).detach();
+	unsigned long took = run_until(&timeout_done);
+	CHECK(!timeout_ok);
+	CHECK(took >= 100 && took <= 110);
+	CHECK_EQ(radio.receivers(), 0);
+}
+
+static RHTask<int> increment(int value) {
+	co_await RHAsyncManager::SleepAwaiter(loop, 5);
+	co_return value + 1;
+}
+
+static bool chain_done;
+static int chain_result;
+
+static RHTask<void> chain() {
+	int value = co_await increment(1);
+	chain_result = co_await increment(value);
+	chain_done = true;
+}
+
+static void test_task_result() {
+	chain_done = false;
+	chain().detach();
+	unsigned long took = run_until(&chain_done);
+	CHECK_EQ(chain_result, 3);
+	CHECK(took >= 10 && took <= 12);
+}
+
+int main() {
+	CHECK(loop.begin());
+	RHReliableDatagram manager1(drivers[0], 1), manager2(drivers[1], 2);
+	manager1.init();
+	manager2.init();
+	RHAsyncManager radio1(loop, manager1), radio2(loop, manager2);
+	CHECK(radio1.begin());
+	CHECK(radio2.begin());
+	server(radio2).detach();
+
+	test_exchange(radio1, manager1);
+	test_ack_timeout(radio1, manager1);
+	test_receive_timeout(radio1);
+	test_task_result();
+
+	// end() completes the waiting receive of the server
+	CHECK(answering);
+	CHECK_EQ(radio2.receivers(), 1);
+	radio2.end();
+	for (int i = 0; i < 3; i++)
+		loop.runOnce(0);
+	CHECK(!answering);
+	radio1.end();
+	return test_result("test_async");
+}
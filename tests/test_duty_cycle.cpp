@@ -0,0 +1,154 @@
+// test_duty_cycle.cpp
+//
+// RHDutyCycle on a fake driver and clock: the token bucket of each sub-band,
+// its refill, rejection, and deferral of messages until there is budget.
+
+#include <RHDutyCycle.h>
+
+#include "FakeClock.h"
+#include "FakeDriver.h"
+#include "test.h"
+
+// Every message takes 400ms on the air. Over a 100s window a 1% sub-band holds 1s
+#define AIRTIME  400000
+#define WINDOW   100
+#define CAPACITY 1000000
+
+static const uint8_t message[] = { 1, 2, 3 };
+
+static void setup(FakeDriver &driver, RHDutyCycle &duty) {
+	driver.setAirtime(AIRTIME);
+	duty.init();
+	duty.setWindow(WINDOW);
+	duty.setFrequency(868.1);
+}
+
+static void test_bucket() {
+	FakeDriver driver;
+	RHDutyCycle duty(driver);
+	setup(driver, duty);
+	CHECK_EQ(duty.band(), 2);
+	CHECK_EQ(duty.remaining(), CAPACITY);
+
+	CHECK(duty.send(message, sizeof(message)));
+	CHECK(duty.send(message, sizeof(message)));
+	CHECK_EQ(duty.remaining(), CAPACITY - 2 * AIRTIME);
+	CHECK_EQ(duty.used(), 2 * AIRTIME);
+
+	// Without deferral a message over budget is rejected
+	CHECK(!duty.send(message, sizeof(message)));
+	CHECK_EQ(duty.rejected(), 1);
+	CHECK_EQ(driver.sent.size(), 2);
+
+	// 200ms of airtime short, earned in 20s at 1%, in whole 10ms steps
+	uint32_t delay = duty.txDelay(sizeof(message));
+	CHECK(delay >= 20000 && delay <= 20010);
+	fake_clock_advance(10000000);
+	CHECK_EQ(duty.remaining(), CAPACITY - 2 * AIRTIME + 100000);
+	fake_clock_advance((uint64_t) delay * 1000 - 10000000);
+	CHECK_EQ(duty.txDelay(sizeof(message)), 0);
+	CHECK(duty.send(message, sizeof(message)));
+
+	// The bucket never holds more than the window allows
+	fake_clock_advance((uint64_t) WINDOW * 10 * 1000000);
+	CHECK_EQ(duty.remaining(), CAPACITY);
+
+	// A message longer than the bucket never fits
+	driver.setAirtime(CAPACITY + 1);
+	CHECK_EQ(duty.txDelay(sizeof(message)), 0xffffffff);
+}
+
+static void test_bands() {
+	FakeDriver driver;
+	RHDutyCycle duty(driver);
+	setup(driver, duty);
+	CHECK(duty.send(message, sizeof(message)));
+
+	// 869.4 - 869.65MHz allows 10% and has its own bucket
+	duty.setFrequency(869.525);
+	CHECK_EQ(duty.band(), 4);
+	CHECK_EQ(duty.remaining(), 10 * CAPACITY);
+	CHECK(duty.send(message, sizeof(message)));
+	CHECK_EQ(duty.remaining(), 10 * CAPACITY - AIRTIME);
+	CHECK_EQ(duty.remaining(2), CAPACITY - AIRTIME);
+	CHECK_EQ(duty.used(2), AIRTIME);
+
+	// Outside every sub-band nothing is limited
+	duty.setFrequency(915.0);
+	CHECK_EQ(duty.band(), RH_DUTY_CYCLE_NO_BAND);
+	CHECK_EQ(duty.remaining(), 0xffffffff);
+	for (int i = 0; i < 10; i++)
+		CHECK(duty.send(message, sizeof(message)));
+	CHECK_EQ(duty.txDelay(sizeof(message)), 0);
+
+	// Another plan: one 0.1% band
+	RHDutyCycleBand plan[] = { { 915000, 916000, 10 } };
+	CHECK(duty.setBands(plan, 1));
+	CHECK_EQ(duty.band(), 0);
+	CHECK_EQ(duty.remaining(), CAPACITY / 10);
+	CHECK(!duty.send(message, sizeof(message)));
+}
+
+static void test_deferral() {
+	FakeDriver driver;
+	RHDutyCycle duty(driver);
+	setup(driver, duty);
+	duty.setMaxDeferral(30000);
+	CHECK(duty.send(message, sizeof(message)));
+	CHECK(duty.send(message, sizeof(message)));
+
+	// 200ms short: fits within the maximum deferral, so it waits with its headers
+	duty.setHeaderId(42);
+	CHECK(duty.send(message, sizeof(message)));
+	duty.setHeaderId(43);
+	CHECK_EQ(duty.queued(), 1);
+	CHECK_EQ(duty.queuedBytes(), sizeof(message));
+	CHECK_EQ(duty.deferred(), 1);
+	CHECK_EQ(driver.sent.size(), 2);
+	CHECK(!duty.service());
+	CHECK(!duty.packetSent());
+	int32_t timeout = duty.serviceTimeout();
+	CHECK(timeout > 0 && timeout <= 20010);
+
+	// A message small enough for the budget still waits behind it
+	driver.setAirtime(1000);
+	CHECK(duty.send(message, 1));
+	CHECK_EQ(duty.queued(), 2);
+	driver.setAirtime(AIRTIME);
+
+	fake_clock_advance((uint64_t) timeout * 1000);
+	CHECK(duty.service());
+	CHECK(!duty.service());
+	fake_clock_advance(100000);
+	CHECK(duty.service());
+	CHECK_EQ(duty.queued(), 0);
+	CHECK_EQ(driver.sent.size(), 4);
+	CHECK_EQ(driver.sent[2].id, 42);
+	CHECK_EQ(driver.sent[2].data.size(), sizeof(message));
+	CHECK_EQ(driver.sent[3].id, 43);
+	CHECK_EQ(duty.maxDeferral(), (unsigned long) timeout + 100);
+	CHECK(duty.packetSent());
+
+	// Empty bucket: 40s to wait, longer than the maximum deferral
+	CHECK_EQ(duty.remaining(), 0);
+	CHECK(!duty.send(message, sizeof(message)));
+	CHECK_EQ(duty.rejected(), 1);
+
+	// Dropped once it waited longer than the maximum deferral, lowered meanwhile
+	duty.setMaxDeferral(40000);
+	CHECK(duty.send(message, sizeof(message)));
+	CHECK_EQ(duty.queued(), 1);
+	duty.setMaxDeferral(1000);
+	fake_clock_advance(2000000);
+	CHECK(!duty.service());
+	CHECK_EQ(duty.queued(), 0);
+	CHECK_EQ(duty.rejected(), 2);
+	CHECK_EQ(driver.sent.size(), 4);
+}
+
+int main() {
+	test_bucket();
+	test_bands();
+	test_deferral();
+	return test_result("test_duty_cycle");
+}
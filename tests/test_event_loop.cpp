@@ -0,0 +1,198 @@
+// test_event_loop.cpp
+//
+// RHEventLoop on the fake clock: timers run in order of expiry, cancel(),
+// periodic timers, timers scheduled by callbacks, posted calls and watches.
+// The timerfd is armed for fake times long past, so it is always readable;
+// runOnce(0) runs exactly what is due by the fake clock.
+
+#include <unistd.h>
+#include <sys/eventfd.h>
+#include <vector>
+
+#include <RHEventLoop.h>
+
+#include "FakeClock.h"
+#include "test.h"
+
+// Timer callbacks log their number in the order they run
+static std::vector<int> ran;
+static int numbers[] = { 0, 1, 2, 3, 4, 5 };
+
+static void log_timer(void *arg) {
+	ran.push_back(*(int *) arg);
+}
+
+static void test_order() {
+	RHEventLoop loop;
+	CHECK(loop.begin());
+	ran.clear();
+	loop.schedule(30, log_timer, &numbers[1]);
+	loop.schedule(10, log_timer, &numbers[2]);
+	loop.schedule(20, log_timer, &numbers[3]);
+	loop.schedule(20, log_timer, &numbers[4]);
+	CHECK_EQ(loop.pending(), 4);
+
+	fake_clock_advance(9999);
+	CHECK_EQ(loop.runOnce(0), 0);
+	fake_clock_advance(1);
+	CHECK_EQ(loop.runOnce(0), 1);
+	fake_clock_advance(20000);
+	CHECK_EQ(loop.runOnce(0), 3);
+	// Same expiry: in the order they were scheduled
+	int expected[] = { 2, 3, 4, 1 };
+	CHECK_EQ(ran.size(), 4);
+	for (unsigned i = 0; i < 4 && i < ran.size(); i++)
+		CHECK_EQ(ran[i], expected[i]);
+	CHECK_EQ(loop.pending(), 0);
+}
+
+static RHEventLoop *cancel_loop;
+static uint32_t cancel_id;
+
+static void cancel_other(void *arg) {
+	log_timer(arg);
+	cancel_loop->cancel(cancel_id);
+}
+
+static void test_cancel() {
+	RHEventLoop loop;
+	CHECK(loop.begin());
+	ran.clear();
+	uint32_t first = loop.schedule(10, log_timer, &numbers[1]);
+	loop.schedule(10, log_timer, &numbers[2]);
+	CHECK(first != RH_EVENT_TIMER_NONE);
+	loop.cancel(first);
+	loop.cancel(RH_EVENT_TIMER_NONE);
+
+	// A callback cancels a timer that is due in the same turn
+	cancel_loop = &loop;
+	loop.schedule(20, cancel_other, &numbers[3]);
+	cancel_id = loop.schedule(20, log_timer, &numbers[4]);
+
+	fake_clock_advance(20000);
+	CHECK_EQ(loop.runOnce(0), 2);
+	CHECK_EQ(ran.size(), 2);
+	if (ran.size() == 2) {
+		CHECK_EQ(ran[0], 2);
+		CHECK_EQ(ran[1], 3);
+	}
+	// Expired already
+	loop.cancel(cancel_id);
+	CHECK_EQ(loop.pending(), 0);
+}
+
+static void test_periodic() {
+	RHEventLoop loop;
+	CHECK(loop.begin());
+	ran.clear();
+	uint32_t id = loop.schedule(10, log_timer, &numbers[1], 10);
+	fake_clock_advance(10000);
+	CHECK_EQ(loop.runOnce(0), 1);
+	// Missed periods are skipped, the phase is kept: next at 50ms
+	fake_clock_advance(35000);
+	CHECK_EQ(loop.runOnce(0), 1);
+	fake_clock_advance(4000);
+	CHECK_EQ(loop.runOnce(0), 0);
+	fake_clock_advance(1000);
+	CHECK_EQ(loop.runOnce(0), 1);
+	CHECK_EQ(loop.pending(), 1);
+	loop.cancel(id);
+	CHECK_EQ(loop.pending(), 0);
+	CHECK_EQ(ran.size(), 3);
+}
+
+static RHEventLoop *nested_loop;
+
+static void schedule_now(void *arg) {
+	log_timer(arg);
+	nested_loop->schedule(0, log_timer, &numbers[5]);
+}
+
+static void test_scheduled_by_callback() {
+	RHEventLoop loop;
+	CHECK(loop.begin());
+	ran.clear();
+	nested_loop = &loop;
+	loop.schedule(10, schedule_now, &numbers[1]);
+	loop.schedule(10, log_timer, &numbers[2]);
+	loop.schedule(10, log_timer, &numbers[3]);
+
+	// The new timer is due at once but waits for the next turn, the older ones all run
+	fake_clock_advance(10000);
+	CHECK_EQ(loop.runOnce(0), 3);
+	CHECK_EQ(ran.size(), 3);
+	CHECK_EQ(loop.runOnce(0), 1);
+	CHECK_EQ(ran.size(), 4);
+	if (ran.size() == 4)
+		CHECK_EQ(ran[3], 5);
+}
+
+static RHEventLoop *post_loop;
+
+static void post_again(void *arg) {
+	log_timer(arg);
+	post_loop->post(log_timer, &numbers[3]);
+}
+
+static void test_post() {
+	RHEventLoop loop;
+	CHECK(loop.begin());
+	ran.clear();
+	post_loop = &loop;
+	loop.post(post_again, &numbers[1]);
+	loop.schedule(0, log_timer, &numbers[2]);
+	// Posted calls run after the timers, those they post on the next turn
+	CHECK_EQ(loop.runOnce(0), 2);
+	CHECK_EQ(ran.size(), 2);
+	if (ran.size() == 2) {
+		CHECK_EQ(ran[0], 2);
+		CHECK_EQ(ran[1], 1);
+	}
+	// Does not sleep with a call posted
+	CHECK_EQ(loop.runOnce(-1), 1);
+	CHECK_EQ(ran.size(), 3);
+	CHECK_EQ(loop.pending(), 0);
+}
+
+static int watch_events;
+
+static void count_event(uint32_t events, void *arg) {
+	uint64_t value;
+	if (events & EPOLLIN)
+		watch_events++;
+	if (read(*(int *) arg, &value, sizeof(value)) < 0)
+		value = 0;
+}
+
+static void test_watch() {
+	RHEventLoop loop;
+	CHECK(loop.begin());
+	int fd = eventfd(0, EFD_NONBLOCK);
+	CHECK(fd >= 0);
+	CHECK(loop.watch(fd, EPOLLIN, count_event, &fd));
+	CHECK_EQ(loop.runOnce(0), 0);
+
+	uint64_t one = 1;
+	CHECK_EQ(write(fd, &one, sizeof(one)), sizeof(one));
+	CHECK_EQ(loop.runOnce(0), 1);
+	CHECK_EQ(watch_events, 1);
+	// Drained by the callback
+	CHECK_EQ(loop.runOnce(0), 0);
+
+	loop.unwatch(fd);
+	CHECK_EQ(write(fd, &one, sizeof(one)), sizeof(one));
+	CHECK_EQ(loop.runOnce(0), 0);
+	CHECK_EQ(watch_events, 1);
+	CHECK_EQ(loop.pending(), 0);
+	close(fd);
+}
+
+int main() {
+	test_order();
+	test_cancel();
+	test_periodic();
+	test_scheduled_by_callback();
+	test_post();
+	test_watch();
+	return test_result("test_event_loop");
+}
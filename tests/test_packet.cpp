@@ -0,0 +1,205 @@
+// test_packet.cpp
+//
+// RHPacket bounds: pull() and copyPayload() never go past the frame, frames
+// shorter than the headers. RHPacketPool exhaustion and reuse, from one thread
+// and two, and recvPacket() of a driver when the pool runs out.
+
+#include <thread>
+
+#include <RHGenericDriver.h>
+#include <RHPacket.h>
+
+#include "FakeDriver.h"
+#include "test.h"
+
+// alloc() and release() pairs done by each thread of the thread test
+#define THREAD_ROUNDS 100000
+
+static void fill(RHPacket *packet, uint8_t len) {
+	for (uint8_t i = 0; i < len; i++)
+		packet->data()[i] = i;
+	packet->setLen(len);
+}
+
+static void test_pull() {
+	RHPacketPool pool(1);
+	RHPacket *packet = pool.alloc();
+	CHECK(packet != NULL);
+	if (!packet)
+		return;
+	fill(packet, 10);
+	CHECK_EQ(packet->headerTo(), 0);
+	CHECK_EQ(packet->headerFlags(), 3);
+	CHECK_EQ(packet->payloadLen(), 6);
+	CHECK_EQ(packet->payload()[0], 4);
+
+	uint8_t *header = packet->pull(2);
+	CHECK(header == packet->data() + 4);
+	CHECK_EQ(packet->payloadLen(), 4);
+	CHECK_EQ(packet->payload()[0], 6);
+	// Longer than what is left: nothing taken
+	CHECK(packet->pull(5) == NULL);
+	CHECK_EQ(packet->payloadLen(), 4);
+	CHECK(packet->pull(4) == packet->data() + 6);
+	CHECK_EQ(packet->payloadLen(), 0);
+	CHECK(packet->pull(1) == NULL);
+	CHECK(packet->pull(0) == packet->data() + 10);
+	CHECK(packet->at(4) == header);
+
+	// Shorter than the headers: no headers, an empty payload
+	packet->setLen(2);
+	CHECK_EQ(packet->headerTo(), 0);
+	CHECK_EQ(packet->headerFrom(), 0);
+	CHECK_EQ(packet->payloadLen(), 0);
+	CHECK(packet->pull(1) == NULL);
+	packet->setLen(0);
+	CHECK_EQ(packet->payloadLen(), 0);
+	packet->release();
+}
+
+static void test_copy_payload() {
+	RHPacketPool pool(1);
+	RHPacket *packet = pool.alloc();
+	CHECK(packet != NULL);
+	if (!packet)
+		return;
+	fill(packet, 10);
+	packet->pull(1);
+
+	uint8_t buf[16];
+	memset(buf, 0xee, sizeof(buf));
+	uint8_t len = sizeof(buf);
+	packet->copyPayload(buf, &len);
+	CHECK_EQ(len, 5);
+	CHECK_EQ(buf[0], 5);
+	CHECK_EQ(buf[4], 9);
+	CHECK_EQ(buf[5], 0xee);
+
+	// Truncated to the space given
+	memset(buf, 0xee, sizeof(buf));
+	len = 2;
+	packet->copyPayload(buf, &len);
+	CHECK_EQ(len, 2);
+	CHECK_EQ(buf[1], 6);
+	CHECK_EQ(buf[2], 0xee);
+
+	// Nothing copied without a buffer or a length
+	len = sizeof(buf);
+	packet->copyPayload(NULL, &len);
+	CHECK_EQ(len, sizeof(buf));
+	packet->copyPayload(buf, NULL);
+
+	packet->setLen(3);
+	len = sizeof(buf);
+	packet->copyPayload(buf, &len);
+	CHECK_EQ(len, 0);
+	packet->release();
+}
+
+static void test_pool() {
+	RHPacketPool pool(3);
+	CHECK_EQ(pool.size(), 3);
+	CHECK_EQ(pool.available(), 3);
+	RHPacket *packets[3];
+	for (int i = 0; i < 3; i++) {
+		packets[i] = pool.alloc();
+		CHECK(packets[i] != NULL);
+	}
+	CHECK(pool.alloc() == NULL);
+	CHECK_EQ(pool.available(), 0);
+	if (!packets[0] || !packets[1] || !packets[2])
+		return;
+
+	// A packet given back comes out again, reset
+	fill(packets[1], 20);
+	packets[1]->rssi = -80;
+	packets[1]->release();
+	CHECK_EQ(pool.available(), 1);
+	RHPacket *again = pool.alloc();
+	CHECK(again == packets[1]);
+	if (again) {
+		CHECK_EQ(again->len(), 0);
+		CHECK_EQ(again->rssi, 0);
+		again->release();
+	}
+	packets[0]->release();
+	packets[2]->release();
+	CHECK_EQ(pool.available(), 3);
+
+	RHPacketPool empty(0);
+	CHECK(empty.alloc() == NULL);
+}
+
+static void test_pool_threads() {
+	static RHPacketPool pool(4);
+	bool ok[2] = { true, true };
+	std::thread threads[2];
+	for (int t = 0; t < 2; t++) {
+		bool *result = &ok[t];
+		threads[t] = std::thread([result] {
+			for (int i = 0; i < THREAD_ROUNDS; i++) {
+				RHPacket *first = pool.alloc();
+				RHPacket *second = pool.alloc();
+				// Two threads hold at most 4 packets, so both are there and distinct
+				if (!first || !second || first == second)
+					*result = false;
+				if (first)
+					first->release();
+				if (second)
+					second->release();
+			}
+		});
+	}
+	for (int t = 0; t < 2; t++)
+		threads[t].join();
+	CHECK(ok[0] && ok[1]);
+	CHECK_EQ(pool.available(), 4);
+}
+
+static void test_recv_packet() {
+	FakeDriver driver;
+	uint8_t data[] = { 7, 8, 9 };
+	driver.receive(1, 2, 3, 4, data, sizeof(data));
+	RHPacket *packet = driver.recvPacket();
+	CHECK(packet != NULL);
+	if (!packet)
+		return;
+	CHECK_EQ(packet->headerTo(), 1);
+	CHECK_EQ(packet->headerFrom(), 2);
+	CHECK_EQ(packet->headerId(), 3);
+	CHECK_EQ(packet->headerFlags(), 4);
+	CHECK_EQ(packet->payloadLen(), sizeof(data));
+	CHECK_EQ(packet->payload()[2], 9);
+	packet->release();
+
+	// With every packet held the message stays with the driver
+	RHPacket *held[RH_PACKET_POOL_LEN];
+	for (int i = 0; i < RH_PACKET_POOL_LEN; i++) {
+		driver.receive(1, 2, i, 0, data, sizeof(data));
+		held[i] = driver.recvPacket();
+		CHECK(held[i] != NULL);
+	}
+	driver.receive(1, 2, 99, 0, data, sizeof(data));
+	CHECK(driver.recvPacket() == NULL);
+	CHECK(driver.available());
+	if (held[0])
+		held[0]->release();
+	packet = driver.recvPacket();
+	CHECK(packet != NULL);
+	if (packet) {
+		CHECK_EQ(packet->headerId(), 99);
+		packet->release();
+	}
+	for (int i = 1; i < RH_PACKET_POOL_LEN; i++)
+		if (held[i])
+			held[i]->release();
+}
+
+int main() {
+	test_pull();
+	test_copy_payload();
+	test_pool();
+	test_pool_threads();
+	test_recv_packet();
+	return test_result("test_packet");
+}
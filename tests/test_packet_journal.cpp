@@ -0,0 +1,142 @@
+// test_packet_journal.cpp
+//
+// PacketJournal in a temporary file: appending past the wrap point of the ring,
+// a corrupted record ending the journal when the file is opened again, and a
+// tailSeq left one behind by a dropOldest() that was cut short.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "PacketJournal.h"
+#include "test.h"
+
+// Enough 1000 octet messages to go around the smallest ring more than twice
+#define MESSAGES     150
+#define MESSAGE_LEN  1000
+
+// The tailSeq field of the file header: after the 8 octet magic, version,
+// capacity, head and tail
+#define TAIL_SEQ_OFFSET 24
+
+static void message(uint32_t n, uint8_t *data) {
+	memset(data, n & 0xff, MESSAGE_LEN);
+	snprintf((char *) data, MESSAGE_LEN, "message %05u", n);
+}
+
+// Checks that the oldest record is message n
+static void check_front(PacketJournal &journal, uint32_t n) {
+	PacketJournal::Record record;
+	uint8_t data[MESSAGE_LEN];
+	CHECK(journal.front(record));
+	if (!journal.front(record))
+		return;
+	message(n, data);
+	CHECK_EQ(record.seq, n);
+	CHECK_EQ(record.topicLen, 6);
+	CHECK(memcmp(record.topic, "node/1", 6) == 0);
+	CHECK_EQ(record.len, MESSAGE_LEN);
+	CHECK(memcmp(record.data, data, MESSAGE_LEN) == 0);
+}
+
+// Flips one octet of the message n in the file
+static bool corrupt(const char *path, uint32_t n) {
+	char marker[16];
+	snprintf(marker, sizeof(marker), "message %05u", n);
+	int fd = open(path, O_RDWR);
+	if (fd < 0)
+		return false;
+	off_t size = lseek(fd, 0, SEEK_END);
+	char *file = (char *) malloc(size);
+	bool found = false;
+	if (file && pread(fd, file, size, 0) == size) {
+		char *at = (char *) memmem(file, size, marker, strlen(marker));
+		if (at) {
+			char flipped = at[MESSAGE_LEN / 2] ^ 0x55;
+			found = pwrite(fd, &flipped, 1, at - file + MESSAGE_LEN / 2) == 1;
+		}
+	}
+	free(file);
+	close(fd);
+	return found;
+}
+
+static bool set_tail_seq(const char *path, uint32_t seq) {
+	int fd = open(path, O_RDWR);
+	if (fd < 0)
+		return false;
+	bool ok = pwrite(fd, &seq, sizeof(seq), TAIL_SEQ_OFFSET) == sizeof(seq);
+	close(fd);
+	return ok;
+}
+
+int main() {
+	char path[] = "/tmp/test_packet_journal.XXXXXX";
+	int fd = mkstemp(path);
+	CHECK(fd >= 0);
+	if (fd < 0)
+		return test_result("test_packet_journal");
+	close(fd);
+
+	PacketJournal journal;
+	CHECK(journal.open(path, PACKET_JOURNAL_MIN_SIZE));
+	CHECK_EQ(journal.recovered(), 0);
+	uint8_t data[MESSAGE_LEN];
+	for (uint32_t n = 0; n < MESSAGES; n++) {
+		message(n, data);
+		CHECK(journal.append("node/1", data, sizeof(data)));
+	}
+	// Past the wrap point: only the newest messages are left
+	uint32_t records = journal.records();
+	uint32_t oldest = MESSAGES - records;
+	CHECK(records > 0 && records < MESSAGES / 2);
+	CHECK_EQ(journal.overwritten(), oldest);
+	check_front(journal, oldest);
+	journal.pop();
+	oldest++;
+	records--;
+
+	// Everything is found again
+	journal.close();
+	CHECK(journal.open(path, PACKET_JOURNAL_MIN_SIZE));
+	CHECK_EQ(journal.recovered(), records);
+	CHECK_EQ(journal.records(), records);
+	check_front(journal, oldest);
+
+	// A corrupted record ends the journal, the records before it are kept
+	uint32_t bad = oldest + records / 2;
+	journal.close();
+	CHECK(corrupt(path, bad));
+	CHECK(journal.open(path, PACKET_JOURNAL_MIN_SIZE));
+	CHECK_EQ(journal.recovered(), bad - oldest);
+	CHECK_EQ(journal.records(), bad - oldest);
+	check_front(journal, oldest);
+
+	// Killed between moving tail and counting tailSeq: nothing is lost
+	journal.pop();
+	oldest++;
+	journal.close();
+	CHECK(set_tail_seq(path, oldest - 1));
+	CHECK(journal.open(path, PACKET_JOURNAL_MIN_SIZE));
+	CHECK_EQ(journal.recovered(), bad - oldest);
+	check_front(journal, oldest);
+
+	// Appending goes on after the last good record
+	message(MESSAGES, data);
+	CHECK(journal.append("node/1", data, sizeof(data)));
+	uint32_t n = oldest;
+	PacketJournal::Record record;
+	while (journal.front(record)) {
+		CHECK_EQ(record.seq, n);
+		journal.pop();
+		n++;
+	}
+	CHECK_EQ(n, bad + 1);
+	CHECK(journal.empty());
+
+	journal.close();
+	unlink(path);
+	return test_result("test_packet_journal");
+}
@@ -0,0 +1,121 @@
+// test_packet_ring.cpp
+//
+// PacketRing: order across the wraparound of the indexes, overflow counting,
+// high watermark, and one producer and one consumer thread running together.
+
+#include <thread>
+
+#include "PacketRing.h"
+#include "test.h"
+
+// Records pushed and popped by the two thread test
+#define THREAD_RECORDS 200000
+
+static void test_wraparound() {
+	PacketRing<uint32_t, 4> ring;
+	uint32_t next_in = 0, next_out = 0;
+	// Fill levels of 1 to 4 so that the slots are used at every offset
+	for (int round = 0; round < 50; round++) {
+		unsigned fill = round % 4 + 1;
+		for (unsigned i = 0; i < fill; i++)
+			CHECK(ring.push(next_in++));
+		CHECK_EQ(ring.size(), fill);
+		uint32_t *record;
+		while ((record = ring.front()) != NULL) {
+			CHECK_EQ(*record, next_out);
+			next_out++;
+			ring.pop();
+		}
+		CHECK_EQ(ring.size(), 0);
+	}
+	CHECK_EQ(next_out, next_in);
+	CHECK_EQ(ring.overflows(), 0);
+	CHECK_EQ(ring.highWatermark(), 4);
+}
+
+static void test_overflow() {
+	PacketRing<uint32_t, 4> ring;
+	for (uint32_t i = 0; i < 4; i++)
+		CHECK(ring.push(i));
+	// Full: the new records are dropped and counted, the old ones stay
+	CHECK(!ring.push(4));
+	CHECK(ring.claim() == NULL);
+	CHECK_EQ(ring.overflows(), 2);
+	CHECK_EQ(ring.size(), 4);
+	CHECK_EQ(*ring.front(), 0);
+
+	// One slot free again
+	ring.pop();
+	CHECK(ring.push(5));
+	CHECK(!ring.push(6));
+	CHECK_EQ(ring.overflows(), 3);
+	uint32_t expected[] = { 1, 2, 3, 5 };
+	for (unsigned i = 0; i < 4; i++) {
+		CHECK(ring.front() != NULL);
+		if (ring.front())
+			CHECK_EQ(*ring.front(), expected[i]);
+		ring.pop();
+	}
+	CHECK(ring.front() == NULL);
+	CHECK_EQ(ring.highWatermark(), 4);
+}
+
+static void test_claim_commit() {
+	PacketRing<RadioPacket, 2> ring;
+	RadioPacket *packet = ring.claim();
+	CHECK(packet != NULL);
+	if (!packet)
+		return;
+	packet->from = 7;
+	packet->len = 3;
+	packet->payload[2] = 0x55;
+	// Not visible before commit()
+	CHECK(ring.front() == NULL);
+	ring.commit();
+	RadioPacket *read = ring.front();
+	CHECK(read == packet);
+	if (read) {
+		CHECK_EQ(read->from, 7);
+		CHECK_EQ(read->len, 3);
+		CHECK_EQ(read->payload[2], 0x55);
+	}
+	ring.pop();
+	CHECK(ring.front() == NULL);
+}
+
+static void test_threads() {
+	static PacketRing<uint32_t, 64> ring;
+	std::thread producer([] {
+		for (uint32_t i = 0; i < THREAD_RECORDS; ) {
+			if (ring.push(i))
+				i++;
+			else
+				std::this_thread::yield();
+		}
+	});
+	uint32_t expected = 0;
+	bool ordered = true;
+	while (expected < THREAD_RECORDS) {
+		uint32_t *record = ring.front();
+		if (!record) {
+			std::this_thread::yield();
+			continue;
+		}
+		if (*record != expected)
+			ordered = false;
+		expected++;
+		ring.pop();
+	}
+	producer.join();
+	CHECK(ordered);
+	CHECK(ring.front() == NULL);
+	CHECK(ring.highWatermark() <= 64);
+}
+
+int main() {
+	test_wraparound();
+	test_overflow();
+	test_claim_commit();
+	test_threads();
+	return test_result("test_packet_ring");
+}
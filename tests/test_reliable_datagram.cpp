@@ -0,0 +1,231 @@
+// test_reliable_datagram.cpp
+//
+// RHReliableDatagram asynchronous sends on a fake clock: the RFC 6298 round
+// trip estimate, Karn's rule, the timeout floor and backoff, the ACK timeout
+// starting only once the driver reports the transmission done, and a message
+// cancelled while it is on the air.
+
+#include <RHReliableDatagram.h>
+
+#include "FakeClock.h"
+#include "FakeDriver.h"
+#include "test.h"
+
+static const uint8_t message[] = { 1, 2, 3 };
+
+// Reads everything the driver received, which matches the ACKs
+static void receive_all(RHReliableDatagram &manager) {
+	uint8_t buf[RH_RELIABLE_MAX_MESSAGE_LEN];
+	while (manager.available()) {
+		uint8_t len = sizeof(buf);
+		manager.recvfromAck(buf, &len);
+	}
+}
+
+// The node acknowledges the last message sent
+static void ack_last(FakeDriver &driver) {
+	const FakeMessage &sent = driver.sent.back();
+	uint8_t ack = '!';
+	driver.receive(sent.from, sent.to, sent.id, RH_FLAGS_ACK, &ack, 1);
+}
+
+// Sends a message to node 2 that is acknowledged rtt microseconds after it was sent
+static void send_acked(RHReliableDatagram &manager, FakeDriver &driver, uint32_t rtt) {
+	uint8_t handle = manager.sendtoAsync(message, sizeof(message), 2);
+	CHECK(handle != RH_RELIABLE_NO_HANDLE);
+	CHECK(manager.service());  // Starts the transmission
+	manager.service();         // Sees it done, the ACK timeout starts
+	fake_clock_advance(rtt);
+	ack_last(driver);
+	receive_all(manager);
+	CHECK_EQ(manager.sendResult(handle), RHReliableDatagram::SendAcked);
+}
+
+static RHReliableDatagram::PeerStats peer_stats(RHReliableDatagram &manager, uint8_t address) {
+	RHReliableDatagram::PeerStats stats;
+	memset(&stats, 0, sizeof(stats));
+	CHECK(manager.peerStats(address, &stats));
+	return stats;
+}
+
+static void test_rtt_estimate() {
+	FakeDriver driver;
+	RHReliableDatagram manager(driver, 1);
+	manager.init();
+
+	// First sample: SRTT = R, RTTVAR = R / 2, RTO = SRTT + 4 * RTTVAR
+	send_acked(manager, driver, 20000);
+	RHReliableDatagram::PeerStats stats = peer_stats(manager, 2);
+	CHECK_EQ(stats.samples, 1);
+	CHECK_EQ(stats.srtt, 20000);
+	CHECK_EQ(stats.rttvar, 10000);
+	CHECK_EQ(stats.timeout, 60);
+
+	// RTTVAR = 3/4 RTTVAR + 1/4 |SRTT - R|, SRTT = 7/8 SRTT + 1/8 R
+	send_acked(manager, driver, 40000);
+	stats = peer_stats(manager, 2);
+	CHECK_EQ(stats.samples, 2);
+	CHECK_EQ(stats.srtt, 22500);
+	CHECK_EQ(stats.rttvar, 12500);
+	CHECK_EQ(stats.timeout, 73);
+
+	// A sample equal to SRTT only shrinks the variation
+	send_acked(manager, driver, 22500);
+	stats = peer_stats(manager, 2);
+	CHECK_EQ(stats.srtt, 22500);
+	CHECK_EQ(stats.rttvar, 9375);
+	CHECK_EQ(stats.timeout, 60);
+	CHECK_EQ(stats.sent, 3);
+	CHECK_EQ(stats.acked, 3);
+	CHECK_EQ(stats.retransmissions, 0);
+}
+
+static void test_karn() {
+	FakeDriver driver;
+	RHReliableDatagram manager(driver, 1);
+	manager.init();
+	send_acked(manager, driver, 20000);
+
+	uint8_t handle = manager.sendtoAsync(message, sizeof(message), 2);
+	CHECK(manager.service());
+	manager.service();
+	// Past the deadline, at most twice the timeout with the random variation
+	fake_clock_advance(2 * 60000 + 1000);
+	CHECK(manager.service());
+	manager.service();
+	CHECK_EQ(driver.sent.size(), 3);
+	CHECK_EQ(driver.sent[1].id, driver.sent[2].id);
+	RHReliableDatagram::PeerStats stats = peer_stats(manager, 2);
+	CHECK_EQ(stats.retransmissions, 1);
+	CHECK_EQ(stats.backoff, 1);
+	CHECK_EQ(stats.timeout, 120);
+
+	// Acknowledged after the retransmission: it is not known which transmission the
+	// ACK is for, so the round trip estimate stays, only the backoff ends
+	fake_clock_advance(5000);
+	ack_last(driver);
+	receive_all(manager);
+	CHECK_EQ(manager.sendResult(handle), RHReliableDatagram::SendAcked);
+	stats = peer_stats(manager, 2);
+	CHECK_EQ(stats.samples, 1);
+	CHECK_EQ(stats.srtt, 20000);
+	CHECK_EQ(stats.rttvar, 10000);
+	CHECK_EQ(stats.backoff, 0);
+	CHECK_EQ(stats.timeout, 60);
+	CHECK_EQ(stats.acked, 2);
+}
+
+static void test_failure_backoff() {
+	FakeDriver driver;
+	RHReliableDatagram manager(driver, 1);
+	manager.init();
+	manager.setRetries(1);
+
+	uint8_t handle = manager.sendtoAsync(message, sizeof(message), 3);
+	CHECK(manager.service());
+	manager.service();
+	// Without samples the configured timeout of 200ms applies
+	CHECK_EQ(peer_stats(manager, 3).timeout, 200);
+	fake_clock_advance(2 * 200000 + 1000);
+	CHECK(manager.service());
+	manager.service();
+	fake_clock_advance(2 * 400000 + 1000);
+	manager.service();
+	CHECK_EQ(manager.sendResult(handle), RHReliableDatagram::SendFailed);
+	CHECK_EQ(driver.sent.size(), 2);
+
+	// Doubled for the retransmission and again for the failure
+	RHReliableDatagram::PeerStats stats = peer_stats(manager, 3);
+	CHECK_EQ(stats.failed, 1);
+	CHECK_EQ(stats.backoff, 2);
+	CHECK_EQ(stats.timeout, 800);
+}
+
+static void test_timeout_floor() {
+	FakeDriver driver;
+	RHReliableDatagram manager(driver, 1);
+	manager.init();
+	// The ACK takes 50ms on the air: no timeout below 50 + RH_RELIABLE_TURNAROUND ms
+	driver.setAirtime(50000);
+	send_acked(manager, driver, 5000);
+	RHReliableDatagram::PeerStats stats = peer_stats(manager, 2);
+	CHECK_EQ(stats.srtt, 5000);
+	CHECK_EQ(stats.timeout, 50 + RH_RELIABLE_TURNAROUND);
+}
+
+static void test_transmission_not_waited() {
+	FakeDriver driver;
+	RHReliableDatagram manager(driver, 1);
+	manager.init();
+	driver.setAirtime(30000);
+	driver.setTxTime(30000);
+
+	uint8_t handle = manager.sendtoAsync(message, sizeof(message), 2);
+	unsigned long start = micros();
+	CHECK(manager.service());
+	// service() started the transmitter and returned, the clock did not move
+	CHECK_EQ(micros() - start, 0);
+	CHECK_EQ(manager.sendResult(handle), RHReliableDatagram::SendTransmitting);
+	CHECK_EQ(manager.serviceTimeout(), 30);
+
+	// Nothing else goes out while it is on the air
+	uint8_t other = manager.sendtoAsync(message, sizeof(message), 3);
+	CHECK(!manager.service());
+	CHECK_EQ(driver.sent.size(), 1);
+
+	// Done: the ACK timeout starts now, and the next message goes out
+	fake_clock_advance(30000);
+	CHECK(manager.service());
+	CHECK_EQ(manager.sendResult(handle), RHReliableDatagram::SendWaitAck);
+	CHECK_EQ(manager.sendResult(other), RHReliableDatagram::SendTransmitting);
+	CHECK_EQ(driver.sent.size(), 2);
+
+	// The round trip is counted from the end of the transmission. The radio only
+	// hears the ACK once it is done sending the second message
+	driver.receive(1, 2, driver.sent[0].id, RH_FLAGS_ACK, message, 1);
+	fake_clock_advance(10000);
+	receive_all(manager);
+	CHECK_EQ(manager.sendResult(handle), RHReliableDatagram::SendWaitAck);
+	fake_clock_advance(20000);
+	receive_all(manager);
+	CHECK_EQ(manager.sendResult(handle), RHReliableDatagram::SendAcked);
+	CHECK_EQ(peer_stats(manager, 2).srtt, 30000);
+}
+
+static void test_cancel_on_air() {
+	FakeDriver driver;
+	RHReliableDatagram manager(driver, 1);
+	manager.init();
+	driver.setAirtime(30000);
+	driver.setTxTime(30000);
+
+	uint8_t handle = manager.sendtoAsync(message, sizeof(message), 2);
+	CHECK(manager.service());
+	manager.cancelSend(handle);
+	CHECK_EQ(manager.sendResult(handle), RHReliableDatagram::SendCancelled);
+	CHECK_EQ(manager.pendingSends(), 0);
+
+	// The radio is still busy with it
+	uint8_t other = manager.sendtoAsync(message, sizeof(message), 3);
+	CHECK(other != handle);
+	CHECK(!manager.service());
+	CHECK_EQ(driver.sent.size(), 1);
+	CHECK_EQ(manager.serviceTimeout(), 30);
+
+	// Sent: the entry is free, without an ACK timeout, and the next message goes out
+	fake_clock_advance(30000);
+	CHECK(manager.service());
+	CHECK_EQ(manager.sendResult(handle), RHReliableDatagram::SendFree);
+	CHECK_EQ(manager.sendResult(other), RHReliableDatagram::SendTransmitting);
+	CHECK_EQ(driver.sent.size(), 2);
+}
+
+int main() {
+	test_rtt_estimate();
+	test_karn();
+	test_failure_backoff();
+	test_timeout_floor();
+	test_transmission_not_waited();
+	test_cancel_on_air();
+	return test_result("test_reliable_datagram");
+}
@@ -0,0 +1,78 @@
+// test_time_on_air.cpp
+//
+// RH_RF95::timeOnAir() against the SX1276 datasheet formula, for the preset
+// modem configurations and the header, preamble and low data rate settings.
+// The expected values are those of the Semtech LoRa calculator, in microseconds,
+// for the message data plus the 4 RadioHead header octets, CRC on.
+
+#include <RH_RF95.h>
+
+#include "test.h"
+
+static void test_presets(RH_RF95 &rf95) {
+	// SF7, 125kHz, 4/5: symbols of 1.024ms
+	CHECK(rf95.setModemConfig(RH_RF95::Bw125Cr45Sf128));
+	CHECK_EQ(rf95.symbolTime(), 1024);
+	CHECK_EQ(rf95.timeOnAir(10), 46336);
+	CHECK_EQ(rf95.timeOnAir(1), 30976);
+
+	// SF7, 500kHz, 4/5
+	CHECK(rf95.setModemConfig(RH_RF95::Bw500Cr45Sf128));
+	CHECK_EQ(rf95.symbolTime(), 256);
+	CHECK_EQ(rf95.timeOnAir(10), 11584);
+	CHECK_EQ(rf95.timeOnAir(1), 7744);
+
+	// SF9, 31.25kHz, 4/8
+	CHECK(rf95.setModemConfig(RH_RF95::Bw31_25Cr48Sf512));
+	CHECK_EQ(rf95.symbolTime(), 16384);
+	CHECK_EQ(rf95.timeOnAir(10), 856064);
+	CHECK_EQ(rf95.timeOnAir(1), 593920);
+
+	// SF12, 125kHz, 4/8, low data rate optimisation
+	CHECK(rf95.setModemConfig(RH_RF95::Bw125Cr48Sf4096));
+	CHECK_EQ(rf95.symbolTime(), 32768);
+	CHECK_EQ(rf95.timeOnAir(10), 1449984);
+	CHECK_EQ(rf95.timeOnAir(1), 925696);
+}
+
+static void test_registers(RH_RF95 &rf95) {
+	// SF12, 125kHz, 4/5, low data rate optimisation
+	RH_RF95::ModemConfig sf12 = { 0x72, 0xc4, 0x0c };
+	rf95.setModemRegisters(&sf12);
+	CHECK_EQ(rf95.timeOnAir(10), 1155072);
+	CHECK_EQ(rf95.timeOnAir(1), 827392);
+
+	// SF7, 125kHz, 4/5 with an implicit header: 20 payload symbols instead of 25
+	RH_RF95::ModemConfig implicit = { 0x73, 0x74, 0x00 };
+	rf95.setModemRegisters(&implicit);
+	CHECK_EQ(rf95.timeOnAir(10), 41216);
+
+	// Four more preamble symbols
+	RH_RF95::ModemConfig sf7 = { 0x72, 0x74, 0x00 };
+	rf95.setModemRegisters(&sf7);
+	rf95.setPreambleLength(12);
+	CHECK_EQ(rf95.timeOnAir(10), 46336 + 4 * 1024);
+	rf95.setPreambleLength(8);
+	CHECK_EQ(rf95.timeOnAir(10), 46336);
+}
+
+static void test_monotonic(RH_RF95 &rf95) {
+	CHECK(rf95.setModemConfig(RH_RF95::Bw125Cr45Sf128));
+	uint32_t last = 0;
+	bool increasing = true;
+	for (unsigned len = 0; len <= rf95.maxMessageLength(); len++) {
+		uint32_t airtime = rf95.timeOnAir(len);
+		if (airtime < last)
+			increasing = false;
+		last = airtime;
+	}
+	CHECK(increasing);
+}
+
+int main() {
+	RH_RF95 rf95(8, 25);
+	test_presets(rf95);
+	test_registers(rf95);
+	test_monotonic(rf95);
+	return test_result("test_time_on_air");
+}
@@ -0,0 +1,95 @@
+// test_timer_service.cpp
+//
+// RHTimerService on the real clock: timers run in order of expiry and can be
+// cancelled, and a thread that only waits for a periodic 200ms timer, as the
+// radio threads do for the LED, uses next to no CPU while it sleeps in poll().
+
+#include <poll.h>
+#include <sys/resource.h>
+#include <vector>
+
+#include <RHTimerService.h>
+
+#include "test.h"
+
+// Length of the idle measurement and CPU time it may use, 1%
+#define IDLE_SECONDS   3
+#define IDLE_CPU_US    (IDLE_SECONDS * 10000)
+
+// Timer callbacks log their number in the order they run
+static std::vector<int> ran;
+static int numbers[] = { 0, 1, 2, 3 };
+
+static void log_timer(void *arg) {
+	ran.push_back(*(int *) arg);
+}
+
+// Polls the timerfd and runs the timers until none is left
+static void run_all(RHTimerService &timers) {
+	struct pollfd pfd = { timers.fd(), POLLIN, 0 };
+	while (timers.count() && poll(&pfd, 1, 1000) > 0)
+		timers.run();
+}
+
+static void test_order() {
+	RHTimerService timers;
+	CHECK(timers.begin());
+	ran.clear();
+	timers.schedule(30, log_timer, &numbers[1]);
+	uint32_t cancelled = timers.schedule(20, log_timer, &numbers[2]);
+	timers.schedule(10, log_timer, &numbers[3]);
+	CHECK(cancelled != RH_TIMER_NONE);
+	CHECK(timers.pending(cancelled));
+	timers.cancel(cancelled);
+	CHECK(!timers.pending(cancelled));
+	CHECK_EQ(timers.count(), 2);
+	CHECK(timers.timeout() > 0 && timers.timeout() <= 10);
+
+	run_all(timers);
+	CHECK_EQ(ran.size(), 2);
+	if (ran.size() == 2) {
+		CHECK_EQ(ran[0], 3);
+		CHECK_EQ(ran[1], 1);
+	}
+	CHECK_EQ(timers.timeout(), -1);
+}
+
+static uint64_t cpu_micros() {
+	struct rusage usage;
+	getrusage(RUSAGE_SELF, &usage);
+	return (uint64_t) (usage.ru_utime.tv_sec + usage.ru_stime.tv_sec) * 1000000
+		+ usage.ru_utime.tv_usec + usage.ru_stime.tv_usec;
+}
+
+static void test_idle() {
+	RHTimerService timers;
+	CHECK(timers.begin());
+	ran.clear();
+	uint32_t led = timers.schedule(200, log_timer, &numbers[0], 200);
+	struct pollfd pfd = { timers.fd(), POLLIN, 0 };
+	int wakeups = 0;
+	uint64_t cpu = cpu_micros();
+	uint64_t end = monotonicMicros() + IDLE_SECONDS * 1000000;
+	while (monotonicMicros() < end) {
+		// No timeout: only the timer wakes the thread up
+		if (poll(&pfd, 1, -1) > 0) {
+			timers.run();
+			wakeups++;
+		}
+	}
+	cpu = cpu_micros() - cpu;
+	timers.cancel(led);
+
+	// One wakeup per period, each run() calling the timer once
+	CHECK(wakeups >= IDLE_SECONDS * 5 - 1 && wakeups <= IDLE_SECONDS * 5 + 1);
+	CHECK_EQ(ran.size(), wakeups);
+	if (cpu > IDLE_CPU_US)
+		printf("test_timer_service: %llu us of CPU in %d s idle\n", (unsigned long long) cpu, IDLE_SECONDS);
+	CHECK(cpu <= IDLE_CPU_US);
+}
+
+int main() {
+	test_order();
+	test_idle();
+	return test_result("test_timer_service");
+}